@@ -10,6 +10,10 @@
 
 #include "Agents/AStarAgent.h"
 
+#define REPAIR_DEPTH_SLACK 3
+#define MAX_CACHED_STATES 5000
+#define ANYTIME_WEIGHT_STEP 1.0f
+
 using namespace std;
 
 struct Node {
@@ -19,22 +23,39 @@ struct Node {
 	float cost;
 	float heuristic;
 	int depth;
+	// Landmarks accepted along the path to this node
+	FactSet landmarks;
 
 	Node(shared_ptr<Node> inPrevNode, State inState, Literal inAction, float inCost, float inHeuristic, int inDepth) :
 		prevNode(inPrevNode), state(inState), action(inAction), cost(inCost), heuristic(inHeuristic), depth(inDepth) { }
 	Node(float inCost) : prevNode(nullptr), state(State()), action(Literal()), cost(inCost), heuristic(0.0f), depth(0) { }
 };
 
+AStarAgent::~AStarAgent() {
+	stopRefinement();
+}
+
 void AStarAgent::init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) {
+	stopRefinement();
 	Agent::init(inDomain, inInstances, inGoal, inTrace);
+	domainVersion = domain->getVersion();
 	planReady = false;
+	repairPending = false;
+	successorCache.clear();
+	previousSuccessors.clear();
+	regression = nullptr;
 }
 
 void AStarAgent::updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) {
+	stopRefinement();
 	Agent::updateProblem(inInstances, inGoal, inHeadstart);
 
 	planReady = false;
+	repairPending = false;
 	plan.clear();
+	successorCache.clear();
+	previousSuccessors.clear();
+	regression = nullptr;
 }
 
 void AStarAgent::setMaxDepth(int newLimit) {
@@ -45,12 +66,94 @@ void AStarAgent::setTimeLimit(float seconds) {
 	timeLimit = seconds;
 }
 
+void AStarAgent::setLandmarkHeuristic(bool enabled) {
+	useLandmarks = enabled;
+}
+
+void AStarAgent::setSearchDirection(SearchDirection newDirection) {
+	direction = newDirection;
+}
+
+void AStarAgent::setAnytime(bool enabled, float weight) {
+	anytime = enabled;
+	initialWeight = max(1.0f, weight);
+}
+
+void AStarAgent::setBackgroundRefinement(bool enabled) {
+	backgroundRefinement = enabled;
+}
+
+void AStarAgent::configure(ConfigReader* agentConfig) {
+	Agent::configure(agentConfig);
+	setLandmarkHeuristic(agentConfig->getBool("landmark_heuristic"));
+	setAnytime(agentConfig->getBool("anytime_planning"));
+	setBackgroundRefinement(agentConfig->getBool("background_refinement"));
+
+	string newDirection = agentConfig->getString("search_direction");
+	if (newDirection == "backward")				setSearchDirection(BACKWARD_SEARCH);
+	else if (newDirection == "bidirectional")	setSearchDirection(BIDIRECTIONAL_SEARCH);
+}
+
+void AStarAgent::setImprovementCallback(function<void(vector<Literal> const&, float)> callback) {
+	improvementCallback = callback;
+}
+
+void AStarAgent::updateDomain(shared_ptr<Domain> newDomain) {
+	stopRefinement();
+
+	// Expansions only remain valid for predicates whose actions did not change, a domain patched in place tells which did
+	set<Predicate> changed;
+	if (newDomain == domain)
+		changed = domain->changedActionPredicates(domainVersion);
+	else {
+		set<Predicate> preds;
+		foreach(act, domain->getActionList()) preds.insert(act->actionLiteral.pred);
+		foreach(act, newDomain->getActionList()) preds.insert(act->actionLiteral.pred);
+
+		foreach(pred, preds) {
+			vector<Action> oldActions, newActions;
+			foreach(act, domain->getActionList())
+				if (act->actionLiteral.pred == *pred) oldActions.push_back(*act);
+			foreach(act, newDomain->getActionList())
+				if (act->actionLiteral.pred == *pred) newActions.push_back(*act);
+			if (!allEq(oldActions, newActions))
+				changed.insert(*pred);
+		}
+	}
+
+	foreach(cached, successorCache)
+		foreach(pred, changed)
+			cached->second.erase(*pred);
+	foreach(cached, previousSuccessors)
+		foreach(pred, changed)
+			cached->second.erase(*pred);
+
+	domain = newDomain;
+	domainVersion = domain->getVersion();
+	planOptimizer = nullptr;
+	regression = nullptr;
+
+	if (planReady && plan.size() > 0)
+		repairPending = true;
+	else
+		planReady = false;
+}
+
 Literal AStarAgent::getNextAction(State state) {
-	chrono::high_resolution_clock::time_point startTime = chrono::high_resolution_clock::now();
+	if (repairPending) {
+		repairPending = false;
+		if (!repairPlan(state)) {
+			planReady = false;
+			plan.clear();
+		}
+	}
+
+	adoptRefinedPlan();
 
 	if (planReady && plan.size() > 0) {
 		Literal nextAction = plan.back();
 		plan.pop_back();
+		executedActions.push_back(nextAction);
 
 		if (verbose) cout << plan.size() << " steps remaining." << endl;
 		return nextAction;
@@ -59,12 +162,127 @@ Literal AStarAgent::getNextAction(State state) {
 		return Literal();
 	}
 
+	stopRefinement();
 	if (verbose) cout << "Planning to achieve goal..." << endl;
 
-	shared_ptr<Node> startNode = make_shared<Node>(nullptr, state, Literal(), 0.0f, heuristic(state), 0);
+	if (!search(state, maxDepth, plan))
+		return Literal();
+
+	planReady = true;
+	executedActions.clear();
+
+	if (verbose) cout << "Plan found: " << plan.size() << " steps." << endl;
+
+	if (optimizePlans)
+		plan = optimizePlan(state, plan);
+
+	if (anytime && backgroundRefinement && resumeWeight >= 1.0f)
+		startRefinement(state);
+
+	return getNextAction(state);
+}
+
+bool AStarAgent::repairPlan(State state) {
+	stopRefinement();
+	vector<Literal> remaining = vector<Literal>(plan.rbegin(), plan.rend());
+
+	// The prefix of the plan that is still executable under the revised domain is kept
+	State current = state;
+	size_t broken = remaining.size();
+	foreachindex(si, remaining) {
+		Opt<State> next = domain->tryAction(current, instances, remaining[si]);
+		if (!next.there) {
+			broken = si;
+			break;
+		}
+		current = next.obj;
+	}
+
+	if (broken == remaining.size() && goal.reached(current)) {
+		if (verbose) cout << "Plan still valid after domain revision." << endl;
+		return true;
+	}
+
+	int depthLimit = (int)(remaining.size() - broken) + REPAIR_DEPTH_SLACK;
+	if (maxDepth > 0) depthLimit = min(depthLimit, max(1, maxDepth - (int)broken));
+
+	vector<Literal> repair;
+	if (!search(current, depthLimit, repair)) {
+		if (verbose) cout << "Plan repair failed, replanning." << endl;
+		return false;
+	}
+
+	plan = repair;
+	for (size_t si = broken; si > 0; si--)
+		plan.push_back(remaining[si - 1]);
+
+	if (verbose) cout << "Plan repaired from step " << broken << ": " << plan.size() << " steps." << endl;
+	return true;
+}
+
+bool AStarAgent::search(State start, int depthLimit, vector<Literal>& result) {
+	chrono::high_resolution_clock::time_point deadline = chrono::high_resolution_clock::now() +
+		chrono::microseconds((long long)(timeLimit * 1000000.0f));
+	chrono::high_resolution_clock::time_point const* limit = timeLimit > 0.0f ? &deadline : nullptr;
+
+	landmarks = nullptr;
+	if (useLandmarks) {
+		landmarks = LandmarkGraph::get(domain, instances, goal, start);
+		if (!landmarks->relaxedReachable(start)) {
+			if (verbose) cout << "Goal unreachable, even in the relaxed problem." << endl;
+			return false;
+		}
+	}
+
+	resumeWeight = 0.0f;
+	if (direction != FORWARD_SEARCH) {
+		if (regression == nullptr)
+			regression = make_shared<RegressionSearch>(make_shared<GroundedTask>(domain, instances), goal);
+
+		bool found = regression->search(start, direction == BIDIRECTIONAL_SEARCH, depthLimit, [&]() {
+			return cancelled() || (limit != nullptr && chrono::high_resolution_clock::now() > deadline);
+		}, result);
+
+		if (verbose) cout << "Regression search expanded " << regression->expansions() << " nodes." << endl;
+		return found;
+	}
+
+	if (!anytime)
+		return weightedSearch(start, depthLimit, 1.0f, -1.0f, limit, nullptr, result);
+
+	// Restarting weighted A*: each restart only keeps paths shorter than the best plan so far
+	bool found = false;
+	for (float weight = initialWeight; weight >= 1.0f; weight = weight > 1.0f ? max(1.0f, weight - ANYTIME_WEIGHT_STEP) : 0.0f) {
+		vector<Literal> improved;
+		bool solved = weightedSearch(start, depthLimit, weight, found ? (float)result.size() : -1.0f, limit, nullptr, improved);
+		if (solved) {
+			found = true;
+			result = improved;
+			reportImprovement(result);
+			if (verbose) cout << "Plan of " << result.size() << " steps found with weight " << weight << "." << endl;
+		}
+
+		if (cancelled()) break;
+		if (limit != nullptr && chrono::high_resolution_clock::now() > deadline) {
+			if (!solved) resumeWeight = weight;
+			else if (weight > 1.0f) resumeWeight = max(1.0f, weight - ANYTIME_WEIGHT_STEP);
+			break;
+		}
+	}
+
+	return found;
+}
+
+bool AStarAgent::weightedSearch(State const& start, int depthLimit, float weight, float costBound,
+								chrono::high_resolution_clock::time_point const* deadline, atomic<bool> const* stop, vector<Literal>& result) {
+	shared_ptr<Node> startNode = make_shared<Node>(nullptr, start, Literal(), 0.0f, heuristic(start), 0);
+	if (landmarks != nullptr) {
+		FactSet accepted = landmarks->initialAccepted(start);
+		startNode->heuristic = landmarkHeuristic(start, accepted, startNode->landmarks);
+	}
 	
-	auto compare = [](shared_ptr<Node> lhs, shared_ptr<Node> rhs) {
-		return lhs->heuristic + lhs->cost < rhs->heuristic + rhs->cost;
+	auto compare = [weight](shared_ptr<Node> lhs, shared_ptr<Node> rhs) {
+		return weight * lhs->heuristic + lhs->cost < weight * rhs->heuristic + rhs->cost;
 	};
 
 	set<State> closedList;
@@ -73,12 +291,11 @@ Literal AStarAgent::getNextAction(State state) {
 	openList.push_back(startNode);
 
 	while (!openList.empty()) {
-		chrono::high_resolution_clock::time_point currTime = chrono::high_resolution_clock::now();
-		chrono::duration<double, std::milli> elapsedTime = currTime - startTime;
-		if (timeLimit > 0.0f && elapsedTime.count() * 1.0f / 1000.0f > timeLimit) {
+		if (deadline != nullptr && chrono::high_resolution_clock::now() > *deadline) {
 			if (verbose) cout << "Planning time limit exceeded" << endl;
-			return Literal();
+			return false;
 		}
+		if (stop != nullptr ? stop->load() : cancelled()) return false;
 
 		if (verbose) cout << "\rOpen list: " << openList.size() << "                ";
 
@@ -86,30 +303,30 @@ Literal AStarAgent::getNextAction(State state) {
 		openList.pop_front();
 
 		if (current->heuristic == 0.0f) {
+			result.clear();
 			while (current->prevNode != nullptr) {
-				plan.push_back(current->action);
+				result.push_back(current->action);
 				current = current->prevNode;
 			}
-			planReady = true;
-
-			if (verbose) cout << "Plan found: " << plan.size() << " steps." << endl;
-
-			return getNextAction(state);
+			return true;
 		}
 		else {
-			vector<Literal> available = getAvailableActions(current->state);
-			
-			if (maxDepth > 0 && current->depth >= maxDepth)
-				available.clear();
+			vector<pair<Literal, State>> successors;
+			if (depthLimit <= 0 || current->depth < depthLimit)
+				successors = expand(current->state);
 
 			float newCost = current->cost + 1;
 
 			shared_ptr<Node> fakeNode = make_shared<Node>(newCost);
 			__int64 lowerBound = distance(openList.begin(), lower_bound(openList.begin(), openList.end(), fakeNode, compare));
 
-			foreach(actit, available) {
-				State newState = domain->tryAction(current->state, instances, *actit).obj;
-				float newHeuristic = heuristic(newState);
+			foreach(succ, successors) {
+				State newState = succ->second;
+				FactSet accepted;
+				float newHeuristic = landmarks != nullptr ? landmarkHeuristic(newState, current->landmarks, accepted) : heuristic(newState);
+
+				// At least one more action is needed when the goal is not reached
+				if (costBound >= 0.0f && newCost + (newHeuristic > 0.0f ? 1.0f : 0.0f) >= costBound) continue;
 				
 				if (closedList.find(newState) == closedList.end()) {
 					bool found = false;
@@ -120,7 +337,8 @@ Literal AStarAgent::getNextAction(State state) {
 						}
 					}
 					if (!found) {
-						shared_ptr<Node> newNode = make_shared<Node>(current, newState, *actit, newCost, newHeuristic, current->depth + 1);
+						shared_ptr<Node> newNode = make_shared<Node>(current, newState, succ->first, newCost, newHeuristic, current->depth + 1);
+						newNode->landmarks = accepted;
 						openList.insert(lower_bound(openList.begin() + lowerBound, openList.end(), newNode, compare), newNode);
 					}
 				}
@@ -130,7 +348,120 @@ Literal AStarAgent::getNextAction(State state) {
 		}
 	}
 
-	return Literal();
+	return false;
+}
+
+void AStarAgent::reportImprovement(vector<Literal> const& reversedPlan) {
+	if (improvementCallback)
+		improvementCallback(vector<Literal>(reversedPlan.rbegin(), reversedPlan.rend()), (float)reversedPlan.size());
+}
+
+void AStarAgent::startRefinement(State start) {
+	refinementStop = false;
+	refinedPlan.clear();
+
+	float weight = resumeWeight;
+	float bound = (float)plan.size();
+	int depthLimit = maxDepth;
+
+	// Only the thread uses the successor cache and the landmarks until it is stopped
+	refinementThread = thread([this, start, weight, bound, depthLimit]() {
+		float costBound = bound;
+		for (float w = weight; w >= 1.0f && !refinementStop; w = w > 1.0f ? max(1.0f, w - ANYTIME_WEIGHT_STEP) : 0.0f) {
+			vector<Literal> improved;
+			if (!weightedSearch(start, depthLimit, w, costBound, nullptr, &refinementStop, improved)) continue;
+
+			costBound = (float)improved.size();
+			{
+				lock_guard<mutex> lock(refinementMutex);
+				refinedPlan = vector<Literal>(improved.rbegin(), improved.rend());
+			}
+			reportImprovement(improved);
+		}
+	});
+}
+
+void AStarAgent::stopRefinement() {
+	if (!refinementThread.joinable()) return;
+
+	refinementStop = true;
+	refinementThread.join();
+	refinedPlan.clear();
+}
+
+void AStarAgent::adoptRefinedPlan() {
+	lock_guard<mutex> lock(refinementMutex);
+	if (refinedPlan.empty() || !planReady) return;
+
+	size_t executed = executedActions.size();
+	if (refinedPlan.size() >= executed && refinedPlan.size() < executed + plan.size() &&
+		equal(executedActions.begin(), executedActions.end(), refinedPlan.begin())) {
+		plan = vector<Literal>(refinedPlan.rbegin(), refinedPlan.rend() - executed);
+		if (verbose) cout << "Switching to a refined plan: " << plan.size() << " steps remaining." << endl;
+	}
+	refinedPlan.clear();
+}
+
+vector<pair<Literal, State>> AStarAgent::expand(State const& state) {
+	// States expanded again are moved to the current generation, the previous one is dropped when the current one is full
+	auto current = successorCache.find(state);
+	if (current == successorCache.end()) {
+		map<Predicate, vector<pair<Literal, State>>> entry;
+		auto previous = previousSuccessors.find(state);
+		if (previous != previousSuccessors.end()) {
+			entry = move(previous->second);
+			previousSuccessors.erase(previous);
+		}
+
+		if (successorCache.size() >= MAX_CACHED_STATES) {
+			previousSuccessors = move(successorCache);
+			successorCache.clear();
+		}
+		current = successorCache.insert(make_pair(state, move(entry))).first;
+	}
+
+	map<Predicate, vector<pair<Literal, State>>>& cached = current->second;
+	vector<pair<Literal, State>> successors;
+	set<Predicate> expandedPreds;
+	vector<Term> allInsts = instances + domain->getConstants();
+
+	foreach(act, domain->getActionList()) {
+		Predicate pred = act->actionLiteral.pred;
+		if (!expandedPreds.insert(pred).second) continue;
+
+		auto found = cached.find(pred);
+		if (found == cached.end()) {
+			vector<Literal> literals;
+			set<Literal> seen;
+			foreach(other, domain->getActionList()) {
+				if (other->actionLiteral.pred != pred) continue;
+
+				vector<Substitution> subs = state.unifyAction(*other);
+				foreach(sub, subs) {
+					vector<Substitution> expandedSubs = sub->expandUncovered(other->parameters, allInsts, true);
+					foreach(expSub, expandedSubs) {
+						Literal lit = expSub->apply(other->actionLiteral);
+						if (seen.insert(lit).second)
+							literals.push_back(lit);
+					}
+				}
+			}
+
+			// Actions the domain refuses are left out. They used to be queued as a step leading back to the same state,
+			// which only cost an extra expansion and could leave a useless action in the plan.
+			vector<pair<Literal, State>> predSuccessors;
+			foreach(lit, literals) {
+				Opt<State> next = domain->tryAction(state, instances, *lit);
+				if (next.there)
+					predSuccessors.push_back(make_pair(*lit, next.obj));
+			}
+			found = cached.insert(make_pair(pred, predSuccessors)).first;
+		}
+
+		successors = successors + found->second;
+	}
+
+	return successors;
 }
 
 float AStarAgent::heuristic(State state) {
@@ -145,3 +476,12 @@ float AStarAgent::heuristic(State state) {
 
 	return count * 1.0f;
 }
+
+float AStarAgent::landmarkHeuristic(State const& state, FactSet const& parentAccepted, FactSet& accepted) {
+	// Zero must still mean the goal is reached, as it ends the search
+	float goalCount = heuristic(state);
+	if (goalCount == 0.0f) return 0.0f;
+
+	accepted = landmarks->progress(parentAccepted, state);
+	return max(goalCount, (float)landmarks->count(accepted, state));
+}
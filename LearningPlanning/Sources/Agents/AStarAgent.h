@@ -5,11 +5,20 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 #include "Agents/Agent.h"
+#include "Logic/Landmarks.h"
+#include "Logic/RegressionSearch.h"
 
 class AStarAgent : public Agent {
 public:
 	AStarAgent(bool inVerbose) : Agent(inVerbose) {}
+	~AStarAgent();
 
 	void init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) override;
 
@@ -17,14 +26,72 @@ public:
 	void updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) override;
 	void setMaxDepth(int newLimit);
 	void setTimeLimit(float seconds);
+	// Uses the landmark count of the goal, with the number of unreached goal facts as a lower bound. The count is not
+	// admissible, plans found with it may be longer than needed.
+	void setLandmarkHeuristic(bool enabled);
+	// Backward and bidirectional searches run over compiled operators, and suit goals made of a few facts
+	void setSearchDirection(SearchDirection newDirection);
+	// Restarts weighted A* with a decreasing weight down to 1, and keeps the best plan found within the time limit
+	void setAnytime(bool enabled, float initialWeight = 5.0f);
+	// Anytime restarts left when the plan is returned go on in a background thread. A better plan is followed as soon as
+	// it starts with the actions already taken.
+	void setBackgroundRefinement(bool enabled);
+	// Receives every improved plan, in execution order, with its cost. Called from the refinement thread too.
+	void setImprovementCallback(function<void(vector<Literal> const&, float)> callback);
+	// Also reads landmark_heuristic, anytime_planning, background_refinement and search_direction. The search is a forward
+	// A* with the goal count unless the configuration turns them on.
+	void configure(ConfigReader* agentConfig) override;
+
+	// Replaces the domain while keeping the current plan, which is repaired on the next call to getNextAction. The domain
+	// may be the current one, patched in place while no background refinement runs.
+	void updateDomain(shared_ptr<Domain> newDomain);
 
 	bool receivesEvents = false;
 
 private:
 	float heuristic(State state);
+	float landmarkHeuristic(State const& state, FactSet const& parentAccepted, /*r*/ FactSet& accepted);
+	bool search(State start, int depthLimit, /*r*/ vector<Literal>& result);
+	bool weightedSearch(State const& start, int depthLimit, float weight, float costBound,
+						chrono::high_resolution_clock::time_point const* deadline, atomic<bool> const* stop, /*r*/ vector<Literal>& result);
+	void reportImprovement(vector<Literal> const& reversedPlan);
+	void startRefinement(State start);
+	void stopRefinement();
+	void adoptRefinedPlan();
+	bool repairPlan(State state);
+	vector<pair<Literal, State>> expand(State const& state);
 
 	bool planReady = false;
+	bool repairPending = false;
+	unsigned __int64 domainVersion = 0;
 	vector<Literal> plan;
 	int maxDepth = -1;
 	float timeLimit = -1.0f;
+
+	bool useLandmarks = false;
+	shared_ptr<LandmarkGraph const> landmarks;
+
+	SearchDirection direction = FORWARD_SEARCH;
+	shared_ptr<RegressionSearch> regression;
+
+	bool anytime = false;
+	float initialWeight = 5.0f;
+	// Weight of the next restart, 0 once the restarts reached weight 1
+	float resumeWeight = 0.0f;
+	function<void(vector<Literal> const&, float)> improvementCallback;
+
+	bool backgroundRefinement = false;
+	thread refinementThread;
+	atomic<bool> refinementStop { false };
+	mutex refinementMutex;
+	// Best plan of the refinement thread, in execution order, from the state the current plan started at
+	vector<Literal> refinedPlan;
+	// Actions returned since the current plan was found, in execution order
+	vector<Literal> executedActions;
+
+	// Successors of expanded states, per action predicate, kept across searches until the predicate's actions change.
+	// The states expanded during the current and the previous generations are kept, a generation ends once it holds
+	// MAX_CACHED_STATES states.
+	map<State, map<Predicate, vector<pair<Literal, State>>>> successorCache;
+	map<State, map<Predicate, vector<pair<Literal, State>>>> previousSuccessors;
 };
@@ -14,22 +14,40 @@ void Agent::init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inG
 	instances = inInstances;
 	goal = inGoal;
 	trace = inTrace;
+	planOptimizer = nullptr;
 }
 
 void Agent::updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) {
 	instances = inInstances;
 	goal = inGoal;
 	headstartActions = inHeadstart;
+	planOptimizer = nullptr;
 }
 
 void Agent::setEngine(LogicEngine* inEngine) {
 	engine = inEngine;
 }
 
+void Agent::setPlanOptimization(bool enabled) {
+	optimizePlans = enabled;
+}
+
+void Agent::configure(ConfigReader* agentConfig) {
+	setPlanOptimization(agentConfig->getBool("optimize_plans"));
+}
+
+void Agent::setCancellationToken(shared_ptr<atomic<bool>> token) {
+	cancellationToken = token;
+}
+
+bool Agent::cancelled() const {
+	return cancellationToken != nullptr && cancellationToken->load();
+}
+
 vector<Literal> Agent::getAvailableActions(State state) {
 	vector<Literal> availableActions;
 
-	foreach(act, domain->actions) {
+	foreach(act, domain->getActionList()) {
 		vector<Substitution> subs = state.unifyAction(*act);
 		foreach(sub, subs) {
 			vector<Substitution> expandedSubs = sub->expandUncovered(act->parameters, instances + domain->getConstants(), true);
@@ -40,3 +58,19 @@ vector<Literal> Agent::getAvailableActions(State state) {
 
 	return availableActions;
 }
+
+vector<Literal> Agent::optimizePlan(State state, vector<Literal> reversedPlan, bool reachGoal) {
+	if (reversedPlan.size() == 0) return reversedPlan;
+
+	if (!planOptimizer)
+		planOptimizer = make_shared<PlanOptimizer>(make_shared<GroundedTask>(domain, instances));
+
+	vector<Literal> plan = vector<Literal>(reversedPlan.rbegin(), reversedPlan.rend());
+	if (reachGoal) plan = planOptimizer->optimize(state, plan, goal);
+	else plan = planOptimizer->optimize(state, plan);
+
+	if (verbose && plan.size() != reversedPlan.size())
+		cout << "Optimized plan: from " << reversedPlan.size() << " to " << plan.size() << " steps." << endl;
+
+	return vector<Literal>(plan.rbegin(), plan.rend());
+}
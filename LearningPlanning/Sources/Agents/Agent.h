@@ -5,12 +5,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "Logic/Domain.h"
 #include "Logic/DomainTester.h"
+#include "Logic/PlanOptimizer.h"
+#include "ConfigReader.h"
 #include "SDL.h"
 
 using namespace std;
@@ -28,6 +31,11 @@ public:
 	}
 
 	void setEngine(LogicEngine* inEngine);
+	void setPlanOptimization(bool enabled);
+	// Reads optimize_plans, off unless the configuration turns it on. Planners extend it with their own options.
+	virtual void configure(ConfigReader* agentConfig);
+	// Lets another thread interrupt the search: planners give up as soon as the token is set
+	void setCancellationToken(shared_ptr<atomic<bool>> token);
 
 	virtual void updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart);
 
@@ -40,6 +48,9 @@ public:
 
 protected:
 	vector<Literal> getAvailableActions(State state);
+	// Plans are stored back to front, the next action being popped from the back
+	vector<Literal> optimizePlan(State state, vector<Literal> reversedPlan, bool reachGoal = true);
+	bool cancelled() const;
 
 	shared_ptr<Domain> domain;
 	Goal goal;
@@ -51,4 +62,7 @@ protected:
 	LogicEngine* engine;
 
 	bool verbose = false;
+	bool optimizePlans = false;
+	shared_ptr<PlanOptimizer> planOptimizer;
+	shared_ptr<atomic<bool>> cancellationToken;
 };
@@ -40,6 +40,8 @@ Literal FFAgent::getNextAction(State state) {
 	set<Literal> helpfulFacts;
 	int stateHeuristic = solveRelaxedProblem(state, helpfulFacts);
 	planReady = solveProblem(state, stateHeuristic, helpfulFacts, plan);
+	if (planReady && optimizePlans)
+		plan = optimizePlan(state, plan);
 	if (planReady) return getNextAction(state);
 
 	cout << "COULDN'T PLAN..." << endl;
@@ -64,6 +66,7 @@ bool FFAgent::solveProblem(State state, int stateHeuristic, set<Literal> helpful
 		stack.clear();
 
 		foreach(statePlan, prevStack) {
+			if (cancelled()) return false;
 			vector<Literal> availableActions = getAvailableActions(statePlan->first);
 
 			foreach(act, availableActions) {
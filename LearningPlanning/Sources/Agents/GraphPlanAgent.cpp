@@ -0,0 +1,379 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/GraphPlanAgent.h"
+
+#define MAX_LAYERS 100
+
+using namespace std;
+
+void GraphPlanAgent::init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) {
+	Agent::init(inDomain, inInstances, inGoal, inTrace);
+	planReady = false;
+	stepsReady = false;
+	noPlan = false;
+	task = make_shared<GroundedTask>(domain, instances);
+}
+
+void GraphPlanAgent::updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) {
+	Agent::updateProblem(inInstances, inGoal, inHeadstart);
+	planReady = false;
+	plan.clear();
+	stepsReady = false;
+	noPlan = false;
+	task = make_shared<GroundedTask>(domain, instances);
+}
+
+Literal GraphPlanAgent::getNextAction(State state) {
+	// A state from which no plan exists is not searched again until it changes
+	if (!planReady && !(noPlan && task->encode(state) == initialFacts))
+		noPlan = !findPlan(state) && !cancelled();
+
+	if (planReady && plan.size() > 0) {
+		Literal nextAction = plan.back();
+		plan.pop_back();
+
+		if (verbose) cout << plan.size() << " steps remaining." << endl;
+		return nextAction;
+	}
+
+	return Literal();
+}
+
+size_t GraphPlanAgent::negation(size_t literal) const {
+	return literal < factCount ? literal + factCount : literal - factCount;
+}
+
+bool GraphPlanAgent::findPlan(State state) {
+	if (verbose) cout << "Building planning graph..." << endl;
+
+	initialFacts = task->encode(state);
+
+	vector<size_t> goalFacts;
+	foreach(f, goal.trueFacts)
+		if (f->positive)
+			goalFacts.push_back(task->factIndex(*f));
+	vector<size_t> goalFalseFacts;
+	foreach(f, goal.falseFacts)
+		if (f->positive)
+			goalFalseFacts.push_back(task->factIndex(*f));
+
+	// Grounding every action first fixes the number of facts, steps are compiled again only when new facts appear
+	if (!stepsReady || task->factCount() != factCount) {
+		vector<size_t> ops = task->compileAll();
+		factCount = task->factCount();
+		compileSteps(ops);
+		stepsReady = true;
+	}
+
+	FactSet initialLayer;
+	for (size_t f = 0; f < factCount; f++)
+		initialLayer.set(initialFacts.get(f) ? f : negation(f));
+
+	FactSet goals;
+	foreach(f, goalFacts)
+		goals.set(*f);
+	foreach(f, goalFalseFacts)
+		goals.set(negation(*f));
+
+	factLayers = { initialLayer };
+	factMutexes = { vector<FactSet>(2 * factCount) };
+	actionLayers.clear();
+	actionMutexes.clear();
+	noGoods = { set<FactSet>() };
+
+	// Once the graph leveled off, extraction can only succeed later if it keeps learning no-goods at that layer
+	size_t leveledLayer = 0;
+	size_t leveledNoGoods = 0;
+	bool leveled = false;
+	replayRejections = 0;
+
+	while (true) {
+		if (cancelled()) return false;
+		size_t layer = factLayers.size() - 1;
+
+		if (!leveled && leveledOff()) {
+			leveled = true;
+			leveledLayer = layer - 1;
+			leveledNoGoods = noGoods[leveledLayer].size();
+			if (verbose) cout << "Graph leveled off at layer " << leveledLayer << "." << endl;
+		}
+
+		if (goalsPossible(goals, layer)) {
+			if (verbose) cout << "Goals reachable at layer " << layer << ", extracting plan..." << endl;
+
+			vector<vector<size_t>> layerSteps = vector<vector<size_t>>(layer);
+			size_t rejections = replayRejections;
+			if (extract(goals, layer, layerSteps)) {
+				vector<Literal> actions;
+				foreachindex(li, layerSteps)
+					foreach(step, layerSteps[li])
+						actions.push_back(task->getOperator(steps[*step].op).actionLiteral);
+
+				plan = vector<Literal>(actions.rbegin(), actions.rend());
+				if (optimizePlans)
+					plan = optimizePlan(state, plan);
+				planReady = true;
+
+				if (verbose) cout << "Plan: " << join(", ", actions) << endl;
+				return true;
+			}
+
+			// Plans rejected on replay are not no-goods, a longer graph may still order their steps differently
+			if (leveled && replayRejections == rejections) {
+				if (noGoods[leveledLayer].size() == leveledNoGoods) {
+					if (verbose) cout << "No plan exists." << endl;
+					return false;
+				}
+				leveledNoGoods = noGoods[leveledLayer].size();
+			}
+		}
+		else if (leveled) {
+			if (verbose) cout << "Goals are never reachable." << endl;
+			return false;
+		}
+
+		if (layer >= MAX_LAYERS) {
+			if (verbose) cout << "Couldn't find a solution in " << MAX_LAYERS << " layers." << endl;
+			return false;
+		}
+
+		expandGraph();
+	}
+}
+
+void GraphPlanAgent::compileSteps(vector<size_t> const& ops) {
+	steps.clear();
+
+	foreach(op, ops) {
+		CompiledOperator const& compiled = task->getOperator(*op);
+
+		Step step;
+		step.op = *op;
+		step.noop = false;
+
+		foreach(pre, compiled.pre)
+			step.pre.set(*pre);
+		foreach(pre, compiled.preFalse)
+			step.pre.set(negation(*pre));
+
+		// Deletions are applied after additions
+		set<size_t> deleted = toSet(compiled.del);
+		foreach(eff, compiled.add)
+			if (!in(deleted, *eff)) {
+				step.eff.set(*eff);
+				step.negEff.set(negation(*eff));
+			}
+		foreach(eff, deleted) {
+			step.eff.set(negation(*eff));
+			step.negEff.set(*eff);
+		}
+
+		steps.push_back(step);
+	}
+
+	// One no-op per fact literal, at index ops.size() + literal
+	for (size_t literal = 0; literal < 2 * factCount; literal++) {
+		Step step;
+		step.op = 0;
+		step.noop = true;
+		step.pre.set(literal);
+		step.eff.set(literal);
+		step.negEff.set(negation(literal));
+		steps.push_back(step);
+	}
+
+	requiredBy = vector<FactSet>(2 * factCount);
+	addedBy = vector<FactSet>(2 * factCount);
+	deletedBy = vector<FactSet>(2 * factCount);
+	foreachindex(si, steps) {
+		vector<size_t> pre = steps[si].pre.indices();
+		foreach(f, pre)
+			requiredBy[*f].set(si);
+		vector<size_t> eff = steps[si].eff.indices();
+		foreach(f, eff)
+			addedBy[*f].set(si);
+		vector<size_t> negEff = steps[si].negEff.indices();
+		foreach(f, negEff)
+			deletedBy[*f].set(si);
+	}
+}
+
+void GraphPlanAgent::expandGraph() {
+	FactSet const& facts = factLayers.back();
+	vector<FactSet> const& mutexes = factMutexes.back();
+
+	// 1. Action layer: steps whose preconditions are present and pairwise non-mutex
+	FactSet actions;
+	vector<FactSet> needs = vector<FactSet>(steps.size());
+	foreachindex(si, steps) {
+		Step const& step = steps[si];
+		if (!facts.includes(step.pre)) continue;
+
+		vector<size_t> pre = step.pre.indices();
+		foreach(p, pre)
+			needs[si].unite(mutexes[*p]);
+		if (needs[si].intersects(step.pre)) continue;
+
+		actions.set(si);
+	}
+
+	// 2. Action mutexes: inconsistent effects, interference and competing needs
+	vector<size_t> actionList = actions.indices();
+	vector<FactSet> stepMutexes = vector<FactSet>(steps.size());
+	foreach(si, actionList) {
+		Step const& step = steps[*si];
+		FactSet& row = stepMutexes[*si];
+
+		vector<size_t> negEff = step.negEff.indices();
+		foreach(f, negEff) {
+			row.unite(requiredBy[*f]);
+			row.unite(addedBy[*f]);
+		}
+
+		FactSet touched = step.pre;
+		touched.unite(step.eff);
+		vector<size_t> touchedFacts = touched.indices();
+		foreach(f, touchedFacts)
+			row.unite(deletedBy[*f]);
+
+		vector<size_t> neededAgainst = needs[*si].indices();
+		foreach(f, neededAgainst)
+			row.unite(requiredBy[*f]);
+
+		row.intersect(actions);
+		row.reset(*si);
+	}
+
+	// 3. Next fact layer and its mutexes: two facts are mutex when every pair of achievers is
+	FactSet nextFacts;
+	foreach(si, actionList)
+		nextFacts.unite(steps[*si].eff);
+
+	vector<size_t> factList = nextFacts.indices();
+	vector<FactSet> achievers = vector<FactSet>(2 * factCount);
+	foreach(f, factList) {
+		achievers[*f] = addedBy[*f];
+		achievers[*f].intersect(actions);
+	}
+
+	vector<FactSet> nextMutexes = vector<FactSet>(2 * factCount);
+	foreach(p, factList) {
+		FactSet compatible;
+		vector<size_t> pAchievers = achievers[*p].indices();
+		foreach(a, pAchievers) {
+			FactSet notMutex = actions;
+			notMutex.subtract(stepMutexes[*a]);
+			compatible.unite(notMutex);
+		}
+
+		foreach(q, factList)
+			if (*q != *p && !compatible.intersects(achievers[*q]))
+				nextMutexes[*p].set(*q);
+	}
+
+	actionLayers.push_back(actions);
+	actionMutexes.push_back(stepMutexes);
+	factLayers.push_back(nextFacts);
+	factMutexes.push_back(nextMutexes);
+	noGoods.push_back(set<FactSet>());
+
+	if (verbose) cout << "Layer " << factLayers.size() - 1 << ": " << actionList.size() << " steps, " << factList.size() << " fact literals." << endl;
+}
+
+bool GraphPlanAgent::leveledOff() const {
+	size_t layers = factLayers.size();
+	if (layers < 2) return false;
+	return factLayers[layers - 1] == factLayers[layers - 2] && factMutexes[layers - 1] == factMutexes[layers - 2];
+}
+
+bool GraphPlanAgent::goalsPossible(FactSet const& goals, size_t layer) const {
+	if (!factLayers[layer].includes(goals)) return false;
+
+	vector<size_t> goalList = goals.indices();
+	foreach(g, goalList)
+		if (factMutexes[layer][*g].intersects(goals))
+			return false;
+	return true;
+}
+
+bool GraphPlanAgent::extract(FactSet const& goals, size_t layer, vector<vector<size_t>>& layerSteps) {
+	if (layer == 0) return replays(layerSteps);
+	if (in(noGoods[layer], goals)) return false;
+	if (cancelled()) return false;
+
+	size_t rejections = replayRejections;
+	vector<size_t> goalList = goals.indices();
+	vector<size_t> chosen;
+	if (assignGoals(goalList, 0, layer, chosen, FactSet(), FactSet(), layerSteps))
+		return true;
+	if (cancelled()) return false;
+
+	// A failure caused by rejected replays depends on the steps chosen in the layers above
+	if (replayRejections == rejections)
+		noGoods[layer].insert(goals);
+	return false;
+}
+
+bool GraphPlanAgent::replays(vector<vector<size_t>> const& layerSteps) {
+	// Action literals with free precondition variables are resolved by Domain::tryAction, which must pick the operator
+	// chosen by the extraction at every step
+	FactSet current = initialFacts;
+	foreachindex(li, layerSteps)
+		foreach(step, layerSteps[li]) {
+			size_t op;
+			if (!task->findApplicable(task->getOperator(steps[*step].op).actionLiteral, current, op) || op != steps[*step].op) {
+				replayRejections++;
+				return false;
+			}
+			task->apply(op, current);
+		}
+	return true;
+}
+
+bool GraphPlanAgent::assignGoals(vector<size_t> const& goals, size_t goalIndex, size_t layer, vector<size_t>& chosen,
+								 FactSet const& covered, FactSet const& blocked, vector<vector<size_t>>& layerSteps) {
+	if (goalIndex == goals.size()) {
+		// Steps are recorded before descending, so that the full plan is known when the first layer replays it
+		layerSteps[layer - 1].clear();
+		foreach(step, chosen)
+			if (!steps[*step].noop)
+				layerSteps[layer - 1].push_back(*step);
+
+		FactSet subgoals;
+		foreach(step, chosen)
+			subgoals.unite(steps[*step].pre);
+		return extract(subgoals, layer - 1, layerSteps);
+	}
+
+	size_t goal = goals[goalIndex];
+	if (covered.get(goal))
+		return assignGoals(goals, goalIndex + 1, layer, chosen, covered, blocked, layerSteps);
+
+	FactSet candidates = addedBy[goal];
+	candidates.intersect(actionLayers[layer - 1]);
+	candidates.subtract(blocked);
+
+	// Persisting the goal is tried first, it adds no new subgoal
+	size_t noop = steps.size() - 2 * factCount + goal;
+	vector<size_t> candidateList = candidates.indices();
+	if (candidates.get(noop)) {
+		removeFirst(&candidateList, noop);
+		candidateList.insert(candidateList.begin(), noop);
+	}
+
+	foreach(step, candidateList) {
+		FactSet newCovered = covered;
+		newCovered.unite(steps[*step].eff);
+		FactSet newBlocked = blocked;
+		newBlocked.unite(actionMutexes[layer - 1][*step]);
+
+		chosen.push_back(*step);
+		if (assignGoals(goals, goalIndex + 1, layer, chosen, newCovered, newBlocked, layerSteps))
+			return true;
+		chosen.pop_back();
+	}
+	return false;
+}
@@ -0,0 +1,81 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * GraphPlan over the compiled operators of a GroundedTask. The planning graph alternates fact layers and action layers,
+ * each carrying its mutex relation, until the goals appear pairwise non-mutex; a plan is then extracted backwards, one
+ * set of non-mutex actions per layer. Failed goal sets are memoized per layer as no-goods. Extracted plans are replayed
+ * with the executor's operator selection before being accepted, a rejected replay backtracks into the extraction.
+ *
+ * Negative preconditions and goals are handled by giving each fact a negated literal, true in the initial layer when
+ * the fact is absent. Every layer is a bitset over these literals, and mutexes are propagated row by row with word-wise
+ * operations over precomputed per-literal step sets.
+ */
+
+#pragma once
+
+#include <vector>
+#include <set>
+#include <memory>
+
+#include "Agents/Agent.h"
+#include "Logic/GroundedTask.h"
+
+using namespace std;
+
+class GraphPlanAgent : public Agent {
+public:
+	GraphPlanAgent(bool inVerbose) : Agent(inVerbose) {}
+
+	void init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) override;
+
+	Literal getNextAction(State state) override;
+	void updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) override;
+
+	bool receivesEvents = false;
+
+private:
+	// Operator or no-op between two fact layers, over fact literals (fact f is literal f, its negation literal f + facts)
+	struct Step {
+		size_t op;
+		bool noop;
+		FactSet pre;
+		FactSet eff;
+		FactSet negEff;
+	};
+
+	bool findPlan(State state);
+
+	size_t negation(size_t literal) const;
+	void compileSteps(vector<size_t> const& ops);
+	void expandGraph();
+	bool leveledOff() const;
+	bool goalsPossible(FactSet const& goals, size_t layer) const;
+
+	bool extract(FactSet const& goals, size_t layer, /*r*/ vector<vector<size_t>>& layerSteps);
+	bool replays(vector<vector<size_t>> const& layerSteps);
+	bool assignGoals(vector<size_t> const& goals, size_t goalIndex, size_t layer, /*r*/ vector<size_t>& chosen,
+					 FactSet const& covered, FactSet const& blocked, /*r*/ vector<vector<size_t>>& layerSteps);
+
+	bool planReady = false;
+	bool noPlan = false;
+	vector<Literal> plan;
+
+	shared_ptr<GroundedTask> task;
+
+	bool stepsReady = false;
+	size_t factCount = 0;
+	vector<Step> steps;
+	FactSet initialFacts;
+
+	// Per fact literal: steps requiring it, adding it, and deleting it
+	vector<FactSet> requiredBy, addedBy, deletedBy;
+
+	vector<FactSet> factLayers;
+	vector<vector<FactSet>> factMutexes;
+	vector<FactSet> actionLayers;
+	vector<vector<FactSet>> actionMutexes;
+
+	vector<set<FactSet>> noGoods;
+	size_t replayRejections = 0;
+};
@@ -13,11 +13,21 @@
 
 #include "Agents/LearningAgent/ActionRule.h"
 #include "Agents/LearningAgent/LearningAgent.h"
+#include "Agents/LearningAgent/CdProbability.h"
+#include "Agents/LearningAgent/SubstitutionSampler.h"
+#include <algorithm>
+#include <atomic>
 
-#define PRECISION 0.001f
 #define SUBS_FOR_FULFILMENT 20
 #define SUBS_FOR_CORROBORATION 20
 
+atomic<unsigned __int64> ruleVersions(0);
+
+// Levels only change with some insertions of parents, leaf counts with any change of the lattice
+atomic<unsigned __int64> levelEpoch(1);
+atomic<unsigned __int64> structureEpoch(1);
+atomic<unsigned __int64> latticeVisits(0);
+
 bool varOccurs(Term var, set<Literal> literals) {
 	foreach(litit, literals)
 		if (in(litit->parameters, var))
@@ -25,25 +35,58 @@ bool varOccurs(Term var, set<Literal> literals) {
 	return false;
 }
 
-bool linked(map<Term, set<Term>> links, Term from, set<Term> to) {
-	if (in(to, from)) return true;
-
-	set<Term> toVisit = { from };
-	set<Term> visited;
+size_t findRoot(vector<size_t>& roots, size_t id) {
+	while (roots[id] != id) {
+		roots[id] = roots[roots[id]];
+		id = roots[id];
+	}
+	return id;
+}
 
-	while (toVisit.size() > 0) {
-		Term current = *toVisit.begin();
-		toVisit.erase(current);
-		visited.insert(current);
+// Whether each literal, in order, only has terms linked to one of the targets, terms appearing together in a literal being
+// linked. Components are merged in one pass over the literals by a union-find over term ids.
+vector<bool> linkedLiterals(set<Literal> const& literals, set<Term> const& targets) {
+	map<Term, size_t> ids;
+	vector<size_t> roots;
+	vector<vector<size_t>> literalIds;
+
+	foreach(lit, literals) {
+		vector<size_t> termIds;
+		foreach(param, lit->parameters) {
+			auto found = ids.find(*param);
+			size_t id = found == ids.end() ? roots.size() : found->second;
+			if (found == ids.end()) {
+				ids[*param] = id;
+				roots.push_back(id);
+			}
 
-		foreach(linkedit, links[current]) {
-			if (in(visited, *linkedit)) continue;
-			if (in(to, *linkedit)) return true;
-			toVisit.insert(*linkedit);
+			termIds.push_back(id);
+			size_t first = findRoot(roots, termIds[0]);
+			size_t current = findRoot(roots, id);
+			if (first != current)
+				roots[current] = first;
 		}
+		literalIds.push_back(termIds);
 	}
 
-	return false;
+	vector<bool> reachesTarget = vector<bool>(roots.size(), false);
+	foreach(target, targets) {
+		auto found = ids.find(*target);
+		if (found != ids.end())
+			reachesTarget[findRoot(roots, found->second)] = true;
+	}
+
+	vector<bool> linked;
+	foreachindex(li, literalIds) {
+		bool allLinked = true;
+		foreach(id, literalIds[li])
+			if (!reachesTarget[findRoot(roots, *id)]) {
+				allLinked = false;
+				break;
+			}
+		linked.push_back(allLinked);
+	}
+	return linked;
 }
 
 ActionRule::ActionRule(set<Literal> inPreconditions, Literal inActionLiteral, set<Literal> inAdd, set<Literal> inDel,
@@ -51,36 +94,18 @@ ActionRule::ActionRule(set<Literal> inPreconditions, Literal inActionLiteral, se
 	: actionLiteral(inActionLiteral), add(inAdd), del(inDel), parents(inParents), startPu(startPuIn) {
 
 	if (filter) {
-		map<Term, set<Term>> links;
 		set<Term> vars;
-		foreach(precond, inPreconditions)
-			foreach(pit1, precond->parameters) {
-			if (!in(links, *pit1)) {
-				links[*pit1] = {};
-			}
-
-			foreach(pit2, precond->parameters) {
-				if (*pit1 != *pit2) {
-					links[*pit1].insert(*pit2);
-				}
-			}
-		}
 		foreach(eff, add)
 			vars = vars + eff->parameters;
 		foreach(eff, del)
 			vars = vars + eff->parameters;
 		vars = vars + actionLiteral.parameters;
 
-		foreach(precond, inPreconditions) {
-			bool allLinked = true;
-			foreach(param, precond->parameters)
-				if (!linked(links, *param, vars)) {
-					allLinked = false;
-					break;
-				}
-			if (allLinked)
-				preconditions.insert(*precond);
-		}
+		vector<bool> linked = linkedLiterals(inPreconditions, vars);
+		size_t pi = 0;
+		foreach(precond, inPreconditions)
+			if (linked[pi++])
+				preconditions.insert(preconditions.end(), *precond);
 	}
 	else {
 		preconditions = inPreconditions;
@@ -98,18 +123,22 @@ ActionRule::ActionRule(set<Literal> inPreconditions, Literal inActionLiteral, se
 			constants.insert(*param);
 	float components = (float)preconditions.size() + (float)constants.size() - (float)del.size();
 
+	map<Literal, float> precondNecs;
+	map<Term, float> constNecs;
 	foreach(precond, preconditions) {
 
 		// Del effects must be in preconditions, and we are sure of them, so they are 100% necessary
 		if (in(del, -*precond))
-			precondsNecessities[*precond] = 1.0f;
+			precondNecs[*precond] = 1.0f;
 		else
-			precondsNecessities[*precond] = 1.0f - powf(startPu, 1.0f / components);
+			precondNecs[*precond] = 1.0f - powf(startPu, 1.0f / components);
 		
 		foreach(param, precond->parameters)
 			if (!param->isVariable)
-				constsNecessities[*param] = 1.0f - powf(startPu, 1.0f / components);
+				constNecs[*param] = 1.0f - powf(startPu, 1.0f / components);
 	}
+
+	setNecessities(precondNecs, constNecs);
 }
 
 ActionRule::ActionRule(Trace trace, float startPuIn, bool filter) : actionLiteral(trace.instAct), startPu(startPuIn) {
@@ -120,21 +149,7 @@ ActionRule::ActionRule(Trace trace, float startPuIn, bool filter) : actionLitera
 		tempPreconds.insert(*it);
 
 	if (filter) {
-		map<Term, set<Term>> links;
 		set<Term> vars;
-
-		foreach(precond, tempPreconds)
-			foreach(pit1, precond->parameters) {
-			if (!in(links, *pit1)) {
-				links[*pit1] = {};
-			}
-
-			foreach(pit2, precond->parameters) {
-				if (*pit1 != *pit2) {
-					links[*pit1].insert(*pit2);
-				}
-			}
-		}
 		foreach(eff, add)
 			vars = vars + eff->parameters;
 		foreach(eff, del)
@@ -142,16 +157,11 @@ ActionRule::ActionRule(Trace trace, float startPuIn, bool filter) : actionLitera
 		foreach(param, actionLiteral.parameters)
 			vars.insert(*param);
 
-		foreach(precond, tempPreconds) {
-			bool allLinked = true;
-			foreach(param, precond->parameters)
-				if (!linked(links, *param, vars)) {
-					allLinked = false;
-					break;
-				}
-			if (allLinked)
-				preconditions.insert(*precond);
-		}
+		vector<bool> linked = linkedLiterals(tempPreconds, vars);
+		size_t pi = 0;
+		foreach(precond, tempPreconds)
+			if (linked[pi++])
+				preconditions.insert(preconditions.end(), *precond);
 	}
 	else {
 		preconditions = tempPreconds;
@@ -174,18 +184,22 @@ ActionRule::ActionRule(Trace trace, float startPuIn, bool filter) : actionLitera
 				constants.insert(*param);
 	float components = (float)preconditions.size() + (float)constants.size() - (float)del.size();
 
+	map<Literal, float> precondNecs;
+	map<Term, float> constNecs;
 	foreach(precond, preconditions) {
 
 		// Del effects must be in preconditions, and we are sure of them, so they are 100% necessary
 		if (in(del, -*precond))
-			precondsNecessities[*precond] = 1.0f;
+			precondNecs[*precond] = 1.0f;
 		else
-			precondsNecessities[*precond] = 1.0f - powf(startPu, 1.0f / components);
+			precondNecs[*precond] = 1.0f - powf(startPu, 1.0f / components);
 
 		foreach(param, precond->parameters)
 			if (!param->isVariable)
-				constsNecessities[*param] = 1.0f - powf(startPu, 1.0f / components);
+				constNecs[*param] = 1.0f - powf(startPu, 1.0f / components);
 	}
+
+	setNecessities(precondNecs, constNecs);
 }
 
 void unifyWithState(set<Literal> toUnify, State s, /*r*/ set<Substitution>& subs) {
@@ -226,6 +240,12 @@ void unifyWithState(set<Literal> toUnify, State s, /*r*/ set<Substitution>& subs
 set<Substitution> ActionRule::prematchingSubs(shared_ptr<ActionRule> x, Substitution sub) {
 	if (!Literal::compatible(actionLiteral, x->actionLiteral)) return {};
 
+	set<Substitution> compiledSubs;
+	if (matchPrograms()->preconditions.unify(x->actionLiteral, x->preconditions, nullptr, sub, true, compiledSubs))
+		return compiledSubs;
+
+	// Examples holding variables are interpreted
+
 	set<Term> constants;
 	foreach(p, actionLiteral.parameters)
 		if (!p->isVariable)
@@ -258,12 +278,43 @@ bool ActionRule::prematches(shared_ptr<ActionRule> x, Substitution sub) {
 	return prematchingSubs(x, sub).size() == 1;
 }
 
+set<Substitution> ActionRule::prematchingSubs(State const& state, Literal const& action) {
+	if (!Literal::compatible(actionLiteral, action)) return {};
+
+	set<Substitution> subs;
+	if (matchPrograms()->preconditions.unify(action, state.facts, nullptr, Substitution(), true, subs))
+		return subs;
+	return prematchingSubs(make_shared<ActionRule>(Trace(state, action, true, state), startPu, false));
+}
+
+shared_ptr<RuleMatchPrograms const> ActionRule::matchPrograms() {
+	shared_ptr<RuleMatchPrograms const> compiled = atomic_load(&programs);
+	if (compiled && compiled->version == version) return compiled;
+
+	shared_ptr<RuleMatchPrograms> recompiled = make_shared<RuleMatchPrograms>();
+	recompiled->version = version;
+	recompiled->preconditions = MatchProgram(actionLiteral, preconditions);
+	recompiled->effects = MatchProgram(actionLiteral, add + del);
+	recompiled->application = MatchProgram(actionLiteral, preconditions, parameters);
+
+	compiled = recompiled;
+	atomic_store(&programs, compiled);
+	return compiled;
+}
+
+
 set<Substitution> ActionRule::postmatchingSubs(shared_ptr<ActionRule> x, Substitution sub) {
 	if (!Literal::compatible(actionLiteral, x->actionLiteral)) return {};
 
-	State s = State(x->add + x->del);
 	if (add.size() != x->add.size() || del.size() != x->del.size()) return {};
 
+	set<Substitution> compiledSubs;
+	if (matchPrograms()->effects.unify(x->actionLiteral, x->add, &x->del, sub, false, compiledSubs))
+		return compiledSubs;
+
+	// Examples holding variables are interpreted
+	State s = State(x->add + x->del);
+
 	set<Term> constants;
 	foreach(p, actionLiteral.parameters)
 		if (!p->isVariable)
@@ -385,7 +436,7 @@ Opt<Literal> ActionRule::generalizeLiteralsOI(Literal l1, Literal l2, /*r*/ set<
 bool ActionRule::selection(set<Literal>lr, set<Literal> lx, shared_ptr<ActionRule> x,
 						   /*r*/ Substitution& subr, /*r*/ Substitution& subx,
 						   /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits,
-						   /*r*/ Literal& chosenLr, /*r*/ Literal& chosenLx) {
+						   /*r*/ Literal& chosenLr, /*r*/ Literal& chosenLx, mt19937& g) {
 
 	Substitution invSubR = subr.inverse();
 	Literal genAct = invSubR.apply(actionLiteral);
@@ -397,7 +448,7 @@ bool ActionRule::selection(set<Literal>lr, set<Literal> lx, shared_ptr<ActionRul
 
 	set<Literal> drawLr = lr;
 	while (drawLr.size() > 0) {
-		chosenLr = *select_randomly(drawLr.begin(), drawLr.end());
+		chosenLr = *select_randomly(drawLr.begin(), drawLr.end(), g);
 		drawLr.erase(chosenLr);
 
 		set<Literal> drawLx;
@@ -406,7 +457,7 @@ bool ActionRule::selection(set<Literal>lr, set<Literal> lx, shared_ptr<ActionRul
 				drawLx.insert(*l);
 
 		while (drawLx.size() > 0) {
-			chosenLx = *select_randomly(drawLx.begin(), drawLx.end());
+			chosenLx = *select_randomly(drawLx.begin(), drawLx.end(), g);
 			drawLx.erase(chosenLx);
 
 			tmpSubR = Substitution(subr);
@@ -434,7 +485,7 @@ bool ActionRule::selection(set<Literal>lr, set<Literal> lx, shared_ptr<ActionRul
 }
 
 set<Literal> ActionRule::anyGeneralization(set<Literal> lr, set<Literal> lx, shared_ptr<ActionRule> x,
-										   /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars) {
+										   /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, mt19937& g) {
 	set<Literal> genLits;
 	Literal chosenLr, chosenLx;
 
@@ -442,7 +493,7 @@ set<Literal> ActionRule::anyGeneralization(set<Literal> lr, set<Literal> lx, sha
 	//cout << "Starting with: " << subr << " - " << subx << endl;
 
 	while (lr.size() > 0 && lx.size() > 0) {
-		if (selection(lr, lx, x, subr, subx, genVars, genLits, chosenLr, chosenLx))
+		if (selection(lr, lx, x, subr, subx, genVars, genLits, chosenLr, chosenLx, g))
 			lx.erase(chosenLx);
 		lr.erase(chosenLr);
 
@@ -452,17 +503,18 @@ set<Literal> ActionRule::anyGeneralization(set<Literal> lr, set<Literal> lx, sha
 	return genLits;
 }
 
-set<Literal> ActionRule::anyGeneralization(shared_ptr<ActionRule> x, /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars) {
-	return anyGeneralization(subr.inverse().apply(preconditions), subx.inverse().apply(x->preconditions), x, subr, subx, genVars);
+set<Literal> ActionRule::anyGeneralization(shared_ptr<ActionRule> x, /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars,
+										   mt19937& g) {
+	return anyGeneralization(subr.inverse().apply(preconditions), subx.inverse().apply(x->preconditions), x, subr, subx, genVars, g);
 }
 
 bool ActionRule::exactGeneralizationLxChoice(Literal chosenLr, set<Literal> lr, set<Literal> lx,
-	/*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits) {
+	/*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits, mt19937& g) {
 
 	set<Literal> tmpLx = lx;
 	vector<Literal> shuffledLx;
 	while (tmpLx.size() > 0) {
-		Literal l = *select_randomly(tmpLx.begin(), tmpLx.end());
+		Literal l = *select_randomly(tmpLx.begin(), tmpLx.end(), g);
 		if (Literal::compatible(l, chosenLr))
 			shuffledLx.push_back(l);
 		tmpLx.erase(l);
@@ -481,7 +533,7 @@ bool ActionRule::exactGeneralizationLxChoice(Literal chosenLr, set<Literal> lr,
 
 		set<Literal> tmpGenLits = genLits + set<Literal>{ genLit.obj };
 
-		bool success = exactGeneralizationLrChoice(lr, tmpLx, tmpSubR, tmpSubX, tmpGenVars, tmpGenLits);
+		bool success = exactGeneralizationLrChoice(lr, tmpLx, tmpSubR, tmpSubX, tmpGenVars, tmpGenLits, g);
 		if (success) {
 			genLits = tmpGenLits;
 			subr = tmpSubR;
@@ -495,12 +547,12 @@ bool ActionRule::exactGeneralizationLxChoice(Literal chosenLr, set<Literal> lr,
 }
 
 bool ActionRule::exactGeneralizationLrChoice(set<Literal> lr, set<Literal> lx,
-	/*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits) {
+	/*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits, mt19937& g) {
 	if (lr.size() == 0) return true;
 
 	vector<Literal> shuffledLr;
 	while (lr.size() > 0) {
-		Literal l = *select_randomly(lr.begin(), lr.end());
+		Literal l = *select_randomly(lr.begin(), lr.end(), g);
 		shuffledLr.push_back(l);
 		lr.erase(l);
 	}
@@ -513,7 +565,7 @@ bool ActionRule::exactGeneralizationLrChoice(set<Literal> lr, set<Literal> lx,
 		tmpLr.erase(*chosenLr);
 		set<Literal> tmpGenLits = genLits;
 
-		bool success = exactGeneralizationLxChoice(*chosenLr, tmpLr, lx, tmpSubR, tmpSubX, tmpGenVars, tmpGenLits);
+		bool success = exactGeneralizationLxChoice(*chosenLr, tmpLr, lx, tmpSubR, tmpSubX, tmpGenVars, tmpGenLits, g);
 		if (success) {
 			genLits = tmpGenLits;
 			subr = tmpSubR;
@@ -526,7 +578,8 @@ bool ActionRule::exactGeneralizationLrChoice(set<Literal> lr, set<Literal> lx,
 	return false;
 }
 
-bool ActionRule::postGeneralizes(shared_ptr<ActionRule> x, /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars) {
+bool ActionRule::postGeneralizes(shared_ptr<ActionRule> x, /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars,
+								 mt19937& g) {
 	if (add.size() != x->add.size() || del.size() != x->del.size()) return false;
 
 	Opt<Literal> genAct = generalizeLiteralsOI(actionLiteral, x->actionLiteral, genVars, subr, subx);
@@ -534,7 +587,7 @@ bool ActionRule::postGeneralizes(shared_ptr<ActionRule> x, /*r*/ Substitution& s
 	if (!genAct.there) return false;
 
 	set<Literal> effGen;
-	bool success = exactGeneralizationLrChoice(add + del, x->add + x->del, subr, subx, genVars, effGen);
+	bool success = exactGeneralizationLrChoice(add + del, x->add + x->del, subr, subx, genVars, effGen, g);
 
 	subr.cleanConstants();
 
@@ -661,19 +714,41 @@ bool ActionRule::contradicts(shared_ptr<ActionRule> x) {
 }
 
 void ActionRule::insertParent(shared_ptr<ActionRule> parent) {
-	parents.insert(parent);
+	int level = generalityLevel();
+	if (!parents.insert(parent).second) return;
+	structureEpoch++;
+
+	// Rules above only need new levels when this one rises
+	if (parent->generalityLevel() + 1 > level)
+		levelEpoch++;
 }
 
 void ActionRule::removeParentRecursive(shared_ptr<ActionRule> parent) {
-	parents.erase(parent);
-	foreach(pit, parents)
-		(*pit)->removeParentRecursive(parent);
+	unsigned __int64 mark = ++latticeVisits;
+	bool removed = false;
+
+	vector<ActionRule*> open = { this };
+	visitMark = mark;
+	while (!open.empty()) {
+		ActionRule* rule = open.back();
+		open.pop_back();
+
+		removed = rule->parents.erase(parent) > 0 || removed;
+		foreach(pit, rule->parents) {
+			if ((*pit)->visitMark == mark) continue;
+			(*pit)->visitMark = mark;
+			open.push_back(&**pit);
+		}
+	}
+
+	if (removed) {
+		structureEpoch++;
+		levelEpoch++;
+	}
 }
 
 bool ActionRule::wellFormed() {
-	set<Term> vars;
 	set<Term> addVars;
-	map<Term, set<Term>> links;
 	set<Term> linkTarget = toSet(actionLiteral.parameters);
 
 	// Del effects are included in preconditions
@@ -701,67 +776,87 @@ bool ActionRule::wellFormed() {
 	}
 
 	// Any variable in preconditions should be linked to a variable in the action literal or in the effects
-	foreach(precond, preconditions) {
-		foreach(pit1, precond->parameters) {
-			if (!in(vars, *pit1)) {
-				vars.insert(*pit1);
-				links[*pit1] = {};
-			}
-
-			foreach(pit2, precond->parameters) {
-				if (*pit1 != *pit2) {
-					links[*pit1].insert(*pit2);
-				}
-			}
-		}
-	}
-	foreach(varit, vars)
-		if (!linked(links, *varit, linkTarget)) return false;
+	vector<bool> linked = linkedLiterals(preconditions, linkTarget);
+	foreach(allLinked, linked)
+		if (!*allLinked) return false;
 
 	return true;
 }
 
 // Generality level of a node is the max of its parents generality levels + 1, OR 0 if it's a leaf (it is an example).
 int ActionRule::generalityLevel() const {
+	if (levelStamp == levelEpoch) return cachedLevel;
+
 	int maxGenerality = 0;
 	foreach(ruleit, parents) {
 		int parentGenerality = (*ruleit)->generalityLevel() + 1;
 		if (parentGenerality > maxGenerality)
 			maxGenerality = parentGenerality;
 	}
+
+	cachedLevel = maxGenerality;
+	levelStamp = levelEpoch;
 	return maxGenerality;
 }
 
+// Leaves are counted once per path leading to them
 int ActionRule::countLeaves() {
 	if (parents.empty())
 		return 1;
+	if (leavesStamp == structureEpoch) return cachedLeaves;
 	
 	int sum = 0;
 	foreach(rule, parents)
 		sum += (*rule)->countLeaves();
+
+	cachedLeaves = sum;
+	leavesStamp = structureEpoch;
 	return sum;
 }
 
 float ActionRule::maxLeafSimilarity(State state) {
-	if (parents.empty())
-		return State::similarity(state, State(preconditions));
-	
+	unsigned __int64 mark = ++latticeVisits;
 	float maxSim = 0;
-	foreach(rule, parents) {
-		float sim = (*rule)->maxLeafSimilarity(state);
-		if (maxSim < sim)
-			maxSim = sim;
+
+	vector<ActionRule*> open = { this };
+	visitMark = mark;
+	while (!open.empty()) {
+		ActionRule* rule = open.back();
+		open.pop_back();
+
+		if (rule->parents.empty()) {
+			float sim = State::similarity(state, State(rule->preconditions));
+			if (maxSim < sim)
+				maxSim = sim;
+			continue;
+		}
+
+		foreach(pit, rule->parents) {
+			if ((*pit)->visitMark == mark) continue;
+			(*pit)->visitMark = mark;
+			open.push_back(&**pit);
+		}
 	}
 	return maxSim;
 }
 
 shared_ptr<ActionRule> ActionRule::getLeastGeneralRuleCovering(shared_ptr<ActionRule> example) {
+	map<ActionRule*, shared_ptr<ActionRule>> memo;
+	return leastGeneralRuleCovering(example, memo);
+}
+
+shared_ptr<ActionRule> ActionRule::leastGeneralRuleCovering(shared_ptr<ActionRule> example, /*r*/ map<ActionRule*, shared_ptr<ActionRule>>& memo) {
+	auto known = memo.find(this);
+	if (known != memo.end()) return known->second;
+
 	shared_ptr<ActionRule> result = nullptr;
-	if (covers(example)) result = shared_from_this();
 
+	// Nothing is less general than a leaf, and a rule only counts when no rule below covers the example
 	int minGenerality = -1;
 	foreach(pit, parents) {
-		shared_ptr<ActionRule> lgr = (*pit)->getLeastGeneralRuleCovering(example);
+		if (minGenerality == 0) break;
+
+		shared_ptr<ActionRule> lgr = (*pit)->leastGeneralRuleCovering(example, memo);
 		if (lgr) {
 			int genLevel = lgr->generalityLevel();
 
@@ -771,15 +866,44 @@ shared_ptr<ActionRule> ActionRule::getLeastGeneralRuleCovering(shared_ptr<Action
 			}
 		}
 	}
+	if (!result && covers(example)) result = shared_from_this();
 
+	memo[this] = result;
 	return result;
 }
 
+bool ActionRule::reaches(shared_ptr<ActionRule> rule) {
+	unsigned __int64 mark = ++latticeVisits;
+
+	vector<ActionRule*> open = { this };
+	while (!open.empty()) {
+		ActionRule* current = open.back();
+		open.pop_back();
+
+		foreach(pit, current->parents) {
+			if (*pit == rule) return true;
+			if ((*pit)->visitMark == mark) continue;
+			(*pit)->visitMark = mark;
+			open.push_back(&**pit);
+		}
+	}
+	return false;
+}
+
 vector<SigmaTheta> ActionRule::applies(State state, vector<Term> instances, Literal inActionLiteral, bool onlyFirst=false) {
 	if (inActionLiteral != actionLiteral) return vector<SigmaTheta>();
 
 	Substitution sigma = Substitution(actionLiteral.parameters, inActionLiteral.parameters);
 
+	// The action literals are equal, sigma only maps anything when one of them holds the wildcard variable
+	vector<Substitution> compiledThetas;
+	if (sigma.getMapping().empty() && matchPrograms()->application.expand(state, toSet(instances), onlyFirst, compiledThetas)) {
+		vector<SigmaTheta> sigmaThetas;
+		foreach(theta, compiledThetas)
+			sigmaThetas.push_back(SigmaTheta(sigma, *theta));
+		return sigmaThetas;
+	}
+
 	set<Term> uncovered = sigma.getUncovered(toSet(parameters));
 	vector<Substitution> thetas = Substitution().expandUncovered(uncovered, instances, true);
 
@@ -830,17 +954,29 @@ void ActionRule::setRemovedPreconditions(set<Literal> remPreconds) {
 	foreach(it, removedPreconditions)
 		foreach(pit, (*it).parameters)
 			insertUnique(&parameters, *pit);
+
+	newVersion();
+}
+
+unsigned __int64 ActionRule::getVersion() const {
+	return version;
+}
+
+void ActionRule::newVersion() {
+	version = ++ruleVersions;
 }
 
-float ActionRule::fulfilmentProbability(State state, Literal action, vector<Term> instances, /*r*/ bool& prematches, /*r*/ set<Substitution>& subs) {
-	subs = this->prematchingSubs(make_shared<ActionRule>(Trace(state, action, true, state), startPu, false));
+float ActionRule::fulfilmentProbability(State state, Literal action, vector<Term> instances, /*r*/ bool& prematches, /*r*/ set<Substitution>& subs,
+										  mt19937& g) {
+	subs = prematchingSubs(state, action);
 	prematches = subs.size() > 0;
-	generateRandomSubs(state, action, instances, Substitution(), Substitution(), SUBS_FOR_FULFILMENT, subs);
+	generateRandomSubs(state, action, instances, Substitution(), Substitution(), SUBS_FOR_FULFILMENT, subs, g);
 
 	return 1.0f - computeCdProb(state, action, toVec(subs));
 }
 
-void ActionRule::generateRandomSubs(State state, Literal action, vector<Term> instances, Substitution rho, Substitution sigma, size_t maxRandomSubs, set<Substitution>& subs) {
+void ActionRule::generateRandomSubs(State state, Literal action, vector<Term> instances, Substitution rho, Substitution sigma, size_t maxRandomSubs, set<Substitution>& subs,
+									mt19937& g) {
 	set<Term> genVars;
 	set<Term> varsToMap;
 	set<Term> remainConstants;
@@ -978,110 +1114,34 @@ void ActionRule::generateRandomSubs(State state, Literal action, vector<Term> in
 			// A. Sum up the necessities of every precondition the variable appears in
 			foreach(prec, preconditions)
 				if (in(rho.apply(*prec).parameters, *var))
-					necessityImpact += precondsNecessities[*prec];
+					necessityImpact += necessities.precondValue(*prec);
 			// B. If variable is a generalization of a constant, add up that constant's necessity
 			Opt<Term> original = rho.getInverse(*var);
 			if (original.there && !original.obj.isVariable)
-				necessityImpact += constsNecessities[original.obj];
+				necessityImpact += necessities.constValue(original.obj);
 			
 			// Registering necessity impacts negated so that the biggest ones are sorted at the beginning of the vector
 			sortedVariablesToMap.push_back({ -necessityImpact, *var });
 		}
 		sort(sortedVariablesToMap.begin(), sortedVariablesToMap.end());
 
-		//	2. For each substitution to sample
-		for (size_t i = subs.size(); i < maxRandomSubs; i++) {
-			Substitution randomSigma = sigma;
-			set<Term> instancesLeft = availableInstances;
-
-			// 2.1. For each variable to map in order of decreasing necessity impact
-			foreach(pair, sortedVariablesToMap) {
-				Term var = pair->second;
-				if (instancesLeft.size() == 0) break;
-
-				vector<float> necessityLosses;
-
-				// 2.1.1. Evaluate the necessity loss of each remaining instance, given current substitutions
-				foreach(instit, instancesLeft) {
-					Term inst = *instit;
-					float necessityLoss = 0.0f;
-
-					Substitution tempSigma = randomSigma;
-					tempSigma.set(var, inst);
-
-					// Necessity loss of a variable substitution:
-					foreach(prec, preconditions) {
-						// A. Apply the new substitution to all preconditions
-						Literal subbed = tempSigma.apply(rho.apply(*prec));
-
-						// B. For each grounded fact from precssub which is not in state, accumulate precondition's necessity value
-						if (subbed.grounded()) {
-							if (!state.contains(subbed))
-								necessityLoss += precondsNecessities[*prec];
-						}
-						// C. For each non-grounded fact from precssub:
-						else {
-							// C.1. Query the state for facts corresponding to the non-grounded fact
-							set<Literal> query = state.query(subbed);
-
-							// C.2. Check if state contains at least a fact which could be obtained with current sub and remaining instances
-							bool found = false;
-							foreach(q, query) {
-								bool valid = true;
-								foreachindex(pi, subbed.parameters) {
-									if (!subbed.parameters[pi].isVariable) continue;
-									if (in(instancesLeft, q->parameters[pi])) continue;
-
-									valid = false;
-									break;
-								}
-								if (valid) {
-									found = true;
-									break;
-								}
-							}
-
-							// C.3. If it does not, accumulate precondition's necessity value
-							if (!found)
-								necessityLoss += precondsNecessities[*prec];
-						}
-					}
-
-					// D. If a constant was contradicted by the substitution, accumulate its necessity value
-					Opt<Term> original = rho.getInverse(var);
-					if (original.there && !original.obj.isVariable && original.obj != inst)
-						necessityLoss += constsNecessities[original.obj];
-					if ((!original.there || original.obj != inst) && in(constsNecessities, inst))
-						necessityLoss += constsNecessities[inst];
-
-					necessityLosses.push_back(necessityLoss);
-				}
-
-				// 2.1.2. Sample an instance based by weighting low necessity losses more heavily
-				vector<float> weights;
-				
-				float maxLoss = 0.0f;
-				float lossSum = 0.0f;
-				foreach(loss, necessityLosses) {
-					maxLoss = max(maxLoss, *loss);
-					lossSum += *loss;
-				}
-				maxLoss *= 2.0f;
-				lossSum = maxLoss * (float)necessityLosses.size() - lossSum;
-
-				foreach(loss, necessityLosses)
-					weights.push_back((maxLoss - *loss) / lossSum);
+		// 2. Map the variables in that order for each substitution to sample, weighting low necessity losses more heavily
+		vector<Literal> genPreconds;
+		vector<float> genNecessities;
+		foreach(prec, preconditions) {
+			genPreconds.push_back(rho.apply(*prec));
+			genNecessities.push_back(necessities.precondValue(*prec));
+		}
 
-				Term selectedInstance = *select_randomly_weighted(instancesLeft.begin(), weights);
+		vector<Term> variables;
+		foreach(pair, sortedVariablesToMap)
+			variables.push_back(pair->second);
 
-				// 2.1.3. Add choice to current substitution
-				randomSigma.set(var, selectedInstance);
-				instancesLeft.erase(selectedInstance);
-			}
+		SubstitutionSampler sampler = SubstitutionSampler(state, genPreconds, genNecessities, necessities, rho, variables, availableInstances);
 
-			// 3. Return the set of sampled substitutions
-			subs.insert(rho.merge(randomSigma));
-		}
+		// 3. Return the set of sampled substitutions
+		for (size_t i = subs.size(); i < maxRandomSubs; i++)
+			subs.insert(rho.merge(sampler.sample(sigma, g)));
 	}
 	// Otherwise we can directly generate all possible substitutions
 	else {
@@ -1094,185 +1154,95 @@ void ActionRule::generateRandomSubs(State state, Literal action, vector<Term> in
 float ActionRule::computeCdProb(State state, Literal action, vector<Substitution> subs) {
 	if (!Literal::compatible(actionLiteral, action)) return 1.0f;
 
-	set<Unverified> cds;
-
-	foreach(sub, subs) {
-		vector<Literal> unverifiedPreconditions;
-		vector<Term> unpreservedConstants;
-
-		foreach(pair, precondsNecessities)
-			if (!state.contains(sub->apply(pair->first)))
-				unverifiedPreconditions.push_back(pair->first);
-		foreach(pair, constsNecessities)
-			if (sub->apply(pair->first) != pair->first || (sub->getInverse(pair->first).there && sub->getInverse(pair->first).obj != pair->first))
-				unpreservedConstants.push_back(pair->first);
-
-		cds.insert({ unverifiedPreconditions, unpreservedConstants });
-	}
+	set<NecessityMask> cds;
+	foreach(sub, subs)
+		cds.insert(unverifiedMask(*sub, state));
 
-	return cdProb(precondsNecessities, constsNecessities, toVec(cds));
+	return cdProb(toVec(cds));
 }
 
-float cdProbTree(vector<pair<Literal, float>>& precNecs, vector<pair<Term, float>>& cstNecs,
-	size_t choiceIndex, float branchPower, vector<Unverified> cds,
-	set<Literal> truePreconds, set<Term> trueConsts) {
-
-	if (choiceIndex >= precNecs.size() + cstNecs.size())
-		return branchPower;
-
-	float choicePower = 0.0f;
-	bool lit = true;
-	Literal niPrec;
-	Term niCst;
-	if (choiceIndex < precNecs.size()) {
-		choicePower = precNecs[choiceIndex].second;
-		niPrec = precNecs[choiceIndex].first;
-	}
-	else {
-		choicePower = cstNecs[choiceIndex - precNecs.size()].second;
-		niCst = cstNecs[choiceIndex - precNecs.size()].first;
-		lit = false;
-	}
+NecessityVector const& ActionRule::necessityVector() const {
+	return necessities;
+}
 
-	vector<Unverified> cdsTrue, cdsFalse;
-	bool pruneFalseBranch = false;
-	bool foundChoiceInDisjunction = false;
+void ActionRule::setNecessities(map<Literal, float> const& precondNecs, map<Term, float> const& constNecs) {
+	necessities = NecessityVector(precondNecs, constNecs);
+	newVersion();
+}
 
-	foreach(disj, cds) {
-		if (disj->first.size() + disj->second.size() == 0) return 0.0f;
+void ActionRule::setNecessityValues(vector<float> const& values) {
+	necessities.values = values;
+	newVersion();
+}
 
-		if ((!lit || in(disj->first, niPrec)) && (lit || in(disj->second, niCst))) {
-			foundChoiceInDisjunction = true;
-			
-			set<Literal> remPrecs = toSet(disj->first);
-			set<Term> remCsts = toSet(disj->second);
-			if (lit) remPrecs.erase(niPrec);
-			else remCsts.erase(niCst);
-			if (remPrecs.size() + remCsts.size() == 0)
-				pruneFalseBranch = true;
-			else
-				cdsFalse.push_back({ toVec(remPrecs), toVec(remCsts) });
-		}
-		else {
-			cdsTrue.push_back(*disj);
-			cdsFalse.push_back(*disj);
-		}
+NecessityMask ActionRule::unverifiedMask(Substitution const& sub, State const& state) const {
+	NecessityMask mask = necessities.emptyMask();
+
+	foreachindex(pi, necessities.preconds)
+		if (!state.contains(sub.apply(necessities.preconds[pi])))
+			NecessityVector::setBit(mask, pi);
+	foreachindex(ci, necessities.consts) {
+		Term cst = necessities.consts[ci];
+		Opt<Term> inverse = sub.getInverse(cst);
+		if (sub.apply(cst) != cst || (inverse.there && inverse.obj != cst))
+			NecessityVector::setBit(mask, necessities.preconds.size() + ci);
 	}
-
-	if (!foundChoiceInDisjunction)
-		return cdProbTree(precNecs, cstNecs, choiceIndex + 1, branchPower, cdsTrue, truePreconds, trueConsts);
-
-	set<Literal> newTruePreconds = truePreconds;
-	set<Term> newTrueConsts = trueConsts;
-	if (lit) newTruePreconds.insert(niPrec);
-	else newTrueConsts.insert(niCst);
-	float trueBranchValue = choicePower * branchPower;
-	if (choicePower * branchPower >= PRECISION)
-		trueBranchValue = cdProbTree(precNecs, cstNecs, choiceIndex + 1, branchPower * choicePower, cdsTrue, newTruePreconds, newTrueConsts);
-
-	pruneFalseBranch |= branchPower * (1.0f - choicePower) < PRECISION;
-	if (pruneFalseBranch)
-		return trueBranchValue;
-
-	return trueBranchValue + cdProbTree(precNecs, cstNecs, choiceIndex + 1, branchPower * (1.0f - choicePower), cdsFalse, truePreconds, trueConsts);
+	return mask;
 }
 
-float ActionRule::cdProb(map<Literal, float>& precondNecs, map<Term, float>& constNecs, vector<Unverified> cds) {
-	vector<pair<Literal, float>> precNecs;
-	vector<pair<Term, float>> cstNecs;
-	foreach(pair, precondNecs)
-		if (pair->second == 1.0f)
-			precNecs.insert(precNecs.begin(), *pair);
-		else
-			precNecs.push_back(*pair);
-	foreach(pair, constNecs)
-		if (pair->second == 1.0f)
-			cstNecs.insert(cstNecs.begin(), *pair);
-		else
-			cstNecs.push_back(*pair);
-	return cdProbTree(precNecs, cstNecs, 0, 1.0f, cds, {}, {});
+float denseCdProb(vector<float> const& values, vector<NecessityMask> const& cds, float tolerance) {
+	if (values.size() == 0) return 1.0f;
+
+	vector<vector<size_t>> disjunctions;
+	foreach(disj, cds)
+		disjunctions.push_back(NecessityVector::indices(*disj));
+	return CdProbability(tolerance).solve(values, disjunctions);
 }
 
-float ActionRule::dgcdProb(map<Literal, float>& precondNecs, map<Term, float>& constNecs, Unverified disj, vector<Unverified> conditionalCds) {
+float denseDgcdProb(vector<float> const& values, NecessityMask const& disj, vector<NecessityMask> conditionalCds, float tolerance) {
 	float dgcdVal = 0.0f;
 	float condFactor = 1.0f;
 
-	while (disj.first.size() > 0 || disj.second.size() > 0) {
-		Literal niL;
-		Term niT;
-		float niVal;
-		bool lit;
-		if (disj.first.size() > 0) {
-			niL = disj.first.back();
-			disj.first.pop_back();
-			lit = true;
-			niVal = precondNecs[niL];
-		}
-		else {
-			niT = disj.second.back();
-			disj.second.pop_back();
-			lit = false;
-			niVal = constNecs[niT];
-		}
-
-		float cdVal = cdProb(precondNecs, constNecs, conditionalCds);
-		float ngcdVal = niVal;
+	vector<NecessityMask> filteredCds;
+	foreach(ni, NecessityVector::indices(disj)) {
+		float cdVal = denseCdProb(values, conditionalCds, tolerance);
+		float ngcdVal = values[*ni];
 		if (cdVal > 0) {
-			vector<Unverified> filteredCds;
+			filteredCds.clear();
 			foreach(p, conditionalCds)
-				if ((!lit || !in(p->first, niL)) && (lit || !in(p->second, niT)))
+				if (!NecessityVector::hasBit(*p, *ni))
 					filteredCds.push_back(*p);
 
-			ngcdVal *= cdProb(precondNecs, constNecs, filteredCds) / cdVal;
+			ngcdVal *= denseCdProb(values, filteredCds, tolerance) / cdVal;
 		}
 
 		dgcdVal += condFactor * ngcdVal;
 		condFactor *= 1 - ngcdVal;
 
-		vector<Unverified> tmpCds = conditionalCds;
-		conditionalCds.clear();
-		foreach(p, tmpCds) {
-			vector<Literal> precs;
-			if (lit) {
-				foreach(prec, p->first)
-					if (*prec != niL)
-						precs.push_back(*prec);
-			}
-			else precs = p->first;
-
-			vector<Term> csts;
-			if (!lit) {
-				foreach(cst, p->second)
-					if (*cst != niT)
-						csts.push_back(*cst);
-			}
-			else csts = p->second;
-
-			conditionalCds.push_back({ precs, csts });
-		}
+		// Following necessities are conditioned on this one not being necessary
+		foreach(p, conditionalCds)
+			NecessityVector::clearBit(*p, *ni);
 	}
 
 	return dgcdVal;
 }
 
-void ActionRule::processEffects(/*r*/ set<Unverified>& sigmaPos, /*r*/ set<Unverified>& sigmaNeg,
+float ActionRule::cdProb(vector<NecessityMask> const& cds, float tolerance) {
+	return denseCdProb(necessities.values, cds, tolerance);
+}
+
+float ActionRule::dgcdProb(NecessityMask disj, vector<NecessityMask> conditionalCds, float tolerance) {
+	return denseDgcdProb(necessities.values, disj, conditionalCds, tolerance);
+}
+
+void ActionRule::processEffects(/*r*/ set<NecessityMask>& sigmaPos, /*r*/ set<NecessityMask>& sigmaNeg,
 	State state, Literal action, State effects, vector<Term> instances) {
 
 	set<Substitution> subs;
 	generateRandomSubs(state, action, instances, Substitution(), Substitution(), SUBS_FOR_CORROBORATION, subs);
 	
 	foreach(sub, subs) {
-		vector<Literal> unverifiedPreconditions;
-		vector<Term> unpreservedConstants;
-
-		foreach(pair, precondsNecessities)
-			if (!state.contains(sub->apply(pair->first)))
-				unverifiedPreconditions.push_back(pair->first);
-		foreach(pair, constsNecessities)
-			if (sub->apply(pair->first) != pair->first || (sub->getInverse(pair->first).there && sub->getInverse(pair->first).obj != pair->first))
-				unpreservedConstants.push_back(pair->first);
-
-		Unverified disj = { unverifiedPreconditions, unpreservedConstants };
+		NecessityMask disj = unverifiedMask(*sub, state);
 
 		if (action == sub->apply(actionLiteral) && effects == State(sub->apply(add + del)))
 			sigmaPos.insert(disj);
@@ -1288,7 +1258,7 @@ string ActionRule::toString() const {
 	foreach(precondit, preconditions) {
 		if (!first) result += ", ";
 		else first = false;
-		result += precondit->toString() +":" + formatPercent(precondsNecessities.at(*precondit));
+		result += precondit->toString() +":" + formatPercent(necessities.precondValue(*precondit));
 	}
 
 	result += "\nRemoved preconds: ";
@@ -1296,15 +1266,15 @@ string ActionRule::toString() const {
 	foreach(precondit, removedPreconditions) {
 		if (!first) result += ", ";
 		else first = false;
-		result += precondit->toString() + ":" + formatPercent(precondsNecessities.at(*precondit));
+		result += precondit->toString() + ":" + formatPercent(necessities.precondValue(*precondit));
 	}
 
 	result += "\nConstants: ";
 	first = true;
-	foreach(pair, constsNecessities) {
+	foreach(cst, necessities.consts) {
 		if (!first) result += ", ";
 		else first = false;
-		result += pair->first.toString() + ": " + formatPercent(pair->second);
+		result += cst->toString() + ": " + formatPercent(necessities.constValue(*cst));
 	}
 
 	result += "\nAction: " + actionLiteral.toString() + "\nEffects: ";
@@ -16,10 +16,11 @@
 #include <memory>
 #include <ctime>
 #include <chrono>
+#include <random>
 
 #include "Logic/Domain.h"
-
-typedef pair<vector<Literal>, vector<Term>> Unverified;
+#include "Agents/LearningAgent/NecessityVector.h"
+#include "Agents/LearningAgent/MatchProgram.h"
 
 struct Experiment {
 	State state;
@@ -47,6 +48,14 @@ struct SigmaTheta {
 	}
 };
 
+// Sides of a rule compiled for matching, for one version of the rule
+struct RuleMatchPrograms {
+	unsigned __int64 version = 0;
+	MatchProgram preconditions;
+	MatchProgram effects;
+	MatchProgram application;
+};
+
 struct RoSigmaTheta {
 	Substitution ro, sigma, theta;
 	Substitution rst;
@@ -72,18 +81,16 @@ struct ActionRule : enable_shared_from_this<ActionRule> {
 
 	set<shared_ptr<ActionRule>> parents;
 
-	State cacheState;
-	map<Substitution, float> cacheProbs;
-
-	map<Term, float> constsNecessities;
-	map<Literal, float> precondsNecessities;
-
 	ActionRule(set<Literal> inPreconditions, Literal inActionLiteral, set<Literal> inAdd, set<Literal> inDel, set<shared_ptr<ActionRule>> inParents, float startPu, bool filter = true);
 	ActionRule(Trace trace, float startPu, bool filter = true);
 	
 	// Prematching
 	set<Substitution> prematchingSubs(shared_ptr<ActionRule> x, Substitution sub = Substitution());
 	bool prematches(shared_ptr<ActionRule> x, Substitution sub = Substitution());
+	// Same substitutions as prematching the example built from the state and a grounded action, without building it
+	set<Substitution> prematchingSubs(State const& state, Literal const& action);
+	// Compiled on first use after each new version, several threads may ask at once
+	shared_ptr<RuleMatchPrograms const> matchPrograms();
 
 	// Postmatching
 	set<Substitution> postmatchingSubs(shared_ptr<ActionRule> x, Substitution sub = Substitution());
@@ -100,21 +107,24 @@ struct ActionRule : enable_shared_from_this<ActionRule> {
 	bool selection(set<Literal>lr, set<Literal> lx, shared_ptr<ActionRule> x,
 				   /*r*/ Substitution& subr, /*r*/ Substitution& subx,
 				   /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits,
-				   /*r*/ Literal& chosenLr, /*r*/ Literal& chosenLx);
+				   /*r*/ Literal& chosenLr, /*r*/ Literal& chosenLx, mt19937& g = globalRandomDevice);
 
 	// Algorithm 9: UNE-GEN-OI
+	// Random choices are drawn from g, so that concurrent trials can use their own streams
 	set<Literal> anyGeneralization(set<Literal> lr, set<Literal> lx, shared_ptr<ActionRule> x,
-								   /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars);
-	set<Literal> anyGeneralization(shared_ptr<ActionRule> x, /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars);
+								   /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, mt19937& g = globalRandomDevice);
+	set<Literal> anyGeneralization(shared_ptr<ActionRule> x, /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars,
+								   mt19937& g = globalRandomDevice);
 
 	// Non-official algorithm: exact generalization (UNE-GEN with random exhaustive exploration of the tree of generalizations and no fact deletion)
 	bool exactGeneralizationLxChoice(Literal chosenLr, set<Literal> lr, set<Literal> lx,
-		/*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits);
+		/*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits, mt19937& g = globalRandomDevice);
 	bool exactGeneralizationLrChoice(set<Literal> lr, set<Literal> lx,
-		/*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits);
+		/*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars, /*r*/ set<Literal>& genLits, mt19937& g = globalRandomDevice);
 
 	// Algorithm 7: POST-GENERALIZATION
-	bool postGeneralizes(shared_ptr<ActionRule> x, /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars);
+	bool postGeneralizes(shared_ptr<ActionRule> x, /*r*/ Substitution& subr, /*r*/ Substitution& subx, /*r*/ set<Term>& genVars,
+						 mt19937& g = globalRandomDevice);
 
 
 
@@ -125,6 +135,8 @@ struct ActionRule : enable_shared_from_this<ActionRule> {
 
 	bool contradicts(shared_ptr<ActionRule> x);
 
+	// Rules and their parents form a lattice whose levels and leaf counts are cached until its structure changes, parents must
+	// therefore only change through insertParent and removeParentRecursive. Queries on the lattice are not thread-safe.
 	void insertParent(shared_ptr<ActionRule> parent);
 	void removeParentRecursive(shared_ptr<ActionRule> parent);
 	bool wellFormed();
@@ -132,6 +144,8 @@ struct ActionRule : enable_shared_from_this<ActionRule> {
 	int countLeaves();
 	float maxLeafSimilarity(State state);
 	shared_ptr<ActionRule> getLeastGeneralRuleCovering(shared_ptr<ActionRule> example);
+	// Whether the rule can be reached from this one's parents
+	bool reaches(shared_ptr<ActionRule> rule);
 
 	vector<SigmaTheta> applies(State state, vector<Term> instances, Literal inActionLiteral, bool onlyFirst);
 	State apply(State state, SigmaTheta sigmaTheta);
@@ -139,15 +153,30 @@ struct ActionRule : enable_shared_from_this<ActionRule> {
 	int specificity() const;
 
 	void setRemovedPreconditions(set<Literal> remPreconds);
+
+	// Stamp of the rule's content, kept by copies and renewed by newVersion whenever the rule is changed after construction
+	unsigned __int64 getVersion() const;
+	void newVersion();
 	
 	// Belief-related algorithms
-	float fulfilmentProbability(State state, Literal action, vector<Term> instances, /*r*/ bool& prematches, /*r*/ set<Substitution>& subs);
-	void generateRandomSubs(State state, Literal action, vector<Term> instances, Substitution rho, Substitution sigma, size_t maxRandomSubs, set<Substitution>& subs);
+	float fulfilmentProbability(State state, Literal action, vector<Term> instances, /*r*/ bool& prematches, /*r*/ set<Substitution>& subs,
+								mt19937& g = globalRandomDevice);
+	void generateRandomSubs(State state, Literal action, vector<Term> instances, Substitution rho, Substitution sigma, size_t maxRandomSubs, set<Substitution>& subs,
+							mt19937& g = globalRandomDevice);
 	
 	float computeCdProb(State state, Literal action, vector<Substitution> subs);
-	float cdProb(map<Literal, float>& precondNecs, map<Term, float>& constNecs, vector<Unverified> cds);
-	float dgcdProb(map<Literal, float>& precondNecs, map<Term, float>& constNecs, Unverified disj, vector<Unverified> conditionalCds);
-	void processEffects(/*r*/ set<Unverified>& sigmaPos, /*r*/ set<Unverified>& sigmaNeg,
+
+	NecessityVector const& necessityVector() const;
+	// Both give the rule a new version. Necessities can be added or removed by the first one, while the second one
+	// replaces every value, indexed as in necessityVector()
+	void setNecessities(map<Literal, float> const& precondNecs, map<Term, float> const& constNecs);
+	void setNecessityValues(vector<float> const& values);
+	NecessityMask unverifiedMask(Substitution const& sub, State const& state) const;
+
+	// A tolerance of 0 computes exact probabilities, see CdProbability for the bounded mode
+	float cdProb(vector<NecessityMask> const& cds, float tolerance = 0.0f);
+	float dgcdProb(NecessityMask disj, vector<NecessityMask> conditionalCds, float tolerance = 0.0f);
+	void processEffects(/*r*/ set<NecessityMask>& sigmaPos, /*r*/ set<NecessityMask>& sigmaNeg,
 		State state, Literal action, State effects, vector<Term> instances);
 
 
@@ -159,6 +188,22 @@ struct ActionRule : enable_shared_from_this<ActionRule> {
 
 private:
 	void extractParameters();
+
+	// Only written through setNecessities and setNecessityValues
+	NecessityVector necessities;
+
+	unsigned __int64 version = 0;
+	shared_ptr<RuleMatchPrograms const> programs;
+	shared_ptr<ActionRule> leastGeneralRuleCovering(shared_ptr<ActionRule> example, /*r*/ map<ActionRule*, shared_ptr<ActionRule>>& memo);
+
+	// Valid while their stamps are the current lattice epochs
+	mutable int cachedLevel = 0;
+	mutable unsigned __int64 levelStamp = 0;
+	int cachedLeaves = 0;
+	unsigned __int64 leavesStamp = 0;
+
+	// Last traversal of the lattice that reached the rule
+	unsigned __int64 visitMark = 0;
 };
 
 ostream& operator<<(ostream& os, ActionRule &rule);
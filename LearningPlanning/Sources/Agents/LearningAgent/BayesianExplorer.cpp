@@ -7,6 +7,7 @@
  * available during learning, like removing an entity from the problem, or the reset action.
  */
 
+#include <algorithm>
 #include <ctime>
 
 #include "Agents/LearningAgent/BayesianExplorer.h"
@@ -23,7 +24,7 @@ UnknownRule::UnknownRule(float rawProb, shared_ptr<Domain> domain, size_t instSi
 	groundedAction = inGroundedAction;
 }
 
-float UnknownRule::computeProb(State state, /*r*/ float& expectedGain) {
+float UnknownRule::computeProb(State state, /*r*/ float& expectedGain) const {
 	expectedGain = 0.0f;
 	float prob = 1.0f;
 	float falseAnyFacts = (float)nAll - (float)state.facts.size();
@@ -69,12 +70,13 @@ BayesianExplorer::BayesianExplorer(bool verbose) : ExplorerAgentBase(verbose) {
 	
 	gamma = bayesianConfig->getFloat("gamma");
 	startPu = bayesianConfig->getFloat("start_pu");
-	explorationTimeLimit = bayesianConfig->getFloat("exploration_time_limit");
 	passthroughThreshold = bayesianConfig->getFloat("passthrough_threshold");
 	metaProbability = bayesianConfig->getFloat("meta_probability");
 	factRemovalDiscount = bayesianConfig->getFloat("fact_removal_discount");
 	randomDiscount = bayesianConfig->getFloat("random_discount");
 	focusSpecificRules = bayesianConfig->getFloat("focus_specific_rules");
+	baseResetProb = bayesianConfig->getFloat("base_reset_prob");
+	cdTolerance = bayesianConfig->getFloat("cd_tolerance");
 
 	//estimatedPreconditionsPerRule = bayesianConfig->getInt("estimated_preconditions_per_rule");
 	estimatedRulesPerAction = bayesianConfig->getInt("estimated_rules_per_action");
@@ -83,6 +85,8 @@ BayesianExplorer::BayesianExplorer(bool verbose) : ExplorerAgentBase(verbose) {
 	randomActionTrials = bayesianConfig->getInt("random_action_trials");
 	planDepth = bayesianConfig->getInt("plan_depth");
 	stagnationThreshold = bayesianConfig->getInt("stagnation_threshold");
+	explorationEvaluations = bayesianConfig->getInt("exploration_evaluations");
+	rolloutPool = make_shared<WorkStealingPool>((size_t)max(bayesianConfig->getInt("rollout_threads"), 0));
 
 	saveMotivationTrace = bayesianConfig->getBool("save_motivation_trace");
 	motivationTraceFileName = bayesianConfig->getString("motivation_trace_file_name");
@@ -92,10 +96,40 @@ void BayesianExplorer::init(shared_ptr<Domain> inDomain, vector<Term> inInstance
 	Agent::init(inDomain, inInstances, inGoal, inTrace);
 	prepareActionSubstitutions();
 	deletedInstances.clear();
+	revisionCache.clear();
+	revisionSeed = globalRandomDevice();
 }
 
-void BayesianExplorer::setRules(vector<shared_ptr<ActionRule>> newRules) {
+void BayesianExplorer::setRules(RuleStore const& newRules) {
 	rules = newRules;
+	revisionCache.forgetOutdated(rules);
+}
+
+void BayesianExplorer::updateDomain(shared_ptr<Domain> newDomain) {
+	if (newDomain != domain) {
+		init(newDomain, instances, goal, trace);
+		return;
+	}
+
+	// Only the actions of predicates whose rules changed are grounded again, removed actions are dropped with their ids
+	set<Predicate> changed = domain->changedActionPredicates(groundedVersion);
+	map<size_t, vector<Literal>> groundings;
+	vector<size_t> const& ids = domain->getActionIds();
+	foreachindex(ai, ids) {
+		Action const& act = domain->getActionList()[ai];
+		if (in(actionGroundings, ids[ai]) && !in(changed, act.actionLiteral.pred))
+			groundings[ids[ai]] = actionGroundings[ids[ai]];
+		else
+			groundings[ids[ai]] = groundAction(act);
+	}
+	actionGroundings = groundings;
+
+	collectActions();
+	groundedVersion = domain->getVersion();
+
+	// Outdated revision estimates are dropped by setRules
+	deletedInstances.clear();
+	revisionSeed = globalRandomDevice();
 }
 
 void BayesianExplorer::setActionLiterals(set<Literal> baseActionLiterals) {
@@ -186,13 +220,18 @@ void BayesianExplorer::updateProblem(vector<Term> inInstances, Goal inGoal, vect
 	experimentsPerRule.clear();
 
 	deletedInstances.clear();
+	revisionCache.clear();
 	prepareActionSubstitutions();
 }
 
 float BayesianExplorer::computePu(Experiment e, /*r*/ float& expectedGain) {
 	expectedGain = 0.0f;
 	if (e.action.pred.name == "remove-fact" || e.action.pred.name == "delete" || e.action.pred.name == "reset") return 0.0f;
-	return unknownRules[e.action].computeProb(e.state, expectedGain);
+
+	// Looked up without inserting, so that rollouts can share the map
+	auto found = unknownRules.find(e.action);
+	if (found == unknownRules.end()) return UnknownRule().computeProb(e.state, expectedGain);
+	return found->second.computeProb(e.state, expectedGain);
 }
 
 float BayesianExplorer::computePu(Experiment e) {
@@ -212,36 +251,36 @@ void BayesianExplorer::corroborateRules(Trace trace) {
 	trace.state.difference(trace.newState, &added, &removed);
 	State effects = State(added + removed);
 
-	map<ActionRule*, vector<Unverified>> posSigmas, negSigmas;
+	map<ActionRule*, vector<NecessityMask>> posSigmas, negSigmas;
 	map<ActionRule*, float> protRTs;
 	map<ActionRule*, float> covRTs;
 
 	// Precomputing non-conditional terms (Prot and Cov|Prot)
 	float covMT = 1.0f;
-	foreach(rit, rules) {
+	foreach(rit, rules.byAction(trace.instAct.pred)) {
 		ActionRule* rule = &**rit;
 
 		if (Literal::compatible(rule->actionLiteral, trace.instAct)) {
 			rulesForCurrentAction.insert(rule);
 
-			set<Unverified> posSet, negSet;
+			set<NecessityMask> posSet, negSet;
 			rule->processEffects(posSet, negSet, trace.state, trace.instAct, effects, allInsts);
-			vector<Unverified> pos = toVec(posSet), neg = toVec(negSet);
+			vector<NecessityMask> pos = toVec(posSet), neg = toVec(negSet);
 
 			posSigmas[rule] = pos;
 			negSigmas[rule] = neg;
 
 			//cout << "Corroboration 1: CD with " << neg.size() << " disjunctions." << endl;
-			protRTs[rule] = rule->cdProb(rule->precondsNecessities, rule->constsNecessities, neg);
+			protRTs[rule] = rule->cdProb(neg, cdTolerance);
 			if (protRTs[rule] == 0.0f) return;
 
 			//assertMsg(isProb(protRTs[rule]), "protRTrule not a probability");
 
 			float nCovRT = 1.0f;
-			vector<Unverified> conditionalCds = neg;
+			vector<NecessityMask> conditionalCds = neg;
 			foreach(disj, pos) {
 				//cout << "Corroboration 2: DGCD with " << conditionalCds.size() << " conditional disjunctions." << endl;
-				nCovRT *= rule->dgcdProb(rule->precondsNecessities, rule->constsNecessities, *disj, conditionalCds);
+				nCovRT *= rule->dgcdProb(*disj, conditionalCds, cdTolerance);
 				conditionalCds.push_back(*disj);
 			}
 			covRTs[rule] = 1.0f - nCovRT;
@@ -268,96 +307,54 @@ void BayesianExplorer::corroborateRules(Trace trace) {
 
 	//assertMsg(isProb(covMT), "covMT not a probability");
 
-	vector<Literal> preconds;
-	vector<Term> constants;
-	map<Literal, float> updatedPrecondNecs;
-	map<Term, float> updatedConstNecs;
+	vector<NecessityMask> filteredNeg, filteredPos, conditionalCds;
 
 	// Computing conditional terms and updated necessities
 	foreach(rit, rulesForCurrentAction) {
 		ActionRule* rule = *rit;
-
-		preconds.clear();
-		constants.clear();
-		foreach(precPair, rule->precondsNecessities)
-			preconds.push_back(precPair->first);
-		foreach(constPair, rule->constsNecessities)
-			constants.push_back(constPair->first);
-
-		updatedPrecondNecs.clear();
-		updatedConstNecs.clear();
-
-		while (preconds.size() > 0 || constants.size() > 0) {
-			Literal niL;
-			Term niT;
-			bool lit;
-			float currentNec;
-			if (preconds.size() > 0) {
-				niL = preconds.back();
-				preconds.pop_back();
-				lit = true;
-				currentNec = rule->precondsNecessities[niL];
-
-				if (currentNec == 0.0f || currentNec == 1.0f || protRTs[rule] == 0.0f || covMT == 0.0f) {
-					updatedPrecondNecs[niL] = currentNec;
-					continue;
-				}
-			}
-			else {
-				niT = constants.back();
-				constants.pop_back();
-				lit = false;
-				currentNec = rule->constsNecessities[niT];
-
-				if (currentNec == 0.0f || currentNec == 1.0f || protRTs[rule] == 0.0f || covMT == 0.0f) {
-					updatedConstNecs[niT] = currentNec;
-					continue;
-				}
-			}
-
-			vector<Unverified> filteredNeg, filteredPos;
-
-			foreach(disj, negSigmas[rule]) {
-				if ((!lit || !in(disj->first, niL)) && (lit || !in(disj->second, niT)))
+		vector<float> necessities = rule->necessityVector().values;
+		vector<float> updatedNecessities = necessities;
+
+		float covMTwithoutR = 1.0f - pUe * pUeff;
+		foreach(ritt, rulesForCurrentAction)
+			if (*ritt != rule)
+				covMTwithoutR *= 1.0f - covRTs[*ritt];
+		covMTwithoutR = 1.0f - covMTwithoutR;
+
+		foreachindex(ni, necessities) {
+			float currentNec = necessities[ni];
+			if (currentNec == 0.0f || currentNec == 1.0f || protRTs[rule] == 0.0f || covMT == 0.0f)
+				continue;
+
+			filteredNeg.clear();
+			filteredPos.clear();
+			foreach(disj, negSigmas[rule])
+				if (!NecessityVector::hasBit(*disj, ni))
 					filteredNeg.push_back(*disj);
-			}
-
-			foreach(disj, posSigmas[rule]) {
-				if ((!lit || !in(disj->first, niL)) && (lit || !in(disj->second, niT)))
+			foreach(disj, posSigmas[rule])
+				if (!NecessityVector::hasBit(*disj, ni))
 					filteredPos.push_back(*disj);
-			}
 			
-			float protRTgivenNk = rule->cdProb(rule->precondsNecessities, rule->constsNecessities, filteredNeg);
+			float protRTgivenNk = rule->cdProb(filteredNeg, cdTolerance);
 
 			float covRTgivenNk = 1.0f;
 			float nCovRTgivenNk = 1.0f;
-			vector<Unverified> conditionalCds = filteredNeg;
+			conditionalCds = filteredNeg;
 			foreach(disj, filteredPos) {
-				nCovRTgivenNk *= rule->dgcdProb(rule->precondsNecessities, rule->constsNecessities, *disj, conditionalCds);
+				nCovRTgivenNk *= rule->dgcdProb(*disj, conditionalCds, cdTolerance);
 				conditionalCds.push_back(*disj);
 			}
 			covRTgivenNk = 1.0f - nCovRTgivenNk;
 
-			float covMTwithoutR = 1.0f - pUe * pUeff;
-			foreach(ritt, rulesForCurrentAction)
-				if (*ritt != rule)
-					covMTwithoutR *= 1.0f - covRTs[*ritt];
-			covMTwithoutR = 1.0f - covMTwithoutR;
-			
-			if (lit) {
-				updatedPrecondNecs[niL] = protRTgivenNk * (covRTgivenNk + nCovRTgivenNk * covMTwithoutR) / protRTs[rule] / covMT * rule->precondsNecessities[niL];
-				updatedPrecondNecs[niL] = clamp(updatedPrecondNecs[niL], 0.0f, 0.95f);
-			}
-			else {
-				updatedConstNecs[niT] = protRTgivenNk * (covRTgivenNk + nCovRTgivenNk * covMTwithoutR) / protRTs[rule] / covMT * rule->constsNecessities[niT];
-				updatedConstNecs[niT] = clamp(updatedConstNecs[niT], 0.0f, 0.95f);
-			}
+			updatedNecessities[ni] = protRTgivenNk * (covRTgivenNk + nCovRTgivenNk * covMTwithoutR) / protRTs[rule] / covMT * currentNec;
+			updatedNecessities[ni] = clamp(updatedNecessities[ni], 0.0f, 0.95f);
 		}
 
 		// Registering updated necessities as new values
-		rule->precondsNecessities = updatedPrecondNecs;
-		rule->constsNecessities = updatedConstNecs;
+		rule->setNecessityValues(updatedNecessities);
 	}
+
+	revisionCache.forgetOutdated(rules);
 }
 
 void BayesianExplorer::informRevision(bool knowledgeRevised) {
@@ -400,6 +397,10 @@ void BayesianExplorer::informRevision(bool knowledgeRevised) {
 }
 
 float BayesianExplorer::revisionProbability(State state, Literal action, bool makeTrace) {
+	return revisionProbability(state, action, rules, makeTrace);
+}
+
+float BayesianExplorer::revisionProbability(State state, Literal action, RuleStore const& ruleSet, bool makeTrace) {
 	vector<Term> allInsts = instances + domain->getConstants();
 
 	/// <image url="$(SolutionDir)Images/RevisionProbability.PNG" />
@@ -410,19 +411,31 @@ float BayesianExplorer::revisionProbability(State state, Literal action, bool ma
 	set<ActionRule*> prematchingRules;
 
 	// Pre-computing fulfillment probabilities and prematching rules
-	bool prematches = false;
 	bool corresponds = false;
 	map<ActionRule*, set<Substitution>> subsPerRule;
-	set<Substitution> generatedSubs;
-	foreach(r, rules) {
-		if ((*r)->actionLiteral.pred == action.pred) corresponds = true;
-		else continue;
-		
-		generatedSubs.clear();
-		fulfilmentProbabilities[&**r] = (*r)->fulfilmentProbability(state, action, allInsts, prematches, generatedSubs);
-		subsPerRule[&**r] = generatedSubs;
+	size_t stateHash = RevisionCache::stateHash(state);
+	size_t actionHash = hash<string>()(action.toString());
+	foreach(r, ruleSet.byAction(action.pred)) {
+		corresponds = true;
+
+		// Rules only change on corroboration or revision, which gives them a new version
+		shared_ptr<RevisionCache::Entry const> cached = revisionCache.find(**r, stateHash, state, action);
+		if (!cached) {
+			// Sampled from a stream given by the experiment, so that entries do not depend on which rollout computes them first
+			seed_seq seeds = { revisionSeed, (unsigned int)stateHash, (unsigned int)actionHash };
+			mt19937 g = mt19937(seeds);
+
+			shared_ptr<RevisionCache::Entry> entry = make_shared<RevisionCache::Entry>();
+			entry->state = state;
+			entry->probability = (*r)->fulfilmentProbability(state, action, allInsts, entry->prematches, entry->subs, g);
+			revisionCache.insert(**r, stateHash, action, entry);
+			cached = entry;
+		}
 
-		if (prematches)
+		fulfilmentProbabilities[&**r] = cached->probability;
+		subsPerRule[&**r] = cached->subs;
+
+		if (cached->prematches)
 			prematchingRules.insert(&**r);
 	}
 
@@ -456,9 +469,8 @@ float BayesianExplorer::expectedInformationGain(State state, Literal action) {
 	map<ActionRule*, float> nkis;
 
 	float prodPr = 1.0f;
-	foreach(rit, rules) {
+	foreach(rit, rules.byAction(action.pred)) {
 		shared_ptr<ActionRule> rule = *rit;
-		if (rule->actionLiteral.pred != action.pred) continue;
 
 		set<Substitution> subs;
 		float pr = rule->fulfilmentProbability(state, action, allInsts, dummy, subs);
@@ -466,17 +478,18 @@ float BayesianExplorer::expectedInformationGain(State state, Literal action) {
 		prodPr *= (1.0f - pr);
 
 		float sumNki = 0.0f;
+		NecessityVector const& necs = rule->necessityVector();
 
 		foreach(precond, rule->preconditions)
 			if (!state.contains(sub.apply(*precond)))
-				sumNki += rule->precondsNecessities[*precond];
+				sumNki += necs.precondValue(*precond);
 		foreach(precond, rule->removedPreconditions)
 			if (!state.contains(sub.apply(*precond)))
-				sumNki += rule->precondsNecessities[*precond];
-		foreach(pair, rule->constsNecessities) {
-			Opt<Term> opt = sub.get(pair->first);
-			if (opt.there && opt.obj != pair->first)
-				sumNki += pair->second;
+				sumNki += necs.precondValue(*precond);
+		foreachindex(ci, necs.consts) {
+			Opt<Term> opt = sub.get(necs.consts[ci]);
+			if (opt.there && opt.obj != necs.consts[ci])
+				sumNki += necs.values[necs.preconds.size() + ci];
 		}
 		nkis[&*rule] = sumNki;
 	}
@@ -502,17 +515,17 @@ float BayesianExplorer::expectedInformationGain(State state, Literal action) {
 }
 
 // 0: no meta-action	1: reset	2: delete
-int BayesianExplorer::metaActionType() {
-	if (static_cast<float>(rand()) / static_cast<float>(RAND_MAX) >= metaProbability) return 0;
-	float deleteProb = (1.0f - bayesianConfig->getFloat("base_reset_prob")) / (1.0f + (float)deletedInstances.size());
-	if (deletedInstances.size() < instances.size() && static_cast<float>(rand()) / static_cast<float>(RAND_MAX) < deleteProb) return 2;
+int BayesianExplorer::metaActionType(mt19937& g) {
+	uniform_real_distribution<float> dis(0.0f, 1.0f);
+	if (dis(g) >= metaProbability) return 0;
+	float deleteProb = (1.0f - baseResetProb) / (1.0f + (float)deletedInstances.size());
+	if (deletedInstances.size() < instances.size() && dis(g) < deleteProb) return 2;
 	return 1;
 }
 
 void BayesianExplorer::generateRandomPlan(State state) {
-	chrono::steady_clock::time_point startTime = chrono::high_resolution_clock::now();
+	uniform_real_distribution<float> dis(0.0f, 1.0f);
 
-	vector<Term> allInsts = instances + domain->getConstants();
 	plan.clear();
 	revisionProbs.clear();
 
@@ -527,7 +540,7 @@ void BayesianExplorer::generateRandomPlan(State state) {
 	}
 	else {
 		experiment = *select_randomly(experiments.begin(), experiments.end());
-		switch (metaActionType()) {
+		switch (metaActionType(globalRandomDevice)) {
 		case 0:
 			break;
 		case 1:
@@ -544,7 +557,7 @@ void BayesianExplorer::generateRandomPlan(State state) {
 	}
 
 	// If random action, we don't look for a plan and return sampled action right away
-	if (random || static_cast<float>(rand()) / static_cast<float>(RAND_MAX) < powf(randomDiscount, (float)revisions))
+	if (random || dis(globalRandomDevice) < powf(randomDiscount, (float)revisions))
 		return;
 
 	if (stepsWithoutRevision > stagnationThreshold && useStagnation) {
@@ -553,13 +566,6 @@ void BayesianExplorer::generateRandomPlan(State state) {
 	}
 
 	float bestPlanUtility = revisionProbability(state, experiment);
-	float currentUtility;
-	float noRevisionProb;
-
-	vector<Literal> currentPlan;
-	vector<float> currentRevProbs;
-
-	Predicate removeFactPred = domain->getActionPredByName("remove-fact");
 
 	set<Predicate> mostSpecificRulesPredicates;
 	float meanSpecif = 0.0f;
@@ -569,220 +575,283 @@ void BayesianExplorer::generateRandomPlan(State state) {
 	foreach(rit, rules)
 		if ((*rit)->specificity() * 1.0f > 0.5f * meanSpecif)
 			mostSpecificRulesPredicates.insert((*rit)->actionLiteral.pred);
-	bool limitToSpecifics = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) < focusSpecificRules;
-
-	bool foundBetterThanRandom = false;
+	bool limitToSpecifics = dis(globalRandomDevice) < focusSpecificRules;
 
-	for (int p = 0; p < randomPlans; p++) {
-		chrono::duration<double, std::milli> deltaTime = chrono::high_resolution_clock::now() - startTime;
-		if (deltaTime.count() / 1000.0f > explorationTimeLimit) break;
+	// Without rules, every rollout stops after its first experiments, a single one is enough
+	int rolloutCount = rules.size() == 0 ? min(randomPlans, 1) : randomPlans;
 
-		currentPlan.clear();
-		currentRevProbs.clear();
+	// Rules are only read by the rollouts once their lazily compiled programs are
+	foreach(rit, rules)
+		(*rit)->matchPrograms();
+
+	// The evaluation budget of the step goes to the rollouts in order, each one taking what a full rollout needs, as the
+	// time limit of a sequential loop would have. Rollouts left without budget are not run.
+	int fullRollout = planDepth * randomExperiments;
+	vector<int> budgets;
+	for (int p = 0; p < rolloutCount; p++) {
+		if (explorationEvaluations <= 0)
+			budgets.push_back(-1);
+		else if (explorationEvaluations > p * fullRollout)
+			budgets.push_back(min(fullRollout, explorationEvaluations - p * fullRollout));
+	}
 
-		State currentState = state;
-		set<Term> newDeleted = deletedInstances;
-		currentUtility = 0.0f;
-		noRevisionProb = 1.0f;
+	// Each rollout draws from its own stream and runs to its end, so that the batch does not depend on thread scheduling
+	unsigned int batchSeed = globalRandomDevice();
+	vector<Rollout> rollouts = vector<Rollout>(budgets.size());
 
-		for (int a = 0; a < planDepth; a++) {
-			chrono::duration<double, std::milli> deltaTime = chrono::high_resolution_clock::now() - startTime;
-			if (deltaTime.count() / 1000.0f > explorationTimeLimit) break;
+	vector<function<void()>> tasks;
+	foreachindex(p, rollouts)
+		tasks.push_back([&, p]() {
+			seed_seq seeds = { batchSeed, (unsigned int)p };
+			mt19937 g = mt19937(seeds);
+			rollouts[p] = rollout(state, bestPlanUtility, rules, mostSpecificRulesPredicates, limitToSpecifics, budgets[p], g);
+		});
+	rolloutPool->run(tasks);
 
-			log << "\r" << "Best heuristic: " << bestPlanUtility << " - Steps: " << plan.size() << " - " << p * planDepth + a << "       ";
+	// Rollouts are compared in order, the first one passing through ends the search as it did when they ran one after the other
+	bool foundBetterThanRandom = false;
+	foreachindex(p, rollouts) {
+		Rollout const& candidate = rollouts[p];
+		log << "\r" << "Best heuristic: " << bestPlanUtility << " - Steps: " << plan.size() << " - " << p * planDepth << "       ";
+		if (!candidate.found) continue;
+
+		if ((bestPlanUtility == candidate.utility && candidate.plan.size() < plan.size()) || bestPlanUtility < candidate.utility) {
+			bestPlanUtility = candidate.utility;
+			plan = candidate.plan;
+			revisionProbs = candidate.revisionProbs;
+
+			foreachindex(i, plan) {
+				debug << plan[plan.size() - i - 1];
+				if (i < plan.size() - 1) debug << "->";
+			}
+			debug << " - Utility: " << bestPlanUtility << endl;
 
-			// 1. Perform RANDOM_EXPERIMENTS experiments and check learning utility
-			set<Literal> experiments;
-			if (limitToSpecifics)
-				experiments = getAvailableExperiments(newDeleted, currentState, mostSpecificRulesPredicates);
-			else
-				experiments = getAvailableExperiments(newDeleted, currentState);
-
-			for (int e = 0; e < randomExperiments; e++) {
-				chrono::duration<double, std::milli> deltaTime = chrono::high_resolution_clock::now() - startTime;
-				if (deltaTime.count() / 1000.0f > explorationTimeLimit) break;
-				
-				bool removeFact = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) > powf(factRemovalDiscount, (float)revisions);
-				Literal toRemove = *select_randomly(currentState.facts.begin(), currentState.facts.end());
-
-				if (experiments.size() == 0) break;
-				Literal experiment = *select_randomly(experiments.begin(), experiments.end());
-				//experiments.erase(experiment);
-
-				if (removeFact) {
-					vector<shared_ptr<ActionRule>> matchingRules;
-					foreach(rit, rules)
-						if ((*rit)->actionLiteral.unifies(experiment))
-							matchingRules.push_back(*rit);
-
-					if (matchingRules.size() > 0) {
-						shared_ptr<ActionRule> rule = *select_randomly(matchingRules.begin(), matchingRules.end());
-						Literal precondToRemove = *select_randomly(rule->preconditions.begin(), rule->preconditions.end());
-						vector<Term> toRemoveParams;
-
-						bool shouldReplace = true;
-
-						foreachindex(pi, precondToRemove.parameters) {
-							Term p = precondToRemove.parameters[pi];
-							bool found = false;
-
-							if (p.isVariable) {
-								foreachindex(rpi, rule->actionLiteral.parameters)
-									if (rule->actionLiteral.parameters[rpi] == p) {
-										found = true;
-										p = experiment.parameters[rpi];
-										break;
-									}
-								if (!found) {
-									Term inst = *select_randomly(allInsts.begin(), allInsts.end());
-									p = inst;
-								}
-							}
+			foundBetterThanRandom = true;
+		}
+		if (candidate.passedThrough) break;
+	}
 
-							toRemoveParams.push_back(p);
-						}
+	if (foundBetterThanRandom && plan.size() == 1 && saveMotivationTrace) {
+		revisionProbability(state, plan[0], true);
+	}
 
-						Literal replaceRemove = Literal(precondToRemove.pred, toRemoveParams);
+	if (stepsWithoutRevision > stagnationThreshold && useStagnation) {
+		stepsWithoutRevision = 0;
+		log << "ESCAPING CURRENT STATE" << endl;
+	}
 
-						if (shouldReplace || replaceRemove.grounded())
-							toRemove = replaceRemove;
-					}
-				}
+	log << "Revision cache: " << revisionCache.hits() << " hits - " << revisionCache.misses() << " misses - " << revisionCache.size() << " entries" << endl;
+}
 
-				vector<Literal> expPlan = currentPlan;
+RevisionCache const& BayesianExplorer::getRevisionCache() const {
+	return revisionCache;
+}
 
-				if (removeFact)
-					expPlan.insert(expPlan.begin(), Literal(removeFactPred, { Instance(toRemove.toString(), 0) }));
-				expPlan.insert(expPlan.begin(), experiment);
-				if (removeFact)
-					expPlan.insert(expPlan.begin(), Literal(removeFactPred, vector<Term>{}));
+BayesianExplorer::Rollout BayesianExplorer::rollout(State state, float initialUtility, RuleStore const& ruleSet, set<Predicate> const& specificPredicates,
+													bool limitToSpecifics, int evaluations, mt19937& g) {
+	Rollout best;
+	best.utility = initialUtility;
+	best.plan = plan;
 
-				State expState = State(currentState);
-				if (removeFact)
-					expState.removeFact(toRemove);
+	uniform_real_distribution<float> dis(0.0f, 1.0f);
+	vector<Term> allInsts = instances + domain->getConstants();
+	Predicate removeFactPred = domain->getActionPredByName("remove-fact");
 
-				float pRev = revisionProbability(expState, experiment);
-				//float pRev = expectedInformationGain(expState, experiment);
+	vector<Literal> currentPlan;
+	vector<float> currentRevProbs;
 
-				//float utility = currentUtility + powf((float)GAMMA, a * 1.0f + 1.0f) * noRevisionProb * pRev;
-				//float utility = currentUtility + powf((float)GAMMA, a * 1.0f + 1.0f) * pRev;
-				float utility = powf(gamma, a * 1.0f + 1.0f) * pRev;
+	State currentState = state;
+	set<Term> newDeleted = deletedInstances;
+	float noRevisionProb = 1.0f;
 
-				if (bestPlanUtility == utility && expPlan.size() < plan.size()) {
-					plan = expPlan;
-					revisionProbs = vector<float>{ pRev } + currentRevProbs;
+	for (int a = 0; a < planDepth && evaluations != 0; a++) {
+		// 1. Perform RANDOM_EXPERIMENTS experiments and check learning utility
+		set<Literal> experiments;
+		if (limitToSpecifics)
+			experiments = getAvailableExperiments(newDeleted, currentState, specificPredicates);
+		else
+			experiments = getAvailableExperiments(newDeleted, currentState);
+
+		for (int e = 0; e < randomExperiments && evaluations != 0; e++) {
+			bool removeFact = dis(g) > powf(factRemovalDiscount, (float)revisions);
+			Literal toRemove = *select_randomly(currentState.facts.begin(), currentState.facts.end(), g);
+
+			if (experiments.size() == 0) break;
+			Literal experiment = *select_randomly(experiments.begin(), experiments.end(), g);
+			//experiments.erase(experiment);
+
+			if (removeFact) {
+				vector<shared_ptr<ActionRule>> matchingRules;
+				foreach(rit, ruleSet.byAction(experiment.pred))
+					if ((*rit)->actionLiteral.unifies(experiment))
+						matchingRules.push_back(*rit);
+
+				if (matchingRules.size() > 0) {
+					shared_ptr<ActionRule> rule = *select_randomly(matchingRules.begin(), matchingRules.end(), g);
+					Literal precondToRemove = *select_randomly(rule->preconditions.begin(), rule->preconditions.end(), g);
+					vector<Term> toRemoveParams;
+
+					bool shouldReplace = true;
+
+					foreachindex(pi, precondToRemove.parameters) {
+						Term p = precondToRemove.parameters[pi];
+						bool found = false;
+
+						if (p.isVariable) {
+							foreachindex(rpi, rule->actionLiteral.parameters)
+								if (rule->actionLiteral.parameters[rpi] == p) {
+									found = true;
+									p = experiment.parameters[rpi];
+									break;
+								}
+							if (!found) {
+								Term inst = *select_randomly(allInsts.begin(), allInsts.end(), g);
+								p = inst;
+							}
+						}
 
-					foreachindex(i, expPlan) {
-						debug << expPlan[expPlan.size() - i - 1];
-						if (i < expPlan.size() - 1) debug << "->";
+						toRemoveParams.push_back(p);
 					}
-					debug << " - Utility: " << utility << endl;
 
-					foundBetterThanRandom = true;
-				}
-				else if (bestPlanUtility < utility) {
-					bestPlanUtility = utility;
-					plan = expPlan;
-					revisionProbs = vector<float>{ pRev } + currentRevProbs;
-
-					foreachindex(i, expPlan) {
-						debug << expPlan[expPlan.size() - i - 1];
-						if (i < expPlan.size() - 1) debug << "->";
-					}
-					debug << " - Utility: " << utility << endl;
+					Literal replaceRemove = Literal(precondToRemove.pred, toRemoveParams);
 
-					foundBetterThanRandom = true;
+					if (shouldReplace || replaceRemove.grounded())
+						toRemove = replaceRemove;
 				}
 			}
 
-			if (rules.size() == 0) break;
-			if (bestPlanUtility >= passthroughThreshold && usePassthrough) break;
-
-			Literal chosenAction;
-			float pRev = -1.0f;
-			Opt<State> nextState;
-
-			// 2. If first action of plan, and still below META_ACTION_PLANS, perform a meta-action
-			int metaAction = metaActionType();
-			if (a == 0 && metaAction > 0) {
-				switch (metaAction) {
-				case 1:
-					newDeleted.clear();
-
-					chosenAction = domain->getActionPredByName("reset")();
-					nextState = domain->tryAction(currentState, instances, chosenAction, false);
-					break;
-				case 2:
-					set<Term> notDeleted = getNotDeleted();
-					Term toDelete = *select_randomly(notDeleted.begin(), notDeleted.end());
-					newDeleted.insert(toDelete);
-
-					chosenAction = domain->getActionPredByName("delete")(toDelete);
-					nextState = domain->tryAction(currentState, instances, chosenAction, false);
-					break;
-				}
+			vector<Literal> expPlan = currentPlan;
+
+			if (removeFact)
+				expPlan.insert(expPlan.begin(), Literal(removeFactPred, { Instance(toRemove.toString(), 0) }));
+			expPlan.insert(expPlan.begin(), experiment);
+			if (removeFact)
+				expPlan.insert(expPlan.begin(), Literal(removeFactPred, vector<Term>{}));
+
+			State expState = State(currentState);
+			if (removeFact)
+				expState.removeFact(toRemove);
+
+			float pRev = revisionProbability(expState, experiment, ruleSet);
+			if (evaluations > 0) evaluations--;
+			//float pRev = expectedInformationGain(expState, experiment);
+
+			//float utility = currentUtility + powf((float)GAMMA, a * 1.0f + 1.0f) * noRevisionProb * pRev;
+			//float utility = currentUtility + powf((float)GAMMA, a * 1.0f + 1.0f) * pRev;
+			float utility = powf(gamma, a * 1.0f + 1.0f) * pRev;
+
+			if ((best.utility == utility && expPlan.size() < best.plan.size()) || best.utility < utility) {
+				best.found = true;
+				best.utility = utility;
+				best.plan = expPlan;
+				best.revisionProbs = vector<float>{ pRev } + currentRevProbs;
 			}
+		}
 
-			// 3. Else, perform a random action
-			else {
-				unsigned int trials = randomActionTrials;
-				vector<Literal> selectFrom;
-				foreach(pred, actionPredicates) {
-					bool covered = false;
-					foreach(rit, rules)
-						if ((*rit)->actionLiteral.pred == *pred) {
-							covered = true;
-							break;
-						}
-					if (covered)
-						foreach(lit, actionLiterals)
-							if (lit->pred == *pred)
-								selectFrom.push_back(*lit);
-				}
+		if (ruleSet.size() == 0) break;
+		if (usePassthrough && best.utility >= passthroughThreshold) {
+			best.passedThrough = true;
+			break;
+		}
 
-				while (!nextState.there && trials > 0) {
-					trials--;
-					chosenAction = *select_randomly(selectFrom.begin(), selectFrom.end());
-					nextState = domain->tryAction(currentState, instances, chosenAction, false);
-				}
+		Literal chosenAction;
+		float pRev = -1.0f;
+		Opt<State> nextState;
 
-				pRev = revisionProbability(currentState, chosenAction);
-				//pRev = expectedInformationGain(currentState, chosenAction);
-				//currentUtility += powf((float)GAMMA, a * 1.0f + 1.0f) * noRevisionProb * pRev;
-				//currentUtility += powf((float)GAMMA, a * 1.0f + 1.0f) * pRev;
-				noRevisionProb *= 1 - pRev;
+		// 2. If first action of plan, and still below META_ACTION_PLANS, perform a meta-action
+		int metaAction = metaActionType(g);
+		if (a == 0 && metaAction > 0) {
+			switch (metaAction) {
+			case 1:
+				newDeleted.clear();
+
+				chosenAction = domain->getActionPredByName("reset")();
+				nextState = domain->tryAction(currentState, instances, chosenAction, false);
+				break;
+			case 2:
+				set<Term> notDeleted = getNotDeleted();
+				Term toDelete = *select_randomly(notDeleted.begin(), notDeleted.end(), g);
+				newDeleted.insert(toDelete);
+
+				chosenAction = domain->getActionPredByName("delete")(toDelete);
+				nextState = domain->tryAction(currentState, instances, chosenAction, false);
+				break;
+			}
+		}
+
+		// 3. Else, perform a random action
+		else {
+			unsigned int trials = randomActionTrials;
+			vector<Literal> selectFrom;
+			foreach(pred, actionPredicates) {
+				// Trying remove-fact would update the domain's removed facts, shared by every rollout
+				if (*pred == removeFactPred) continue;
+				if (!ruleSet.byAction(*pred).empty())
+					foreach(lit, actionLiterals)
+						if (lit->pred == *pred)
+							selectFrom.push_back(*lit);
 			}
+			if (selectFrom.size() == 0) break;
 
-			if (!nextState.there) break;
-			currentPlan.insert(currentPlan.begin(), chosenAction);
-			currentRevProbs.insert(currentRevProbs.begin(), pRev);
+			while (!nextState.there && trials > 0) {
+				trials--;
+				chosenAction = *select_randomly(selectFrom.begin(), selectFrom.end(), g);
+				nextState = domain->tryAction(currentState, instances, chosenAction, false);
+			}
 
-			currentState = nextState.obj;
+			pRev = revisionProbability(currentState, chosenAction, ruleSet);
+			//pRev = expectedInformationGain(currentState, chosenAction);
+			//currentUtility += powf((float)GAMMA, a * 1.0f + 1.0f) * noRevisionProb * pRev;
+			//currentUtility += powf((float)GAMMA, a * 1.0f + 1.0f) * pRev;
+			noRevisionProb *= 1 - pRev;
 		}
 
-		if (rules.size() == 0) break;
-		if (bestPlanUtility >= passthroughThreshold && usePassthrough) break;
-	}
+		if (!nextState.there) break;
+		currentPlan.insert(currentPlan.begin(), chosenAction);
+		currentRevProbs.insert(currentRevProbs.begin(), pRev);
 
-	if (foundBetterThanRandom && plan.size() == 1 && saveMotivationTrace) {
-		revisionProbability(state, plan[0], true);
+		currentState = nextState.obj;
 	}
 
-	if (stepsWithoutRevision > stagnationThreshold && useStagnation) {
-		stepsWithoutRevision = 0;
-		log << "ESCAPING CURRENT STATE" << endl;
-	}
+	return best;
 }
 
 void BayesianExplorer::prepareActionSubstitutions() {
-	allActions.clear();
+	actionGroundings.clear();
+	metaGroundings.clear();
+
+	// Meta-actions come after the actions of the domain
 	vector<Action> actions = domain->getActions(true);
-	vector<Term> allInsts = instances + domain->getConstants();
-	foreach(act, actions) {
-		vector<Substitution> subs = Substitution().expandUncovered(act->actionLiteral.parameters, allInsts, true);
-		foreach(sub, subs)
-			insertUnique(&allActions, sub->apply(act->actionLiteral));
+	vector<size_t> const& ids = domain->getActionIds();
+	foreachindex(ai, actions) {
+		vector<Literal> grounded = groundAction(actions[ai]);
+		if (ai < ids.size()) actionGroundings[ids[ai]] = grounded;
+		else metaGroundings = metaGroundings + grounded;
 	}
+
+	collectActions();
+	groundedVersion = domain->getVersion();
+}
+
+vector<Literal> BayesianExplorer::groundAction(Action const& action) {
+	vector<Literal> grounded;
+	vector<Term> allInsts = instances + domain->getConstants();
+	vector<Substitution> subs = Substitution().expandUncovered(action.actionLiteral.parameters, allInsts, true);
+	foreach(sub, subs)
+		grounded.push_back(sub->apply(action.actionLiteral));
+	return grounded;
+}
+
+void BayesianExplorer::collectActions() {
+	allActions.clear();
+	set<Literal> collected;
+	foreach(id, domain->getActionIds())
+		foreach(lit, actionGroundings[*id])
+			if (collected.insert(*lit).second)
+				allActions.push_back(*lit);
+	foreach(lit, metaGroundings)
+		if (collected.insert(*lit).second)
+			allActions.push_back(*lit);
 }
 
 set<Literal> BayesianExplorer::getAvailableExperiments(set<Term> newDeleted, State state, set<Predicate> actionPreds) {
@@ -869,17 +938,18 @@ void BayesianExplorer::makeMotivationTraceJsonObject(State state, Literal action
 		string ruleObj = "{";
 		ActionRule* rule = pair->first;
 
+		NecessityVector const& necs = rule->necessityVector();
 		vector<string> preconds;
 		vector<string> removedPreconds;
-		foreach(precNec, rule->precondsNecessities)
-			if (in(rule->preconditions, precNec->first))
-				preconds.push_back(jsonLit(precNec->first, precNec->second));
+		foreachindex(pi, necs.preconds)
+			if (in(rule->preconditions, necs.preconds[pi]))
+				preconds.push_back(jsonLit(necs.preconds[pi], necs.values[pi]));
 			else
-				removedPreconds.push_back(jsonLit(precNec->first, precNec->second));
+				removedPreconds.push_back(jsonLit(necs.preconds[pi], necs.values[pi]));
 
 		vector<string> constants;
-		foreach(cstNec, rule->constsNecessities)
-			constants.push_back("[" + jsonStr(cstNec->first.name) + "," + to_string(cstNec->second) + "]");
+		foreachindex(ci, necs.consts)
+			constants.push_back("[" + jsonStr(necs.consts[ci].name) + "," + to_string(necs.values[necs.preconds.size() + ci]) + "]");
 
 		vector<string> effects;
 		foreach(a, rule->add)
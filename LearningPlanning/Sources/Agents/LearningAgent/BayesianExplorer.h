@@ -15,15 +15,17 @@
 
 #include "Agents/LearningAgent/ExplorerAgentBase.h"
 #include "Agents/LearningAgent/ActionRule.h"
+#include "Agents/LearningAgent/RevisionCache.h"
 
 #include "ConfigReader.h"
+#include "WorkStealingPool.h"
 
 class UnknownRule {
 public:
 	UnknownRule() {}
 	UnknownRule(float rawProb, shared_ptr<Domain> domain, size_t instSize, Literal inGroundedAction);
 
-	float computeProb(State state, /*r*/ float& expectedGain);
+	float computeProb(State state, /*r*/ float& expectedGain) const;
 	void corroborateFailure(State state);
 
 	Literal groundedAction = Literal();
@@ -38,7 +40,8 @@ public:
 	BayesianExplorer(bool inVerbose);
 
 	void init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) override;
-	void setRules(vector<shared_ptr<ActionRule>> newRules) override;
+	void setRules(RuleStore const& newRules) override;
+	void updateDomain(shared_ptr<Domain> newDomain) override;
 	void setActionLiterals(set<Literal> baseActionLiterals) override;
 
 	Literal getNextAction(State state) override;
@@ -47,20 +50,40 @@ public:
 	void corroborateRules(Trace trace) override;
 	void informRevision(bool knowledgeRevised) override;
 
+	// Hit and miss counts are kept for the explorer's whole life
+	RevisionCache const& getRevisionCache() const;
+
 	bool receivesEvents = false;
 
 private:
+	// Best plan found by one rollout, starting from the utility it has to beat
+	struct Rollout {
+		bool found = false;
+		bool passedThrough = false;
+		float utility = 0.0f;
+		vector<Literal> plan;
+		vector<float> revisionProbs;
+	};
+
 	float revisionProbability(State state, Literal action, bool makeTrace = false);
+	// Rollouts only read the explorer and the rules, whose necessities and match programs are brought up to date beforehand
+	float revisionProbability(State state, Literal action, RuleStore const& ruleSet, bool makeTrace = false);
 	float expectedInformationGain(State state, Literal action);
 	float computePu(Experiment e, /*r*/ float& expectedGain);
 	float computePu(Experiment e);
 
 	void generateRandomPlan(State state);
+	// Negative evaluation budgets are unbounded
+	Rollout rollout(State state, float initialUtility, RuleStore const& ruleSet, set<Predicate> const& specificPredicates, bool limitToSpecifics,
+					int evaluations, mt19937& g);
 	void prepareActionSubstitutions();
+	vector<Literal> groundAction(Action const& action);
+	// Same order as grounding every action again: actions in domain order, then the meta-actions
+	void collectActions();
 	set<Literal> getAvailableExperiments(set<Term> newDeleted, State state);
 	set<Literal> getAvailableExperiments(set<Term> newDeleted, State state, set<Predicate> actionPreds);
 	set<Term> getNotDeleted();
-	int metaActionType();
+	int metaActionType(mt19937& g);
 
 	void makeMotivationTraceJsonObject(State state, Literal action, float revisionProb,
 		map<ActionRule*, set<Substitution>> subsPerRule,
@@ -68,14 +91,20 @@ private:
 	void saveMotivationTraceFile();
 
 	vector<Literal> allActions;
+	unsigned __int64 groundedVersion = 0;
+	// Grounded literals of each action of the domain, by id
+	map<size_t, vector<Literal>> actionGroundings;
+	vector<Literal> metaGroundings;
 
 	vector<float> revisionProbs;
 
 private:
 	ConfigReader* bayesianConfig;
 	bool random, useStagnation, usePassthrough;
-	float gamma, explorationTimeLimit, passthroughThreshold, metaProbability, factRemovalDiscount, randomDiscount, focusSpecificRules;
-	int estimatedRulesPerAction, randomPlans, randomExperiments, randomActionTrials, planDepth, stagnationThreshold;
+	float gamma, passthroughThreshold, metaProbability, factRemovalDiscount, randomDiscount, focusSpecificRules, baseResetProb, cdTolerance;
+	int estimatedRulesPerAction, randomPlans, randomExperiments, randomActionTrials, planDepth, stagnationThreshold, explorationEvaluations;
+
+	shared_ptr<WorkStealingPool> rolloutPool;
 
 	bool saveMotivationTrace;
 	string motivationTraceFileName;
@@ -90,7 +119,7 @@ private:
 
 	int stepsWithoutRevision = 0;
 
-	vector<shared_ptr<ActionRule>> rules;
+	RuleStore rules;
 	set<Literal> actionLiterals;
 	set<Predicate> actionPredicates;
 	set<Term> deletedInstances;
@@ -101,6 +130,8 @@ private:
 	shared_ptr<ActionRule> targetRule;
 
 	map<Literal, UnknownRule> unknownRules;
+	RevisionCache revisionCache;
+	unsigned int revisionSeed = 0;
 
 	int iteration = 0;
 };
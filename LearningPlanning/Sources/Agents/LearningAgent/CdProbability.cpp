@@ -0,0 +1,205 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/LearningAgent/CdProbability.h"
+
+#include <algorithm>
+
+#include "Utils.h"
+
+#define MIN_STATES_TO_DROP 64
+
+typedef vector<uint64_t> Mask;
+
+void setBit(Mask& mask, size_t bit) {
+	mask[bit / 64] |= 1ULL << (bit % 64);
+}
+
+size_t groupRoot(vector<size_t>& groupOf, size_t di) {
+	while (groupOf[di] != di)
+		di = groupOf[di] = groupOf[groupOf[di]];
+	return di;
+}
+
+CdProbability::CdProbability(double inTolerance) : tolerance(inTolerance) {}
+
+float CdProbability::solve(vector<float> const& probabilities, vector<vector<size_t>> const& disjunctions) const {
+	double droppedMass = 0.0;
+	return solve(probabilities, disjunctions, droppedMass);
+}
+
+float CdProbability::solve(vector<float> const& probabilities, vector<vector<size_t>> const& disjunctions, /*r*/ double& droppedMass) const {
+	droppedMass = 0.0;
+
+	// 1. Removing false variables and disjunctions holding a true one
+	vector<vector<size_t>> simplified;
+	foreach(disj, disjunctions) {
+		vector<size_t> vars;
+		bool holds = false;
+		foreach(var, (*disj)) {
+			if (probabilities[*var] >= 1.0f) holds = true;
+			else if (probabilities[*var] > 0.0f) vars.push_back(*var);
+		}
+		if (holds) continue;
+		if (vars.size() == 0) return 0.0f;
+
+		sort(vars.begin(), vars.end());
+		vars.erase(unique(vars.begin(), vars.end()), vars.end());
+		simplified.push_back(vars);
+	}
+
+	// 2. Removing disjunctions implied by a smaller one, smallest first so that duplicates keep their first occurrence
+	sort(simplified.begin(), simplified.end(), [](vector<size_t> const& d1, vector<size_t> const& d2) {
+		return d1.size() < d2.size() || (d1.size() == d2.size() && d1 < d2);
+	});
+	vector<vector<size_t>> kept;
+	foreach(disj, simplified) {
+		bool implied = false;
+		foreach(smaller, kept)
+			if (includes(disj->begin(), disj->end(), smaller->begin(), smaller->end())) {
+				implied = true;
+				break;
+			}
+		if (!implied) kept.push_back(*disj);
+	}
+
+	// 3. Grouping disjunctions linked by shared variables
+	vector<size_t> groupOf = vector<size_t>(kept.size());
+	foreachindex(di, kept) groupOf[di] = di;
+	map<size_t, size_t> firstDisjunctionOf;
+	foreachindex(di, kept)
+		foreach(var, kept[di]) {
+			auto found = firstDisjunctionOf.find(*var);
+			if (found == firstDisjunctionOf.end()) firstDisjunctionOf[*var] = di;
+			else groupOf[groupRoot(groupOf, di)] = groupRoot(groupOf, found->second);
+		}
+
+	map<size_t, vector<vector<size_t>>> groups;
+	foreachindex(di, kept)
+		groups[groupRoot(groupOf, di)].push_back(kept[di]);
+
+	// Groups share the tolerance, each one only gets what the previous ones left of it
+	double prob = 1.0;
+	foreach(group, groups) {
+		double groupDropped = 0.0;
+		prob *= solveGroup(probabilities, group->second, tolerance - droppedMass, groupDropped);
+		droppedMass += groupDropped;
+		if (prob == 0.0) break;
+	}
+	return (float)prob;
+}
+
+double CdProbability::solveGroup(vector<float> const& probabilities, vector<vector<size_t>> const& disjunctions, double budget,
+								 /*r*/ double& droppedMass) const {
+	// A single disjunction fails only when all its variables are false
+	if (disjunctions.size() == 1) {
+		double allFalse = 1.0;
+		foreach(var, disjunctions[0])
+			allFalse *= 1.0 - (double)probabilities[*var];
+		return 1.0 - allFalse;
+	}
+
+	map<size_t, vector<size_t>> disjunctionsOf;
+	foreachindex(di, disjunctions)
+		foreach(var, disjunctions[di])
+			disjunctionsOf[*var].push_back(di);
+
+	// Greedy order keeping few disjunctions open at once: the open disjunction closest to closing is closed first, through
+	// the variable shared with the most open ones
+	vector<size_t> order;
+	map<size_t, size_t> positions;
+	vector<size_t> remaining = vector<size_t>(disjunctions.size());
+	vector<bool> opened = vector<bool>(disjunctions.size(), false);
+	foreachindex(di, disjunctions)
+		remaining[di] = disjunctions[di].size();
+
+	while (order.size() < disjunctionsOf.size()) {
+		size_t next = disjunctions.size();
+		foreachindex(di, disjunctions) {
+			if (remaining[di] == 0) continue;
+			if (next == disjunctions.size() || (opened[di] && !opened[next]) ||
+				(opened[di] == opened[next] && remaining[di] < remaining[next]))
+				next = di;
+		}
+
+		size_t chosen = 0;
+		int chosenOpenCount = -1;
+		foreach(var, disjunctions[next]) {
+			if (in(positions, *var)) continue;
+			int openCount = 0;
+			foreach(di, disjunctionsOf[*var])
+				if (opened[*di]) openCount++;
+			if (openCount > chosenOpenCount) {
+				chosen = *var;
+				chosenOpenCount = openCount;
+			}
+		}
+
+		positions[chosen] = order.size();
+		order.push_back(chosen);
+		foreach(di, disjunctionsOf[chosen]) {
+			opened[*di] = true;
+			remaining[*di]--;
+		}
+	}
+
+	size_t words = (disjunctions.size() + 63) / 64;
+	vector<Mask> containing = vector<Mask>(order.size(), Mask(words, 0));
+	vector<Mask> closing = vector<Mask>(order.size(), Mask(words, 0));
+	foreachindex(di, disjunctions) {
+		size_t last = 0;
+		foreach(var, disjunctions[di]) {
+			setBit(containing[positions[*var]], di);
+			last = max(last, positions[*var]);
+		}
+		setBit(closing[last], di);
+	}
+
+	// States are the open disjunctions already satisfied, closed ones are cleared so that equal futures merge
+	map<Mask, double> states = { { Mask(words, 0), 1.0 } };
+	foreachindex(pos, order) {
+		double p = (double)probabilities[order[pos]];
+		map<Mask, double> next;
+
+		foreach(state, states) {
+			Mask whenTrue = state->first;
+			Mask whenFalse = state->first;
+			bool falseHolds = true;
+			for (size_t w = 0; w < words; w++) {
+				whenTrue[w] = (whenTrue[w] | containing[pos][w]) & ~closing[pos][w];
+				if ((whenFalse[w] & closing[pos][w]) != closing[pos][w]) falseHolds = false;
+				whenFalse[w] &= ~closing[pos][w];
+			}
+
+			next[whenTrue] += state->second * p;
+			if (falseHolds) next[whenFalse] += state->second * (1.0 - p);
+		}
+
+		// Each variable may drop its share of what is left of the budget, lightest states first. Few states are not worth
+		// sorting, their share is left to the next variables.
+		if (budget > droppedMass && next.size() > MIN_STATES_TO_DROP) {
+			double share = (budget - droppedMass) / (double)(order.size() - pos);
+			vector<map<Mask, double>::iterator> byWeight;
+			for (auto it = next.begin(); it != next.end(); it++)
+				byWeight.push_back(it);
+			sort(byWeight.begin(), byWeight.end(), [](map<Mask, double>::iterator s1, map<Mask, double>::iterator s2) {
+				return s1->second < s2->second;
+			});
+
+			foreach(state, byWeight) {
+				if ((*state)->second > share) break;
+				share -= (*state)->second;
+				droppedMass += (*state)->second;
+				next.erase(*state);
+			}
+		}
+		states.swap(next);
+	}
+
+	double prob = 0.0;
+	foreach(state, states)
+		prob += state->second;
+	return prob;
+}
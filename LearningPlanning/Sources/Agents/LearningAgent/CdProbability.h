@@ -0,0 +1,43 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Probability that a conjunction of disjunctions (CD) holds, each disjunction being over independent necessity variables
+ * that are true with their own probability.
+ *
+ * Disjunctions are first simplified (certain variables, duplicates, disjunctions implied by smaller ones) and split into
+ * groups sharing no variable, whose probabilities multiply. In each group, variables are then assigned one at a time
+ * while keeping the distribution over which still open disjunctions are satisfied, as a bitmask. A disjunction is open
+ * from its first variable to its last one, where the assignments not satisfying it are dropped. Assignments leading to the
+ * same bitmask are merged, so the work grows with the number of disjunctions open at once, not with the number of
+ * variables.
+ *
+ * With a tolerance, the lightest merged assignments are dropped as well, as long as their total mass over all groups stays
+ * below the tolerance: the result then underestimates the exact probability by at most the dropped mass, which is
+ * reported.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+class CdProbability {
+public:
+	// A tolerance of 0 computes the exact probability
+	CdProbability(double inTolerance = 0.0);
+
+	// Disjunctions hold indices in probabilities, an empty one never holds
+	float solve(vector<float> const& probabilities, vector<vector<size_t>> const& disjunctions) const;
+	float solve(vector<float> const& probabilities, vector<vector<size_t>> const& disjunctions, /*r*/ double& droppedMass) const;
+
+private:
+	// Drops at most budget
+	double solveGroup(vector<float> const& probabilities, vector<vector<size_t>> const& disjunctions, double budget,
+					  /*r*/ double& droppedMass) const;
+
+	double tolerance;
+};
@@ -0,0 +1,125 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/LearningAgent/CounterExampleStore.h"
+#include "Agents/LearningAgent/RuleStore.h"
+
+#include <algorithm>
+
+#define COUNTS_PER_WORD 8
+#define MAX_COUNT 127
+#define GUARD_BITS 0x8080808080808080ULL
+
+string countKey(Literal const& lit) {
+	return lit.pred.name + "/" + to_string(lit.parameters.size());
+}
+
+bool CounterExampleStore::insert(shared_ptr<ActionRule> example) {
+	if (!examples.insert(example).second) return false;
+
+	foreach(precond, example->preconditions) {
+		string key = countKey(*precond);
+		if (!in(predicateIds, key)) {
+			size_t id = predicateIds.size();
+			predicateIds[key] = id;
+		}
+	}
+
+	Entry entry;
+	entry.example = example;
+	entry.signature = RuleStore::effectSignature(*example);
+	encode(example->preconditions, entry.counts);
+	byAction[example->actionLiteral.pred].push_back(entry);
+	return true;
+}
+
+void CounterExampleStore::clear() {
+	examples.clear();
+	byAction.clear();
+	predicateIds.clear();
+}
+
+size_t CounterExampleStore::size() const {
+	return examples.size();
+}
+
+vector<shared_ptr<ActionRule>> CounterExampleStore::candidates(shared_ptr<ActionRule> rule) const {
+	vector<shared_ptr<ActionRule>> result;
+	vector<Entry const*> entries = filter(rule);
+	foreach(entry, entries)
+		result.push_back((*entry)->example);
+	return result;
+}
+
+shared_ptr<ActionRule> CounterExampleStore::findContradicted(shared_ptr<ActionRule> rule) const {
+	string signature = RuleStore::effectSignature(*rule);
+
+	vector<Entry const*> entries = filter(rule);
+	foreach(entry, entries) {
+		shared_ptr<ActionRule> example = (*entry)->example;
+		if ((*entry)->signature == signature) {
+			if (rule->contradicts(example))
+				return example;
+		}
+		else if (rule->prematchingSubs(example).size() > 0)
+			return example;
+	}
+	return nullptr;
+}
+
+shared_ptr<ActionRule> CounterExampleStore::findPrematched(shared_ptr<ActionRule> rule) const {
+	vector<Entry const*> entries = filter(rule);
+	foreach(entry, entries)
+		if (rule->prematches((*entry)->example))
+			return (*entry)->example;
+	return nullptr;
+}
+
+vector<CounterExampleStore::Entry const*> CounterExampleStore::filter(shared_ptr<ActionRule> rule) const {
+	vector<Entry const*> result;
+
+	auto found = byAction.find(rule->actionLiteral.pred);
+	if (found == byAction.end()) return result;
+
+	vector<uint64_t> required;
+	if (!encode(rule->preconditions, required)) return result;
+
+	foreach(entry, found->second)
+		if (dominates(entry->counts, required))
+			result.push_back(&*entry);
+	return result;
+}
+
+bool CounterExampleStore::encode(set<Literal> const& preconditions, /*r*/ vector<uint64_t>& counts) const {
+	set<Literal> distinct;
+	foreach(precond, preconditions)
+		distinct.insert(precond->abs());
+
+	vector<size_t> perPredicate = vector<size_t>(predicateIds.size(), 0);
+	foreach(lit, distinct) {
+		auto found = predicateIds.find(countKey(*lit));
+		if (found == predicateIds.end()) return false;
+		perPredicate[found->second]++;
+	}
+
+	// Saturating keeps the condition necessary: a smaller count never ends up above a larger one
+	counts = vector<uint64_t>((perPredicate.size() + COUNTS_PER_WORD - 1) / COUNTS_PER_WORD, 0);
+	foreachindex(pi, perPredicate) {
+		uint64_t count = min(perPredicate[pi], (size_t)MAX_COUNT);
+		counts[pi / COUNTS_PER_WORD] |= count << (8 * (pi % COUNTS_PER_WORD));
+	}
+	return true;
+}
+
+bool CounterExampleStore::dominates(vector<uint64_t> const& counts, vector<uint64_t> const& required) {
+	foreachindex(wi, required) {
+		uint64_t available = wi < counts.size() ? counts[wi] : 0;
+
+		// Setting the guard bit of each byte before subtracting keeps borrows inside bytes, the guard survives where available >= required
+		if ((((available | GUARD_BITS) - required[wi]) & GUARD_BITS) != GUARD_BITS)
+			return false;
+	}
+	return true;
+}
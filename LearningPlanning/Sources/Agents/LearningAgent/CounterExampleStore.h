@@ -0,0 +1,56 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Counter-examples indexed by action predicate, with a cheap necessary condition checked before prematching. Prematching
+ * maps distinct preconditions of a rule to distinct facts of the example through an injective substitution, and facts are
+ * queried regardless of their sign, so a rule can only prematch an example having, for each predicate, at least as many
+ * distinct unsigned preconditions. These counts are stored per example as bytes packed eight per word and compared a
+ * word at a time.
+ *
+ * The effect signature of each example is stored as well: when it differs from the rule's, postmatching is impossible,
+ * so the rule contradicts the example as soon as it prematches it.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Agents/LearningAgent/ActionRule.h"
+
+using namespace std;
+
+class CounterExampleStore {
+public:
+	bool insert(shared_ptr<ActionRule> example);
+	void clear();
+	size_t size() const;
+
+	// Examples passing the action and predicate count filters for this rule
+	vector<shared_ptr<ActionRule>> candidates(shared_ptr<ActionRule> rule) const;
+
+	// First stored example the rule contradicts, or prematches, nullptr if there is none
+	shared_ptr<ActionRule> findContradicted(shared_ptr<ActionRule> rule) const;
+	shared_ptr<ActionRule> findPrematched(shared_ptr<ActionRule> rule) const;
+
+private:
+	struct Entry {
+		shared_ptr<ActionRule> example;
+		string signature;
+		vector<uint64_t> counts;
+	};
+
+	vector<Entry const*> filter(shared_ptr<ActionRule> rule) const;
+	// Fails when a precondition predicate was never seen in a counter-example
+	bool encode(set<Literal> const& preconditions, /*r*/ vector<uint64_t>& counts) const;
+	static bool dominates(vector<uint64_t> const& counts, vector<uint64_t> const& required);
+
+	set<shared_ptr<ActionRule>> examples;
+	map<Predicate, vector<Entry>> byAction;
+	map<string, size_t> predicateIds;
+};
@@ -11,6 +11,7 @@
 
 #include "Agents/Agent.h"
 #include "Agents/LearningAgent/ActionRule.h"
+#include "Agents/LearningAgent/RuleStore.h"
 #include <vector>
 #include <map>
 #include <set>
@@ -19,12 +20,15 @@ class ExplorerAgentBase : public Agent {
 public:
 	ExplorerAgentBase(bool inVerbose) : Agent(inVerbose) {}
 
-	void virtual setRules(vector<shared_ptr<ActionRule>> newRules) {}
+	void virtual setRules(RuleStore const& newRules) {}
 	void virtual setActionLiterals(set<Literal> baseActionLiterals) {}
 
 	void virtual corroborateRules(Trace trace) {}
 	void virtual informRevision(bool knowledgeRevised) {}
 
+	// Takes the domain built from the revised rules, which may be the current one patched in place
+	void virtual updateDomain(shared_ptr<Domain> newDomain) { init(newDomain, instances, goal, trace); }
+
 	bool receivesEvents = false;
 
 	vector<Literal> plan;
@@ -20,8 +20,26 @@ void IRALeExplorer::init(shared_ptr<Domain> inDomain, vector<Term> inInstances,
 	prevState = State();
 }
 
-void IRALeExplorer::setRules(vector<shared_ptr<ActionRule>> newRules) {
+void IRALeExplorer::setRules(RuleStore const& newRules) {
 	rules = newRules;
+
+	// Rules kept from the previous set keep their place in the network
+	set<shared_ptr<ActionRule>> kept;
+	foreach(rit, rules)
+		kept.insert(*rit);
+
+	for (auto it = networkIds.begin(); it != networkIds.end();) {
+		if (in(kept, it->first))
+			it++;
+		else {
+			network.removeRule(it->second);
+			it = networkIds.erase(it);
+		}
+	}
+
+	foreach(rule, kept)
+		if (!in(networkIds, *rule))
+			networkIds[*rule] = network.addRule((*rule)->preconditions);
 }
 
 void IRALeExplorer::setActionLiterals(set<Literal> baseActionLiterals) {
@@ -48,13 +66,14 @@ Literal IRALeExplorer::getNextAction(State state) {
 
 		interestingActions.clear();
 		prevState = state;
+		network.update(state);
 
 		foreach(rit, rules) {
 			shared_ptr<ActionRule> rule = *rit;
 			
 			debug << "Rule: " << endl << rule->toString() << endl;
 
-			if (Substitution().oiSubsume(rule->preconditions, state.facts).size() == 0) {
+			if (!network.active(networkIds[rule])) {
 				debug << "RULE DOESN'T APPLY, performing anticipated generalization" << endl;
 
 				// Looking for subr and subx such that delsubr-1subx in S, addsubr-1subx not in S and (del+add)subr-1subx is grounded
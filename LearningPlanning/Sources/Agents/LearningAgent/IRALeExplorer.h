@@ -15,6 +15,7 @@
 
 #include "Agents/LearningAgent/ExplorerAgentBase.h"
 #include "Agents/LearningAgent/ActionRule.h"
+#include "Agents/LearningAgent/MatchNetwork.h"
 
 #include "ConfigReader.h"
 
@@ -24,7 +25,7 @@ public:
 	IRALeExplorer(bool inVerbose);
 
 	void init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) override;
-	void setRules(vector<shared_ptr<ActionRule>> newRules) override;
+	void setRules(RuleStore const& newRules) override;
 	void setActionLiterals(set<Literal> baseActionLiterals) override;
 
 	Literal getNextAction(State state) override;
@@ -38,7 +39,9 @@ private:
 	ConfigReader* explorerConfig;
 	float epsilon;
 
-	vector<shared_ptr<ActionRule>> rules;
+	RuleStore rules;
+	MatchNetwork network;
+	map<shared_ptr<ActionRule>, size_t> networkIds;
 	set<Literal> actionLiterals;
 	set<Predicate> actionPredicates;
 	vector<Literal> allActions;
@@ -21,32 +21,28 @@
 #include <sstream>
 #include <iostream>
 
-bool checkSelfParenting(shared_ptr<ActionRule> current, shared_ptr<ActionRule> check) {
-	foreach(parent, current->parents)
-		if (*parent == check || checkSelfParenting(*parent, check)) return true;
-	return false;
-}
-
-shared_ptr<Domain> domainFromRules(shared_ptr<Domain> initialDomain, set<shared_ptr<ActionRule>> edsRules) {
-	vector<Action> initialActions = initialDomain->getActions();
-	vector<Action> finalActions;
+Action actionFromRule(ActionRule const& rule) {
+	vector<Literal> truePreconds, falsePreconds, add, del;
 
-	foreach(rit, edsRules) {
-		vector<Literal> truePreconds, falsePreconds, add, del;
+	foreach(precond, rule.preconditions)
+		truePreconds.push_back(*precond);
 
-		foreach(precond, (*rit)->preconditions)
-			truePreconds.push_back(*precond);
+	foreach(addEff, rule.add)
+		add.push_back(*addEff);
 
-		foreach(addEff, (*rit)->add)
-			add.push_back(*addEff);
+	foreach(delEff, rule.del)
+		del.push_back(*delEff);
 
-		foreach(delEff, (*rit)->del)
-			del.push_back(*delEff);
+	return Action(rule.actionLiteral, truePreconds, falsePreconds, add, del);
+}
 
-		finalActions.push_back(Action((*rit)->actionLiteral, truePreconds, falsePreconds, add, del));
-	}
+shared_ptr<Domain> domainFromRules(shared_ptr<Domain> initialDomain, set<shared_ptr<ActionRule>> edsRules) {
+	vector<Action> finalActions;
+	foreach(rit, edsRules)
+		finalActions.push_back(actionFromRule(**rit));
 
 	shared_ptr<Domain> newDomain = make_shared<Domain>(initialDomain->getTypes(), initialDomain->getPredicates(), initialDomain->getConstants(), finalActions);
+	newDomain->name = initialDomain->name + ":learned";
 	newDomain->removedFacts = initialDomain->removedFacts;
 	return newDomain;
 }
@@ -120,6 +116,7 @@ float computeVarDistBetweenDomains(shared_ptr<Domain> domain, set<shared_ptr<Act
 
 LearningAgent::LearningAgent(bool verbose) : Agent(verbose) {
 	iraleConfig = config->getSubconfig("irale");
+	generalizationPool = make_shared<WorkStealingPool>((size_t)max(iraleConfig->getInt("generalization_threads"), 0));
 
 	/*
 		"irale": {
@@ -196,10 +193,11 @@ Literal LearningAgent::getNextAction(State state) {
 	float uncertainty, nec, nki;
 	foreach(rit, rules) {
 		shared_ptr<ActionRule> rule = *rit;
+		NecessityVector const& necs = rule->necessityVector();
 		uncertainty = 0.0f;
 		nki = 0.0f;
 		foreach(precond, rule->preconditions) {
-			nec = rule->precondsNecessities[*precond];
+			nec = necs.precondValue(*precond);
 
 			uncertainty += nec < 0.5f ?
 						   nec / 0.5f :
@@ -207,15 +205,15 @@ Literal LearningAgent::getNextAction(State state) {
 			nki++;
 		}
 		foreach(precond, rule->removedPreconditions) {
-			nec = rule->precondsNecessities[*precond];
+			nec = necs.precondValue(*precond);
 
 			uncertainty += nec < 0.5f ?
 				nec / 0.5f :
 				1 - (nec - 0.5f) / (1 - 0.5f);
 			nki++;
 		}
-		foreach(pair, rule->constsNecessities) {
-			nec = pair->second;
+		foreachindex(ci, necs.consts) {
+			nec = necs.values[necs.preconds.size() + ci];
 
 			uncertainty += nec < 0.5f ?
 				nec / 0.5f :
@@ -250,7 +248,7 @@ Literal LearningAgent::getNextAction(State state) {
 
 			if (trace->size() % steps % iraleConfig->getInt("test_domain_every") == 0) {
 				if (revisedSinceLastEval || !iraleConfig->getBool("test_only_when_knowledge_modified")) {
-					domainTester->testDomain(domainFromRules(domain, rules), prevVarDist, prevPlanDist);
+					domainTester->testDomain(domainFromRules(domain, rules.all()), prevVarDist, prevPlanDist);
 				}
 				stats[run][trace->size() % steps][4] = prevVarDist;
 				stats[run][trace->size() % steps][6] = prevPlanDist;
@@ -261,7 +259,7 @@ Literal LearningAgent::getNextAction(State state) {
 				stats[run][trace->size() % steps][6] = -1.0f;
 			}
 
-			stats[run][trace->size() % steps][5] = computeVarDistBetweenDomains(domain, rules);
+			stats[run][trace->size() % steps][5] = computeVarDistBetweenDomains(domain, rules.all());
 		}
 
 		if (trace->size() % steps == 0) {
@@ -344,12 +342,7 @@ Literal LearningAgent::getNextAction(State state) {
 			
 			// If action failed and was unknown yet, remember failure for later initialization
 			if (!tr.authorized) {
-				bool foundRule = false;
-				foreach(rit, rules)
-					if ((*rit)->actionLiteral.pred == pred) {
-						foundRule = true;
-						break;
-					}
+				bool foundRule = !rules.byAction(pred).empty();
 				if (!foundRule) {
 					if (in(failedBeforeFirstSuccess, pred)) failedBeforeFirstSuccess[pred].push_back(tr);
 					else failedBeforeFirstSuccess[pred] = { tr };
@@ -437,10 +430,10 @@ bool LearningAgent::updateKnowledge(Trace trace) {
 		cout << endl;
 	}
 
-	// Checking coverage and consistency
+	// Checking coverage and consistency, only rules of the same action can prematch
 	vector<shared_ptr<ActionRule>> prematching;
 	vector<shared_ptr<ActionRule>> contradiction;
-	foreach(it, rules) {
+	foreach(it, rules.byAction(example->actionLiteral.pred)) {
 		set<Substitution> prematchSubs = (*it)->prematchingSubs(example);
 
 		if (prematchSubs.size() > 0) {
@@ -480,7 +473,8 @@ bool LearningAgent::updateKnowledge(Trace trace) {
 		foreach(rit, prematching) {
 			set<shared_ptr<ActionRule>> newUncovered = specialize(*rit, example);
 			foreach(uncovit, newUncovered) {
-				foreach(rit, rules)
+				// Uncovered examples only have ancestors among rules of their own effect signature
+				foreach(rit, rules.byEffects(**uncovit))
 					(*rit)->removeParentRecursive(*uncovit);
 				uncoveredExamples.insert(*uncovit);
 			}
@@ -538,7 +532,7 @@ void LearningAgent::generalize(shared_ptr<ActionRule> example) {
 	log << "GENERALIZING - STEP 1 - Testing coverage" << endl;
 	int leastGeneralityLevel = -1;
 	set<shared_ptr<ActionRule>> leastGeneralRules;
-	foreach(rit, rules) {
+	foreach(rit, rules.byEffects(*example)) {
 		shared_ptr<ActionRule> leastGeneralRule = (*rit)->getLeastGeneralRuleCovering(example);
 
 		if (leastGeneralRule) {
@@ -555,14 +549,9 @@ void LearningAgent::generalize(shared_ptr<ActionRule> example) {
 	}
 
 	// Adding example to the parents of each least general rule identified
-	// TODO : find why some rules are added as parents to themselves, fix it and then remove assertion
 	foreach(rit, leastGeneralRules) {
-		if (*rit == example) {
-			cout << "ERROR: SAME POINTER" << endl;
-			continue;
-		}
 		(*rit)->insertParent(example);
-		assert(!checkSelfParenting(*rit, *rit));
+		assert(!(*rit)->reaches(*rit));
 	}
 
 	bool recovered = leastGeneralRules.size() > 0;
@@ -571,170 +560,79 @@ void LearningAgent::generalize(shared_ptr<ActionRule> example) {
 	if (!recovered) {
 		log << "GENERALIZING - STEP 2 - Computing generalizations" << endl;
 
-		set<shared_ptr<ActionRule>> currentRules = set<shared_ptr<ActionRule>>(rules);
-		foreach(rit, currentRules) {
-			Substitution subr, subx;
-			shared_ptr<ActionRule> rule = *rit;
+		// Post-generalization needs the same action and effects shape, copied as the store changes while iterating
+		vector<shared_ptr<ActionRule>> currentRules = toVec(rules.byEffects(*example));
+		int trials = max(iraleConfig->getInt("generalization_trials"), 0);
+		bool leastGeneral = iraleConfig->getBool("least_general");
+
+		// Each rule and trial draws from its own stream, so that results only depend on the global seed and not on scheduling
+		unsigned int batchSeed = globalRandomDevice();
 
+		struct PostGeneralization {
+			bool success = false;
+			Substitution subr, subx;
 			set<Term> genVars;
-			bool pg = rule->postGeneralizes(example, subr, subx, genVars);
-
-			log << "Rule " << (pg ? "post-generalizes" : "doesn't post-generalize") << " example." << endl;
-
-			if (pg) {
-				int trials = iraleConfig->getInt("generalization_trials");
-				shared_ptr<ActionRule> lggRule = nullptr;
-
-				while (trials-- > 0) {
-					set<Term> genVarsTrial = genVars;
-					Substitution subrTrial = subr;
-					Substitution subxTrial = subx;
-
-					log << "Substitutions: " << subrTrial << " - " << subxTrial << endl;
-					log << "Post-generalized preconds: " << join(subrTrial.inverse().apply(rule->preconditions)) << endl;
-					log << "Post-generalized example: " << join(subxTrial.inverse().apply(example->preconditions)) << endl;
-
-					set<Literal> genPreconds = rule->anyGeneralization(example, subrTrial, subxTrial, genVarsTrial);
-
-					log << "Found generalization: " << join(genPreconds) << endl;
-					log << "New substitutions: " << subrTrial << " - " << subxTrial << endl;
-
-					auto mappingR = subrTrial.getMapping();
-					foreach (pair, mappingR) {
-						if (subxTrial.get(pair->first).obj == pair->second) {
-							genPreconds = Substitution({ pair->first }, { pair->second }).apply(genPreconds);
-							subrTrial.remove(pair->first);
-							subxTrial.remove(pair->first);
-						}
-						if (pair->first == pair->second)
-							subrTrial.remove(pair->first);
-					}
-
-					set<Literal> removedPreconds;
-					map<Literal, vector<float>> precondsNecessitiesList;
-					map<Term, vector<float>> constsNecessitiesList;
-
-					Substitution invSubR = subrTrial.inverse();
-					Substitution invSubX = subxTrial.inverse();
-					foreach(pair, rule->precondsNecessities) {
-						Literal genVersion = invSubR.apply(pair->first);
-
-						if (!in(genPreconds, genVersion)) {
-							removedPreconds.insert(genVersion);
-							//removedPreconds.insert(pair->first);
-							//genVersion = pair->first;
-						}
-
-						if (in(precondsNecessitiesList, genVersion)) precondsNecessitiesList[genVersion].push_back(pair->second);
-						else precondsNecessitiesList[genVersion] = { pair->second };
-
-					}
-					foreach(pair, example->precondsNecessities) {
-						Literal genVersion = invSubX.apply(pair->first);
-
-						if (!in(genPreconds, genVersion)) {
-							removedPreconds.insert(genVersion);
-							//removedPreconds.insert(pair->first);
-							//genVersion = pair->first;
-						}
-
-						if (in(precondsNecessitiesList, genVersion)) precondsNecessitiesList[genVersion].push_back(pair->second);
-						else precondsNecessitiesList[genVersion] = { pair->second };
-					}
-					foreach(pair, rule->constsNecessities)
-						if (invSubR.apply(pair->first) == pair->first) {
-							if (in(constsNecessitiesList, pair->first)) constsNecessitiesList[pair->first].push_back(pair->second);
-							else constsNecessitiesList[pair->first] = { pair->second };
-						}
-					foreach(pair, example->constsNecessities)
-						if (invSubX.apply(pair->first) == pair->first) {
-							if (in(constsNecessitiesList, pair->first)) constsNecessitiesList[pair->first].push_back(pair->second);
-							else constsNecessitiesList[pair->first] = { pair->second };
-						}
-
-					/*foreach(prec, removedPreconds)
-						assertMsg(prec->grounded(), "Removed precondition is not grounded.");*/
-
-					map<Literal, float> precondsNecessities;
-					map<Term, float> constsNecessities;
-					foreach(pair, precondsNecessitiesList) {
-						float mean = 0.0f;
-						foreach(val, pair->second)
-							mean += *val;
-						if (mean <= 0.01f && !in(genPreconds, pair->first)) {
-							removedPreconds.erase(pair->first);
-							continue;
-						}
-						
-						precondsNecessities[pair->first] = mean / (float)pair->second.size();
-
-					}
-					foreach(pair, constsNecessitiesList) {
-						float mean = 0.0f;
-						foreach(val, pair->second)
-							mean += *val;
-						constsNecessities[pair->first] = mean / (float)pair->second.size();
-					}
-
-					shared_ptr<ActionRule> genRule = make_shared<ActionRule>(
-						genPreconds, invSubR.apply(rule->actionLiteral), invSubR.apply(rule->add), invSubR.apply(rule->del),
-						set<shared_ptr<ActionRule>>{ rule, example }, startPu, true);
-
-					genRule->removedPreconditions = removedPreconds;
-
-					foreach(pair, precondsNecessities)
-						if (in(genRule->preconditions, pair->first) || in(genRule->removedPreconditions, pair->first)) {
-							//assertMsg(isProb(pair->second), "Precond necessity not a probability" + joinmap(precondsNecessities));
-							genRule->precondsNecessities[pair->first] = pair->second;
-						}
-					foreach(pair, constsNecessities)
-						if (in(genRule->constsNecessities, pair->first)) {
-							//assertMsg(isProb(pair->second), "Const necessity not a probability " + joinmap(constsNecessities));
-							genRule->constsNecessities[pair->first] = pair->second;
-						}
-
-					log << "Gen rule:" << endl << *genRule << endl;
-
-					if (genRule->wellFormed()) {
-						bool doesntContradict = true;
-						foreach(cx, counterExamples)
-							if (genRule->contradicts(*cx)) {
-								log << "Contradicts counter-example:" << endl << **cx << endl;
-								doesntContradict = false;
-								break;
-							}
-						if (doesntContradict) {
-							foreach(fcx, failedActionsCounterExamples) {
-								if (genRule->prematches(*fcx)) {
-									log << "Prematches with a failed action counter-example:" << endl << **fcx << endl;
-									doesntContradict = false;
-									break;
-								}
-							}
-						}
-
-						if (doesntContradict) {
-							bool better = lggRule == nullptr ||
-								(iraleConfig->getBool("least_general") ?
-								genRule->preconditions.size() > lggRule->preconditions.size() :
-								genRule->preconditions.size() < lggRule->preconditions.size());
-
-							if (better) {
-								log << "Better LGG found." << endl;
-								lggRule = genRule;
-							}
-						}
-					}
-					else log << "Not well formed." << endl;
-				}
+		};
+		vector<PostGeneralization> postGeneralizations = vector<PostGeneralization>(currentRules.size());
+
+		vector<function<void()>> tasks;
+		foreachindex(ri, currentRules)
+			tasks.push_back([&, ri]() {
+				seed_seq seeds = { batchSeed, (unsigned int)ri };
+				mt19937 g = mt19937(seeds);
+				PostGeneralization& pg = postGeneralizations[ri];
+				pg.success = currentRules[ri]->postGeneralizes(example, pg.subr, pg.subx, pg.genVars, g);
+			});
+		generalizationPool->run(tasks);
+
+		vector<shared_ptr<ActionRule>> trialRules = vector<shared_ptr<ActionRule>>(currentRules.size() * trials);
+		vector<string> trialLogs = vector<string>(trialRules.size());
+		tasks.clear();
+		foreachindex(ri, currentRules) {
+			if (!postGeneralizations[ri].success) continue;
+
+			for (int ti = 0; ti < trials; ti++)
+				tasks.push_back([&, ri, ti]() {
+					seed_seq seeds = { batchSeed, (unsigned int)ri, (unsigned int)ti + 1 };
+					mt19937 g = mt19937(seeds);
+					PostGeneralization const& pg = postGeneralizations[ri];
+					ostringstream trialLog;
+					trialRules[ri * trials + ti] = generalizationTrial(currentRules[ri], example, pg.subr, pg.subx, pg.genVars, g, trialLog);
+					trialLogs[ri * trials + ti] = trialLog.str();
+				});
+		}
+		generalizationPool->run(tasks);
+
+		// Trials are compared in order, the first of equally good ones is kept as when they ran one after the other
+		foreachindex(ri, currentRules) {
+			shared_ptr<ActionRule> rule = currentRules[ri];
+			log << "Rule " << (postGeneralizations[ri].success ? "post-generalizes" : "doesn't post-generalize") << " example." << endl;
+			if (!postGeneralizations[ri].success) continue;
+
+			shared_ptr<ActionRule> lggRule = nullptr;
+			for (int ti = 0; ti < trials; ti++) {
+				log << trialLogs[ri * trials + ti];
+
+				shared_ptr<ActionRule> genRule = trialRules[ri * trials + ti];
+				if (genRule == nullptr) continue;
+
+				bool better = lggRule == nullptr ||
+					(leastGeneral ?
+					genRule->preconditions.size() > lggRule->preconditions.size() :
+					genRule->preconditions.size() < lggRule->preconditions.size());
 
-				if (lggRule != nullptr) {
-					rules.insert(lggRule);
-					rules.erase(rule);
-					recovered = true;
-					log << "Rule added to active rules." << endl;
+				if (better) {
+					log << "Better LGG found." << endl;
+					lggRule = genRule;
 				}
 			}
+
+			if (lggRule != nullptr) {
+				rules.insert(lggRule);
+				rules.erase(rule);
+				recovered = true;
+				log << "Rule added to active rules." << endl;
+			}
 		}
 	}
 
@@ -762,10 +660,191 @@ void LearningAgent::generalize(shared_ptr<ActionRule> example) {
 	}
 }
 
+shared_ptr<ActionRule> LearningAgent::generalizationTrial(shared_ptr<ActionRule> rule, shared_ptr<ActionRule> example,
+														   Substitution subrTrial, Substitution subxTrial, set<Term> genVarsTrial,
+														   mt19937& g, /*r*/ ostream& trialLog) const {
+	if (verbose) {
+		trialLog << "Substitutions: " << subrTrial << " - " << subxTrial << endl;
+		trialLog << "Post-generalized preconds: " << join(subrTrial.inverse().apply(rule->preconditions)) << endl;
+		trialLog << "Post-generalized example: " << join(subxTrial.inverse().apply(example->preconditions)) << endl;
+	}
+
+	set<Literal> genPreconds = rule->anyGeneralization(example, subrTrial, subxTrial, genVarsTrial, g);
+
+	if (verbose) {
+		trialLog << "Found generalization: " << join(genPreconds) << endl;
+		trialLog << "New substitutions: " << subrTrial << " - " << subxTrial << endl;
+	}
+
+	auto mappingR = subrTrial.getMapping();
+	foreach (pair, mappingR) {
+		if (subxTrial.get(pair->first).obj == pair->second) {
+			genPreconds = Substitution({ pair->first }, { pair->second }).apply(genPreconds);
+			subrTrial.remove(pair->first);
+			subxTrial.remove(pair->first);
+		}
+		if (pair->first == pair->second)
+			subrTrial.remove(pair->first);
+	}
+
+	set<Literal> removedPreconds;
+	map<Literal, vector<float>> precondsNecessitiesList;
+	map<Term, vector<float>> constsNecessitiesList;
+
+	Substitution invSubR = subrTrial.inverse();
+	Substitution invSubX = subxTrial.inverse();
+	NecessityVector const& ruleNecs = rule->necessityVector();
+	NecessityVector const& exampleNecs = example->necessityVector();
+	foreachindex(pi, ruleNecs.preconds) {
+		Literal genVersion = invSubR.apply(ruleNecs.preconds[pi]);
+
+		if (!in(genPreconds, genVersion)) {
+			removedPreconds.insert(genVersion);
+			//removedPreconds.insert(pair->first);
+			//genVersion = pair->first;
+		}
+
+		if (in(precondsNecessitiesList, genVersion)) precondsNecessitiesList[genVersion].push_back(ruleNecs.values[pi]);
+		else precondsNecessitiesList[genVersion] = { ruleNecs.values[pi] };
+
+	}
+	foreachindex(pi, exampleNecs.preconds) {
+		Literal genVersion = invSubX.apply(exampleNecs.preconds[pi]);
+
+		if (!in(genPreconds, genVersion)) {
+			removedPreconds.insert(genVersion);
+			//removedPreconds.insert(pair->first);
+			//genVersion = pair->first;
+		}
+
+		if (in(precondsNecessitiesList, genVersion)) precondsNecessitiesList[genVersion].push_back(exampleNecs.values[pi]);
+		else precondsNecessitiesList[genVersion] = { exampleNecs.values[pi] };
+	}
+	foreachindex(ci, ruleNecs.consts) {
+		Term cst = ruleNecs.consts[ci];
+		float nec = ruleNecs.values[ruleNecs.preconds.size() + ci];
+		if (invSubR.apply(cst) == cst) {
+			if (in(constsNecessitiesList, cst)) constsNecessitiesList[cst].push_back(nec);
+			else constsNecessitiesList[cst] = { nec };
+		}
+	}
+	foreachindex(ci, exampleNecs.consts) {
+		Term cst = exampleNecs.consts[ci];
+		float nec = exampleNecs.values[exampleNecs.preconds.size() + ci];
+		if (invSubX.apply(cst) == cst) {
+			if (in(constsNecessitiesList, cst)) constsNecessitiesList[cst].push_back(nec);
+			else constsNecessitiesList[cst] = { nec };
+		}
+	}
+
+	/*foreach(prec, removedPreconds)
+		assertMsg(prec->grounded(), "Removed precondition is not grounded.");*/
+
+	map<Literal, float> precondsNecessities;
+	map<Term, float> constsNecessities;
+	foreach(pair, precondsNecessitiesList) {
+		float mean = 0.0f;
+		foreach(val, pair->second)
+			mean += *val;
+		if (mean <= 0.01f && !in(genPreconds, pair->first)) {
+			removedPreconds.erase(pair->first);
+			continue;
+		}
+		
+		precondsNecessities[pair->first] = mean / (float)pair->second.size();
+
+	}
+	foreach(pair, constsNecessitiesList) {
+		float mean = 0.0f;
+		foreach(val, pair->second)
+			mean += *val;
+		constsNecessities[pair->first] = mean / (float)pair->second.size();
+	}
+
+	shared_ptr<ActionRule> genRule = make_shared<ActionRule>(
+		genPreconds, invSubR.apply(rule->actionLiteral), invSubR.apply(rule->add), invSubR.apply(rule->del),
+		set<shared_ptr<ActionRule>>{ rule, example }, startPu, true);
+
+	genRule->removedPreconditions = removedPreconds;
+
+	// Necessities the new rule starts with are replaced by the averaged ones, removed preconditions are added
+	map<Literal, float> genPrecondNecs = genRule->necessityVector().precondMap();
+	map<Term, float> genConstNecs = genRule->necessityVector().constMap();
+	foreach(pair, precondsNecessities)
+		if (in(genRule->preconditions, pair->first) || in(genRule->removedPreconditions, pair->first)) {
+			//assertMsg(isProb(pair->second), "Precond necessity not a probability" + joinmap(precondsNecessities));
+			genPrecondNecs[pair->first] = pair->second;
+		}
+	foreach(pair, constsNecessities)
+		if (in(genConstNecs, pair->first)) {
+			//assertMsg(isProb(pair->second), "Const necessity not a probability " + joinmap(constsNecessities));
+			genConstNecs[pair->first] = pair->second;
+		}
+
+	genRule->setNecessities(genPrecondNecs, genConstNecs);
+
+	if (verbose) trialLog << "Gen rule:" << endl << *genRule << endl;
+
+	if (!genRule->wellFormed()) {
+		if (verbose) trialLog << "Not well formed." << endl;
+		return nullptr;
+	}
+
+	shared_ptr<ActionRule> cx = counterExamples.findContradicted(genRule);
+	if (cx) {
+		if (verbose) trialLog << "Contradicts counter-example:" << endl << *cx << endl;
+		return nullptr;
+	}
+
+	shared_ptr<ActionRule> fcx = failedActionsCounterExamples.findPrematched(genRule);
+	if (fcx) {
+		if (verbose) trialLog << "Prematches with a failed action counter-example:" << endl << *fcx << endl;
+		return nullptr;
+	}
+
+	return genRule;
+}
+
+void LearningAgent::patchInternalDomain() {
+	if (internalDomain == nullptr || internalDomain->getTypes() != domain->getTypes() ||
+		internalDomain->getPredicates() != domain->getPredicates() || internalDomain->getConstants() != domain->getConstants()) {
+		internalDomain = domainFromRules(domain, {});
+		ruleActions.clear();
+	}
+	internalDomain->removedFacts = domain->removedFacts;
+
+	// Rules are never modified once built, a revision only removes and adds some
+	set<shared_ptr<ActionRule>> current = rules.all();
+	vector<size_t> freedActions;
+	for (auto it = ruleActions.begin(); it != ruleActions.end();) {
+		if (in(current, it->first)) {
+			++it;
+			continue;
+		}
+		freedActions.push_back(it->second);
+		it = ruleActions.erase(it);
+	}
+
+	foreach(rule, current) {
+		if (in(ruleActions, *rule)) continue;
+		if (freedActions.empty())
+			ruleActions[*rule] = internalDomain->addAction(actionFromRule(**rule));
+		else {
+			internalDomain->replaceAction(freedActions.back(), actionFromRule(**rule));
+			ruleActions[*rule] = freedActions.back();
+			freedActions.pop_back();
+		}
+	}
+
+	foreach(id, freedActions)
+		internalDomain->removeAction(*id);
+}
+
 void LearningAgent::setupInternalPlanner() {
-	internalDomain = domainFromRules(domain, rules);
+	patchInternalDomain();
 
 	planner = make_shared<AStarAgent>(verbose);
+	planner->configure(iraleConfig);
 	planner->init(internalDomain, instances, goal, trace);
 
 	if (iraleConfig->getBool("use_bayesian_explorer"))
@@ -776,22 +855,21 @@ void LearningAgent::setupInternalPlanner() {
 	learner->init(internalDomain, instances, goal, trace);
 	startPu = learner->startPu;
 
-	vector<shared_ptr<ActionRule>> vecRules;
-	foreach(r, rules)
-		vecRules.push_back(*r);
-	learner->setRules(vecRules);
+	learner->setRules(rules);
 	learner->setActionLiterals(domain->getActionLiterals());
 }
 
 void LearningAgent::updateInternalPlanner() {
-	internalDomain = domainFromRules(domain, rules);
+	patchInternalDomain();
 	
-	planner->init(internalDomain, instances, goal, trace);
-	learner->init(internalDomain, instances, goal, trace);
-	vector<shared_ptr<ActionRule>> vecRules;
-	foreach(r, rules)
-		vecRules.push_back(*r);
-	learner->setRules(vecRules);
+	// Repairing keeps the current plan and the planner's expansions of unchanged actions. On unless the configuration turns
+	// it off: a plan that cannot be repaired is searched again from scratch.
+	if (iraleConfig->getBool("plan_repair", true))
+		planner->updateDomain(internalDomain);
+	else
+		planner->init(internalDomain, instances, goal, trace);
+	learner->updateDomain(internalDomain);
+	learner->setRules(rules);
 }
 
 void LearningAgent::handleEvent(SDL_Event event) {
@@ -17,16 +17,20 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <random>
 
 #include "Agents/AStarAgent.h"
 #include "Agents/Agent.h"
 #include "Agents/LearningAgent/ActionRule.h"
 #include "Agents/LearningAgent/ExplorerAgentBase.h"
+#include "Agents/LearningAgent/RuleStore.h"
+#include "Agents/LearningAgent/CounterExampleStore.h"
 
 #include "Agents/LearningAgent/IRALeExplorer.h"
 #include "Agents/LearningAgent/BayesianExplorer.h"
 
 #include "ConfigReader.h"
+#include "WorkStealingPool.h"
 
 class ConvertedDomain;
 class AStarAgent;
@@ -41,6 +45,8 @@ public:
 	void updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) override;
 	void setupInternalPlanner();
 	void updateInternalPlanner();
+	// Brings the actions of the internal domain in line with the rules, only touching those of added and removed rules
+	void patchInternalDomain();
 	void handleEvent(SDL_Event event) override;
 
 	bool receivesEvents = true;
@@ -48,8 +54,8 @@ public:
 	// In paper: ALGORITHM 1: REVISION
 	bool updateKnowledge(Trace trace);
 
-	set<shared_ptr<ActionRule>> rules;
-	set<shared_ptr<ActionRule>> counterExamples;
+	RuleStore rules;
+	CounterExampleStore counterExamples;
 
 private:
 	// In paper: ALGORITHM 2: SPECIALIZE
@@ -57,15 +63,21 @@ private:
 
 	// In paper: ALGORITHM 3: GENERALIZE
 	void generalize(shared_ptr<ActionRule> example);
+	// One randomised generalization of rule and example, nullptr when ill-formed or inconsistent with counter-examples
+	shared_ptr<ActionRule> generalizationTrial(shared_ptr<ActionRule> rule, shared_ptr<ActionRule> example,
+											   Substitution subrTrial, Substitution subxTrial, set<Term> genVarsTrial,
+											   mt19937& g, /*r*/ ostream& trialLog) const;
 
-	set<shared_ptr<ActionRule>> failedActionsCounterExamples;
+	CounterExampleStore failedActionsCounterExamples;
 	map<Predicate, vector<Trace>> failedBeforeFirstSuccess;
 
-	shared_ptr<Agent> planner;
+	shared_ptr<AStarAgent> planner;
 	shared_ptr<ExplorerAgentBase> learner;
 	shared_ptr<Domain> internalDomain;
+	map<shared_ptr<ActionRule>, size_t> ruleActions;
 
 	ConfigReader* iraleConfig;
+	shared_ptr<WorkStealingPool> generalizationPool;
 	int runs, steps;
 	//int estimatedPreconditions = 10;
 	float startPu = 0.5f;
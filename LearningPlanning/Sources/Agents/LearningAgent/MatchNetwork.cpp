@@ -0,0 +1,234 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/LearningAgent/MatchNetwork.h"
+
+#include <algorithm>
+
+size_t MatchNetwork::addRule(set<Literal> const& conditions) {
+	size_t id;
+	if (freeIds.empty()) {
+		id = rules.size();
+		rules.push_back(Rule());
+	}
+	else {
+		id = freeIds.back();
+		freeIds.pop_back();
+		rules[id] = Rule();
+	}
+
+	Rule& rule = rules[id];
+	map<Term, int> slots;
+	foreach(cond, conditions) {
+		Condition compiled;
+		foreach(param, cond->parameters) {
+			if (!param->isVariable) {
+				compiled.slots.push_back(-1);
+				continue;
+			}
+			if (!in(slots, *param)) {
+				int slot = (int)slots.size();
+				slots[*param] = slot;
+			}
+			compiled.slots.push_back(slots[*param]);
+		}
+
+		string key = alphaKey(*cond);
+		auto found = alphas.find(key);
+		if (found == alphas.end()) {
+			Alpha& alpha = alphas[key];
+			alpha.key = key;
+			alpha.pattern = *cond;
+			foreach(fact, current.facts)
+				if (fact->pred == cond->pred && accepts(alpha, *fact))
+					alpha.facts.insert(*fact);
+			alphasByPred[cond->pred.name].push_back(&alpha);
+			found = alphas.find(key);
+		}
+
+		compiled.alpha = &found->second;
+		compiled.alpha->successors.push_back({ id, rule.conds.size() });
+		rule.conds.push_back(compiled);
+	}
+
+	rule.slotCount = slots.size();
+	rule.active = search(rule, -1, nullptr);
+	return id;
+}
+
+void MatchNetwork::removeRule(size_t id) {
+	Rule& rule = rules[id];
+
+	foreachindex(ci, rule.conds) {
+		Alpha* alpha = rule.conds[ci].alpha;
+		pair<size_t, size_t> successor = { id, ci };
+		alpha->successors.erase(remove(alpha->successors.begin(), alpha->successors.end(), successor), alpha->successors.end());
+		if (!alpha->successors.empty()) continue;
+
+		string predName = alpha->pattern.pred.name;
+		vector<Alpha*>& samePred = alphasByPred[predName];
+		samePred.erase(remove(samePred.begin(), samePred.end(), alpha), samePred.end());
+		if (samePred.empty())
+			alphasByPred.erase(predName);
+		alphas.erase(alpha->key);
+	}
+
+	rule = Rule();
+	freeIds.push_back(id);
+}
+
+void MatchNetwork::update(State const& state) {
+	set<Literal> added, removed;
+	current.difference(state, &added, &removed);
+	if (added.empty() && removed.empty()) return;
+
+	// Active rules losing a fact of their match are joined again once every memory is up to date
+	set<size_t> stale;
+	foreach(negFact, removed) {
+		Literal fact = negFact->abs();
+		current.facts.erase(fact);
+
+		auto samePred = alphasByPred.find(fact.pred.name);
+		if (samePred == alphasByPred.end()) continue;
+		foreach(alpha, samePred->second) {
+			if ((*alpha)->facts.erase(fact) == 0) continue;
+			foreach(succ, (*alpha)->successors)
+				if (rules[succ->first].active && rules[succ->first].witness[succ->second] == fact)
+					stale.insert(succ->first);
+		}
+	}
+
+	// Inactive rules can only match through an added fact
+	struct Seed {
+		size_t rule;
+		size_t cond;
+		Literal const* fact;
+	};
+	vector<Seed> seeds;
+	foreach(fact, added) {
+		current.facts.insert(*fact);
+
+		auto samePred = alphasByPred.find(fact->pred.name);
+		if (samePred == alphasByPred.end()) continue;
+		foreach(alpha, samePred->second) {
+			if (!accepts(**alpha, *fact)) continue;
+			Literal const* stored = &*(*alpha)->facts.insert(*fact).first;
+			foreach(succ, (*alpha)->successors)
+				if (!rules[succ->first].active)
+					seeds.push_back({ succ->first, succ->second, stored });
+		}
+	}
+
+	foreach(id, stale)
+		rules[*id].active = search(rules[*id], -1, nullptr);
+
+	foreach(seed, seeds) {
+		Rule& rule = rules[seed->rule];
+		if (!rule.active && !in(stale, seed->rule))
+			rule.active = search(rule, (int)seed->cond, seed->fact);
+	}
+}
+
+bool MatchNetwork::active(size_t id) const {
+	return rules[id].active;
+}
+
+size_t MatchNetwork::alphaCount() const {
+	return alphas.size();
+}
+
+string MatchNetwork::alphaKey(Literal const& condition) {
+	string key = condition.pred.name + "/" + to_string(condition.parameters.size());
+
+	// Variables are numbered in their order of appearance
+	vector<Term> variables;
+	foreach(param, condition.parameters) {
+		if (!param->isVariable) {
+			key += " =" + param->name;
+			continue;
+		}
+		size_t index = find(variables.begin(), variables.end(), *param) - variables.begin();
+		if (index == variables.size())
+			variables.push_back(*param);
+		key += " ?" + to_string(index);
+	}
+	return key;
+}
+
+bool MatchNetwork::accepts(Alpha const& alpha, Literal const& fact) {
+	vector<Term> const& params = alpha.pattern.parameters;
+	if (fact.parameters.size() != params.size()) return false;
+
+	// A variable of a condition maps to one term, and distinct variables to distinct ones
+	foreachindex(pi, params) {
+		if (!params[pi].isVariable) {
+			if (params[pi] != fact.parameters[pi]) return false;
+			continue;
+		}
+		for (size_t pj = 0; pj < pi; pj++)
+			if (params[pj].isVariable && (params[pj] == params[pi]) != (fact.parameters[pj] == fact.parameters[pi]))
+				return false;
+	}
+	return true;
+}
+
+bool MatchNetwork::search(Rule& rule, int seedCond, Literal const* seedFact) {
+	vector<Term const*> values = vector<Term const*>(rule.slotCount, nullptr);
+	rule.witness.resize(rule.conds.size());
+
+	// Smallest memories first, after the seed
+	vector<size_t> order;
+	foreachindex(ci, rule.conds)
+		if ((int)ci != seedCond)
+			order.push_back(ci);
+	sort(order.begin(), order.end(), [&](size_t c1, size_t c2) {
+		return rule.conds[c1].alpha->facts.size() < rule.conds[c2].alpha->facts.size();
+	});
+
+	if (seedFact != nullptr) {
+		vector<int> newSlots;
+		if (!bind(rule.conds[seedCond], *seedFact, values, newSlots)) return false;
+		rule.witness[seedCond] = *seedFact;
+	}
+	return join(rule, order, 0, values);
+}
+
+bool MatchNetwork::join(Rule& rule, vector<size_t> const& order, size_t depth, vector<Term const*>& values) const {
+	if (depth == order.size()) return true;
+
+	Condition const& cond = rule.conds[order[depth]];
+	vector<int> newSlots;
+	foreach(fact, cond.alpha->facts) {
+		newSlots.clear();
+		if (bind(cond, *fact, values, newSlots)) {
+			rule.witness[order[depth]] = *fact;
+			if (join(rule, order, depth + 1, values)) return true;
+		}
+		foreach(slot, newSlots)
+			values[*slot] = nullptr;
+	}
+	return false;
+}
+
+bool MatchNetwork::bind(Condition const& cond, Literal const& fact, vector<Term const*>& values, /*r*/ vector<int>& newSlots) const {
+	foreachindex(pi, cond.slots) {
+		int slot = cond.slots[pi];
+		if (slot < 0) continue;
+
+		Term const& value = fact.parameters[pi];
+		if (values[slot] != nullptr) {
+			if (*values[slot] != value) return false;
+			continue;
+		}
+
+		// Injectivity, as oiSubsume checks the inverse mapping
+		foreach(other, values)
+			if (*other != nullptr && **other == value)
+				return false;
+		values[slot] = &value;
+		newSlots.push_back(slot);
+	}
+	return true;
+}
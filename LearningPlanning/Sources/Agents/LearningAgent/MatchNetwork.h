@@ -0,0 +1,76 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * TREAT-style network telling which rules have their conditions OI-subsuming the facts of a state, fed with the facts
+ * added and removed between two states. Conditions sharing a predicate and constants, up to the naming of their
+ * variables, share an alpha memory holding the facts they match on their own. Rules keep no partial matches: an
+ * inactive rule is only joined again from the facts just added to its alpha memories, and an active one keeps the facts
+ * of one match, and is only joined again from scratch when one of them is removed.
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Logic/Domain.h"
+
+using namespace std;
+
+class MatchNetwork {
+public:
+	// Returns the id of the rule, matched against the facts fed so far
+	size_t addRule(set<Literal> const& conditions);
+	void removeRule(size_t id);
+
+	// Feeds the facts added and removed since the previous state
+	void update(State const& state);
+
+	// Whether Substitution().oiSubsumes(conditions, facts) for the facts fed so far
+	bool active(size_t id) const;
+
+	size_t alphaCount() const;
+
+private:
+	struct Alpha {
+		string key;
+		Literal pattern;
+		set<Literal> facts;
+
+		// Rule and condition indices reading this memory
+		vector<pair<size_t, size_t>> successors;
+	};
+
+	struct Condition {
+		Alpha* alpha;
+
+		// Slot of the variable at each position, -1 for constants
+		vector<int> slots;
+	};
+
+	struct Rule {
+		bool active = false;
+		vector<Condition> conds;
+		size_t slotCount = 0;
+
+		// Facts of the current match, one per condition
+		vector<Literal> witness;
+	};
+
+	static string alphaKey(Literal const& condition);
+	static bool accepts(Alpha const& alpha, Literal const& fact);
+
+	bool search(Rule& rule, int seedCond, Literal const* seedFact);
+	bool join(Rule& rule, vector<size_t> const& order, size_t depth, vector<Term const*>& values) const;
+	bool bind(Condition const& cond, Literal const& fact, vector<Term const*>& values, /*r*/ vector<int>& newSlots) const;
+
+	State current;
+	vector<Rule> rules;
+	vector<size_t> freeIds;
+
+	map<string, Alpha> alphas;
+	map<string, vector<Alpha*>> alphasByPred;
+};
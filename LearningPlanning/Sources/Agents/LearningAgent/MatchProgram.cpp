@@ -0,0 +1,369 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/LearningAgent/MatchProgram.h"
+
+#include <algorithm>
+
+// Buffers of a matching, kept per thread and reused from one to the next
+struct MatchProgram::Run {
+	// Values of slots, nullptr while unbound, and of constants
+	vector<Term const*> slotValues;
+	vector<Term const*> constValues;
+	vector<bool> presetSlots;
+
+	// Every term mapped to, for injectivity, and slots bound by probes, for backtracking
+	vector<Term const*> targets;
+	vector<size_t> bound;
+
+	map<Term, Term> preset;
+	bool injective = true;
+	vector<vector<Literal const*>> candidates;
+	vector<size_t> order;
+	set<Substitution>* subs = nullptr;
+
+	State const* state = nullptr;
+	vector<Term const*> instances;
+	vector<Substitution>* thetas = nullptr;
+	bool onlyFirst = false;
+	bool done = false;
+
+	bool isTarget(Term const& term) const {
+		foreach(target, targets)
+			if (**target == term)
+				return true;
+		return false;
+	}
+};
+
+MatchProgram::Run& MatchProgram::threadRun() {
+	thread_local Run run;
+	return run;
+}
+
+MatchProgram::MatchProgram(Literal const& actionLit, set<Literal> const& literals, vector<Term> const& extraTerms) {
+	set<Term> variables;
+	set<Term> consts;
+	foreach(param, actionLit.parameters)
+		(param->isVariable ? variables : consts).insert(*param);
+	foreach(lit, literals)
+		foreach(param, lit->parameters)
+			(param->isVariable ? variables : consts).insert(*param);
+	foreach(term, extraTerms)
+		if (term->isVariable)
+			variables.insert(*term);
+
+	slots = toVec(variables);
+	constants = toVec(consts);
+
+	// The wildcard variable equals any other one, and terms only compare by name: slots would not tell them apart
+	string anyName = Variable::anyVar().name;
+	foreach(slot, slots)
+		if (slot->name == anyName || in(consts, *slot))
+			return;
+
+	auto operandOf = [&](Term const& term) {
+		Operand operand;
+		operand.isSlot = term.isVariable;
+		if (term.isVariable)
+			operand.index = lower_bound(slots.begin(), slots.end(), term) - slots.begin();
+		else
+			operand.index = lower_bound(constants.begin(), constants.end(), term) - constants.begin();
+		return operand;
+	};
+
+	vector<bool> bound = vector<bool>(slots.size(), false);
+	foreach(param, actionLit.parameters) {
+		action.push_back(operandOf(*param));
+		if (param->isVariable)
+			bound[action.back().index] = true;
+	}
+
+	vector<Probe> pending;
+	foreach(lit, literals) {
+		Probe probe;
+		probe.literal = *lit;
+		foreach(param, lit->parameters)
+			probe.operands.push_back(operandOf(*param));
+		pending.push_back(probe);
+	}
+
+	// Each probe binds as few new slots as possible, given those bound by the action and the previous probes
+	while (!pending.empty()) {
+		size_t best = 0;
+		size_t bestFree = numeric_limits<size_t>::max();
+		foreachindex(pi, pending) {
+			set<size_t> free;
+			foreach(operand, pending[pi].operands)
+				if (operand->isSlot && !bound[operand->index])
+					free.insert(operand->index);
+			if (free.size() < bestFree) {
+				best = pi;
+				bestFree = free.size();
+			}
+		}
+
+		foreach(operand, pending[best].operands)
+			if (operand->isSlot)
+				bound[operand->index] = true;
+		probes.push_back(pending[best]);
+		pending.erase(pending.begin() + best);
+	}
+
+	completedBySlot = vector<vector<size_t>>(slots.size() + 1);
+	foreachindex(pi, probes) {
+		size_t last = slots.size();
+		foreach(operand, probes[pi].operands)
+			if (operand->isSlot && (last == slots.size() || operand->index > last))
+				last = operand->index;
+		completedBySlot[last].push_back(pi);
+	}
+
+	runnable = true;
+}
+
+size_t MatchProgram::slotCount() const {
+	return slots.size();
+}
+
+size_t MatchProgram::probeCount() const {
+	return probes.size();
+}
+
+bool MatchProgram::unify(Literal const& target, set<Literal> const& facts, set<Literal> const* moreFacts, Substitution const& preset,
+						 bool pinMappedTo, /*r*/ set<Substitution>& subs) const {
+	if (!runnable || target.parameters.size() != action.size()) return false;
+	foreach(param, target.parameters)
+		if (param->isVariable)
+			return false;
+
+	Run& run = threadRun();
+	run.preset = preset.getMapping();
+	run.injective = preset.getInjective();
+	if (!run.injective) return false;
+
+	run.targets.clear();
+	run.bound.clear();
+	foreach(pair, run.preset) {
+		if (pair->second.isVariable) return false;
+		run.targets.push_back(&pair->second);
+	}
+
+	run.slotValues.assign(slots.size(), nullptr);
+	run.presetSlots.assign(slots.size(), false);
+	foreachindex(si, slots) {
+		auto found = run.preset.find(slots[si]);
+		if (found != run.preset.end()) {
+			run.slotValues[si] = &found->second;
+			run.presetSlots[si] = true;
+		}
+	}
+
+	// Constants map to themselves unless the preset maps them elsewhere
+	run.constValues.assign(constants.size(), nullptr);
+	size_t presetTargets = run.targets.size();
+	foreachindex(ci, constants) {
+		Term const& constant = constants[ci];
+		auto found = run.preset.find(constant);
+		if (found != run.preset.end()) {
+			run.constValues[ci] = &found->second;
+			continue;
+		}
+
+		run.constValues[ci] = &constant;
+		bool mappedTo = false;
+		for (size_t ti = 0; ti < presetTargets; ti++)
+			if (*run.targets[ti] == constant)
+				mappedTo = true;
+
+		// Mapping a constant to itself while another term maps to it is not injective, the interpreter asserts there
+		if (mappedTo && pinMappedTo) return false;
+		if (!mappedTo)
+			run.targets.push_back(&constant);
+	}
+
+	foreachindex(i, action) {
+		Operand const& operand = action[i];
+		Term const& from = operand.isSlot ? slots[operand.index] : constants[operand.index];
+		Term const& to = target.parameters[i];
+
+		if (from == to) continue;
+		if (!operand.isSlot) return true;
+		if (run.slotValues[operand.index]) {
+			if (*run.slotValues[operand.index] != to) return true;
+			continue;
+		}
+		if (run.isTarget(to)) return true;
+
+		run.slotValues[operand.index] = &to;
+		run.targets.push_back(&to);
+	}
+
+	// Facts each probe could match given the action, the most constrained probes going first
+	if (run.candidates.size() < probes.size())
+		run.candidates.resize(probes.size());
+	foreachindex(pi, probes) {
+		run.candidates[pi].clear();
+		if (!gatherCandidates(facts, pi, run)) return false;
+		if (moreFacts && !gatherCandidates(*moreFacts, pi, run)) return false;
+	}
+	foreachindex(pi, probes)
+		if (run.candidates[pi].empty())
+			return true;
+
+	run.order.clear();
+	foreachindex(pi, probes)
+		run.order.push_back(pi);
+	stable_sort(run.order.begin(), run.order.end(), [&](size_t a, size_t b) { return run.candidates[a].size() < run.candidates[b].size(); });
+
+	run.subs = &subs;
+	unifyProbes(0, run);
+	return true;
+}
+
+bool MatchProgram::gatherCandidates(set<Literal> const& facts, size_t probe, Run& run) const {
+	Probe const& p = probes[probe];
+
+	foreach(fact, facts) {
+		if (fact->pred != p.literal.pred || fact->parameters.size() != p.operands.size())
+			continue;
+
+		bool corresponds = true;
+		foreachindex(oi, p.operands) {
+			Term const& value = fact->parameters[oi];
+			if (value.isVariable) return false;
+
+			Operand const& operand = p.operands[oi];
+			Term const* resolved = operand.isSlot ? run.slotValues[operand.index] : run.constValues[operand.index];
+			if (resolved ? *resolved != value : !TermType::typeSubsumes(slots[operand.index].type, value.type))
+				corresponds = false;
+		}
+		if (corresponds)
+			run.candidates[probe].push_back(&*fact);
+	}
+	return true;
+}
+
+void MatchProgram::unifyProbes(size_t depth, Run& run) const {
+	if (depth == run.order.size()) {
+		Substitution sub = Substitution(run.injective);
+		foreach(pair, run.preset)
+			if (pair->first != pair->second)
+				sub.set(pair->first, pair->second);
+		foreachindex(si, slots)
+			if (run.slotValues[si] && !run.presetSlots[si] && slots[si] != *run.slotValues[si])
+				sub.set(slots[si], *run.slotValues[si]);
+		run.subs->insert(sub);
+		return;
+	}
+
+	Probe const& probe = probes[run.order[depth]];
+	bool grounded = true;
+	foreach(operand, probe.operands)
+		if (operand->isSlot && !run.slotValues[operand->index])
+			grounded = false;
+
+	size_t targetsMark = run.targets.size();
+	size_t boundMark = run.bound.size();
+	foreach(fact, run.candidates[run.order[depth]]) {
+		bool matches = true;
+		foreachindex(oi, probe.operands) {
+			Operand const& operand = probe.operands[oi];
+			Term const& value = (*fact)->parameters[oi];
+			Term const* resolved = operand.isSlot ? run.slotValues[operand.index] : run.constValues[operand.index];
+
+			// Candidates already passed the type checks of unbound slots
+			if (resolved)
+				matches = *resolved == value;
+			else if (run.isTarget(value))
+				matches = false;
+			else {
+				run.slotValues[operand.index] = &value;
+				run.targets.push_back(&value);
+				run.bound.push_back(operand.index);
+			}
+			if (!matches) break;
+		}
+
+		if (matches)
+			unifyProbes(depth + 1, run);
+
+		while (run.bound.size() > boundMark) {
+			run.slotValues[run.bound.back()] = nullptr;
+			run.bound.pop_back();
+		}
+		run.targets.resize(targetsMark);
+
+		// A grounded probe only needs to be found once
+		if (matches && grounded) break;
+	}
+}
+
+bool MatchProgram::expand(State const& state, set<Term> const& instances, bool onlyFirst, /*r*/ vector<Substitution>& thetas) const {
+	if (!runnable) return false;
+
+	Run& run = threadRun();
+	run.slotValues.assign(slots.size(), nullptr);
+	run.constValues.clear();
+	foreach(constant, constants)
+		run.constValues.push_back(&*constant);
+	run.targets.clear();
+	run.instances.clear();
+	foreach(inst, instances)
+		run.instances.push_back(&*inst);
+
+	run.state = &state;
+	run.thetas = &thetas;
+	run.onlyFirst = onlyFirst;
+	run.done = false;
+
+	foreach(pi, completedBySlot[slots.size()])
+		if (!holds(*pi, run))
+			return true;
+
+	expandSlots(0, run);
+	return true;
+}
+
+bool MatchProgram::holds(size_t probe, Run& run) const {
+	Probe const& p = probes[probe];
+	Literal fact = Literal(p.literal.pred, p.literal.positive);
+	foreach(operand, p.operands)
+		fact.parameters.push_back(operand->isSlot ? *run.slotValues[operand->index] : *run.constValues[operand->index]);
+	return run.state->contains(fact);
+}
+
+void MatchProgram::expandSlots(size_t slot, Run& run) const {
+	if (slot == slots.size()) {
+		Substitution theta;
+		foreachindex(si, slots)
+			theta.set(slots[si], *run.slotValues[si]);
+		run.thetas->push_back(theta);
+		run.done = run.onlyFirst;
+		return;
+	}
+
+	foreach(inst, run.instances) {
+		if (run.isTarget(**inst) || !TermType::typeSubsumes(slots[slot].type, (*inst)->type))
+			continue;
+
+		run.slotValues[slot] = *inst;
+		run.targets.push_back(*inst);
+
+		// Probes are checked as soon as their last slot is bound
+		bool verified = true;
+		foreach(pi, completedBySlot[slot])
+			if (!holds(*pi, run)) {
+				verified = false;
+				break;
+			}
+		if (verified)
+			expandSlots(slot + 1, run);
+
+		run.targets.pop_back();
+		run.slotValues[slot] = nullptr;
+		if (run.done) return;
+	}
+}
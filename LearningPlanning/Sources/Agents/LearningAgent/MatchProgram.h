@@ -0,0 +1,71 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Side of a rule compiled for matching: its variables are numbered slots, its constants are numbered as well, and its
+ * literals become probes over those numbers, ordered so that each probe binds as few new slots as possible. Matching
+ * backtracks over an array of slot values instead of building a set of substitutions per literal, and only allocates the
+ * substitutions it finds once its per-thread buffers have grown.
+ *
+ * The interpreted matching treats a term its substitution maps to a variable as a variable again. Programs only run
+ * against ground facts and bindings, where both agree, and decline otherwise so that the caller falls back to it.
+ */
+
+#pragma once
+
+#include <set>
+#include <vector>
+
+#include "Logic/Domain.h"
+
+using namespace std;
+
+class MatchProgram {
+public:
+	MatchProgram() {}
+	// Slots go to the variables of the action, the literals and the extra terms
+	MatchProgram(Literal const& action, set<Literal> const& literals, vector<Term> const& extraTerms = {});
+
+	// Substitutions mapping the action to the target one and each literal to a fact regardless of its sign, extending
+	// preset and cleaned of constants, as unifying with a state does. Unmapped constants first map to themselves, except
+	// those another term maps to when pinMappedTo is false. Facts may come in two sets.
+	// Returns false, leaving subs untouched, when the program cannot run on these arguments.
+	bool unify(Literal const& target, set<Literal> const& facts, set<Literal> const* moreFacts, Substitution const& preset,
+			   bool pinMappedTo, /*r*/ set<Substitution>& subs) const;
+
+	// Injective mappings of the variable slots, in their order, to instances of subsuming types, mapping every literal to a
+	// fact of the state with its sign. They come in the order expandUncovered generates them. Returns false when the
+	// program cannot run.
+	bool expand(State const& state, set<Term> const& instances, bool onlyFirst, /*r*/ vector<Substitution>& thetas) const;
+
+	size_t slotCount() const;
+	size_t probeCount() const;
+
+private:
+	struct Operand {
+		bool isSlot;
+		size_t index;
+	};
+
+	struct Probe {
+		Literal literal;
+		vector<Operand> operands;
+	};
+
+	struct Run;
+	static Run& threadRun();
+
+	bool gatherCandidates(set<Literal> const& facts, size_t probe, Run& run) const;
+	bool holds(size_t probe, Run& run) const;
+	void unifyProbes(size_t depth, Run& run) const;
+	void expandSlots(size_t slot, Run& run) const;
+
+	bool runnable = false;
+	vector<Term> slots;
+	vector<Term> constants;
+	vector<Operand> action;
+	vector<Probe> probes;
+
+	// Probes whose last slot, in slot order, is the index; probes without slots come last
+	vector<vector<size_t>> completedBySlot;
+};
@@ -0,0 +1,103 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/LearningAgent/NecessityVector.h"
+
+#include <algorithm>
+
+NecessityVector::NecessityVector(map<Literal, float> const& precondNecs, map<Term, float> const& constNecs) {
+	foreach(pair, precondNecs) {
+		preconds.push_back(pair->first);
+		values.push_back(pair->second);
+	}
+	foreach(pair, constNecs) {
+		consts.push_back(pair->first);
+		values.push_back(pair->second);
+	}
+}
+
+size_t NecessityVector::size() const {
+	return values.size();
+}
+
+float NecessityVector::precondValue(Literal const& precond) const {
+	size_t index;
+	return precondIndex(precond, index) ? values[index] : 0.0f;
+}
+
+float NecessityVector::constValue(Term const& cst) const {
+	size_t index;
+	return constIndex(cst, index) ? values[index] : 0.0f;
+}
+
+map<Literal, float> NecessityVector::precondMap() const {
+	map<Literal, float> result;
+	foreachindex(pi, preconds)
+		result[preconds[pi]] = values[pi];
+	return result;
+}
+
+map<Term, float> NecessityVector::constMap() const {
+	map<Term, float> result;
+	foreachindex(ci, consts)
+		result[consts[ci]] = values[preconds.size() + ci];
+	return result;
+}
+
+NecessityMask NecessityVector::emptyMask() const {
+	return NecessityMask((values.size() + 63) / 64, 0);
+}
+
+bool NecessityVector::toMask(Unverified const& disj, /*r*/ NecessityMask& mask) const {
+	mask = emptyMask();
+
+	size_t index;
+	foreach(prec, disj.first) {
+		if (!precondIndex(*prec, index)) return false;
+		setBit(mask, index);
+	}
+	foreach(cst, disj.second) {
+		if (!constIndex(*cst, index)) return false;
+		setBit(mask, index);
+	}
+	return true;
+}
+
+// Preconditions and constants are sorted as in the maps they come from
+bool NecessityVector::precondIndex(Literal const& precond, /*r*/ size_t& index) const {
+	auto found = lower_bound(preconds.begin(), preconds.end(), precond);
+	if (found == preconds.end() || precond < *found) return false;
+	index = found - preconds.begin();
+	return true;
+}
+
+bool NecessityVector::constIndex(Term const& cst, /*r*/ size_t& index) const {
+	auto found = lower_bound(consts.begin(), consts.end(), cst);
+	if (found == consts.end() || cst < *found) return false;
+	index = preconds.size() + (found - consts.begin());
+	return true;
+}
+
+void NecessityVector::setBit(NecessityMask& mask, size_t index) {
+	mask[index / 64] |= 1ULL << (index % 64);
+}
+
+bool NecessityVector::hasBit(NecessityMask const& mask, size_t index) {
+	return (mask[index / 64] >> (index % 64)) & 1ULL;
+}
+
+void NecessityVector::clearBit(NecessityMask& mask, size_t index) {
+	mask[index / 64] &= ~(1ULL << (index % 64));
+}
+
+vector<size_t> NecessityVector::indices(NecessityMask const& mask) {
+	vector<size_t> result;
+	foreachindex(w, mask) {
+		uint64_t word = mask[w];
+		for (size_t b = 0; word != 0; b++, word >>= 1)
+			if (word & 1ULL) result.push_back(w * 64 + b);
+	}
+	return result;
+}
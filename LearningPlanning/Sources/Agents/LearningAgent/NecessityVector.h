@@ -0,0 +1,53 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Necessities of a rule laid out in a dense array, preconditions first and then constants, each sorted as in a map.
+ * Disjunctions of unverified necessities are bitmasks over the same indices, so that filtering
+ * them on a necessity or removing one from all of them are plain word operations.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "Logic/Domain.h"
+
+using namespace std;
+
+typedef pair<vector<Literal>, vector<Term>> Unverified;
+
+// One bit per necessity
+typedef vector<uint64_t> NecessityMask;
+
+struct NecessityVector {
+	vector<Literal> preconds;
+	vector<Term> consts;
+	vector<float> values;
+
+	NecessityVector() {}
+	NecessityVector(map<Literal, float> const& precondNecs, map<Term, float> const& constNecs);
+
+	size_t size() const;
+	// Missing necessities read as 0
+	float precondValue(Literal const& precond) const;
+	float constValue(Term const& cst) const;
+	// Same necessities keyed as when the vector was built, to be edited and given back to a rule
+	map<Literal, float> precondMap() const;
+	map<Term, float> constMap() const;
+	NecessityMask emptyMask() const;
+
+	// Fails when the disjunction holds a necessity missing from the vector
+	bool toMask(Unverified const& disj, /*r*/ NecessityMask& mask) const;
+
+	static void setBit(NecessityMask& mask, size_t index);
+	static bool hasBit(NecessityMask const& mask, size_t index);
+	static void clearBit(NecessityMask& mask, size_t index);
+	static vector<size_t> indices(NecessityMask const& mask);
+
+private:
+	bool precondIndex(Literal const& precond, /*r*/ size_t& index) const;
+	bool constIndex(Term const& cst, /*r*/ size_t& index) const;
+};
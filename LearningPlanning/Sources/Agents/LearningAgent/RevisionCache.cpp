@@ -0,0 +1,99 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/LearningAgent/RevisionCache.h"
+
+#include <functional>
+
+size_t RevisionCache::stateHash(State const& state) {
+	hash<string> hashString;
+	unsigned __int64 h = 14695981039346656037ULL;
+
+	// Facts are sorted, so equal states always hash the same
+	foreach(fact, state.facts) {
+		h ^= hashString(fact->pred.name) + (fact->positive ? 1 : 0);
+		h *= 1099511628211ULL;
+		foreach(param, fact->parameters) {
+			h ^= hashString(param->name);
+			h *= 1099511628211ULL;
+		}
+		h ^= h >> 29;
+	}
+	return (size_t)h;
+}
+
+shared_ptr<RevisionCache::Entry const> RevisionCache::find(ActionRule const& rule, size_t hash, State const& state, Literal const& action) {
+	Key key = Key(rule.getVersion(), hash, action);
+	shared_ptr<Entry const> entry;
+	{
+		lock_guard<mutex> guard(lock);
+		auto found = entries.find(key);
+		if (found != entries.end()) {
+			if (found->second->state == state)
+				entry = found->second;
+		}
+		else {
+			// Entries of the previous generation are moved to the current one when hit
+			auto previous = previousEntries.find(key);
+			if (previous != previousEntries.end() && previous->second->state == state) {
+				entry = previous->second;
+				previousEntries.erase(previous);
+				store(key, entry);
+			}
+		}
+	}
+
+	if (entry) hitCount++;
+	else missCount++;
+	return entry;
+}
+
+void RevisionCache::insert(ActionRule const& rule, size_t hash, Literal const& action, shared_ptr<Entry const> entry) {
+	lock_guard<mutex> guard(lock);
+	store(Key(rule.getVersion(), hash, action), entry);
+}
+
+void RevisionCache::store(Key const& key, shared_ptr<Entry const> entry) {
+	if (entries.size() >= capacity && entries.find(key) == entries.end()) {
+		previousEntries = move(entries);
+		entries.clear();
+	}
+	entries[key] = entry;
+}
+
+void RevisionCache::forgetOutdated(RuleStore const& rules) {
+	set<unsigned __int64> versions;
+	foreach(rit, rules)
+		versions.insert((*rit)->getVersion());
+
+	lock_guard<mutex> guard(lock);
+	for (auto it = entries.begin(); it != entries.end();) {
+		if (in(versions, get<0>(it->first))) it++;
+		else it = entries.erase(it);
+	}
+	for (auto it = previousEntries.begin(); it != previousEntries.end();) {
+		if (in(versions, get<0>(it->first))) it++;
+		else it = previousEntries.erase(it);
+	}
+}
+
+void RevisionCache::clear() {
+	lock_guard<mutex> guard(lock);
+	entries.clear();
+	previousEntries.clear();
+}
+
+size_t RevisionCache::size() const {
+	lock_guard<mutex> guard(lock);
+	return entries.size() + previousEntries.size();
+}
+
+size_t RevisionCache::hits() const {
+	return hitCount;
+}
+
+size_t RevisionCache::misses() const {
+	return missCount;
+}
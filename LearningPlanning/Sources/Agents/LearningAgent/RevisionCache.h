@@ -0,0 +1,66 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Fulfilment probabilities of rules, memoized per rule version, state and grounded action. A rule gets a new version
+ * whenever its necessities change, so entries of an outdated version are never hit again; forgetOutdated drops them.
+ * States are keyed by a hash, the state itself being kept to tell collisions apart. Several rollouts may look up and fill
+ * the cache at once.
+ *
+ * Entries are kept for two generations: once the current generation holds its capacity, it replaces the previous one,
+ * whose entries are dropped unless they were hit in the meantime.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <tuple>
+
+#include "Agents/LearningAgent/ActionRule.h"
+#include "Agents/LearningAgent/RuleStore.h"
+
+using namespace std;
+
+#define REVISION_CACHE_CAPACITY 20000
+
+class RevisionCache {
+public:
+	struct Entry {
+		State state;
+		float probability = 0.0f;
+		bool prematches = false;
+		set<Substitution> subs;
+	};
+
+	RevisionCache(size_t inCapacity = REVISION_CACHE_CAPACITY) : capacity(inCapacity), hitCount(0), missCount(0) {}
+
+	static size_t stateHash(State const& state);
+
+	// nullptr on a miss
+	shared_ptr<Entry const> find(ActionRule const& rule, size_t hash, State const& state, Literal const& action);
+	void insert(ActionRule const& rule, size_t hash, Literal const& action, shared_ptr<Entry const> entry);
+
+	// Drops entries of versions these rules no longer have
+	void forgetOutdated(RuleStore const& rules);
+	void clear();
+
+	size_t size() const;
+	size_t hits() const;
+	size_t misses() const;
+
+private:
+	typedef tuple<unsigned __int64, size_t, Literal> Key;
+
+	// Called with the lock held
+	void store(Key const& key, shared_ptr<Entry const> entry);
+
+	size_t capacity;
+	mutable mutex lock;
+	map<Key, shared_ptr<Entry const>> entries;
+	map<Key, shared_ptr<Entry const>> previousEntries;
+	atomic<size_t> hitCount, missCount;
+};
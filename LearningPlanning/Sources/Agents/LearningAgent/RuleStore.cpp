@@ -0,0 +1,90 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/LearningAgent/RuleStore.h"
+
+#include <algorithm>
+
+const set<shared_ptr<ActionRule>> noRules;
+
+bool RuleStore::insert(shared_ptr<ActionRule> rule) {
+	if (!rules.insert(rule).second) return false;
+
+	actionIndex[rule->actionLiteral.pred].insert(rule);
+	effectIndex[effectSignature(*rule)].insert(rule);
+	return true;
+}
+
+bool RuleStore::erase(shared_ptr<ActionRule> rule) {
+	if (rules.erase(rule) == 0) return false;
+
+	auto action = actionIndex.find(rule->actionLiteral.pred);
+	action->second.erase(rule);
+	if (action->second.empty())
+		actionIndex.erase(action);
+
+	auto effects = effectIndex.find(effectSignature(*rule));
+	effects->second.erase(rule);
+	if (effects->second.empty())
+		effectIndex.erase(effects);
+	return true;
+}
+
+void RuleStore::clear() {
+	rules.clear();
+	actionIndex.clear();
+	effectIndex.clear();
+}
+
+size_t RuleStore::size() const {
+	return rules.size();
+}
+
+bool RuleStore::empty() const {
+	return rules.empty();
+}
+
+RuleStore::const_iterator RuleStore::begin() const {
+	return rules.begin();
+}
+
+RuleStore::const_iterator RuleStore::end() const {
+	return rules.end();
+}
+
+set<shared_ptr<ActionRule>> const& RuleStore::all() const {
+	return rules;
+}
+
+vector<shared_ptr<ActionRule>> RuleStore::toVector() const {
+	return vector<shared_ptr<ActionRule>>(rules.begin(), rules.end());
+}
+
+set<shared_ptr<ActionRule>> const& RuleStore::byAction(Predicate const& pred) const {
+	auto found = actionIndex.find(pred);
+	if (found == actionIndex.end())
+		return noRules;
+	return found->second;
+}
+
+set<shared_ptr<ActionRule>> const& RuleStore::byEffects(ActionRule const& example) const {
+	auto found = effectIndex.find(effectSignature(example));
+	if (found == effectIndex.end())
+		return noRules;
+	return found->second;
+}
+
+string RuleStore::effectSignature(ActionRule const& rule) {
+	vector<string> effects;
+	foreach(eff, rule.add)
+		effects.push_back(eff->pred.name + "/" + to_string(eff->parameters.size()));
+	foreach(eff, rule.del)
+		effects.push_back(eff->pred.name + "/" + to_string(eff->parameters.size()));
+	sort(effects.begin(), effects.end());
+
+	return rule.actionLiteral.pred.name + "/" + to_string(rule.actionLiteral.parameters.size())
+		+ "|" + to_string(rule.add.size()) + "," + to_string(rule.del.size())
+		+ "|" + join(",", effects);
+}
@@ -0,0 +1,53 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Set of action rules indexed by action predicate and by effect signature. A rule can only prematch an example with the
+ * same action predicate, and can only cover or post-generalize an example whose action and effects have the same shape:
+ * action predicate and arity, then the numbers of add and delete effects and the multiset of effect predicates with their
+ * arity. Add and delete effects are unified together, and State::query ignores signs, so signs are left out. Lookups
+ * return the rules that could match, in the same order as a full iteration over the store.
+ *
+ * The action literal and effects of a rule must not change while it is stored, as its buckets are not recomputed.
+ */
+
+#pragma once
+
+#include <memory>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Agents/LearningAgent/ActionRule.h"
+
+using namespace std;
+
+class RuleStore {
+public:
+	typedef set<shared_ptr<ActionRule>>::const_iterator const_iterator;
+
+	bool insert(shared_ptr<ActionRule> rule);
+	bool erase(shared_ptr<ActionRule> rule);
+	void clear();
+
+	size_t size() const;
+	bool empty() const;
+	const_iterator begin() const;
+	const_iterator end() const;
+
+	set<shared_ptr<ActionRule>> const& all() const;
+	vector<shared_ptr<ActionRule>> toVector() const;
+
+	// Rules that may prematch an example of this action predicate
+	set<shared_ptr<ActionRule>> const& byAction(Predicate const& pred) const;
+	// Rules that may cover or post-generalize this example
+	set<shared_ptr<ActionRule>> const& byEffects(ActionRule const& example) const;
+
+	static string effectSignature(ActionRule const& rule);
+
+private:
+	set<shared_ptr<ActionRule>> rules;
+	map<Predicate, set<shared_ptr<ActionRule>>> actionIndex;
+	map<string, set<shared_ptr<ActionRule>>> effectIndex;
+};
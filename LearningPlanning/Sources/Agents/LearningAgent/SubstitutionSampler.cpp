@@ -0,0 +1,147 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/LearningAgent/SubstitutionSampler.h"
+
+#include <algorithm>
+
+SubstitutionSampler::SubstitutionSampler(State const& state, vector<Literal> const& preconds, vector<float> const& precondNecs, NecessityVector const& necessities,
+										 Substitution const& rho, vector<Term> const& variables, set<Term> const& instances) :
+	state(state), preconds(preconds), precondNecs(precondNecs), variables(variables), instances(toVec(instances)) {
+
+	foreachindex(i, this->instances)
+		instanceIds[this->instances[i]] = i;
+	foreach(fact, state.facts)
+		factsByPred[fact->pred].push_back(&*fact);
+
+	// A constant contradicted by the substitution adds up its necessity
+	foreach(var, variables) {
+		Opt<Term> original = rho.getInverse(*var);
+		vector<float> losses;
+
+		foreach(inst, this->instances) {
+			float loss = 0.0f;
+			if (original.there && !original.obj.isVariable && original.obj != *inst)
+				loss += necessities.constValue(original.obj);
+			if (!original.there || original.obj != *inst)
+				loss += necessities.constValue(*inst);
+			losses.push_back(loss);
+		}
+		constLosses.push_back(losses);
+	}
+}
+
+Substitution SubstitutionSampler::sample(Substitution sigma, mt19937& g) {
+	vector<bool> left = vector<bool>(instances.size(), true);
+	size_t leftCount = instances.size();
+
+	Node* node = &root;
+	foreachindex(vi, variables) {
+		if (leftCount == 0) break;
+		if (!node->built)
+			build(*node, vi, sigma, left);
+
+		size_t selected = node->instances[node->table.sample(g)];
+		sigma.set(variables[vi], instances[selected]);
+		left[selected] = false;
+		leftCount--;
+
+		unique_ptr<Node>& child = node->children[selected];
+		if (!child)
+			child.reset(new Node());
+		node = child.get();
+	}
+
+	return sigma;
+}
+
+void SubstitutionSampler::build(Node& node, size_t varIndex, Substitution const& sigma, vector<bool> const& left) {
+	Term const& var = variables[varIndex];
+
+	foreachindex(i, instances)
+		if (left[i])
+			node.instances.push_back(i);
+
+	// Preconditions without the variable lose the same necessity whatever instance it gets
+	vector<Literal> subbed;
+	vector<float> fixedLosses;
+	vector<bool> hasVar;
+	foreachindex(pi, preconds) {
+		subbed.push_back(sigma.apply(preconds[pi]));
+		hasVar.push_back(in(subbed[pi].parameters, var));
+		fixedLosses.push_back(hasVar[pi] ? 0.0f : precondLoss(subbed[pi], precondNecs[pi], left));
+	}
+
+	vector<float> necessityLosses;
+	foreach(inst, node.instances) {
+		float necessityLoss = 0.0f;
+		foreachindex(pi, preconds) {
+			if (!hasVar[pi]) {
+				necessityLoss += fixedLosses[pi];
+				continue;
+			}
+
+			Literal lit = subbed[pi];
+			foreach(param, lit.parameters)
+				if (*param == var)
+					*param = instances[*inst];
+			necessityLoss += precondLoss(lit, precondNecs[pi], left);
+		}
+		necessityLoss += constLosses[varIndex][*inst];
+		necessityLosses.push_back(necessityLoss);
+	}
+
+	// Weighting low necessity losses more heavily
+	vector<float> weights;
+
+	float maxLoss = 0.0f;
+	float lossSum = 0.0f;
+	foreach(loss, necessityLosses) {
+		maxLoss = max(maxLoss, *loss);
+		lossSum += *loss;
+	}
+	maxLoss *= 2.0f;
+	lossSum = maxLoss * (float)necessityLosses.size() - lossSum;
+
+	foreach(loss, necessityLosses)
+		weights.push_back((maxLoss - *loss) / lossSum);
+
+	// Without any loss, weights are undefined and the cumulative selection used to fall through to the last instance
+	if (lossSum <= 0.0f) {
+		weights = vector<float>(necessityLosses.size(), 0.0f);
+		weights.back() = 1.0f;
+	}
+
+	node.table = AliasTable(weights);
+	node.built = true;
+}
+
+float SubstitutionSampler::precondLoss(Literal const& subbed, float necessity, vector<bool> const& left) const {
+	if (subbed.grounded())
+		return state.contains(subbed) ? 0.0f : necessity;
+
+	// The state must hold a fact the precondition could still be mapped to, with instances left
+	auto found = factsByPred.find(subbed.pred);
+	if (found == factsByPred.end()) return necessity;
+
+	foreach(fact, found->second) {
+		Literal const& q = **fact;
+		if (q.parameters.size() != subbed.parameters.size()) continue;
+
+		bool valid = true;
+		foreachindex(pi, subbed.parameters) {
+			Term const& param = subbed.parameters[pi];
+			if (!param.isVariable)
+				valid = param == q.parameters[pi];
+			else {
+				auto id = instanceIds.find(q.parameters[pi]);
+				valid = TermType::typeSubsumes(param.type, q.parameters[pi].type) && id != instanceIds.end() && left[id->second];
+			}
+			if (!valid) break;
+		}
+		if (valid) return 0.0f;
+	}
+	return necessity;
+}
@@ -0,0 +1,60 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Random substitutions of a rule's remaining variables, drawn as in generateRandomSubs: variables are mapped in a fixed
+ * order, each to one of the instances left, weighting low necessity losses more heavily. The weights of a variable only
+ * depend on the instances already chosen for the previous ones, so the choices made so far form a tree whose nodes keep
+ * their alias table, and samples sharing a prefix of choices draw each of them in constant time. Losses due to constants
+ * do not depend on previous choices and are computed once per variable and instance.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "Logic/Domain.h"
+#include "Agents/LearningAgent/NecessityVector.h"
+#include "Utils.h"
+
+using namespace std;
+
+class SubstitutionSampler {
+public:
+	// Preconditions are already generalized by rho, and come with their necessities. Constants are read from the rule's
+	// necessities. The state must outlive the sampler
+	SubstitutionSampler(State const& state, vector<Literal> const& preconds, vector<float> const& precondNecs, NecessityVector const& necessities,
+						Substitution const& rho, vector<Term> const& variables, set<Term> const& instances);
+
+	// Extends sigma with one instance per variable, while there are instances left
+	Substitution sample(Substitution sigma, mt19937& g);
+
+private:
+	struct Node {
+		bool built = false;
+		vector<size_t> instances;
+		AliasTable table;
+		map<size_t, unique_ptr<Node>> children;
+	};
+
+	void build(Node& node, size_t varIndex, Substitution const& sigma, vector<bool> const& left);
+	float precondLoss(Literal const& subbed, float necessity, vector<bool> const& left) const;
+
+	State const& state;
+	vector<Literal> preconds;
+	vector<float> precondNecs;
+	vector<Term> variables;
+
+	vector<Term> instances;
+	map<Term, size_t> instanceIds;
+	map<Predicate, vector<Literal const*>> factsByPred;
+
+	// Loss due to constants, per variable and instance
+	vector<vector<float>> constLosses;
+
+	Node root;
+};
@@ -0,0 +1,75 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/PartialOrderPlanner/OrderingGraph.h"
+
+#define WORD_BITS 64
+
+void OrderingGraph::addConstraint(size_t before, size_t after) {
+	grow(max(before, after) + 1);
+	if (before == after || get(after, before))
+		cyclic = true;
+	if (get(before, after))
+		return;
+
+	vector<unsigned __int64> added = rows[after];
+	added[after / WORD_BITS] |= 1ULL << (after % WORD_BITS);
+
+	// Every step preceding before (and before itself) now precedes after and its successors
+	foreachindex(step, rows) {
+		if (step != before && !get(step, before)) continue;
+
+		vector<unsigned __int64>& row = rows[step];
+		foreachindex(w, row)
+			row[w] |= added[w];
+	}
+}
+
+bool OrderingGraph::tryAddConstraint(size_t before, size_t after) {
+	if (cyclic || wouldCreateCycle(before, after))
+		return false;
+	addConstraint(before, after);
+	return true;
+}
+
+bool OrderingGraph::precedes(size_t before, size_t after) const {
+	if (before >= rows.size() || after >= rows.size()) return false;
+	return get(before, after);
+}
+
+bool OrderingGraph::wouldCreateCycle(size_t before, size_t after) const {
+	return before == after || precedes(after, before);
+}
+
+bool OrderingGraph::isCyclic() const {
+	return cyclic;
+}
+
+size_t OrderingGraph::size() const {
+	return rows.size();
+}
+
+vector<size_t> OrderingGraph::successors(size_t before) const {
+	vector<size_t> result;
+	if (before >= rows.size()) return result;
+
+	foreachindex(step, rows)
+		if (get(before, step))
+			result.push_back(step);
+	return result;
+}
+
+void OrderingGraph::grow(size_t stepCount) {
+	if (stepCount <= rows.size()) return;
+
+	size_t words = (stepCount + WORD_BITS - 1) / WORD_BITS;
+	rows.resize(stepCount);
+	foreach(row, rows)
+		row->resize(words, 0ULL);
+}
+
+bool OrderingGraph::get(size_t row, size_t step) const {
+	return (rows[row][step / WORD_BITS] >> (step % WORD_BITS)) & 1ULL;
+}
@@ -0,0 +1,39 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "Utils.h"
+
+using namespace std;
+
+// Ordering constraints between the steps of a partial plan, identified by their index. The transitive closure is kept up
+// to date on each insertion, as one bitset row per step: row i holds every step that must come after step i.
+// Reachability and cycle queries are then simple bit tests, and inserting a constraint ORs one row into the rows of its
+// predecessors.
+class OrderingGraph {
+public:
+	// Adds before -> after, even if it closes a cycle (the graph is then marked cyclic)
+	void addConstraint(size_t before, size_t after);
+	// Adds before -> after only if the graph stays acyclic
+	bool tryAddConstraint(size_t before, size_t after);
+
+	// True if after is reachable from before
+	bool precedes(size_t before, size_t after) const;
+	bool wouldCreateCycle(size_t before, size_t after) const;
+	bool isCyclic() const;
+
+	size_t size() const;
+	vector<size_t> successors(size_t before) const;
+
+private:
+	void grow(size_t stepCount);
+	bool get(size_t row, size_t step) const;
+
+	vector<vector<unsigned __int64>> rows;
+	bool cyclic = false;
+};
@@ -54,6 +54,8 @@ void PopAgent::updateProblem(vector<Term> inInstances, Goal inGoal, vector<Liter
 	start = GroundedAction();
 	actions.clear();
 	constraints.clear();
+	orderingGraph = OrderingGraph();
+	actionIndices.clear();
 	agenda.clear();
 
 	vector<Condition> goalFacts;
@@ -138,28 +140,19 @@ bool PopAgent::findOpenPreconditions(Condition& subgoal, GroundedAction& action,
 	return true;
 }
 
-bool visit(map<GroundedAction, set<GroundedAction>>& graph, GroundedAction vertex, set<GroundedAction> path) {
-	set<GroundedAction> newPath = path;
-	newPath.insert(vertex);
-	foreach(it, graph[vertex]) {
-		if (in(newPath, *it)) return true;
-		if (visit(graph, *it, newPath)) return true;
-	}
-	return false;
-}
+size_t PopAgent::actionIndex(GroundedAction const& action) {
+	auto found = actionIndices.find(action);
+	if (found != actionIndices.end())
+		return found->second;
 
-bool PopAgent::checkCyclic(set<OrderingConstraint> graph) {
-	map<GroundedAction, set<GroundedAction>> mapGraph;
-	foreach(it, graph)
-		if (mapGraph.find(it->first) == mapGraph.end())
-			mapGraph[it->first] = { it->second };
-		else
-			mapGraph[it->first].insert(it->second);
+	size_t index = actionIndices.size();
+	actionIndices[action] = index;
+	return index;
+}
 
-	foreach(it, mapGraph)
-		if (visit(mapGraph, it->first, {}))
-			return true;
-	return false;
+bool PopAgent::createsCycle(OrderingConstraint constraint) {
+	// Constraints are only added when they keep the graph acyclic
+	return orderingGraph.wouldCreateCycle(actionIndex(constraint.first), actionIndex(constraint.second));
 }
 
 bool PopAgent::isAThreat(Condition precondition, Condition effect) {
@@ -171,11 +164,9 @@ bool PopAgent::isAThreat(Condition precondition, Condition effect) {
 void PopAgent::addConstraint(OrderingConstraint constraint) {
 	if (constraint.first == finish || constraint.second == start) return;
 
-	set<OrderingConstraint> newConstraints = constraints;
-	newConstraints.insert(constraint);
-	if (checkCyclic(newConstraints)) return;
+	if (!orderingGraph.tryAddConstraint(actionIndex(constraint.first), actionIndex(constraint.second))) return;
 
-	constraints = newConstraints;
+	constraints.insert(constraint);
 }
 
 void PopAgent::protect(CausalLink causalLink, GroundedAction action) {
@@ -189,15 +180,11 @@ void PopAgent::protect(CausalLink causalLink, GroundedAction action) {
 
 	if (threat && action != causalLink.act1 && action != causalLink.act2) {
 		// Try promotion
-		set<OrderingConstraint> newConstraints = constraints;
-		newConstraints.insert({ action, causalLink.act1 });
-		if (!checkCyclic(newConstraints))
+		if (!createsCycle({ action, causalLink.act1 }))
 			addConstraint({ action, causalLink.act1 });
 		else {
 			// Try demotion
-			newConstraints = constraints;
-			newConstraints.insert({ causalLink.act2, action });
-			if (!checkCyclic(newConstraints))
+			if (!createsCycle({ causalLink.act2, action }))
 				addConstraint({ causalLink.act2, action });
 			else if (verbose) cout << "Unable to resolve a threat caused by " << action << " onto " << causalLink.toString() << endl;
 		}
@@ -217,6 +204,7 @@ bool PopAgent::findPlan(State state) {
 
 	while (agenda.size() > 0) {
 		step += 1;
+		if (cancelled()) return false;
 
 		if (step > MAX_STEPS) {
 			if (verbose) cout << "Couldn't find a solution in " << MAX_STEPS << " steps." << endl;
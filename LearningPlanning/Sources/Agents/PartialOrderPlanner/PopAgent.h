@@ -15,6 +15,7 @@
 #include <set>
 
 #include "Agents/Agent.h"
+#include "Agents/PartialOrderPlanner/OrderingGraph.h"
 #include "Logic/Domain.h"
 #include "Utils.h"
 
@@ -53,7 +54,8 @@ protected:
 	void prepareActionSubstitutions();
 
 	bool findOpenPreconditions(Condition& subgoal, GroundedAction& action, vector<GroundedAction>& actionsForPrecond);
-	bool checkCyclic(set<OrderingConstraint> graph);
+	size_t actionIndex(GroundedAction const& action);
+	bool createsCycle(OrderingConstraint constraint);
 	bool isAThreat(Condition precondition, Condition effect);
 	void addConstraint(OrderingConstraint constraint);
 	void addConstraint(GroundedAction before, GroundedAction after) {
@@ -73,5 +75,7 @@ protected:
 	GroundedAction start, finish;
 	set<GroundedAction> actions;
 	set<OrderingConstraint> constraints;
+	OrderingGraph orderingGraph;
+	map<GroundedAction, size_t> actionIndices;
 	set<AgendaElem> agenda;
 };
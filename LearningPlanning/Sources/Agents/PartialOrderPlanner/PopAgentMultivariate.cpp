@@ -5,8 +5,15 @@
 
 #include "Agents/PartialOrderPlanner/PopAgentMultivariate.h"
 
+#include <queue>
+#include <unordered_set>
+#include <algorithm>
+
 using namespace std;
 
+// Heuristic, insertion order, plan: the earliest inserted plan wins ties
+typedef tuple<float, size_t, shared_ptr<PartialPlan>> OpenEntry;
+
 PartialPlan::PartialPlan(State startState, Goal finishGoal, Literal inStartLiteral, Literal inFinishLiteral) :
 	startLiteral(inStartLiteral), finishLiteral(inFinishLiteral) {
 	vector<Condition> startConditions, finishConditions;
@@ -34,12 +41,12 @@ PartialPlan::PartialPlan(State startState, Goal finishGoal, Literal inStartLiter
 		safeVariablesFinish.set(*var, Variable(var->name + "_1"));
 	finishAction = safeVariablesFinish.apply(finishAction);
 
-	actions.push_back(startAction); // Index 0
-	actions.push_back(finishAction); // Index 1
+	actions.write().push_back(startAction); // Index 0
+	actions.write().push_back(finishAction); // Index 1
 	addConstraint(0, 1);
 
 	foreach(precond, finishConditions)
-		openPreconditions.insert({ *precond, 1 });
+		openPreconditions.write().insert({ *precond, 1 });
 }
 
 PartialPlan::PartialPlan(PartialPlan const& other) {
@@ -54,6 +61,7 @@ PartialPlan::PartialPlan(PartialPlan const& other) {
 	constraints = other.constraints;
 	openPreconditions = other.openPreconditions;
 
+	recordHistory = other.recordHistory;
 	history = other.history;
 }
 
@@ -65,7 +73,7 @@ void PartialPlan::computeNextChoices(vector<GroundedAction> availableActions,
 	set<pair<GroundedAction, Substitution>> bestAS;
 	OpenPrecondition ASPrecond;
 
-	foreach(openPrecond, openPreconditions) {
+	foreach(openPrecond, openPreconditions.get()) {
 
 		// 1. Looking for direct bindings from current precondition to an existing action
 		set<pair<size_t, Substitution>> bindings = getDirectBindings(*openPrecond);
@@ -80,7 +88,7 @@ void PartialPlan::computeNextChoices(vector<GroundedAction> availableActions,
 			set<Term> vars = action.getVariables();
 			Substitution safeVariables = Substitution(false);
 			foreach(var, vars)
-				safeVariables.set(*var, Variable(var->name + "_" + to_string(actions.size())));
+				safeVariables.set(*var, Variable(var->name + "_" + to_string(actions->size())));
 			action = safeVariables.apply(action);
 
 			foreach(eff, action.postConditions) {
@@ -130,7 +138,7 @@ void PartialPlan::computeNextChoices(vector<GroundedAction> availableActions,
 void PartialPlan::updateHeuristic() {
 	heuristic = 0.0f;
 
-	foreach(precond, openPreconditions)
+	foreach(precond, openPreconditions.get())
 		if (hasDirectBinding(*precond))
 			heuristic += 1.0f;
 		else
@@ -140,18 +148,19 @@ void PartialPlan::updateHeuristic() {
 }
 
 bool PartialPlan::goalCheck() {
-	return openPreconditions.size() == 0;
+	return openPreconditions->size() == 0;
 }
 
 bool PartialPlan::directlyBindPrecondition(OpenPrecondition precond, size_t toAction, Substitution sub) {
-	history.push_back("Bound precondition: " + precond.first.toString() + " required by [" + to_string(precond.second) + "] to [" + to_string(toAction) + "]");
+	if (recordHistory)
+		history.write().push_back("Bound precondition: " + precond.first.toString() + " required by [" + to_string(precond.second) + "] to [" + to_string(toAction) + "]");
 	
 	// 1. Remove precond from openPreconditions
-	openPreconditions.erase(precond);
+	openPreconditions.write().erase(precond);
 
 	// 2. Perform variable binding
 	if (!bindVariables(sub)) return false;
-	foreach(act, actions) {
+	foreach(act, actions.get()) {
 		set<Term> params;
 		foreach(pit, act->actionLiteral.parameters)
 			params.insert(*pit);
@@ -163,11 +172,12 @@ bool PartialPlan::directlyBindPrecondition(OpenPrecondition precond, size_t toAc
 
 	// 4. Add (Action->Precond->Precond's owner) causal link
 	CausalLink newLink = CausalLink(toAction, precond.first, precond.second);
-	causalLinks.insert(newLink);
-	history.push_back("Added causal link: (" + to_string(toAction) + ", " + precond.first.lit.toString() + ", " + to_string(precond.second) + ")");
+	causalLinks.write().insert(newLink);
+	if (recordHistory)
+		history.write().push_back("Added causal link: (" + to_string(toAction) + ", " + precond.first.lit.toString() + ", " + to_string(precond.second) + ")");
 
 	// 5. Protect new link from every other action
-	foreachindex(i, actions)
+	foreachindex(i, actions.get())
 		if (!protectCausalLink(newLink, i))
 			return false;
 
@@ -176,7 +186,7 @@ bool PartialPlan::directlyBindPrecondition(OpenPrecondition precond, size_t toAc
 
 bool PartialPlan::applyActionToPrecondition(OpenPrecondition precond, GroundedAction action, Substitution sub) {
 	// 1. Remove precond from openPreconditions
-	openPreconditions.erase(precond);
+	openPreconditions.write().erase(precond);
 
 	// 2. Perform variable binding
 	action = sub.apply(action);
@@ -192,33 +202,35 @@ bool PartialPlan::applyActionToPrecondition(OpenPrecondition precond, GroundedAc
 	if (uniqueActions.size() != actions.size()) return false;*/
 
 	// 3. Insert new action
-	size_t actionId = actions.size();
-	actions.push_back(action);
-	history.push_back("Added action: [" + to_string(actionId) + "] - " + action.actionLiteral.toString());
+	size_t actionId = actions->size();
+	actions.write().push_back(action);
+	if (recordHistory)
+		history.write().push_back("Added action: [" + to_string(actionId) + "] - " + action.actionLiteral.toString());
 
 	// 4. Add Start->Action constraint and Action->Finish
 	addConstraint(0, actionId);
 	addConstraint(actionId, 1);
 
 	// 5. Protect all causal links from new action
-	foreach(link, causalLinks)
+	foreach(link, causalLinks.get())
 		if (!protectCausalLink(*link, actionId))
 			return false;
 
 	// 6. Insert new preconditions to openPreconditions
 	foreach(newPrecond, action.preConditions)
-		openPreconditions.insert({ *newPrecond, actionId });
+		openPreconditions.write().insert({ *newPrecond, actionId });
 
 	// 7. Add Action->Precond's owner constraint
 	addConstraint(actionId, precond.second);
 
 	// 8. Add (Action->Precond->Precond's owner) causal link
 	CausalLink newLink = CausalLink(actionId, precond.first, precond.second);
-	causalLinks.insert(newLink);
-	history.push_back("Added causal link: (" + to_string(actionId) + ", " + precond.first.lit.toString() + ", " + to_string(precond.second) + ")");
+	causalLinks.write().insert(newLink);
+	if (recordHistory)
+		history.write().push_back("Added causal link: (" + to_string(actionId) + ", " + precond.first.lit.toString() + ", " + to_string(precond.second) + ")");
 
 	// 9. Protect new link from every other action
-	foreachindex(i, actions)
+	foreachindex(i, actions.get())
 		if (!protectCausalLink(newLink, i))
 			return false;
 
@@ -226,102 +238,70 @@ bool PartialPlan::applyActionToPrecondition(OpenPrecondition precond, GroundedAc
 }
 
 bool PartialPlan::bindVariables(Substitution sub) {
-	if (sub.getMapping().size() > 0) history.push_back("Bound variables: " + sub.toString());
+	if (recordHistory && sub.getMapping().size() > 0) history.write().push_back("Bound variables: " + sub.toString());
+	if (sub.getMapping().size() == 0) {
+		// Nothing to rename, only the links need to be checked again
+		foreach(link, causalLinks.get())
+			foreachindex(i, actions.get())
+				if (!protectCausalLink(*link, i)) return false;
+		return true;
+	}
 
-	foreachindex(i, actions)
-		actions[i] = sub.apply(actions[i]);
+	vector<GroundedAction>& writableActions = actions.write();
+	foreachindex(i, writableActions)
+		writableActions[i] = sub.apply(writableActions[i]);
 
 	set<CausalLink> newCausalLinks;
-	foreach(link, causalLinks)
+	foreach(link, causalLinks.get())
 		newCausalLinks.insert(CausalLink(get<0>(*link), Condition(sub.apply(get<1>(*link).lit), get<1>(*link).truth), get<2>(*link)));
 	causalLinks = newCausalLinks;
 
 	set<OpenPrecondition> newOpenPreconditions;
-	foreach(precond, openPreconditions)
+	foreach(precond, openPreconditions.get())
 		newOpenPreconditions.insert({ Condition(sub.apply(precond->first.lit), precond->first.truth), precond->second });
 	openPreconditions = newOpenPreconditions;
 
-	foreach(link, causalLinks)
-		foreachindex(i, actions)
+	foreach(link, causalLinks.get())
+		foreachindex(i, actions.get())
 			if (!protectCausalLink(*link, i)) return false;
 	return true;
 }
 
 void PartialPlan::addConstraint(size_t before, size_t after) {
-	history.push_back("Added constraint: " + to_string(before) + " -> " + to_string(after));
-	if (in(constraints, before)) constraints[before].insert(after);
-	else constraints[before] = { after };
+	if (recordHistory) history.write().push_back("Added constraint: " + to_string(before) + " -> " + to_string(after));
+	if (!constraints->precedes(before, after))
+		constraints.write().addConstraint(before, after);
 }
 
-void PartialPlan::removeConstraint(size_t before, size_t after) {
-	history.push_back("Removed constraint: " + to_string(before) + " -> " + to_string(after));
-	if (in(constraints, before)) constraints[before].erase(after);
-}
-
-bool PartialPlan::hasConstraint(size_t before, size_t after) {
-	if (!in(constraints, before)) return false;
-	if (!in(constraints[before], after)) return false;
+bool PartialPlan::tryAddConstraint(size_t before, size_t after) {
+	if (constraints->isCyclic() || constraints->wouldCreateCycle(before, after))
+		return false;
+	addConstraint(before, after);
 	return true;
 }
 
-set<size_t> PartialPlan::getConstraints(size_t before) {
-	if (!in(constraints, before)) return {};
-	return constraints[before];
-}
-
 bool PartialPlan::protectCausalLink(CausalLink link, size_t fromAction) {
 	if (fromAction == get<0>(link) || fromAction == get<2>(link)) return true;
 
-	GroundedAction action = actions[fromAction];
+	GroundedAction const& action = actions.get()[fromAction];
 	foreach(eff, action.postConditions) {
 		if (get<1>(link).truth == eff->truth) continue;
 		if (get<1>(link).lit != eff->lit) continue;
 
-		history.push_back("Threat detected: action [" + to_string(fromAction) + "] threatens (" + to_string(get<0>(link)) + ", " + get<1>(link).toString() + ", " + to_string(get<2>(link)) + ")");
+		if (recordHistory) history.write().push_back("Threat detected: action [" + to_string(fromAction) + "] threatens (" + to_string(get<0>(link)) + ", " + get<1>(link).toString() + ", " + to_string(get<2>(link)) + ")");
 		
-		// Trying promotion
-		addConstraint(fromAction, get<0>(link));
-		if (checkCyclicity()) {
-			removeConstraint(fromAction, get<0>(link));
-			history.pop_back();
-			history.pop_back();
-
-			// Trying demotion
-			addConstraint(get<2>(link), fromAction);
-			if (checkCyclicity()) {
-				removeConstraint(get<2>(link), fromAction);
-				history.pop_back();
-				history.pop_back();
-
-				// Couldn't solve threat
-				return false;
-			}
-		}
+		// Trying promotion, then demotion
+		if (!tryAddConstraint(fromAction, get<0>(link)) && !tryAddConstraint(get<2>(link), fromAction))
+			return false; // Couldn't solve threat
 		break;
 	}
 	return true;
 }
 
-bool visit(OrderingGraph& graph, size_t vertex, set<size_t> path) {
-	path.insert(vertex);
-	foreach(i, graph[vertex]) {
-		if (in(path, *i)) return true;
-		if (visit(graph, *i, path)) return true;
-	}
-	return false;
-}
-
-bool PartialPlan::checkCyclicity() {
-	foreach(i, constraints)
-		if (visit(constraints, i->first, {}))
-			return true;
-	return false;
-}
-
 bool PartialPlan::hasDirectBinding(OpenPrecondition precond) {
-	foreachindex(i, actions)
+	foreachindex(i, actions.get())
 		if (!isAAfterB(i, precond.second))
-			foreach(eff, actions[i].postConditions) {
+			foreach(eff, actions.get()[i].postConditions) {
 				if (eff->truth != precond.first.truth) continue;
 
 				// Try to unify effect with the precondition being solved
@@ -334,9 +314,9 @@ bool PartialPlan::hasDirectBinding(OpenPrecondition precond) {
 
 set<pair<size_t, Substitution>> PartialPlan::getDirectBindings(OpenPrecondition precond) {
 	set<pair<size_t, Substitution>> bindings;
-	foreachindex(i, actions)
+	foreachindex(i, actions.get())
 		if (!isAAfterB(i, precond.second)) {
-			foreach(eff, actions[i].postConditions) {
+			foreach(eff, actions.get()[i].postConditions) {
 				if (eff->truth != precond.first.truth) continue;
 
 				// Try to unify effect with the precondition being solved
@@ -350,23 +330,13 @@ set<pair<size_t, Substitution>> PartialPlan::getDirectBindings(OpenPrecondition
 	return bindings;
 }
 
-bool PartialPlan::isAAfterB(size_t actionA, size_t actionB) {
-	vector<size_t> search = { actionB };
-	size_t index = 0;
-	while (index < search.size()) {
-		set<size_t> nexts = getConstraints(search[index]);
-		foreach(next, nexts) {
-			if (*next == actionA) return true;
-			insertUnique(&search, *next);
-		}
-		index++;
-	}
-	return false;
+bool PartialPlan::isAAfterB(size_t actionA, size_t actionB) const {
+	return constraints->precedes(actionB, actionA);
 }
 
 bool PartialPlan::extractPlan(vector<GroundedAction>& /*r*/ plan) {
 	set<size_t> toAdd;
-	foreachindex(i, actions)
+	foreachindex(i, actions.get())
 		toAdd.insert(i);
 
 	bool added, eligible;
@@ -376,7 +346,7 @@ bool PartialPlan::extractPlan(vector<GroundedAction>& /*r*/ plan) {
 
 		foreach(a, toAdd) {
 			eligible = true;
-			foreachindex(b, actions)
+			foreachindex(b, actions.get())
 				if (*a != b && in(toAdd, b) && isAAfterB(*a, b)) {
 					eligible = false;
 					break;
@@ -390,12 +360,94 @@ bool PartialPlan::extractPlan(vector<GroundedAction>& /*r*/ plan) {
 
 		if (!added) return false;
 		
-		plan.push_back(actions[add]);
+		plan.push_back(actions.get()[add]);
 		toAdd.erase(add);
 	}
 	return true;
 }
 
+string PartialPlan::canonicalKey() const {
+	vector<GroundedAction> const& steps = actions.get();
+
+	// Variable names depend on the index of the step that introduced them: steps are sorted on their literal with
+	// variables left out, then variables are renamed in order of first occurrence.
+	// The pruning is deliberately incomplete: steps with the same signature keep the order in which they were added, so
+	// equivalent plans adding them in another order get different keys and are both searched. Keys never merge plans
+	// that differ.
+	vector<pair<string, size_t>> signatures;
+	for (size_t i = 2; i < steps.size(); i++) {
+		string signature = steps[i].actionLiteral.pred.name + "(";
+		foreach(param, steps[i].actionLiteral.parameters)
+			signature += (param->isVariable ? string("?") : param->name) + ",";
+		signatures.push_back(make_pair(signature, i));
+	}
+	sort(signatures.begin(), signatures.end());
+
+	vector<size_t> order = { 0, 1 };
+	vector<size_t> position = vector<size_t>(steps.size(), 0);
+	position[1] = 1;
+	foreachindex(si, signatures) {
+		order.push_back(signatures[si].second);
+		position[signatures[si].second] = si + 2;
+	}
+
+	map<Term, string> names;
+	auto termName = [&names](Term const& term) {
+		if (!term.isVariable) return term.name;
+		auto found = names.find(term);
+		if (found != names.end()) return found->second;
+		string name = "?" + to_string(names.size());
+		names[term] = name;
+		return name;
+	};
+	auto literalName = [&termName](Literal const& lit) {
+		string name = (lit.positive ? "" : "-") + lit.pred.name + "(";
+		foreach(param, lit.parameters)
+			name += termName(*param) + ",";
+		return name + ")";
+	};
+
+	// Start and Finish conditions are the same for every plan of a search
+	string key;
+	foreach(index, order) {
+		key += literalName(steps[*index].actionLiteral);
+		if (*index < 2) continue;
+		foreach(cond, steps[*index].preConditions)
+			key += (cond->truth ? "+" : "!") + literalName(cond->lit);
+		key += ">";
+		foreach(cond, steps[*index].postConditions)
+			key += (cond->truth ? "+" : "!") + literalName(cond->lit);
+		key += ";";
+	}
+
+	vector<string> links;
+	foreach(link, causalLinks.get())
+		links.push_back(to_string(position[get<0>(*link)]) + (get<1>(*link).truth ? "+" : "!") +
+						literalName(get<1>(*link).lit) + to_string(position[get<2>(*link)]));
+	sort(links.begin(), links.end());
+	key += "|" + join(",", links);
+
+	// Only the closure matters to the rest of the search, redundant constraints are left out
+	vector<pair<size_t, size_t>> edges;
+	for (size_t before = 0; before < constraints->size(); before++) {
+		vector<size_t> afters = constraints->successors(before);
+		foreach(after, afters)
+			edges.push_back(make_pair(position[before], position[*after]));
+	}
+	sort(edges.begin(), edges.end());
+	key += "|";
+	foreach(edge, edges)
+		key += to_string(edge->first) + "<" + to_string(edge->second) + ",";
+
+	vector<string> open;
+	foreach(precond, openPreconditions.get())
+		open.push_back((precond->first.truth ? "+" : "!") + literalName(precond->first.lit) + to_string(position[precond->second]));
+	sort(open.begin(), open.end());
+	key += "|" + join(",", open);
+
+	return key;
+}
+
 void PopAgentMultivariate::init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) {
 	Agent::init(inDomain, inInstances, inGoal, inTrace);
 
@@ -424,6 +476,10 @@ void PopAgentMultivariate::prepareActionSubstitutions() {
 		availableActions.push_back(GroundedAction(*it));
 }
 
+size_t PopAgentMultivariate::prunedPlans() const {
+	return pruned;
+}
+
 Literal PopAgentMultivariate::getNextAction(State state) {
 	if (!planReady)
 		findPlan(state);
@@ -444,36 +500,36 @@ bool PopAgentMultivariate::findPlan(State state) {
 
 	// Creating the first plan, with two actions only: Start and Finish
 	shared_ptr<PartialPlan> startNode = make_shared<PartialPlan>(state, goal, startLiteral, finishLiteral);
+	startNode->recordHistory = verbose;
 	startNode->updateHeuristic();
 
-	vector<shared_ptr<PartialPlan>> openList;
-	openList.push_back(startNode);
+	auto compare = [](OpenEntry const& lhs, OpenEntry const& rhs) {
+		if (get<0>(lhs) != get<0>(rhs)) return get<0>(lhs) > get<0>(rhs);
+		return get<1>(lhs) > get<1>(rhs);
+	};
+	priority_queue<OpenEntry, vector<OpenEntry>, decltype(compare)> openList(compare);
+	unordered_set<string> seenPlans;
+
+	size_t inserted = 0;
+	pruned = 0;
+	openList.push(OpenEntry(startNode->heuristic, inserted++, startNode));
+	seenPlans.insert(startNode->canonicalKey());
 
 	size_t step = 0;
 
 	while (!openList.empty()) {
 		step++;
+		if (cancelled()) return false;
 		if (verbose) cout << "Step: " << step << " - Open list: " << openList.size() << endl;
 
-		size_t index = 0;
-		float minHeuristic = 0.0f;
-		bool first = true;
-		foreachindex(i, openList) {
-			if (first || openList[i]->heuristic < minHeuristic) {
-				first = false;
-				index = i;
-				minHeuristic = openList[i]->heuristic;
-			}
-		}
-
-		shared_ptr<PartialPlan> current = openList[index];
-		openList.erase(openList.begin() + index);
+		shared_ptr<PartialPlan> current = get<2>(openList.top());
+		openList.pop();
 
 		if (verbose) {
 			cout << "PARTIAL PLAN: heuristic = " << current->heuristic << endl;
-			cout << "Actions: " << join(", ", current->actions) << endl;
+			cout << "Actions: " << join(", ", current->actions.get()) << endl;
 			cout << "Open preconditions: ";
-			foreach(precond, current->openPreconditions)
+			foreach(precond, current->openPreconditions.get())
 				cout << precond->first.lit.toString() << ", ";
 			cout << endl;
 			//cout << "Causal links: " << join(", ", current->causalLinks) << endl;
@@ -489,14 +545,22 @@ bool PopAgentMultivariate::findPlan(State state) {
 			node->updateHeuristic();
 			node->cost = current->cost + 1.0f;
 			node->heuristic += node->cost;
-			node->parent = current;
+			if (verbose) node->parent = current;
 			if (node->goalCheck()) {
 				// Found a plan !
 				extractPlan(node);
+				if (optimizePlans)
+					this->plan = optimizePlan(state, this->plan);
 				return true;
 			}
 
-			openList.push_back(node);
+			// The same partial plan can be reached through different refinement orders
+			if (!seenPlans.insert(node->canonicalKey()).second) {
+				pruned++;
+				continue;
+			}
+
+			openList.push(OpenEntry(node->heuristic, inserted++, node));
 		}
 	}
 
@@ -509,8 +573,10 @@ void PopAgentMultivariate::extractPlan(shared_ptr<PartialPlan> partialPlan) {
 
 	if (!partialPlan->extractPlan(actions)) return;
 	
+	// Start and Finish only stand for the initial state and the goal
 	foreach(git, actions)
-		plan.insert(plan.begin(), git->actionLiteral);
+		if (git->actionLiteral != startLiteral && git->actionLiteral != finishLiteral)
+			plan.insert(plan.begin(), git->actionLiteral);
 	planReady = true;
 
 
@@ -525,24 +591,25 @@ void PopAgentMultivariate::extractPlan(shared_ptr<PartialPlan> partialPlan) {
 
 			shared_ptr<PartialPlan> pp = allSteps[i];
 			
-			foreachindex(i, pp->actions) {
-				cout << i << ": " << pp->actions[i].actionLiteral << endl;
+			foreachindex(i, pp->actions.get()) {
+				cout << i << ": " << pp->actions.get()[i].actionLiteral.toString() << endl;
 			}
-			foreach(it, pp->causalLinks) {
+			foreach(it, pp->causalLinks.get()) {
 				Condition cond = get<1>(*it);
 				cout << get<0>(*it) << " - " << cond << " - " << get<2>(*it) << endl;
 			}
-			foreach(it, pp->constraints) {
-				cout << it->first << " before ";
-				foreach(elem, it->second)
+			for (size_t before = 0; before < pp->constraints->size(); before++) {
+				cout << before << " before ";
+				vector<size_t> afters = pp->constraints->successors(before);
+				foreach(elem, afters)
 					cout << *elem << " ";
 				cout << endl;
 			}
 
 			cout << endl << "History:" << endl;
-			foreachindex(hindex, pp->history) {
-				if (pp->parent == nullptr || hindex >= pp->parent->history.size())
-					cout << "- " << pp->history[hindex] << endl;
+			foreachindex(hindex, pp->history.get()) {
+				if (pp->parent == nullptr || hindex >= pp->parent->history->size())
+					cout << "- " << pp->history.get()[hindex] << endl;
 			}
 
 			cout << endl;
@@ -11,6 +11,7 @@
 #include <memory>
 
 #include "Agents/Agent.h"
+#include "Agents/PartialOrderPlanner/OrderingGraph.h"
 #include "Logic/Domain.h"
 #include "Utils.h"
 
@@ -18,23 +19,26 @@ using namespace std;
 
 typedef tuple<size_t, Condition, size_t> CausalLink;
 typedef pair<Condition, size_t> OpenPrecondition;
-typedef map<size_t, set<size_t>> OrderingGraph;
 
 struct PartialPlan {
 	float heuristic = 0.0f;
 	float cost = 0.0f;
 	shared_ptr<PartialPlan> parent;
-	vector<string> history;
+
+	// Only filled in verbose mode
+	bool recordHistory = false;
+	CopyOnWrite<vector<string>> history;
 
 	Literal startLiteral;
 	Literal finishLiteral;
 	GroundedAction startAction; // Index 0
 	GroundedAction finishAction; // Index 1
 
-	vector<GroundedAction> actions;
-	set<CausalLink> causalLinks;
-	OrderingGraph constraints;
-	set<OpenPrecondition> openPreconditions;
+	// Shared with the parent plan until modified
+	CopyOnWrite<vector<GroundedAction>> actions;
+	CopyOnWrite<set<CausalLink>> causalLinks;
+	CopyOnWrite<OrderingGraph> constraints;
+	CopyOnWrite<set<OpenPrecondition>> openPreconditions;
 
 	PartialPlan(State startState, Goal finishGoal, Literal inStartLiteral, Literal inFinishLiteral);
 	PartialPlan(PartialPlan const& other);
@@ -44,20 +48,18 @@ struct PartialPlan {
 	void updateHeuristic();
 	bool goalCheck();
 	bool extractPlan(vector<GroundedAction>& /*r*/ plan);
+	string canonicalKey() const;
 
 private:
 	bool directlyBindPrecondition(OpenPrecondition precond, size_t toAction, Substitution sub);
 	bool applyActionToPrecondition(OpenPrecondition precond, GroundedAction action, Substitution sub);
 	bool bindVariables(Substitution sub);
 	void addConstraint(size_t before, size_t after);
-	void removeConstraint(size_t before, size_t after);
-	bool hasConstraint(size_t before, size_t after);
-	set<size_t> getConstraints(size_t before);
+	bool tryAddConstraint(size_t before, size_t after);
 	bool protectCausalLink(CausalLink link, size_t fromAction);
-	bool checkCyclicity();
 	bool hasDirectBinding(OpenPrecondition precond);
 	set<pair<size_t, Substitution>> getDirectBindings(OpenPrecondition precond);
-	bool isAAfterB(size_t actionA, size_t actionB);
+	bool isAAfterB(size_t actionA, size_t actionB) const;
 };
 
 class PopAgentMultivariate : public Agent {
@@ -69,6 +71,9 @@ public:
 	Literal getNextAction(State state) override;
 	void updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) override;
 
+	// Refinements of the last search dropped because the same partial plan had already been reached
+	size_t prunedPlans() const;
+
 	bool receivesEvents = false;
 
 protected:
@@ -79,6 +84,7 @@ protected:
 	bool planReady = false;
 	vector<Literal> plan;
 	vector<GroundedAction> availableActions;
+	size_t pruned = 0;
 
 	Literal startLiteral, finishLiteral;
 };
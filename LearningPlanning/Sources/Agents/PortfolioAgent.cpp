@@ -0,0 +1,242 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Agents/PortfolioAgent.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define FAVOURITE_HEAD_START_MS 50
+#define MAX_COMPARED_PLAN_SIZE 1000
+
+using namespace std;
+
+mutex portfolioWinsMutex;
+map<string, map<string, size_t>> portfolioWins;
+
+void PortfolioAgent::addPlanner(string name, shared_ptr<Agent> planner) {
+	names.push_back(name);
+	planners.push_back(planner);
+}
+
+void PortfolioAgent::setTimeLimit(float seconds) {
+	timeLimit = seconds;
+}
+
+void PortfolioAgent::setSelection(PortfolioSelection newSelection) {
+	selection = newSelection;
+}
+
+void PortfolioAgent::init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) {
+	Agent::init(inDomain, inInstances, inGoal, inTrace);
+	current = -1;
+	comparedPlan.clear();
+
+	// Planners run concurrently and trying actions modifies a domain, each one gets a copy
+	domains.clear();
+	foreach(planner, planners) {
+		domains.push_back(domain->copy());
+		(*planner)->init(domains.back(), instances, goal, trace);
+	}
+}
+
+void PortfolioAgent::updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) {
+	Agent::updateProblem(inInstances, inGoal, inHeadstart);
+	current = -1;
+	comparedPlan.clear();
+}
+
+Literal PortfolioAgent::getNextAction(State state) {
+	if (selection == SHORTEST_PLAN && comparedStep < comparedPlan.size())
+		return comparedPlan[comparedStep++];
+
+	if (selection == FIRST_PLAN && current >= 0) {
+		Literal nextAction = planners[current]->getNextAction(state);
+		if (!(nextAction == Literal()))
+			return nextAction;
+		current = -1;
+	}
+
+	if (goal.reached(state) || planners.empty())
+		return Literal();
+	return selection == SHORTEST_PLAN ? compare(state) : race(state);
+}
+
+Literal PortfolioAgent::race(State const& state) {
+	shared_ptr<atomic<bool>> token = make_shared<atomic<bool>>(false);
+	foreach(planner, planners) {
+		(*planner)->updateProblem(instances, goal, headstartActions);
+		(*planner)->setCancellationToken(token);
+	}
+
+	mutex raceMutex;
+	condition_variable raceUpdate;
+	size_t finished = 0;
+	int winner = -1;
+	Literal winningAction;
+
+	auto run = [&](size_t pi) {
+		Literal action = planners[pi]->getNextAction(state);
+		bool valid = !(action == Literal()) && domains[pi]->tryAction(state, instances, action).there;
+
+		lock_guard<mutex> lock(raceMutex);
+		finished++;
+		if (valid && winner < 0) {
+			winner = (int)pi;
+			winningAction = action;
+		}
+		raceUpdate.notify_all();
+	};
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	chrono::steady_clock::time_point deadline = startTime + chrono::milliseconds((long long)(timeLimit * 1000.0f));
+	auto waitRace = [&](size_t launched, bool bounded, chrono::steady_clock::time_point until) {
+		unique_lock<mutex> lock(raceMutex);
+		auto over = [&]() { return winner >= 0 || finished == launched; };
+		if (timeLimit > 0.0f) until = min(until, deadline);
+		if (bounded || timeLimit > 0.0f) raceUpdate.wait_until(lock, until, over);
+		else raceUpdate.wait(lock, over);
+	};
+
+	vector<size_t> order = raceOrder();
+	vector<thread> threads;
+
+	map<string, size_t> wins = getWins(domain);
+	if (order.size() > 1 && wins[names[order[0]]] > 0) {
+		if (verbose) cout << "Giving a head start to " << names[order[0]] << "." << endl;
+		threads.push_back(thread(run, order[0]));
+		waitRace(threads.size(), true, startTime + chrono::milliseconds(FAVOURITE_HEAD_START_MS));
+	}
+
+	bool launchOthers;
+	{
+		lock_guard<mutex> lock(raceMutex);
+		launchOthers = winner < 0 && (timeLimit <= 0.0f || chrono::steady_clock::now() < deadline);
+	}
+	if (launchOthers) {
+		for (size_t oi = threads.size(); oi < order.size(); oi++)
+			threads.push_back(thread(run, order[oi]));
+		waitRace(threads.size(), false, deadline);
+	}
+
+	token->store(true);
+	foreach(t, threads)
+		t->join();
+
+	if (winner < 0) {
+		if (verbose) cout << "No planner found a plan." << endl;
+		return Literal();
+	}
+
+	// The winner keeps planning for the next steps, without the token that stopped the others
+	current = winner;
+	planners[winner]->setCancellationToken(nullptr);
+	recordWin(winner);
+
+	if (verbose) cout << names[winner] << " found a plan first." << endl;
+	return winningAction;
+}
+
+Literal PortfolioAgent::compare(State const& state) {
+	foreach(planner, planners) {
+		(*planner)->updateProblem(instances, goal, headstartActions);
+		(*planner)->setCancellationToken(nullptr);
+	}
+
+	// Each planner is followed on its own domain until it reaches the goal or runs out of plan
+	vector<vector<Literal>> plans = vector<vector<Literal>>(planners.size());
+	vector<int> solved = vector<int>(planners.size(), 0);
+	auto run = [&](size_t pi) {
+		State current = state;
+		while (!goal.reached(current) && plans[pi].size() < MAX_COMPARED_PLAN_SIZE) {
+			Literal action = planners[pi]->getNextAction(current);
+			if (action == Literal()) break;
+
+			Opt<State> next = domains[pi]->tryAction(current, instances, action);
+			if (!next.there) break;
+
+			plans[pi].push_back(action);
+			current = next.obj;
+		}
+		solved[pi] = goal.reached(current) ? 1 : 0;
+	};
+
+	vector<thread> threads;
+	foreachindex(pi, planners)
+		threads.push_back(thread(run, pi));
+	foreach(t, threads)
+		t->join();
+
+	int winner = -1;
+	foreachindex(pi, planners)
+		if (solved[pi] && (winner < 0 || plans[pi].size() < plans[winner].size()))
+			winner = (int)pi;
+
+	if (winner < 0) {
+		if (verbose) cout << "No planner found a plan." << endl;
+		return Literal();
+	}
+
+	recordWin(winner);
+	comparedPlan = plans[winner];
+	comparedStep = 0;
+
+	if (verbose) cout << names[winner] << " found the shortest plan: " << comparedPlan.size() << " steps." << endl;
+	return getNextAction(state);
+}
+
+void PortfolioAgent::recordWin(size_t winner) {
+	lock_guard<mutex> lock(portfolioWinsMutex);
+	portfolioWins[domainKey(domain)][names[winner]]++;
+}
+
+vector<size_t> PortfolioAgent::raceOrder() {
+	map<string, size_t> wins = getWins(domain);
+
+	vector<size_t> order;
+	foreachindex(pi, planners)
+		order.push_back(pi);
+
+	stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+		return wins[names[lhs]] > wins[names[rhs]];
+	});
+	return order;
+}
+
+map<string, size_t> PortfolioAgent::getWins(shared_ptr<Domain> domain) {
+	lock_guard<mutex> lock(portfolioWinsMutex);
+	auto found = portfolioWins.find(domainKey(domain));
+	if (found == portfolioWins.end())
+		return map<string, size_t>();
+	return found->second;
+}
+
+void PortfolioAgent::resetWins() {
+	lock_guard<mutex> lock(portfolioWinsMutex);
+	portfolioWins.clear();
+}
+
+string PortfolioAgent::domainKey(shared_ptr<Domain> domain) {
+	// Domains are told apart by their name, types, predicates and action names, which stay the same while a domain is
+	// revised. Learned domains extend the name of the domain they are learned from.
+	set<string> typeNames;
+	foreach(type, domain->types)
+		typeNames.insert((*type)->name);
+
+	set<string> predicateNames;
+	foreach(pred, domain->predicates)
+		predicateNames.insert(pred->name + "/" + to_string(pred->arity));
+
+	set<string> actionNames;
+	foreach(act, domain->getActionList())
+		actionNames.insert(act->actionLiteral.pred.name);
+
+	return domain->name + ";" + join(",", vector<string>(typeNames.begin(), typeNames.end())) + ";" +
+		join(",", vector<string>(predicateNames.begin(), predicateNames.end())) + ";" +
+		join(",", vector<string>(actionNames.begin(), actionNames.end()));
+}
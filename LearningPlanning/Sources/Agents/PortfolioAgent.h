@@ -0,0 +1,72 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Races several planner configurations on separate threads and follows the first one coming up with an applicable
+ * action. The other planners are stopped through a shared cancellation token and joined before returning; the winner
+ * is then followed until it runs out of plan, when a new race starts from the current state.
+ *
+ * Wins are counted per domain, told apart by name and signature, over every portfolio of the run. The configuration
+ * with the most wins on a domain gets a head start: the others are only launched if it did not find a plan in the
+ * meantime.
+ *
+ * When the selection must not depend on thread scheduling, every planner plans up to the goal instead, and the shortest
+ * plan is followed, ties going to the planner added first.
+ */
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+
+#include "Agents/Agent.h"
+
+using namespace std;
+
+enum PortfolioSelection {
+	FIRST_PLAN,
+	SHORTEST_PLAN
+};
+
+class PortfolioAgent : public Agent {
+public:
+	PortfolioAgent(bool inVerbose) : Agent(inVerbose) {}
+
+	// Planners must be added before init, and are only used through the portfolio afterwards
+	void addPlanner(string name, shared_ptr<Agent> planner);
+	// Only bounds races, planners compared on their plans are bounded by their own limits
+	void setTimeLimit(float seconds);
+	void setSelection(PortfolioSelection newSelection);
+
+	void init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) override;
+
+	Literal getNextAction(State state) override;
+	void updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) override;
+
+	static map<string, size_t> getWins(shared_ptr<Domain> domain);
+	static void resetWins();
+
+	bool receivesEvents = false;
+
+private:
+	Literal race(State const& state);
+	Literal compare(State const& state);
+	void recordWin(size_t winner);
+	vector<size_t> raceOrder();
+	static string domainKey(shared_ptr<Domain> domain);
+
+	vector<string> names;
+	vector<shared_ptr<Agent>> planners;
+	vector<shared_ptr<Domain>> domains;
+
+	// Planner whose plan is being followed, -1 when a race is needed
+	int current = -1;
+	float timeLimit = -1.0f;
+
+	PortfolioSelection selection = FIRST_PLAN;
+	// Shortest plan of the last comparison, in execution order, and the next step to follow
+	vector<Literal> comparedPlan;
+	size_t comparedStep = 0;
+};
@@ -214,11 +214,28 @@ void RandomExploreAgent::generateRandomPlan(State state) {
 }
 
 void RandomExploreAgent::simplifyPlan(State state) {
+	size_t stepsBefore = plan.size();
+
+	// Meta-actions are not compiled by the plan optimizer, plans using them only get their loops removed
+	bool metaActions = false;
+	foreach(action, plan)
+		if (action->pred == domain->resetAction.actionLiteral.pred || action->pred == domain->deletePred || action->pred == domain->removeFactPred)
+			metaActions = true;
+
+	// The plan was selected on its heuristic value, so it is shortened without changing the state it leads to
+	if (metaActions)
+		removeLoops(state);
+	else
+		plan = optimizePlan(state, plan, false);
+
+	if (plan.size() != stepsBefore)
+		cout << "Simplified plan: from " << stepsBefore << " to " << plan.size() << " steps." << endl;
+}
+
+void RandomExploreAgent::removeLoops(State state) {
 	vector<State> states = { state };
 	vector<Literal> simplifiedPlan;
 
-	size_t stepsBefore = plan.size();
-
 	foreach(action, plan) {
 		State newState = domain->tryAction(states.back(), instances, *action).obj;
 
@@ -252,7 +269,4 @@ void RandomExploreAgent::simplifyPlan(State state) {
 	}
 
 	plan = simplifiedPlan;
-
-	if (plan.size() != stepsBefore)
-		cout << "Simplified plan: from " << stepsBefore << " to " << plan.size() << " steps." << endl;
 }
@@ -25,6 +25,7 @@ private:
 	float heuristic(State state);
 	void generateRandomPlan(State state);
 	void simplifyPlan(State state);
+	void removeLoops(State state);
 	void prepareActionSubstitutions();
 
 	State searchState;
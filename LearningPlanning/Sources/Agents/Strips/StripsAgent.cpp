@@ -45,6 +45,7 @@ void StripsAgent::init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Go
 
 void StripsAgent::updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) {
 	allGroundedActions.clear();
+	achievers.clear();
 	Agent::updateProblem(inInstances, inGoal, inHeadstart);
 	planReady = false;
 	plan.clear();
@@ -82,6 +83,14 @@ void StripsAgent::prepareActionSubstitutions() {
 		foreach(subit, subs)
 			allGroundedActions.push_back(GroundedAction(action, *subit));
 	}
+
+	foreachindex(ai, allGroundedActions) {
+		set<Condition> effects = toSet(allGroundedActions[ai].postConditions);
+		foreach(eff, effects)
+			achievers[*eff].push_back(ai);
+	}
+
+	task = make_shared<GroundedTask>(domain, instances);
 }
 
 void StripsAgent::findPlan(State state) {
@@ -95,8 +104,13 @@ void StripsAgent::findPlan(State state) {
 
 	if (verbose) cout << "Goals: " << join(", ", goals) << endl;
 
+	State initialState = state;
 	vector<GroundedAction> planActions;
-	bool success = findPlanRecursive(state, goals, planActions, {}, 0);
+	forbiddenStates = vector<unordered_map<FactSet, size_t, FactSetHasher>>(allGroundedActions.size());
+	forbiddenLog.clear();
+	oldestForbiddenHit = SIZE_MAX;
+	failedGoals.clear();
+	bool success = findPlanRecursive(state, goals, planActions, 0);
 
 	if (success) {
 
@@ -111,6 +125,8 @@ void StripsAgent::findPlan(State state) {
 		vector<Action> actions = domain->getActions();
 		foreach(git, planActions)
 			plan.insert(plan.begin(), git->actionLiteral);
+		if (optimizePlans)
+			plan = optimizePlan(initialState, plan);
 		planReady = true;
 	}
 	else {
@@ -122,7 +138,7 @@ void StripsAgent::findPlan(State state) {
 	}
 }
 
-int initialStateDistance(State state, vector<Condition> conds) {
+int initialStateDistance(State const& state, vector<Condition> const& conds) {
 	int i = 0;
 	foreach(cit, conds)
 		if (!cit->reached(state))
@@ -130,11 +146,47 @@ int initialStateDistance(State state, vector<Condition> conds) {
 	return i;
 }
 
-bool StripsAgent::findPlanRecursive(State &state, vector<Condition> goals, vector<GroundedAction> &currentPlan, map<GroundedAction, set<State>> forbiddenActions, size_t depth) {
-	string pad = padString(depth);
-
+bool StripsAgent::findPlanRecursive(State &state, vector<Condition> goals, vector<GroundedAction> &currentPlan, size_t depth) {
 	if (goals.empty()) return true;
 	if (depth > MAXDEPTH) return false;
+	if (cancelled()) return false;
+
+	// A goal list that failed from the same state with as much depth left fails again. Only failures that did not run
+	// into actions forbidden by the callers are recorded, forbidding more actions can only make a search fail.
+	FactSet facts = task->encode(state);
+	auto failedHere = failedGoals.find(facts);
+	if (failedHere != failedGoals.end()) {
+		auto failed = failedHere->second.find(goals);
+		if (failed != failedHere->second.end() && failed->second <= depth) {
+			if (verbose) cout << padString(depth) << ">> Goals already failed from this state." << endl;
+			return false;
+		}
+	}
+
+	size_t logMark = forbiddenLog.size();
+	size_t callerHit = oldestForbiddenHit;
+	oldestForbiddenHit = SIZE_MAX;
+	bool success = solveGoals(state, goals, currentPlan, depth);
+	bool usedCallerForbids = oldestForbiddenHit < logMark;
+	oldestForbiddenHit = min(oldestForbiddenHit, callerHit);
+
+	// Actions forbidden at this level or below are allowed again for the caller
+	while (forbiddenLog.size() > logMark) {
+		forbiddenStates[forbiddenLog.back().first].erase(forbiddenLog.back().second);
+		forbiddenLog.pop_back();
+	}
+
+	if (!success && !usedCallerForbids && !cancelled()) {
+		map<vector<Condition>, size_t>& failed = failedGoals[facts];
+		auto previous = failed.find(goals);
+		if (previous == failed.end() || previous->second > depth)
+			failed[goals] = depth;
+	}
+	return success;
+}
+
+bool StripsAgent::solveGoals(State &state, vector<Condition> goals, vector<GroundedAction> &currentPlan, size_t depth) {
+	string pad = padString(depth);
 
 	size_t i = 0;
 	while (i < goals.size()) {
@@ -156,32 +208,32 @@ bool StripsAgent::findPlanRecursive(State &state, vector<Condition> goals, vecto
 			continue;
 		}
 
-		vector<GroundedAction> possibleActions = getSortedPossibleActions(curGoal, state);
+		vector<size_t> possibleActions = getSortedPossibleActions(curGoal, state);
 
 		if (verbose) {
 			cout << pad << "List of possible actions that satisfy " << curGoal << ":" << endl;
 
 			foreach(actit, possibleActions) {
-				cout << pad << "> " << actit->toString() << " - Score: " << initialStateDistance(state, actit->preConditions) << endl;
+				GroundedAction const& action = allGroundedActions[*actit];
+				cout << pad << "> " << action.toString() << " - Score: " << initialStateDistance(state, action.preConditions) << endl;
 			}
 
 			cout << endl;
 		}
 
+		FactSet stateFacts = task->encode(state);
 		bool found = false;
 		foreach(actit, possibleActions) {
-			GroundedAction action = *actit;
+			GroundedAction const& action = allGroundedActions[*actit];
 
-			auto f = forbiddenActions.find(action);
-			if (f != forbiddenActions.end()) {
-				if (f->second.find(state) != f->second.end()) continue;
-				forbiddenActions[action].insert(state);
-			}
-			else {
-				forbiddenActions[action] = { state };
+			auto forbidden = forbiddenStates[*actit].insert(make_pair(stateFacts, forbiddenLog.size()));
+			if (!forbidden.second) {
+				oldestForbiddenHit = min(oldestForbiddenHit, forbidden.first->second);
+				continue;
 			}
+			forbiddenLog.push_back(make_pair(*actit, stateFacts));
 
-			if (verbose) cout << pad << "-> Trying action: " << action << endl;
+			if (verbose) cout << pad << "-> Trying action: " << action.toString() << endl;
 			
 			// Only continue if action's preConditions can be reached and if action's postConditions don't contradict our goals
 			if (!canReachPreconds(action.preConditions, state, pad)) continue;
@@ -198,7 +250,7 @@ bool StripsAgent::findPlanRecursive(State &state, vector<Condition> goals, vecto
 			//currentPlan.push_back(action);
 
 			vector<GroundedAction> subPlan;
-			bool success = findPlanRecursive(newState, subGoals, subPlan, forbiddenActions, depth + 1);
+			bool success = findPlanRecursive(newState, subGoals, subPlan, depth + 1);
 
 			// Unable to find such a plan, we skip to the next action
 			if (!success) {
@@ -261,41 +313,29 @@ bool StripsAgent::findPlanRecursive(State &state, vector<Condition> goals, vecto
 	return true;
 }
 
-vector<GroundedAction> StripsAgent::getSortedPossibleActions(Condition goal, State state) {
-	vector<GroundedAction> possible;
-	foreach(actit, allGroundedActions) {
-		foreach(pit, actit->postConditions) {
-			if (*pit == goal) {
-				possible.push_back(*actit);
-				break;
-			}
-		}
-	}
+vector<size_t> StripsAgent::getSortedPossibleActions(Condition const& goal, State const& state) {
+	auto found = achievers.find(goal);
+	if (found == achievers.end()) return {};
+
+	vector<size_t> possible = found->second;
+	map<size_t, int> distances;
+	foreach(actit, possible)
+		distances[*actit] = initialStateDistance(state, allGroundedActions[*actit].preConditions);
 
-	auto compare = [&, state](GroundedAction lhs, GroundedAction rhs) {
-		return initialStateDistance(state, lhs.preConditions) < initialStateDistance(state, rhs.preConditions);
+	auto compare = [&distances](size_t lhs, size_t rhs) {
+		return distances[lhs] < distances[rhs];
 	};
 
 	sort(possible.begin(), possible.end(), compare);
 	return possible;
 }
 
-bool StripsAgent::canReachPreconds(vector<Condition> conds, State state, string pad) {
+bool StripsAgent::canReachPreconds(vector<Condition> const& conds, State const& state, string pad) {
 	foreach(cit, conds) {
 		if (cit->reached(state)) continue;
-		bool found = false;
-		foreach(actit, allGroundedActions) {
-			foreach(pit, actit->postConditions) {
-				if (*pit == *cit) {
-					found = true;
-					break;
-				}
-			}
-			if (found) break;
-		}
-		if (found) continue;
+		if (in(achievers, *cit)) continue;
 
-		if (verbose) cout << pad << "   Couldn't reach precondition: " << *cit << endl;
+		if (verbose) cout << pad << "   Couldn't reach precondition: " << cit->toString() << endl;
 		return false;
 	}
 	return true;
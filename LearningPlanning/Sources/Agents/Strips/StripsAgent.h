@@ -9,9 +9,13 @@
 #pragma once
 
 #include <vector>
+#include <map>
+#include <cstdint>
+#include <unordered_map>
 
 #include "Agents/Agent.h"
 #include "Logic/Domain.h"
+#include "Logic/GroundedTask.h"
 #include "Utils.h"
 
 using namespace std;
@@ -31,12 +35,27 @@ protected:
 	void prepareActionSubstitutions();
 
 	void findPlan(State state);
-	bool findPlanRecursive(State &state, vector<Condition> goals, vector<GroundedAction> &currentPlan, map<GroundedAction, set<State>> forbiddenActions, size_t depth);
-	vector<GroundedAction> getSortedPossibleActions(Condition goal, State state);
-	bool canReachPreconds(vector<Condition> conds, State state, string pad);
+	bool findPlanRecursive(State &state, vector<Condition> goals, vector<GroundedAction> &currentPlan, size_t depth);
+	bool solveGoals(State &state, vector<Condition> goals, vector<GroundedAction> &currentPlan, size_t depth);
+	vector<size_t> getSortedPossibleActions(Condition const& goal, State const& state);
+	bool canReachPreconds(vector<Condition> const& conds, State const& state, string pad);
 	bool contradicts(vector<Condition> newConds, vector<Condition> goals, string pad);
 	
 	bool planReady = false;
 	vector<Literal> plan;
 	vector<GroundedAction> allGroundedActions;
+	// Indices of the grounded actions having each condition as an effect, in allGroundedActions order
+	map<Condition, vector<size_t>> achievers;
+	// Only used to encode states as hashable fact sets
+	shared_ptr<GroundedTask> task;
+
+	// States in which each grounded action was already tried along the current branch, with the position of the entry in
+	// the log. Entries are logged so that returning from a recursion level removes the ones it added.
+	vector<unordered_map<FactSet, size_t, FactSetHasher>> forbiddenStates;
+	vector<pair<size_t, FactSet>> forbiddenLog;
+	// Lowest log position of the entries that stopped an action since the current recursion level started
+	size_t oldestForbiddenHit = SIZE_MAX;
+
+	// Goal lists that failed from a state, with the lowest depth they failed at
+	unordered_map<FactSet, map<vector<Condition>, size_t>, FactSetHasher> failedGoals;
 };
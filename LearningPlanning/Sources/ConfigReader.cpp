@@ -65,8 +65,8 @@ string ConfigReader::getString(string key) {
 	return "";
 }
 
-bool ConfigReader::getBool(string key) {
-	if (!cJSON_HasObjectItem(doc, key.c_str())) return false;
+bool ConfigReader::getBool(string key, bool fallback) {
+	if (!cJSON_HasObjectItem(doc, key.c_str())) return fallback;
 	cJSON* val = cJSON_GetObjectItemCaseSensitive(doc, key.c_str());
 	return cJSON_IsTrue(val);
 }
@@ -24,7 +24,8 @@ public:
 	double getDouble(string key);
 	float getFloat(string key);
 	string getString(string key);
-	bool getBool(string key);
+	// Missing keys read as the fallback
+	bool getBool(string key, bool fallback = false);
 
 	cJSON* getArray(string key);
 
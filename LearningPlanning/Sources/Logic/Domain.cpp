@@ -4,9 +4,13 @@
  */
 
 #include "Logic/Domain.h"
+#include "Logic/Subsumption.h"
 #include <iostream>
 #include<stdio.h>
 #include <stdarg.h>
+#include <atomic>
+
+atomic<unsigned __int64> domainVersions(0);
 
 string LogicObject::toString() const {
 	return "LogicObject";
@@ -423,49 +427,16 @@ bool Substitution::unify(Literal const& from, Literal const& to) {
 	return true;
 }
 
-std::set<Substitution> Substitution::oiSubsume(std::set<Literal> source, std::set<Literal> dst) {
-	return oiSubsume(toVec(source), dst);
+std::set<Substitution> Substitution::oiSubsume(std::set<Literal> const& source, std::set<Literal> const& dst, size_t limit) const {
+	return oiSubsume(toVec(source), dst, limit);
 }
 
-std::set<Substitution> Substitution::oiSubsume(vector<Literal> source, std::set<Literal> dst) {
-	if (source.size() == 0) return { *this };
-
-	Literal firstSource = apply(source.back());
-	source.pop_back();
-
-	Term srcParam, dstParam;
-	Opt<Term> currMapping, invMapping;
-	Substitution sub;
-	bool couldMatch;
-
-	std::set<Substitution> subs;
-	foreach(d, dst) {
-		if (d->pred != firstSource.pred) continue;
-
-		sub = Substitution(*this);
-		couldMatch = true;
-		foreachindex(pi, firstSource.parameters) {
-			srcParam = firstSource.parameters[pi];
-			dstParam = d->parameters[pi];
-			currMapping = sub.get(srcParam);
-			invMapping = sub.getInverse(dstParam);
-
-			if (srcParam == dstParam)
-				continue;
-
-			if (srcParam.isVariable && !currMapping.there && !invMapping.there)
-				sub.set(srcParam, dstParam);
-			else {
-				couldMatch = false;
-				break;
-			}
-		}
-		if (!couldMatch) continue;
-
-		subs = subs + sub.oiSubsume(source, dst);
-	}
+std::set<Substitution> Substitution::oiSubsume(vector<Literal> const& source, std::set<Literal> const& dst, size_t limit) const {
+	return OISubsumption(source, dst, *this).solutions(limit);
+}
 
-	return subs;
+bool Substitution::oiSubsumes(std::set<Literal> const& source, std::set<Literal> const& dst) const {
+	return OISubsumption(toVec(source), dst, *this).exists();
 }
 
 bool Substitution::operator== (Substitution const& other) const {
@@ -804,7 +775,7 @@ Condition Condition::ground(Substitution sub) {
 	return Condition(sub.apply(lit), truth);
 }
 
-bool Condition::reached(State state) const {
+bool Condition::reached(State const& state) const {
 	if (!lit.grounded()) return false;
 	return state.contains(lit) == truth;
 }
@@ -922,6 +893,13 @@ vector<Substitution> unifyFacts(State state, vector<Term> instances, vector<Lite
 
 Domain::Domain(vector<shared_ptr<TermType>> inTypes, set<Predicate> inPreds, set<Term> inConsts, vector<Action> inActions) :
 	types(inTypes), predicates(inPreds), constants(inConsts), actions(inActions) {
+	newVersion();
+	id = version;
+
+	foreachindex(ai, actions) {
+		actionIds.push_back(nextActionId);
+		actionIndices[nextActionId++] = ai;
+	}
 
 	Predicate resetPred = Predicate();
 	foreach(pred, predicates)
@@ -1114,6 +1092,10 @@ vector<Action> Domain::getActions(bool learning) {
 	return actions;
 }
 
+vector<Action> const& Domain::getActionList() const {
+	return actions;
+}
+
 set<Literal> Domain::getActionLiterals(bool learning) {
 	vector<Action> allActions = getActions(learning);
 	set<Literal> res;
@@ -1169,22 +1151,89 @@ Predicate Domain::getActionPredByName(string name) {
 void Domain::addType(shared_ptr<TermType> type) {
 	assert(!in(types, type));
 	types.push_back(type);
+	newVersion();
 }
 
 void Domain::addPredicate(Predicate pred) {
 	predicates.insert(pred);
+	newVersion();
 }
 
 void Domain::addConstant(Term cst) {
 	constants.insert(cst);
+	newVersion();
 }
 
-void Domain::addAction(Action action) {
+size_t Domain::addAction(Action action) {
+	size_t id = nextActionId++;
+	actionIndices[id] = actions.size();
+	actionIds.push_back(id);
 	actions.push_back(action);
+	stampActions(action.actionLiteral.pred);
+	return id;
+}
+
+void Domain::replaceAction(size_t id, Action action) {
+	Action& replaced = actions[actionIndices.at(id)];
+	Predicate previousPred = replaced.actionLiteral.pred;
+	replaced = action;
+	stampActions(previousPred);
+	actionVersions[action.actionLiteral.pred] = version;
+}
+
+void Domain::removeAction(size_t id) {
+	size_t index = actionIndices.at(id);
+	Predicate pred = actions[index].actionLiteral.pred;
+
+	// The following actions keep their order, tryAction applies the first one that matches
+	actions.erase(actions.begin() + index);
+	actionIds.erase(actionIds.begin() + index);
+	actionIndices.erase(id);
+	for (size_t i = index; i < actionIds.size(); ++i)
+		actionIndices[actionIds[i]] = i;
+
+	stampActions(pred);
+}
+
+vector<size_t> const& Domain::getActionIds() const {
+	return actionIds;
+}
+
+set<Predicate> Domain::changedActionPredicates(unsigned __int64 sinceVersion) const {
+	set<Predicate> changed;
+	foreach(stamp, actionVersions)
+		if (stamp->second > sinceVersion)
+			changed.insert(stamp->first);
+	return changed;
 }
 
 void Domain::setResetState(State state) {
 	resetState = Opt<State>(state);
+	newVersion();
+}
+
+unsigned __int64 Domain::getVersion() const {
+	return version;
+}
+
+unsigned __int64 Domain::getId() const {
+	return id;
+}
+
+shared_ptr<Domain> Domain::copy() const {
+	shared_ptr<Domain> result = shared_ptr<Domain>(new Domain(*this));
+	result->newVersion();
+	result->id = result->version;
+	return result;
+}
+
+void Domain::newVersion() {
+	version = ++domainVersions;
+}
+
+void Domain::stampActions(Predicate const& pred) {
+	newVersion();
+	actionVersions[pred] = version;
 }
 
 Term Problem::getInstByName(string name) {
@@ -169,8 +169,10 @@ public:
 	void cleanConstants();
 	bool unify(Literal const& from, Literal const& to);
 
-	std::set<Substitution> oiSubsume(std::set<Literal> source, std::set<Literal> dst);
-	std::set<Substitution> oiSubsume(vector<Literal> source, std::set<Literal> dst);
+	// Extensions mapping every source literal to a destination one under object identity, at most limit of them unless it is 0
+	std::set<Substitution> oiSubsume(std::set<Literal> const& source, std::set<Literal> const& dst, size_t limit = 0) const;
+	std::set<Substitution> oiSubsume(vector<Literal> const& source, std::set<Literal> const& dst, size_t limit = 0) const;
+	bool oiSubsumes(std::set<Literal> const& source, std::set<Literal> const& dst) const;
 
 	bool operator== (Substitution const& other) const;
 	bool operator!=(Substitution const& other) const;
@@ -268,7 +270,7 @@ struct Condition : public LogicObject {
 	Condition() : Condition(Predicate(), {}, false) { }
 
 	Condition ground(Substitution sub);
-	bool reached(State state) const;
+	bool reached(State const& state) const;
 
 	bool operator==(Condition const& other) const;
 	bool operator!=(Condition const& other) const;
@@ -319,11 +321,14 @@ class Domain {
 public:
 	Domain(vector<shared_ptr<TermType>> inTypes, set<Predicate> inPreds, set<Term> inConsts, vector<Action> inActions);
 	Domain() : Domain({}, {}, {},  {}) { }
+	Domain& operator=(Domain const& other) = delete;
 
 	virtual Opt<State> tryAction(State state, vector<Term> instances, Literal actionLiteral, bool onlyAdd = false);
 	Literal parseLiteral(string str, vector<Term> instances, bool action = false, bool verbose = true);
 
 	vector<Action> getActions(bool learning = false);
+	// Same as getActions(), without a copy
+	vector<Action> const& getActionList() const;
 	set<Literal> getActionLiterals(bool learning = false);
 	set<Predicate> getPredicates();
 	set<Term> getConstants();
@@ -337,14 +342,32 @@ public:
 	void addType(shared_ptr<TermType> type);
 	void addPredicate(Predicate pred);
 	void addConstant(Term cst);
-	void addAction(Action action);
 	void setResetState(State state);
+
+	// Actions keep the id addAction gives them until they are removed, and their relative order. Each change
+	// stamps the predicates of the actions it affects with the new version of the domain.
+	size_t addAction(Action action);
+	void replaceAction(size_t id, Action action);
+	void removeAction(size_t id);
+	// Ids of the actions, in the order of getActionList()
+	vector<size_t> const& getActionIds() const;
+	// Predicates of the actions changed after that version
+	set<Predicate> changedActionPredicates(unsigned __int64 sinceVersion) const;
+
+	// Unique among the domains of a run, renewed by every modification made through the methods above. Caches derived
+	// from a domain are keyed on it.
+	unsigned __int64 getVersion() const;
+	// Unique among the domains of a run and kept by modifications, unlike the version
+	unsigned __int64 getId() const;
+	// Copies keep the action ids but get an id and a version of their own, as they are modified independently
+	shared_ptr<Domain> copy() const;
 	
 public:
+	// File the domain was loaded from, without its extension. Domains derived from it extend the name.
+	string name;
 	vector<shared_ptr<TermType>> types;
 	set<Predicate> predicates;
 	set<Term> constants;
-	vector<Action> actions;
 
 	Predicate deletePred = Predicate();
 	Predicate removeFactPred = Predicate();
@@ -353,6 +376,24 @@ public:
 	Action removeFactAction;
 	Opt<State> resetState;
 	set<Literal> removedFacts;
+
+protected:
+	Domain(Domain const& other) = default;
+
+private:
+	void newVersion();
+	void stampActions(Predicate const& pred);
+
+	unsigned __int64 id;
+	unsigned __int64 version;
+
+	// Only changed through addAction, replaceAction and removeAction
+	vector<Action> actions;
+	// Id of each action, in order, and index of each id
+	vector<size_t> actionIds;
+	map<size_t, size_t> actionIndices;
+	size_t nextActionId = 0;
+	map<Predicate, unsigned __int64> actionVersions;
 };
 
 struct Problem {
@@ -0,0 +1,348 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Logic/GroundedTask.h"
+
+#define WORD_BITS 64
+
+size_t significantWords(FactSet const& facts) {
+	size_t size = facts.words.size();
+	while (size > 0 && facts.words[size - 1] == 0)
+		size--;
+	return size;
+}
+
+bool FactSet::get(size_t fact) const {
+	size_t word = fact / WORD_BITS;
+	if (word >= words.size()) return false;
+	return (words[word] >> (fact % WORD_BITS)) & 1ULL;
+}
+
+void FactSet::set(size_t fact) {
+	size_t word = fact / WORD_BITS;
+	if (word >= words.size()) words.resize(word + 1, 0ULL);
+	words[word] |= 1ULL << (fact % WORD_BITS);
+}
+
+void FactSet::reset(size_t fact) {
+	size_t word = fact / WORD_BITS;
+	if (word >= words.size()) return;
+	words[word] &= ~(1ULL << (fact % WORD_BITS));
+}
+
+size_t FactSet::count() const {
+	size_t result = 0;
+	foreach(word, words) {
+		unsigned __int64 w = *word;
+		while (w != 0) {
+			w &= w - 1;
+			result++;
+		}
+	}
+	return result;
+}
+
+vector<size_t> FactSet::indices() const {
+	vector<size_t> result;
+	foreachindex(w, words) {
+		unsigned __int64 word = words[w];
+		for (size_t bit = 0; word != 0; bit++, word >>= 1)
+			if (word & 1ULL)
+				result.push_back(w * WORD_BITS + bit);
+	}
+	return result;
+}
+
+void FactSet::unite(FactSet const& other) {
+	if (words.size() < other.words.size())
+		words.resize(other.words.size(), 0ULL);
+	foreachindex(w, other.words)
+		words[w] |= other.words[w];
+}
+
+void FactSet::intersect(FactSet const& other) {
+	foreachindex(w, words)
+		words[w] &= w < other.words.size() ? other.words[w] : 0ULL;
+}
+
+void FactSet::subtract(FactSet const& other) {
+	size_t size = min(words.size(), other.words.size());
+	for (size_t w = 0; w < size; w++)
+		words[w] &= ~other.words[w];
+}
+
+bool FactSet::intersects(FactSet const& other) const {
+	size_t size = min(words.size(), other.words.size());
+	for (size_t w = 0; w < size; w++)
+		if ((words[w] & other.words[w]) != 0)
+			return true;
+	return false;
+}
+
+bool FactSet::includes(FactSet const& other) const {
+	foreachindex(w, other.words)
+		if ((other.words[w] & ~(w < words.size() ? words[w] : 0ULL)) != 0)
+			return false;
+	return true;
+}
+
+size_t FactSet::hash() const {
+	size_t size = significantWords(*this);
+	unsigned __int64 h = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++) {
+		h ^= words[i];
+		h *= 1099511628211ULL;
+		h ^= h >> 29;
+	}
+	return (size_t)h;
+}
+
+bool FactSet::operator==(FactSet const& other) const {
+	size_t size = significantWords(*this);
+	if (size != significantWords(other)) return false;
+	for (size_t i = 0; i < size; i++)
+		if (words[i] != other.words[i])
+			return false;
+	return true;
+}
+
+bool FactSet::operator!=(FactSet const& other) const {
+	return !(*this == other);
+}
+
+bool FactSet::operator<(FactSet const& other) const {
+	size_t size = significantWords(*this);
+	size_t otherSize = significantWords(other);
+	if (size != otherSize) return size < otherSize;
+	for (size_t i = size; i > 0; i--)
+		if (words[i - 1] != other.words[i - 1])
+			return words[i - 1] < other.words[i - 1];
+	return false;
+}
+
+GroundedTask::GroundedTask(shared_ptr<Domain> inDomain, vector<Term> inInstances) : domain(inDomain), instances(inInstances) {
+	allInsts = instances + domain->constants;
+}
+
+size_t GroundedTask::factIndex(Literal const& fact) {
+	Literal key = fact.abs();
+	auto found = factIds.find(key);
+	if (found != factIds.end())
+		return found->second;
+
+	size_t index = facts.size();
+	facts.push_back(key);
+	factIds[key] = index;
+	return index;
+}
+
+Literal GroundedTask::getFact(size_t index) const {
+	return facts[index];
+}
+
+size_t GroundedTask::factCount() const {
+	return facts.size();
+}
+
+FactSet GroundedTask::encode(State const& state) {
+	FactSet result;
+	foreach(fact, state.facts)
+		result.set(factIndex(*fact));
+	return result;
+}
+
+State GroundedTask::decode(FactSet const& factSet) const {
+	State result;
+	foreachindex(fi, facts)
+		if (factSet.get(fi))
+			result.addFact(facts[fi]);
+	return result;
+}
+
+bool GroundedTask::compilable(Literal const& actionLiteral) const {
+	return actionLiteral.pred != domain->resetAction.actionLiteral.pred &&
+		actionLiteral.pred != domain->deleteAction.actionLiteral.pred &&
+		actionLiteral.pred != domain->removeFactAction.actionLiteral.pred;
+}
+
+vector<size_t> const& GroundedTask::getOperators(Literal const& actionLiteral) {
+	auto found = literalOperators.find(actionLiteral);
+	if (found == literalOperators.end()) {
+		compileAction(actionLiteral);
+		found = literalOperators.find(actionLiteral);
+	}
+	return found->second;
+}
+
+CompiledOperator const& GroundedTask::getOperator(size_t index) const {
+	return operators[index];
+}
+
+size_t GroundedTask::operatorCount() const {
+	return operators.size();
+}
+
+vector<size_t> GroundedTask::compileAll() {
+	vector<size_t> ops;
+	set<size_t> uniqueOps;
+	set<Literal> literals;
+
+	foreach(act, domain->getActionList()) {
+		if (!compilable(act->actionLiteral)) continue;
+
+		vector<Substitution> subs = Substitution().expandUncovered(act->actionLiteral.parameters, allInsts, true);
+		foreach(sub, subs) {
+			Literal actionLiteral = sub->apply(act->actionLiteral);
+			if (!literals.insert(actionLiteral).second) continue;
+
+			vector<size_t> const& literalOps = getOperators(actionLiteral);
+			foreach(op, literalOps)
+				if (uniqueOps.insert(*op).second)
+					ops.push_back(*op);
+		}
+	}
+	return ops;
+}
+
+void GroundedTask::forgetActions(set<Predicate> const& actionPreds) {
+	for (auto it = literalOperators.begin(); it != literalOperators.end();) {
+		if (in(actionPreds, it->first.pred))
+			it = literalOperators.erase(it);
+		else
+			it++;
+	}
+}
+
+void GroundedTask::compileAction(Literal const& actionLiteral) {
+	vector<size_t>& compiled = literalOperators[actionLiteral];
+	if (!compilable(actionLiteral)) return;
+
+	// Same candidate selection as Domain::tryAction: the literal binds the action parameters, and the remaining
+	// precondition variables are ground over every instance.
+	foreachindex(ai, domain->getActionList()) {
+		Action const& act = domain->getActionList()[ai];
+		if (act.actionLiteral.pred != actionLiteral.pred) continue;
+
+		Substitution sub;
+		bool valid = true;
+		foreachindex(pi, act.actionLiteral.parameters) {
+			Term actParam = act.actionLiteral.parameters[pi];
+			Term litParam = actionLiteral.parameters[pi];
+
+			if (!TermType::typeSubsumes(actParam.type, litParam.type)) {
+				valid = false;
+				break;
+			}
+
+			if (actParam == litParam)
+				continue;
+			if (sub.getInverse(litParam).there)
+				continue;
+
+			sub.set(actParam, litParam);
+		}
+		if (!valid) continue;
+
+		set<Term> precondTerms;
+		foreach(pre, act.truePrecond)
+			precondTerms = precondTerms + pre->parameters;
+		foreach(pre, act.falsePrecond)
+			precondTerms = precondTerms + pre->parameters;
+
+		vector<Substitution> groundings = sub.expandUncovered(precondTerms, allInsts, true);
+
+		foreach(ground, groundings) {
+			CompiledOperator op;
+			op.actionLiteral = actionLiteral;
+			op.actionIndex = ai;
+
+			bool possible = true;
+			foreach(pre, act.truePrecond) {
+				// States only hold positive facts, a negative literal can never be contained
+				if (!pre->positive) {
+					possible = false;
+					break;
+				}
+				op.pre.push_back(factIndex(ground->apply(*pre)));
+			}
+			if (!possible) continue;
+
+			foreach(pre, act.falsePrecond)
+				if (pre->positive)
+					op.preFalse.push_back(factIndex(ground->apply(*pre)));
+			foreach(param, actionLiteral.parameters)
+				op.preFalse.push_back(factIndex(Literal(domain->deletePred, { *param })));
+
+			foreach(eff, act.add)
+				op.add.push_back(factIndex(ground->apply(*eff)));
+			foreach(eff, act.del)
+				op.del.push_back(factIndex(ground->apply(*eff)));
+
+			compiled.push_back(operators.size());
+			operators.push_back(op);
+		}
+	}
+}
+
+bool GroundedTask::applicable(size_t op, FactSet const& factSet) const {
+	CompiledOperator const& compiledOp = operators[op];
+	foreach(pre, compiledOp.pre)
+		if (!factSet.get(*pre))
+			return false;
+	foreach(pre, compiledOp.preFalse)
+		if (factSet.get(*pre))
+			return false;
+	return true;
+}
+
+bool GroundedTask::findApplicable(Literal const& actionLiteral, FactSet const& factSet, size_t& op) {
+	vector<size_t> const& candidates = getOperators(actionLiteral);
+
+	// Domain::tryAction uses the first action admitting a valid substitution, and applies the last one it found
+	bool found = false;
+	foreach(candidate, candidates) {
+		if (found && operators[*candidate].actionIndex != operators[op].actionIndex)
+			break;
+		if (applicable(*candidate, factSet)) {
+			op = *candidate;
+			found = true;
+		}
+	}
+	return found;
+}
+
+void GroundedTask::apply(size_t op, FactSet& factSet) const {
+	CompiledOperator const& compiledOp = operators[op];
+	foreach(eff, compiledOp.add)
+		factSet.set(*eff);
+	foreach(eff, compiledOp.del)
+		factSet.reset(*eff);
+}
+
+bool GroundedTask::tryAction(Literal const& actionLiteral, FactSet& factSet) {
+	size_t op;
+	if (!findApplicable(actionLiteral, factSet, op))
+		return false;
+	apply(op, factSet);
+	return true;
+}
+
+bool GroundedTask::reached(Goal const& goal, FactSet const& factSet) {
+	foreach(f, goal.trueFacts)
+		if (!f->positive || !factSet.get(factIndex(*f)))
+			return false;
+	foreach(f, goal.falseFacts)
+		if (f->positive && factSet.get(factIndex(*f)))
+			return false;
+	return true;
+}
+
+shared_ptr<Domain> GroundedTask::getDomain() const {
+	return domain;
+}
+
+vector<Term> GroundedTask::getInstances() const {
+	return instances;
+}
@@ -0,0 +1,102 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#pragma once
+
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+
+#include "Logic/Domain.h"
+
+using namespace std;
+
+// Set of fact indices of a GroundedTask, stored as a bitset. Trailing empty words are ignored by comparisons and hashing,
+// so sets encoded before and after the fact index grew remain comparable.
+struct FactSet {
+	vector<unsigned __int64> words;
+
+	bool get(size_t fact) const;
+	void set(size_t fact);
+	void reset(size_t fact);
+	size_t count() const;
+	vector<size_t> indices() const;
+
+	// Word-wise set operations
+	void unite(FactSet const& other);
+	void intersect(FactSet const& other);
+	void subtract(FactSet const& other);
+	bool intersects(FactSet const& other) const;
+	bool includes(FactSet const& other) const;
+
+	size_t hash() const;
+
+	bool operator==(FactSet const& other) const;
+	bool operator!=(FactSet const& other) const;
+	bool operator<(FactSet const& other) const;
+};
+
+struct FactSetHasher {
+	size_t operator()(FactSet const& facts) const {
+		return facts.hash();
+	}
+};
+
+// Fully grounded action: every precondition and effect is a fact index.
+struct CompiledOperator {
+	Literal actionLiteral;
+	size_t actionIndex;
+	vector<size_t> pre;
+	vector<size_t> preFalse;
+	vector<size_t> add;
+	vector<size_t> del;
+};
+
+// Compiled view of a domain over a fixed set of instances. Facts and operators are indexed lazily, the first time a state
+// containing them is encoded or an action literal is requested, so that only the reachable part of the task is grounded.
+// Applying an operator mirrors Domain::tryAction for regular actions; reset, delete and remove-fact are not compiled.
+class GroundedTask {
+public:
+	GroundedTask(shared_ptr<Domain> inDomain, vector<Term> inInstances);
+
+	size_t factIndex(Literal const& fact);
+	Literal getFact(size_t index) const;
+	size_t factCount() const;
+
+	FactSet encode(State const& state);
+	State decode(FactSet const& facts) const;
+
+	bool compilable(Literal const& actionLiteral) const;
+	vector<size_t> const& getOperators(Literal const& actionLiteral);
+	CompiledOperator const& getOperator(size_t index) const;
+	size_t operatorCount() const;
+	// Grounds every regular action over the instances and constants, returns every resulting operator once
+	vector<size_t> compileAll();
+	// Drops the operators compiled for these action predicates, they are compiled again from the domain when requested
+	void forgetActions(set<Predicate> const& actionPreds);
+
+	bool applicable(size_t op, FactSet const& facts) const;
+	bool findApplicable(Literal const& actionLiteral, FactSet const& facts, /*r*/ size_t& op);
+	void apply(size_t op, FactSet& facts) const;
+	bool tryAction(Literal const& actionLiteral, FactSet& facts);
+	bool reached(Goal const& goal, FactSet const& facts);
+
+	shared_ptr<Domain> getDomain() const;
+	vector<Term> getInstances() const;
+
+private:
+	void compileAction(Literal const& actionLiteral);
+
+	shared_ptr<Domain> domain;
+	vector<Term> instances;
+	vector<Term> allInsts;
+
+	map<Literal, size_t> factIds;
+	vector<Literal> facts;
+
+	map<Literal, vector<size_t>> literalOperators;
+	vector<CompiledOperator> operators;
+};
@@ -23,6 +23,8 @@ public:
 
 	shared_ptr<Domain> parseDomain(string path) {
 		domain = make_shared<Domain>();
+		domain->name = path.substr(path.find_last_of("/\\") + 1);
+		domain->name = domain->name.substr(0, domain->name.find_last_of('.'));
 
 		std::string line, text;
 		std::ifstream in(path);
@@ -0,0 +1,355 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Logic/Landmarks.h"
+
+#include <deque>
+#include <mutex>
+#include <algorithm>
+
+#define MAX_CACHED_GRAPHS 256
+#define MAX_CACHED_TASKS 16
+
+// Guards both the graph and the relaxed task caches, shared by the planners of every thread
+mutex landmarkCacheMutex;
+map<string, shared_ptr<LandmarkGraph const>> landmarkCache;
+
+// Grounding of a domain object over a set of instances, kept across the versions of that domain
+struct LandmarkGraph::RelaxedTaskEntry {
+	mutex entryMutex;
+	unsigned __int64 version = 0;
+	set<Term> constants;
+	shared_ptr<GroundedTask> grounded;
+	shared_ptr<RelaxedTask const> relaxed;
+};
+
+shared_ptr<LandmarkGraph const> LandmarkGraph::get(shared_ptr<Domain> domain, vector<Term> const& instances, Goal const& goal,
+													State const& start) {
+	string key = to_string(domain->getVersion()) + "|" + join(",", instances) + "|" + goal.toString() + "|" + join(",", start.facts);
+
+	{
+		lock_guard<mutex> lock(landmarkCacheMutex);
+		auto found = landmarkCache.find(key);
+		if (found != landmarkCache.end())
+			return found->second;
+	}
+
+	shared_ptr<LandmarkGraph const> graph = shared_ptr<LandmarkGraph const>(new LandmarkGraph(relaxedTask(domain, instances), goal, start));
+
+	lock_guard<mutex> lock(landmarkCacheMutex);
+	if (landmarkCache.size() >= MAX_CACHED_GRAPHS)
+		landmarkCache.clear();
+	landmarkCache[key] = graph;
+	return graph;
+}
+
+shared_ptr<LandmarkGraph::RelaxedTask const> LandmarkGraph::relaxedTask(shared_ptr<Domain> domain, vector<Term> const& instances) {
+	static map<string, shared_ptr<RelaxedTaskEntry>> relaxedTaskCache;
+
+	// Entries are kept across the versions of a domain, the version they were built for is checked below
+	string key = to_string(domain->getId()) + "|" + join(",", instances);
+	shared_ptr<RelaxedTaskEntry> entry;
+	{
+		lock_guard<mutex> lock(landmarkCacheMutex);
+		auto found = relaxedTaskCache.find(key);
+		if (found == relaxedTaskCache.end()) {
+			if (relaxedTaskCache.size() >= MAX_CACHED_TASKS)
+				relaxedTaskCache.clear();
+			found = relaxedTaskCache.insert(make_pair(key, make_shared<RelaxedTaskEntry>())).first;
+		}
+		entry = found->second;
+	}
+
+	lock_guard<mutex> lock(entry->entryMutex);
+	if (entry->relaxed != nullptr && entry->version == domain->getVersion())
+		return entry->relaxed;
+
+	// Only the actions changed since the last version are ground again
+	if (entry->grounded == nullptr || entry->constants != domain->constants)
+		entry->grounded = make_shared<GroundedTask>(domain, instances);
+	else {
+		set<Predicate> changed = domain->changedActionPredicates(entry->version);
+		if (changed.empty()) {
+			entry->version = domain->getVersion();
+			return entry->relaxed;
+		}
+		entry->grounded->forgetActions(changed);
+	}
+	entry->version = domain->getVersion();
+	entry->constants = domain->constants;
+
+	GroundedTask& grounded = *entry->grounded;
+	vector<size_t> ops = grounded.compileAll();
+
+	shared_ptr<RelaxedTask> relaxed = make_shared<RelaxedTask>();
+	for (size_t fi = 0; fi < grounded.factCount(); fi++) {
+		relaxed->facts.push_back(grounded.getFact(fi));
+		relaxed->factIds[grounded.getFact(fi)] = fi;
+	}
+	relaxed->requiredBy = vector<vector<size_t>>(grounded.factCount());
+	relaxed->achievers = vector<vector<size_t>>(grounded.factCount());
+
+	foreach(op, ops) {
+		CompiledOperator const& compiled = grounded.getOperator(*op);
+		set<size_t> deleted = toSet(compiled.del);
+
+		// Deletions are applied after additions, only net additions are kept
+		vector<size_t> added;
+		foreach(eff, compiled.add)
+			if (!in(deleted, *eff))
+				added.push_back(*eff);
+		if (added.empty()) continue;
+
+		size_t index = relaxed->opPre.size();
+		relaxed->opPre.push_back(toVec(toSet(compiled.pre)));
+		relaxed->opAdd.push_back(added);
+		foreach(pre, relaxed->opPre.back())
+			relaxed->requiredBy[*pre].push_back(index);
+		foreach(eff, added)
+			relaxed->achievers[*eff].push_back(index);
+	}
+
+	entry->relaxed = relaxed;
+	return entry->relaxed;
+}
+
+LandmarkGraph::LandmarkGraph(shared_ptr<RelaxedTask const> inTask, Goal const& goal, State const& start) : task(inTask) {
+	foreach(f, goal.trueFacts)
+		if (f->positive)
+			goalFacts.push_back(*f);
+
+	vector<size_t> startFacts = encode(start);
+	vector<size_t> factLayers, opLayers;
+	relaxedLayers(startFacts, SIZE_MAX, factLayers, opLayers);
+
+	// Backchaining from the goals
+	map<Literal, size_t> landmarkIds;
+	deque<size_t> toVisit;
+	auto addLandmark = [&](Literal const& fact, bool isGoal) {
+		auto found = landmarkIds.find(fact);
+		if (found != landmarkIds.end()) {
+			if (isGoal) goalLandmarks[found->second] = true;
+			return found->second;
+		}
+
+		size_t index = landmarks.size();
+		landmarkIds[fact] = index;
+		landmarks.push_back(fact);
+		goalLandmarks.push_back(isGoal);
+		predecessors.push_back(set<size_t>());
+		successors.push_back(set<size_t>());
+		toVisit.push_back(index);
+		return index;
+	};
+
+	foreach(f, goalFacts)
+		addLandmark(*f, true);
+
+	// Without a relaxed plan every candidate would pass the check below, the search gives up on the start state anyway
+	if (!goalsReached(start, factLayers))
+		return;
+
+	map<size_t, bool> necessary;
+	while (!toVisit.empty()) {
+		size_t landmark = toVisit.front();
+		toVisit.pop_front();
+
+		auto found = task->factIds.find(landmarks[landmark]);
+		if (found == task->factIds.end()) continue;
+		size_t fact = found->second;
+		if (factLayers[fact] == 0 || factLayers[fact] == SIZE_MAX) continue;
+
+		// Achievers applicable before the fact first appears
+		set<size_t> shared;
+		bool first = true;
+		foreach(op, task->achievers[fact]) {
+			if (opLayers[*op] >= factLayers[fact]) continue;
+
+			vector<size_t> const& pre = task->opPre[*op];
+			if (first) {
+				shared = toSet(pre);
+				first = false;
+				continue;
+			}
+
+			set<size_t> kept;
+			foreach(f, shared)
+				if (binary_search(pre.begin(), pre.end(), *f))
+					kept.insert(*f);
+			shared = kept;
+		}
+
+		foreach(f, shared) {
+			if (*f == fact) continue;
+
+			// Candidates not in the start state are kept when the goals are unreachable without them
+			if (factLayers[*f] > 0) {
+				auto checked = necessary.find(*f);
+				if (checked == necessary.end()) {
+					vector<size_t> withoutFacts, withoutOps;
+					relaxedLayers(startFacts, *f, withoutFacts, withoutOps);
+					checked = necessary.insert(make_pair(*f, !goalsReached(start, withoutFacts))).first;
+				}
+				if (!checked->second) continue;
+			}
+
+			size_t predecessor = addLandmark(task->facts[*f], false);
+
+			// Orderings in both directions would make both landmarks unacceptable
+			if (in(predecessors[predecessor], landmark)) continue;
+			predecessors[landmark].insert(predecessor);
+			successors[predecessor].insert(landmark);
+		}
+	}
+}
+
+vector<size_t> LandmarkGraph::encode(State const& state) const {
+	vector<size_t> result;
+	foreach(fact, state.facts) {
+		auto found = task->factIds.find(*fact);
+		if (found != task->factIds.end())
+			result.push_back(found->second);
+	}
+	return result;
+}
+
+void LandmarkGraph::relaxedLayers(vector<size_t> const& facts, size_t excluded, vector<size_t>& factLayers,
+								  vector<size_t>& opLayers) const {
+	factLayers = vector<size_t>(task->facts.size(), SIZE_MAX);
+	opLayers = vector<size_t>(task->opPre.size(), SIZE_MAX);
+
+	// Operators are applied in the layer where their last missing precondition appears
+	vector<size_t> missing = vector<size_t>(task->opPre.size());
+	vector<size_t> ready;
+	foreachindex(op, task->opPre) {
+		missing[op] = task->opPre[op].size();
+		if (missing[op] == 0)
+			ready.push_back(op);
+	}
+
+	vector<size_t> layerFacts;
+	foreach(f, facts) {
+		factLayers[*f] = 0;
+		layerFacts.push_back(*f);
+	}
+
+	for (size_t layer = 0; !layerFacts.empty() || !ready.empty(); layer++) {
+		foreach(f, layerFacts)
+			foreach(op, task->requiredBy[*f])
+				if (--missing[*op] == 0)
+					ready.push_back(*op);
+
+		vector<size_t> nextFacts;
+		foreach(op, ready) {
+			vector<size_t> const& added = task->opAdd[*op];
+			if (excluded != SIZE_MAX && find(added.begin(), added.end(), excluded) != added.end()) continue;
+
+			opLayers[*op] = layer;
+			foreach(eff, added)
+				if (factLayers[*eff] == SIZE_MAX) {
+					factLayers[*eff] = layer + 1;
+					nextFacts.push_back(*eff);
+				}
+		}
+
+		ready.clear();
+		layerFacts = nextFacts;
+	}
+}
+
+bool LandmarkGraph::goalsReached(State const& state, vector<size_t> const& factLayers) const {
+	foreach(goal, goalFacts) {
+		auto found = task->factIds.find(*goal);
+		if (found != task->factIds.end() ? factLayers[found->second] == SIZE_MAX : !state.contains(*goal))
+			return false;
+	}
+	return true;
+}
+
+size_t LandmarkGraph::size() const {
+	return landmarks.size();
+}
+
+Literal LandmarkGraph::getLandmark(size_t index) const {
+	return landmarks[index];
+}
+
+set<size_t> const& LandmarkGraph::getPredecessors(size_t index) const {
+	return predecessors[index];
+}
+
+FactSet LandmarkGraph::initialAccepted(State const& start) const {
+	FactSet accepted;
+	FactSet needed;
+	deque<size_t> toVisit;
+
+	// Only landmarks leading to a goal that is still false are needed
+	foreachindex(li, landmarks)
+		if (goalLandmarks[li] && !start.contains(landmarks[li])) {
+			needed.set(li);
+			toVisit.push_back(li);
+		}
+
+	while (!toVisit.empty()) {
+		size_t landmark = toVisit.front();
+		toVisit.pop_front();
+
+		foreach(pred, predecessors[landmark])
+			if (!needed.get(*pred) && !start.contains(landmarks[*pred])) {
+				needed.set(*pred);
+				toVisit.push_back(*pred);
+			}
+	}
+
+	foreachindex(li, landmarks)
+		if (!needed.get(li))
+			accepted.set(li);
+	return accepted;
+}
+
+FactSet LandmarkGraph::progress(FactSet const& parentAccepted, State const& state) const {
+	FactSet accepted = parentAccepted;
+
+	foreachindex(li, landmarks) {
+		if (parentAccepted.get(li) || !state.contains(landmarks[li])) continue;
+
+		bool ready = true;
+		foreach(pred, predecessors[li])
+			if (!parentAccepted.get(*pred)) {
+				ready = false;
+				break;
+			}
+		if (ready) accepted.set(li);
+	}
+	return accepted;
+}
+
+size_t LandmarkGraph::count(FactSet const& accepted, State const& state) const {
+	size_t result = 0;
+
+	foreachindex(li, landmarks) {
+		if (!accepted.get(li)) {
+			result++;
+			continue;
+		}
+		if (state.contains(landmarks[li])) continue;
+
+		bool requiredAgain = goalLandmarks[li];
+		if (!requiredAgain)
+			foreach(succ, successors[li])
+				if (!accepted.get(*succ)) {
+					requiredAgain = true;
+					break;
+				}
+		if (requiredAgain) result++;
+	}
+	return result;
+}
+
+bool LandmarkGraph::relaxedReachable(State const& state) const {
+	vector<size_t> factLayers, opLayers;
+	relaxedLayers(encode(state), SIZE_MAX, factLayers, opLayers);
+	return goalsReached(state, factLayers);
+}
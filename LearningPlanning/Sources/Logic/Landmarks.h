@@ -0,0 +1,83 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Fact landmarks of a goal from a start state: facts that every plan reaching the goal makes true at some point. They
+ * are found on the relaxed planning graph of the start state, by backchaining from the goal facts: the preconditions
+ * shared by every achiever applicable before a landmark first appears are candidates, kept when the goal becomes
+ * relaxed-unreachable without them (facts of the start state are landmarks already). A kept candidate must hold right
+ * before the landmark it was found for is first achieved (greedy-necessary ordering).
+ *
+ * The relaxed operators are compiled once per (domain, instances) and patched with the action predicates changed by
+ * each new domain version. Graphs are built once per (domain version, instances, goal, start state) and shared by every
+ * search targeting them; both are immutable once built.
+ *
+ * Along a search path, a landmark is accepted once it is true and all its predecessors were accepted before. The
+ * landmark count is the number of landmarks not accepted yet, plus the accepted ones that are required again: goals
+ * that are false, and predecessors of landmarks still to achieve.
+ */
+
+#pragma once
+
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+
+#include "Logic/Domain.h"
+#include "Logic/GroundedTask.h"
+
+using namespace std;
+
+class LandmarkGraph {
+public:
+	static shared_ptr<LandmarkGraph const> get(shared_ptr<Domain> domain, vector<Term> const& instances, Goal const& goal,
+											   State const& start);
+
+	size_t size() const;
+	Literal getLandmark(size_t index) const;
+	set<size_t> const& getPredecessors(size_t index) const;
+
+	// Landmarks true in the start state are accepted, as well as those only needed to achieve them
+	FactSet initialAccepted(State const& start) const;
+	FactSet progress(FactSet const& parentAccepted, State const& state) const;
+	size_t count(FactSet const& accepted, State const& state) const;
+
+	// False when a goal landmark cannot be reached even with delete effects ignored
+	bool relaxedReachable(State const& state) const;
+
+private:
+	// Compiled operators with delete effects and negative preconditions ignored
+	struct RelaxedTask {
+		vector<Literal> facts;
+		map<Literal, size_t> factIds;
+		vector<vector<size_t>> opPre;
+		vector<vector<size_t>> opAdd;
+		// Per fact: operators requiring it and operators adding it
+		vector<vector<size_t>> requiredBy;
+		vector<vector<size_t>> achievers;
+	};
+
+	struct RelaxedTaskEntry;
+
+	static shared_ptr<RelaxedTask const> relaxedTask(shared_ptr<Domain> domain, vector<Term> const& instances);
+
+	LandmarkGraph(shared_ptr<RelaxedTask const> inTask, Goal const& goal, State const& start);
+
+	vector<size_t> encode(State const& state) const;
+	// First layer of each fact and operator in the relaxed planning graph of the given facts, SIZE_MAX when unreachable.
+	// Operators adding the excluded fact are never applied.
+	void relaxedLayers(vector<size_t> const& facts, size_t excluded, /*r*/ vector<size_t>& factLayers,
+					   /*r*/ vector<size_t>& opLayers) const;
+	bool goalsReached(State const& state, vector<size_t> const& factLayers) const;
+
+	shared_ptr<RelaxedTask const> task;
+
+	vector<Literal> landmarks;
+	vector<bool> goalLandmarks;
+	vector<set<size_t>> predecessors;
+	vector<set<size_t>> successors;
+
+	// Goal facts that no operator adds have no index, they are reached only when already true
+	vector<Literal> goalFacts;
+};
@@ -0,0 +1,296 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Logic/PlanOptimizer.h"
+
+#include <unordered_map>
+#include <deque>
+
+// Steps supporting each step of a plan. The goal is represented as an extra step, at index steps.size().
+struct CausalLinks {
+	vector<Literal> steps;
+	vector<set<size_t>> supports;
+
+	set<size_t> justifiedSteps() const;
+};
+
+set<size_t> CausalLinks::justifiedSteps() const {
+	set<size_t> justified;
+	deque<size_t> toVisit = { steps.size() };
+
+	while (!toVisit.empty()) {
+		size_t current = toVisit.front();
+		toVisit.pop_front();
+
+		foreach(support, supports[current])
+			if (justified.insert(*support).second)
+				toVisit.push_back(*support);
+	}
+	return justified;
+}
+
+vector<Literal> PlanOptimizer::optimize(State const& state, vector<Literal> const& plan, Goal const& goal) {
+	FactSet initial = task->encode(state);
+	return optimize(state, initial, plan, goalTarget(goal));
+}
+
+vector<Literal> PlanOptimizer::optimize(State const& state, vector<Literal> const& plan) {
+	FactSet initial = task->encode(state);
+
+	vector<size_t> ops;
+	FactSet final;
+	if (!compile(initial, plan, ops, final))
+		return plan;
+
+	// Every indexed fact must end up with the same truth value
+	Target target;
+	for (size_t fi = 0; fi < task->factCount(); fi++)
+		if (final.get(fi)) target.trueFacts.push_back(fi);
+		else target.falseFacts.push_back(fi);
+
+	return optimize(state, initial, plan, target);
+}
+
+vector<Literal> PlanOptimizer::optimize(State const& state, FactSet const& initial, vector<Literal> const& plan, Target const& target) {
+	vector<size_t> ops;
+	FactSet final;
+	if (!compile(initial, plan, ops, final) || !reached(target, final))
+		return plan;
+
+	vector<Literal> result = removeLoops(initial, plan);
+	result = removeUnjustified(initial, result, target);
+	result = eliminateActions(initial, result, target);
+
+	// Actions with free precondition variables can compile to several operators, and the one Domain::tryAction picks
+	// may differ: the plan is then checked against the domain itself.
+	bool ambiguous = false;
+	foreach(step, result)
+		if (task->getOperators(*step).size() > 1) {
+			ambiguous = true;
+			break;
+		}
+
+	if (ambiguous) {
+		State current = state;
+		vector<Term> instances = task->getInstances();
+		foreach(step, result) {
+			Opt<State> next = task->getDomain()->tryAction(current, instances, *step);
+			if (!next.there) return plan;
+			current = next.obj;
+		}
+		if (!reached(target, task->encode(current)))
+			return plan;
+	}
+
+	return result;
+}
+
+vector<Literal> PlanOptimizer::removeLoops(State const& state, vector<Literal> const& plan) {
+	return removeLoops(task->encode(state), plan);
+}
+
+vector<Literal> PlanOptimizer::eliminateActions(State const& state, vector<Literal> const& plan, Goal const& goal) {
+	return eliminateActions(task->encode(state), plan, goalTarget(goal));
+}
+
+bool PlanOptimizer::validate(State const& state, vector<Literal> const& plan, Goal const& goal) {
+	vector<size_t> ops;
+	FactSet final;
+	if (!compile(task->encode(state), plan, ops, final))
+		return false;
+	return reached(goalTarget(goal), final);
+}
+
+shared_ptr<GroundedTask> PlanOptimizer::getTask() const {
+	return task;
+}
+
+PlanOptimizer::Target PlanOptimizer::goalTarget(Goal const& goal) {
+	Target target;
+	foreach(f, goal.trueFacts)
+		if (f->positive)
+			target.trueFacts.push_back(task->factIndex(*f));
+	foreach(f, goal.falseFacts)
+		if (f->positive)
+			target.falseFacts.push_back(task->factIndex(*f));
+	return target;
+}
+
+bool PlanOptimizer::compile(FactSet const& initial, vector<Literal> const& plan, vector<size_t>& ops, FactSet& final) {
+	ops.clear();
+	final = initial;
+
+	foreach(step, plan) {
+		size_t op;
+		if (!task->compilable(*step) || !task->findApplicable(*step, final, op))
+			return false;
+		task->apply(op, final);
+		ops.push_back(op);
+	}
+	return true;
+}
+
+bool PlanOptimizer::reached(Target const& target, FactSet const& facts) const {
+	foreach(f, target.trueFacts)
+		if (!facts.get(*f))
+			return false;
+	foreach(f, target.falseFacts)
+		if (facts.get(*f))
+			return false;
+	return true;
+}
+
+bool PlanOptimizer::simulate(FactSet const& initial, vector<Literal> const& plan, vector<bool> const& removed, Target const& target,
+							 bool skipInapplicable, vector<bool>& skipped) {
+	FactSet current = initial;
+	skipped = vector<bool>(plan.size(), false);
+
+	foreachindex(si, plan) {
+		if (removed[si]) continue;
+
+		size_t op;
+		if (!task->findApplicable(plan[si], current, op)) {
+			if (!skipInapplicable) return false;
+			skipped[si] = true;
+			continue;
+		}
+		task->apply(op, current);
+	}
+
+	return reached(target, current);
+}
+
+vector<Literal> PlanOptimizer::removeLoops(FactSet const& initial, vector<Literal> const& plan) {
+	unordered_map<FactSet, size_t, FactSetHasher> visited;
+	vector<FactSet> states = { initial };
+	vector<Literal> simplifiedPlan;
+
+	visited[initial] = 0;
+	FactSet current = initial;
+
+	foreach(step, plan) {
+		if (!task->tryAction(*step, current))
+			return plan;
+
+		auto found = visited.find(current);
+		if (found != visited.end()) {
+			// Back to an already visited state: every step since then is useless
+			size_t index = found->second;
+			for (size_t si = index + 1; si < states.size(); si++)
+				visited.erase(states[si]);
+			states.resize(index + 1);
+			simplifiedPlan.resize(index);
+		}
+		else {
+			visited[current] = states.size();
+			states.push_back(current);
+			simplifiedPlan.push_back(*step);
+		}
+	}
+
+	return simplifiedPlan;
+}
+
+vector<Literal> PlanOptimizer::removeUnjustified(FactSet const& initial, vector<Literal> const& plan, Target const& target) {
+	set<size_t> justified = causalLinks(initial, plan, target).justifiedSteps();
+	if (justified.size() == plan.size())
+		return plan;
+
+	vector<Literal> reducedPlan;
+	vector<bool> removed;
+	foreachindex(si, plan) {
+		removed.push_back(!in(justified, si));
+		if (!removed.back())
+			reducedPlan.push_back(plan[si]);
+	}
+
+	// Unjustified steps may still protect a negative precondition by deleting a fact, so the block is validated
+	vector<bool> skipped;
+	if (simulate(initial, plan, removed, target, false, skipped))
+		return reducedPlan;
+	return plan;
+}
+
+vector<Literal> PlanOptimizer::eliminateActions(FactSet const& initial, vector<Literal> const& plan, Target const& target) {
+	vector<Literal> currentPlan = plan;
+	size_t index = 0;
+
+	while (index < currentPlan.size()) {
+		vector<bool> removed = vector<bool>(currentPlan.size(), false);
+		removed[index] = true;
+
+		vector<bool> skipped;
+		if (simulate(initial, currentPlan, removed, target, true, skipped)) {
+			vector<Literal> reducedPlan;
+			foreachindex(si, currentPlan)
+				if (!removed[si] && !skipped[si])
+					reducedPlan.push_back(currentPlan[si]);
+			currentPlan = reducedPlan;
+		}
+		else {
+			index++;
+		}
+	}
+
+	return currentPlan;
+}
+
+CausalLinks PlanOptimizer::causalLinks(FactSet const& initial, vector<Literal> const& plan, Target const& target) {
+	CausalLinks result;
+	result.steps = plan;
+	result.supports = vector<set<size_t>>(plan.size() + 1);
+
+	vector<size_t> ops;
+	FactSet final;
+	if (!compile(initial, plan, ops, final)) {
+		// Not executable: each step supports the next one
+		for (size_t si = 1; si <= plan.size(); si++)
+			result.supports[si].insert(si - 1);
+		return result;
+	}
+
+	// For each fact, the steps changing its value, in plan order (true when the fact is made true)
+	vector<vector<pair<size_t, bool>>> events = vector<vector<pair<size_t, bool>>>(task->factCount());
+	foreachindex(si, ops) {
+		CompiledOperator const& op = task->getOperator(ops[si]);
+		set<size_t> deleted = toSet(op.del);
+		foreach(eff, op.add)
+			if (!in(deleted, *eff))
+				events[*eff].push_back(make_pair(si, true));
+		foreach(eff, deleted)
+			events[*eff].push_back(make_pair(si, false));
+	}
+
+	auto addLinks = [&](size_t consumer, vector<size_t> const& facts, bool truth) {
+		foreach(fact, facts) {
+			if (*fact >= events.size()) continue;
+			vector<pair<size_t, bool>> const& factEvents = events[*fact];
+
+			// Producer: last step giving the fact its required value before the consumer, the initial state otherwise
+			bool fromInitial = true;
+			size_t producer = 0;
+			foreach(ev, factEvents) {
+				if (ev->first >= consumer) break;
+				if (ev->second == truth) {
+					fromInitial = false;
+					producer = ev->first;
+				}
+			}
+
+			if (!fromInitial)
+				result.supports[consumer].insert(producer);
+		}
+	};
+
+	foreachindex(si, ops) {
+		CompiledOperator const& op = task->getOperator(ops[si]);
+		addLinks(si, op.pre, true);
+		addLinks(si, op.preFalse, false);
+	}
+	addLinks(plan.size(), target.trueFacts, true);
+	addLinks(plan.size(), target.falseFacts, false);
+
+	return result;
+}
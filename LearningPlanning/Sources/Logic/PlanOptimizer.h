@@ -0,0 +1,62 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Post-optimization of sequential plans, whatever planner produced them. Plans are simulated over the compiled operators
+ * of a GroundedTask, which keeps every validation cheap enough to run on each plan an agent executes:
+ *  - loop removal cuts the steps between two occurrences of the same state, found through a hash of visited states,
+ *  - the causal links of the plan are built, and steps that support neither the target nor another step are dropped as
+ *    a single block,
+ *  - greedy action elimination removes a step together with the later steps it enables, whenever the target is still reached.
+ *
+ * Plans are taken and returned in execution order.
+ */
+
+#pragma once
+
+#include <vector>
+#include <set>
+#include <memory>
+
+#include "Logic/Domain.h"
+#include "Logic/GroundedTask.h"
+
+using namespace std;
+
+struct CausalLinks;
+
+class PlanOptimizer {
+public:
+	PlanOptimizer(shared_ptr<GroundedTask> inTask) : task(inTask) { }
+
+	// The target is the goal
+	vector<Literal> optimize(State const& state, vector<Literal> const& plan, Goal const& goal);
+	// The target is the state the plan leads to
+	vector<Literal> optimize(State const& state, vector<Literal> const& plan);
+
+	vector<Literal> removeLoops(State const& state, vector<Literal> const& plan);
+	vector<Literal> eliminateActions(State const& state, vector<Literal> const& plan, Goal const& goal);
+	bool validate(State const& state, vector<Literal> const& plan, Goal const& goal);
+
+	shared_ptr<GroundedTask> getTask() const;
+
+private:
+	struct Target {
+		vector<size_t> trueFacts;
+		vector<size_t> falseFacts;
+	};
+
+	Target goalTarget(Goal const& goal);
+	bool compile(FactSet const& initial, vector<Literal> const& plan, /*r*/ vector<size_t>& ops, /*r*/ FactSet& final);
+	bool reached(Target const& target, FactSet const& facts) const;
+	bool simulate(FactSet const& initial, vector<Literal> const& plan, vector<bool> const& removed, Target const& target,
+				  bool skipInapplicable, /*r*/ vector<bool>& skipped);
+
+	vector<Literal> removeLoops(FactSet const& initial, vector<Literal> const& plan);
+	vector<Literal> removeUnjustified(FactSet const& initial, vector<Literal> const& plan, Target const& target);
+	vector<Literal> eliminateActions(FactSet const& initial, vector<Literal> const& plan, Target const& target);
+	CausalLinks causalLinks(FactSet const& initial, vector<Literal> const& plan, Target const& target);
+	vector<Literal> optimize(State const& state, FactSet const& initial, vector<Literal> const& plan, Target const& target);
+
+	shared_ptr<GroundedTask> task;
+};
@@ -0,0 +1,249 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Logic/RegressionSearch.h"
+
+#include <algorithm>
+#include <queue>
+
+RegressionSearch::RegressionSearch(shared_ptr<GroundedTask> inTask, Goal const& inGoal) : task(inTask), goal(inGoal) {
+	ops = task->compileAll();
+
+	foreach(f, goal.trueFacts)
+		if (f->positive)
+			goalPos.set(task->factIndex(*f));
+	foreach(f, goal.falseFacts)
+		if (f->positive)
+			goalNeg.set(task->factIndex(*f));
+
+	// Partial states only ever require facts known at this point
+	factCount = task->factCount();
+	addedBy = vector<vector<size_t>>(factCount);
+	deletedBy = vector<vector<size_t>>(factCount);
+
+	set<Literal> seen;
+	foreachindex(oi, ops) {
+		CompiledOperator const& compiled = task->getOperator(ops[oi]);
+		if (seen.insert(compiled.actionLiteral).second)
+			actionLiterals.push_back(compiled.actionLiteral);
+
+		FactSet pre, preFalse, add, del;
+		foreach(f, compiled.pre) pre.set(*f);
+		foreach(f, compiled.preFalse) preFalse.set(*f);
+		foreach(f, compiled.del) del.set(*f);
+
+		// Deletions are applied after additions
+		foreach(f, compiled.add)
+			if (!del.get(*f)) {
+				add.set(*f);
+				addedBy[*f].push_back(oi);
+			}
+		foreach(f, compiled.del)
+			deletedBy[*f].push_back(oi);
+
+		opPre.push_back(pre);
+		opPreFalse.push_back(preFalse);
+		opAdd.push_back(add);
+		opDel.push_back(del);
+	}
+}
+
+size_t RegressionSearch::expansions() const {
+	return expanded;
+}
+
+bool RegressionSearch::search(State const& start, bool bidirectional, int depthLimit, function<bool()> interrupted, vector<Literal>& result) {
+	forwardNodes.clear();
+	backwardNodes.clear();
+	forwardIds.clear();
+	backwardIds.clear();
+	forwardByFact.clear();
+	backwardByAnchor.clear();
+	unanchored.clear();
+	expanded = 0;
+
+	FactSet startFacts = task->encode(start);
+
+	typedef pair<int, size_t> Entry;
+	priority_queue<Entry, vector<Entry>, greater<Entry>> forwardOpen;
+	priority_queue<Entry, vector<Entry>, greater<Entry>> backwardOpen;
+	bool found = false;
+
+	auto addForward = [&](FactSet const& facts, int parent, size_t op, int cost) {
+		if (forwardIds.find(facts) != forwardIds.end()) return;
+
+		size_t id = forwardNodes.size();
+		forwardNodes.push_back(ForwardNode { facts, parent, op, cost });
+		forwardIds[facts] = id;
+
+		vector<size_t> factList = facts.indices();
+		vector<size_t> candidates = unanchored;
+		foreach(f, factList) {
+			if (*f >= factCount) break;
+			forwardByFact[*f].push_back(id);
+
+			auto anchored = backwardByAnchor.find(*f);
+			if (anchored != backwardByAnchor.end())
+				candidates.insert(candidates.end(), anchored->second.begin(), anchored->second.end());
+		}
+
+		foreach(b, candidates)
+			if (meets(facts, backwardNodes[*b]) && tryMeeting((int)id, (int)*b, startFacts, depthLimit, result)) {
+				found = true;
+				return;
+			}
+
+		forwardOpen.push(Entry(cost + forwardHeuristic(facts), id));
+	};
+
+	auto addBackward = [&](FactSet const& pos, FactSet const& neg, int parent, size_t op, int cost) {
+		FactSet key = backwardKey(pos, neg);
+		if (backwardIds.find(key) != backwardIds.end()) return;
+
+		size_t id = backwardNodes.size();
+		backwardNodes.push_back(BackwardNode { pos, neg, parent, op, cost });
+		backwardIds[key] = id;
+
+		vector<size_t> posList = pos.indices();
+		vector<size_t> candidates;
+		if (posList.empty()) {
+			unanchored.push_back(id);
+			foreachindex(f, forwardNodes)
+				candidates.push_back(f);
+		}
+		else {
+			backwardByAnchor[posList[0]].push_back(id);
+			auto containing = forwardByFact.find(posList[0]);
+			if (containing != forwardByFact.end())
+				candidates = containing->second;
+		}
+
+		foreach(f, candidates)
+			if (meets(forwardNodes[*f].facts, backwardNodes[id]) && tryMeeting((int)*f, (int)id, startFacts, depthLimit, result)) {
+				found = true;
+				return;
+			}
+
+		backwardOpen.push(Entry(cost + backwardHeuristic(pos, neg, startFacts), id));
+	};
+
+	addForward(startFacts, -1, 0, 0);
+	addBackward(goalPos, goalNeg, -1, 0, 0);
+
+	while (!found) {
+		if (interrupted && interrupted()) return false;
+
+		bool expandForward = bidirectional && !forwardOpen.empty() && (backwardOpen.empty() || forwardOpen.size() < backwardOpen.size());
+		if (!expandForward && backwardOpen.empty()) return false;
+		expanded++;
+
+		if (expandForward) {
+			size_t id = forwardOpen.top().second;
+			forwardOpen.pop();
+			ForwardNode node = forwardNodes[id];
+			if (depthLimit > 0 && node.cost >= depthLimit) continue;
+
+			foreach(lit, actionLiterals) {
+				size_t op;
+				if (!task->findApplicable(*lit, node.facts, op)) continue;
+
+				FactSet next = node.facts;
+				task->apply(op, next);
+				addForward(next, (int)id, op, node.cost + 1);
+				if (found) break;
+			}
+		}
+		else {
+			size_t id = backwardOpen.top().second;
+			backwardOpen.pop();
+			BackwardNode node = backwardNodes[id];
+			if (depthLimit > 0 && node.cost >= depthLimit) continue;
+
+			// Only operators achieving a requirement are relevant
+			set<size_t> relevant;
+			vector<size_t> posList = node.pos.indices();
+			foreach(f, posList)
+				relevant.insert(addedBy[*f].begin(), addedBy[*f].end());
+			vector<size_t> negList = node.neg.indices();
+			foreach(f, negList)
+				relevant.insert(deletedBy[*f].begin(), deletedBy[*f].end());
+
+			foreach(oi, relevant) {
+				FactSet pos, neg;
+				if (!regress(node, *oi, pos, neg)) continue;
+
+				addBackward(pos, neg, (int)id, ops[*oi], node.cost + 1);
+				if (found) break;
+			}
+		}
+	}
+
+	return true;
+}
+
+FactSet RegressionSearch::backwardKey(FactSet const& pos, FactSet const& neg) const {
+	FactSet key = pos;
+	vector<size_t> negList = neg.indices();
+	foreach(f, negList)
+		key.set(*f + factCount);
+	return key;
+}
+
+bool RegressionSearch::meets(FactSet const& facts, BackwardNode const& node) const {
+	return facts.includes(node.pos) && !facts.intersects(node.neg);
+}
+
+int RegressionSearch::forwardHeuristic(FactSet const& facts) const {
+	FactSet missing = goalPos;
+	missing.subtract(facts);
+	FactSet extra = goalNeg;
+	extra.intersect(facts);
+	return (int)(missing.count() + extra.count());
+}
+
+int RegressionSearch::backwardHeuristic(FactSet const& pos, FactSet const& neg, FactSet const& start) const {
+	FactSet missing = pos;
+	missing.subtract(start);
+	FactSet extra = neg;
+	extra.intersect(start);
+	return (int)(missing.count() + extra.count());
+}
+
+bool RegressionSearch::regress(BackwardNode const& node, size_t op, FactSet& pos, FactSet& neg) const {
+	if (!opAdd[op].intersects(node.pos) && !opDel[op].intersects(node.neg)) return false;
+	// The operator must not undo another requirement
+	if (opDel[op].intersects(node.pos) || opAdd[op].intersects(node.neg)) return false;
+
+	pos = node.pos;
+	pos.subtract(opAdd[op]);
+	pos.unite(opPre[op]);
+
+	neg = node.neg;
+	neg.subtract(opDel[op]);
+	neg.unite(opPreFalse[op]);
+
+	return !pos.intersects(neg);
+}
+
+bool RegressionSearch::tryMeeting(int forward, int backward, FactSet const& start, int depthLimit, vector<Literal>& result) {
+	vector<Literal> plan;
+	for (int f = forward; forwardNodes[f].parent >= 0; f = forwardNodes[f].parent)
+		plan.push_back(task->getOperator(forwardNodes[f].op).actionLiteral);
+	reverse(plan.begin(), plan.end());
+	for (int b = backward; backwardNodes[b].parent >= 0; b = backwardNodes[b].parent)
+		plan.push_back(task->getOperator(backwardNodes[b].op).actionLiteral);
+
+	if (depthLimit > 0 && (int)plan.size() > depthLimit) return false;
+
+	// Regression picks operators freely, while Domain::tryAction may pick another one for the same literal
+	FactSet facts = start;
+	foreach(lit, plan)
+		if (!task->tryAction(*lit, facts))
+			return false;
+	if (!task->reached(goal, facts)) return false;
+
+	result = vector<Literal>(plan.rbegin(), plan.rend());
+	return true;
+}
@@ -0,0 +1,91 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Goal regression over the compiled operators of a GroundedTask. Backward nodes are partial states: facts required true
+ * and facts required false. Regressing one through an operator that achieves part of it, without undoing the rest,
+ * replaces the achieved facts by the operator preconditions. Backward nodes are ordered by their cost plus the number of
+ * requirements the start state does not meet.
+ *
+ * In bidirectional mode, a forward frontier ordered by cost plus goal count is expanded alternately, the smaller frontier
+ * first. Generated nodes of both sides are hashed: forward states by their facts, backward nodes by one of their required
+ * facts, so that a new node is only checked against nodes of the other side that can meet it. Plans found at a meeting
+ * are replayed with Domain::tryAction semantics before being returned, the first valid one wins.
+ */
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+
+#include "Logic/Domain.h"
+#include "Logic/GroundedTask.h"
+
+using namespace std;
+
+enum SearchDirection {
+	FORWARD_SEARCH,
+	BACKWARD_SEARCH,
+	BIDIRECTIONAL_SEARCH
+};
+
+class RegressionSearch {
+public:
+	RegressionSearch(shared_ptr<GroundedTask> inTask, Goal const& inGoal);
+
+	// Plans are returned back to front, like agents store them. The search gives up when interrupted returns true.
+	bool search(State const& start, bool bidirectional, int depthLimit, function<bool()> interrupted, /*r*/ vector<Literal>& result);
+
+	// Nodes expanded by the last search, on both sides
+	size_t expansions() const;
+
+private:
+	struct ForwardNode {
+		FactSet facts;
+		int parent;
+		size_t op;
+		int cost;
+	};
+
+	struct BackwardNode {
+		FactSet pos;
+		FactSet neg;
+		int parent;
+		size_t op;
+		int cost;
+	};
+
+	FactSet backwardKey(FactSet const& pos, FactSet const& neg) const;
+	bool meets(FactSet const& facts, BackwardNode const& node) const;
+	int forwardHeuristic(FactSet const& facts) const;
+	int backwardHeuristic(FactSet const& pos, FactSet const& neg, FactSet const& start) const;
+
+	bool regress(BackwardNode const& node, size_t op, /*r*/ FactSet& pos, /*r*/ FactSet& neg) const;
+	bool tryMeeting(int forward, int backward, FactSet const& start, int depthLimit, /*r*/ vector<Literal>& result);
+
+	shared_ptr<GroundedTask> task;
+	Goal goal;
+	FactSet goalPos;
+	FactSet goalNeg;
+
+	// Operators by action literal in grounding order, and per fact the operators adding or deleting it
+	vector<size_t> ops;
+	vector<Literal> actionLiterals;
+	vector<FactSet> opPre, opPreFalse, opAdd, opDel;
+	vector<vector<size_t>> addedBy, deletedBy;
+	size_t factCount;
+
+	vector<ForwardNode> forwardNodes;
+	vector<BackwardNode> backwardNodes;
+	unordered_map<FactSet, size_t, FactSetHasher> forwardIds;
+	unordered_map<FactSet, size_t, FactSetHasher> backwardIds;
+	// Meeting index: forward states per fact they contain, backward nodes per anchor fact (unanchored ones require no fact)
+	unordered_map<size_t, vector<size_t>> forwardByFact;
+	unordered_map<size_t, vector<size_t>> backwardByAnchor;
+	vector<size_t> unanchored;
+
+	size_t expanded = 0;
+};
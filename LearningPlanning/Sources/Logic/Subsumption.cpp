@@ -0,0 +1,196 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "Logic/Subsumption.h"
+
+#include <map>
+
+OISubsumption::OISubsumption(vector<Literal> const& source, std::set<Literal> const& dst, Substitution const& preset) : preset(preset) {
+	map<Term, int> valueIds;
+	map<string, vector<Literal const*>> dstByPred;
+	foreach(fact, dst) {
+		dstByPred[fact->pred.name].push_back(&*fact);
+		foreach(param, fact->parameters) {
+			if (!in(valueIds, *param)) {
+				int id = (int)valueTerms.size();
+				valueIds[*param] = id;
+				valueTerms.push_back(*param);
+			}
+		}
+	}
+
+	usedBy = vector<int>(valueTerms.size(), -1);
+	map<Term, Term> presetMapping = preset.getMapping();
+	foreach(entry, presetMapping) {
+		auto found = valueIds.find(entry->second);
+		if (found != valueIds.end())
+			usedBy[found->second] = -2;
+	}
+
+	map<Term, int> slotIds;
+	foreach(lit, source) {
+		Probe probe;
+		vector<int> fixed;
+
+		// Mapped terms and constants must be found as they are
+		foreach(param, lit->parameters) {
+			Opt<Term> mapped = preset.get(*param);
+			if (mapped.there || !param->isVariable) {
+				auto found = valueIds.find(mapped.there ? mapped.obj : *param);
+				if (found == valueIds.end()) satisfiable = false;
+				fixed.push_back(found == valueIds.end() ? -1 : found->second);
+				probe.slots.push_back(-1);
+				continue;
+			}
+
+			if (!in(slotIds, *param)) {
+				int slot = (int)slotTerms.size();
+				slotIds[*param] = slot;
+				slotTerms.push_back(*param);
+			}
+			fixed.push_back(-1);
+			probe.slots.push_back(slotIds[*param]);
+		}
+		if (!satisfiable) return;
+
+		std::set<vector<int>> rows;
+		auto samePred = dstByPred.find(lit->pred.name);
+		if (samePred != dstByPred.end()) {
+			foreach(fact, samePred->second) {
+				if ((*fact)->parameters.size() < probe.slots.size()) continue;
+
+				// A slot takes one value and distinct slots distinct ones, which the preset does not map to
+				vector<int> row;
+				bool fits = true;
+				for (size_t pi = 0; pi < probe.slots.size() && fits; pi++) {
+					int value = valueIds[(*fact)->parameters[pi]];
+					int slot = probe.slots[pi];
+					row.push_back(value);
+
+					if (slot < 0) {
+						fits = fixed[pi] == value;
+						continue;
+					}
+					if (usedBy[value] == -2) fits = false;
+					for (size_t pj = 0; pj < pi && fits; pj++)
+						if (probe.slots[pj] >= 0 && (probe.slots[pj] == slot) != (row[pj] == value))
+							fits = false;
+				}
+				if (fits)
+					rows.insert(row);
+			}
+		}
+
+		foreach(row, rows)
+			probe.rows.insert(probe.rows.end(), row->begin(), row->end());
+		probe.count = rows.size();
+		probes.push_back(probe);
+	}
+
+	values = vector<int>(slotTerms.size(), -1);
+	done = vector<bool>(probes.size(), false);
+	trail.reserve(slotTerms.size());
+}
+
+bool OISubsumption::exists() {
+	if (!satisfiable) return false;
+
+	limit = 1;
+	found = 0;
+	results = nullptr;
+	search();
+	return found > 0;
+}
+
+std::set<Substitution> OISubsumption::solutions(size_t inLimit) {
+	std::set<Substitution> subs;
+	if (!satisfiable) return subs;
+
+	limit = inLimit;
+	found = 0;
+	results = &subs;
+	search();
+	results = nullptr;
+	return subs;
+}
+
+bool OISubsumption::consistent(Probe const& probe, size_t row) const {
+	int const* rowValues = probe.rows.data() + row * probe.slots.size();
+	foreachindex(pi, probe.slots) {
+		int slot = probe.slots[pi];
+		if (slot < 0) continue;
+		if (values[slot] >= 0 ? values[slot] != rowValues[pi] : usedBy[rowValues[pi]] != -1)
+			return false;
+	}
+	return true;
+}
+
+size_t OISubsumption::support(Probe const& probe) const {
+	size_t count = 0;
+	for (size_t ri = 0; ri < probe.count; ri++)
+		if (consistent(probe, ri))
+			count++;
+	return count;
+}
+
+bool OISubsumption::search() {
+	if (doneCount == probes.size()) {
+		if (results != nullptr) {
+			Substitution sub = preset;
+			foreachindex(si, slotTerms)
+				sub.set(slotTerms[si], valueTerms[values[si]]);
+			results->insert(sub);
+		}
+		found++;
+		return limit > 0 && found >= limit;
+	}
+
+	// Most constrained literal first, any literal left without candidates ends the branch
+	size_t best = 0;
+	size_t bestSupport = 0;
+	bool chosen = false;
+	foreachindex(pi, probes) {
+		if (done[pi]) continue;
+		size_t count = support(probes[pi]);
+		if (count == 0) return false;
+		if (!chosen || count < bestSupport) {
+			best = pi;
+			bestSupport = count;
+			chosen = true;
+		}
+	}
+
+	Probe const& probe = probes[best];
+	done[best] = true;
+	doneCount++;
+
+	bool stop = false;
+	size_t mark = trail.size();
+	for (size_t ri = 0; ri < probe.count && !stop; ri++) {
+		if (!consistent(probe, ri)) continue;
+
+		int const* rowValues = probe.rows.data() + ri * probe.slots.size();
+		foreachindex(pi, probe.slots) {
+			int slot = probe.slots[pi];
+			if (slot < 0 || values[slot] >= 0) continue;
+			values[slot] = rowValues[pi];
+			usedBy[rowValues[pi]] = slot;
+			trail.push_back(slot);
+		}
+
+		stop = search();
+
+		while (trail.size() > mark) {
+			int slot = trail.back();
+			trail.pop_back();
+			usedBy[values[slot]] = -1;
+			values[slot] = -1;
+		}
+	}
+
+	done[best] = false;
+	doneCount--;
+	return stop;
+}
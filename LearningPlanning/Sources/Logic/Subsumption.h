@@ -0,0 +1,64 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Object-identity subsumption of a set of literals into another, extending a preset substitution: distinct variables map
+ * to distinct terms, which are not targets of the preset either. Variables are numbered slots and the destination terms
+ * numbered values. Each source literal keeps the destination facts it could map to on its own, deduplicated on their
+ * values, and the search backtracks over them: it always extends the literal with the fewest candidates left under the
+ * current bindings, and drops a branch as soon as one literal has none left. Bindings live in arrays sized once, the
+ * recursion itself does not allocate, only the substitutions it reports do.
+ *
+ * Like oiSubsume used to, signs are ignored and predicates compared by name.
+ */
+
+#pragma once
+
+#include <set>
+#include <vector>
+
+#include "Logic/Domain.h"
+
+using namespace std;
+
+class OISubsumption {
+public:
+	OISubsumption(vector<Literal> const& source, std::set<Literal> const& dst, Substitution const& preset);
+
+	// Stops at the first solution
+	bool exists();
+
+	// Every solution, or the first limit ones when limit is not 0
+	std::set<Substitution> solutions(size_t limit = 0);
+
+private:
+	struct Probe {
+		// Slot at each position, -1 where the term is fixed
+		vector<int> slots;
+
+		// Values of the candidate facts, one row of slots.size() values per candidate
+		vector<int> rows;
+		size_t count = 0;
+	};
+
+	bool consistent(Probe const& probe, size_t row) const;
+	size_t support(Probe const& probe) const;
+	bool search();
+
+	Substitution preset;
+	bool satisfiable = true;
+	vector<Term> slotTerms;
+	vector<Term> valueTerms;
+	vector<Probe> probes;
+
+	// Value of each slot and slot of each value, -1 when unbound, -2 for targets of the preset
+	vector<int> values;
+	vector<int> usedBy;
+	vector<bool> done;
+	size_t doneCount = 0;
+	vector<int> trail;
+
+	size_t limit = 0;
+	size_t found = 0;
+	std::set<Substitution>* results = nullptr;
+};
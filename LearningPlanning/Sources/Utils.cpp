@@ -66,3 +66,46 @@ float clamp(float val, float minv, float maxv) {
 string formatPercent(const float value) {
 	return to_string((int)(value * 100)) + "%";
 }
+
+AliasTable::AliasTable(vector<float> const& weights) : probs(weights.size(), 1.0f), aliases(weights.size(), 0) {
+	vector<double> scaled;
+	vector<size_t> small, large;
+	foreachindex(i, weights) {
+		scaled.push_back((double)weights[i] * (double)weights.size());
+		if (scaled[i] < 1.0) small.push_back(i);
+		else large.push_back(i);
+	}
+
+	// Each small entry is topped up to 1 by a large one, which then becomes small if it went under 1
+	while (!small.empty() && !large.empty()) {
+		size_t less = small.back();
+		size_t more = large.back();
+		small.pop_back();
+
+		probs[less] = (float)scaled[less];
+		aliases[less] = more;
+		scaled[more] -= 1.0 - scaled[less];
+		if (scaled[more] < 1.0) {
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+
+	// Leftovers only differ from 1 by rounding
+	foreach(i, small)
+		probs[*i] = 1.0f;
+	foreach(i, large)
+		probs[*i] = 1.0f;
+}
+
+size_t AliasTable::size() const {
+	return probs.size();
+}
+
+size_t AliasTable::sample(std::mt19937& g) const {
+	std::uniform_int_distribution<size_t> column(0, probs.size() - 1);
+	std::uniform_real_distribution<float> coin(0.0f, 1.0f);
+
+	size_t i = column(g);
+	return coin(g) < probs[i] ? i : aliases[i];
+}
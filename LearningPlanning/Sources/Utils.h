@@ -13,6 +13,8 @@
 #include <string>
 #include <limits>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #ifndef foreach
 #define foreach(iter, iterable) for(auto iter = iterable.begin(); iter != iterable.end(); iter++)
@@ -49,7 +51,7 @@ Iter select_randomly(Iter start, Iter end) {
 }
 
 template<typename Iter>
-Iter select_randomly_weighted(Iter start, vector<float> weights, std::mt19937& g) {
+Iter select_randomly_weighted(Iter start, vector<float> const& weights, std::mt19937& g) {
 	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
 	float sample = dis(g);
 	float cumulWeight = 0.0f;
@@ -65,7 +67,7 @@ Iter select_randomly_weighted(Iter start, vector<float> weights, std::mt19937& g
 }
 
 template<typename Iter>
-Iter select_randomly_weighted(Iter start, vector<float> weights) {
+Iter select_randomly_weighted(Iter start, vector<float> const& weights) {
 	return select_randomly_weighted(start, weights, globalRandomDevice);
 }
 
@@ -281,6 +283,31 @@ string joinmap(std::map<K, V> const& args) {
 	return joinmap(", ", args);
 }
 
+// Shares its value between copies until one of them writes to it.
+template<typename T>
+class CopyOnWrite {
+public:
+	CopyOnWrite() : ptr(make_shared<T>()) { }
+	CopyOnWrite(T const& value) : ptr(make_shared<T>(value)) { }
+
+	T const& get() const {
+		return *ptr;
+	}
+
+	T const* operator->() const {
+		return ptr.get();
+	}
+
+	T& write() {
+		if (ptr.use_count() > 1)
+			ptr = make_shared<T>(*ptr);
+		return *ptr;
+	}
+
+private:
+	shared_ptr<T> ptr;
+};
+
 string padString(size_t level);
 
 bool isInfinite(const float& value);
@@ -293,5 +320,18 @@ float clamp(float val, float minv, float maxv);
 
 string formatPercent(const float value);
 
+// Walker's alias method: built in linear time from weights summing to 1, then drawing an index in constant time
+struct AliasTable {
+	AliasTable() {}
+	AliasTable(vector<float> const& weights);
+
+	size_t size() const;
+	size_t sample(std::mt19937& g) const;
+
+private:
+	vector<float> probs;
+	vector<size_t> aliases;
+};
+
 extern bool debugPrints;
 extern std::map<std::string, std::tuple<std::uint8_t, std::uint8_t, std::uint8_t>> colorMap;
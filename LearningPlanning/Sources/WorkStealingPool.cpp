@@ -0,0 +1,102 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(size_t threads) : queued(0) {
+	if (threads == 0)
+		threads = max(thread::hardware_concurrency(), 1u);
+
+	// The last queue belongs to the thread submitting batches
+	for (size_t qi = 0; qi < threads; qi++)
+		queues.push_back(unique_ptr<TaskQueue>(new TaskQueue()));
+
+	for (size_t wi = 0; wi + 1 < threads; wi++)
+		workers.push_back(thread(&WorkStealingPool::work, this, wi));
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		lock_guard<mutex> lock(stateMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+
+	for (size_t wi = 0; wi < workers.size(); wi++)
+		workers[wi].join();
+}
+
+size_t WorkStealingPool::size() const {
+	return queues.size();
+}
+
+void WorkStealingPool::run(vector<function<void()>> const& tasks) {
+	if (tasks.empty()) return;
+
+	if (workers.empty()) {
+		for (size_t ti = 0; ti < tasks.size(); ti++)
+			tasks[ti]();
+		return;
+	}
+
+	// Counts are set before any task can be taken, a worker still awake from the previous batch may take one at once
+	{
+		lock_guard<mutex> lock(stateMutex);
+		pending = tasks.size();
+		queued = tasks.size();
+		for (size_t ti = 0; ti < tasks.size(); ti++) {
+			TaskQueue& queue = *queues[ti % queues.size()];
+			lock_guard<mutex> queueLock(queue.lock);
+			queue.tasks.push_back(tasks[ti]);
+		}
+	}
+	wakeUp.notify_all();
+
+	size_t caller = queues.size() - 1;
+	while (runOne(caller)) {}
+
+	unique_lock<mutex> lock(stateMutex);
+	batchDone.wait(lock, [&]() { return pending == 0; });
+}
+
+void WorkStealingPool::work(size_t worker) {
+	while (true) {
+		if (runOne(worker)) continue;
+
+		unique_lock<mutex> lock(stateMutex);
+		wakeUp.wait(lock, [&]() { return stopping || queued > 0; });
+		if (stopping) return;
+	}
+}
+
+bool WorkStealingPool::runOne(size_t worker) {
+	function<void()> task;
+
+	for (size_t offset = 0; offset < queues.size() && !task; offset++) {
+		TaskQueue& queue = *queues[(worker + offset) % queues.size()];
+		lock_guard<mutex> lock(queue.lock);
+		if (queue.tasks.empty()) continue;
+
+		if (offset == 0) {
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+		}
+		else {
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+		}
+	}
+	if (!task) return false;
+
+	queued--;
+	task();
+
+	lock_guard<mutex> lock(stateMutex);
+	if (--pending == 0)
+		batchDone.notify_all();
+	return true;
+}
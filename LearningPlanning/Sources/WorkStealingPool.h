@@ -0,0 +1,56 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ *
+ * Fixed set of worker threads running batches of independent tasks. Each worker owns a queue it takes tasks from at the
+ * back, and steals from the front of the others' queues once its own is empty. The thread submitting a batch works on
+ * it as well, and only returns once every task of the batch is done.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class WorkStealingPool {
+public:
+	// 0 threads uses one per hardware core, the calling thread counting as one
+	WorkStealingPool(size_t threads);
+	~WorkStealingPool();
+
+	WorkStealingPool(WorkStealingPool const&) = delete;
+	WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+
+	// Threads working on a batch, including the calling one
+	size_t size() const;
+
+	// Batches must not be submitted from several threads at once, nor from a task
+	void run(vector<function<void()>> const& tasks);
+
+private:
+	struct TaskQueue {
+		mutex lock;
+		deque<function<void()>> tasks;
+	};
+
+	void work(size_t worker);
+	bool runOne(size_t worker);
+
+	vector<unique_ptr<TaskQueue>> queues;
+	vector<thread> workers;
+
+	mutex stateMutex;
+	condition_variable wakeUp;
+	condition_variable batchDone;
+	atomic<size_t> queued;
+	size_t pending = 0;
+	bool stopping = false;
+};
@@ -27,10 +27,12 @@
 #include "Agents/ManualAgent.h"
 #include "Agents/RandomExploreAgent.h"
 #include "Agents/FFAgent.h"
+#include "Agents/GraphPlanAgent.h"
 #include "Agents/LearningAgent/LearningAgent.h"
 #include "Agents/Strips/StripsAgent.h"
 #include "Agents/PartialOrderPlanner/PopAgentMultivariate.h"
 #include "Agents/DataGeneratorAgent.h"
+#include "Agents/PortfolioAgent.h"
 
 #include "Render/BlocksWorldRenderer.h"
 #include "Render/LogisticsRenderer.h"
@@ -54,6 +56,37 @@ bool debugPrints = false;
 
 ConfigReader* config = nullptr;
 
+shared_ptr<Agent> createAgent(string agentName, bool verbose) {
+	shared_ptr<Agent> agent = nullptr;
+
+	if (agentName == "AStarAgent")					agent = make_shared<AStarAgent>(verbose);
+	else if (agentName == "ManualAgent")			agent = make_shared<ManualAgent>(verbose);
+	else if (agentName == "RandomExploreAgent")		agent = make_shared<RandomExploreAgent>(verbose);
+	else if (agentName == "FFAgent")				agent = make_shared<FFAgent>(verbose);
+	else if (agentName == "GraphPlanAgent")			agent = make_shared<GraphPlanAgent>(verbose);
+	else if (agentName == "LearningAgent")			agent = make_shared<LearningAgent>(verbose);
+	else if (agentName == "StripsAgent")			agent = make_shared<StripsAgent>(verbose);
+	else if (agentName == "PopAgentMultivariate")	agent = make_shared<PopAgentMultivariate>(verbose);
+	else if (agentName == "DataGeneratorAgent")		agent = make_shared<DataGeneratorAgent>(verbose);
+	else if (agentName == "PortfolioAgent") {
+		// The agent acts on the first plan found, comparing plans is left to experiments where latency does not matter
+		shared_ptr<PortfolioAgent> portfolio = make_shared<PortfolioAgent>(verbose);
+		portfolio->setSelection(FIRST_PLAN);
+		cJSON* planners = config->getArray("portfolio");
+		cJSON* elem;
+		cJSON_ArrayForEach(elem, planners) {
+			shared_ptr<Agent> planner = createAgent(elem->valuestring, verbose);
+			if (planner != nullptr) portfolio->addPlanner(elem->valuestring, planner);
+		}
+		agent = portfolio;
+	}
+
+	if (agent != nullptr)
+		agent->configure(config);
+
+	return agent;
+}
+
 int main(int argc, char **argv) {
 	string configFilePath = "config.json";
 	if (argc > 1)
@@ -101,8 +134,10 @@ int main(int argc, char **argv) {
 
 	bool useSeed = config->getUint("seed") != 0;
 	unsigned int seed = 0;
-	if (useSeed)
+	if (useSeed) {
 		seed = config->getUint("seed");
+		globalRandomDevice.seed(seed);
+	}
 
 	SDL_Window* window = nullptr;
 	SDL_Renderer* renderer = nullptr;
@@ -150,18 +185,9 @@ int main(int argc, char **argv) {
 	if (useSeed)
 		stateGenerator->setSeed(seed);
 
-	shared_ptr<Agent> agent = nullptr;
+	shared_ptr<Agent> agent = createAgent(agentName, verbose);
 	DomainRenderer* domainRenderer = nullptr;
 
-	if (agentName == "AStarAgent")					agent = make_shared<AStarAgent>(verbose);
-	else if (agentName == "ManualAgent")			agent = make_shared<ManualAgent>(verbose);
-	else if (agentName == "RandomExploreAgent")		agent = make_shared<RandomExploreAgent>(verbose);
-	else if (agentName == "FFAgent")				agent = make_shared<FFAgent>(verbose);
-	else if (agentName == "LearningAgent")			agent = make_shared<LearningAgent>(verbose);
-	else if (agentName == "StripsAgent")			agent = make_shared<StripsAgent>(verbose);
-	else if (agentName == "PopAgentMultivariate")	agent = make_shared<PopAgentMultivariate>(verbose);
-	else if (agentName == "DataGeneratorAgent")		agent = make_shared<DataGeneratorAgent>(verbose);
-
 	if (domain == "logistics")			domainRenderer = new LogisticsRenderer();
 	if (domain == "logistics_onebox")	domainRenderer = new LogisticsRenderer();
 	if (domain == "blocksworld")		domainRenderer = new BlocksWorldRenderer();
@@ -0,0 +1,174 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "pch.h"
+
+#include "Agents/AStarAgent.h"
+
+using namespace std;
+
+// Records the state and action predicate of every action tried
+class RecordingDomain : public Domain {
+public:
+	using Domain::Domain;
+
+	Opt<State> tryAction(State state, vector<Term> instances, Literal actionLiteral, bool onlyAdd = false) override {
+		tried.push_back(make_pair(state, actionLiteral.pred));
+		return Domain::tryAction(state, instances, actionLiteral, onlyAdd);
+	}
+
+	vector<pair<State, Predicate>> tried;
+};
+
+class AStarAgentTest : public ::testing::Test {
+protected:
+	void SetUp() override {
+	}
+
+	// A chain of four steps reaches the goal, a detour replaces the second step and q is a way to the goal the chain
+	// does not take
+	shared_ptr<RecordingDomain> chainDomain() {
+		vector<Action> actions = {
+			Action(s1Pred(), {}, {}, { p1() }, {}),
+			Action(s2Pred(), { p1() }, {}, { p2() }, {}),
+			Action(s3Pred(), { p2() }, {}, { p3() }, {}),
+			Action(s4Pred(), { p3() }, {}, { g1() }, {}),
+			Action(detour1Pred(), { p1() }, {}, { d() }, {}),
+			Action(detour2Pred(), { d() }, {}, { p2() }, {}),
+			Action(finishPred(), { q() }, {}, { g1() }, {})
+		};
+		return make_shared<RecordingDomain>(vector<shared_ptr<TermType>>(),
+			set<Predicate>{ g1, p1, p2, p3, d, q, s1Pred, s2Pred, s3Pred, s4Pred, detour1Pred, detour2Pred, finishPred },
+			set<Term>(), actions);
+	}
+
+	vector<Literal> runAgent(AStarAgent& agent, shared_ptr<Domain> domain, Goal goal, /*r*/ State& state) {
+		vector<Literal> executed;
+		for (size_t step = 0; step < 10 && !goal.reached(state); step++) {
+			Literal action = agent.getNextAction(state);
+			if (action == Literal()) break;
+
+			executed.push_back(action);
+			state = domain->tryAction(state, {}, action).obj;
+		}
+		return executed;
+	}
+
+	Predicate g1 = Predicate("g1", 0);
+	Predicate g2 = Predicate("g2", 0);
+	Predicate prepared = Predicate("prepared", 0);
+	Predicate q = Predicate("q", 0);
+	Predicate r = Predicate("r", 0);
+
+	Predicate preparePred = Predicate("prepare", 0);
+	Predicate finishPred = Predicate("finish", 0);
+	Predicate s1Pred = Predicate("s1", 0);
+	Predicate s2Pred = Predicate("s2", 0);
+	Predicate s3Pred = Predicate("s3", 0);
+	Predicate s4Pred = Predicate("s4", 0);
+
+	Predicate p1 = Predicate("p1", 0);
+	Predicate p2 = Predicate("p2", 0);
+	Predicate p3 = Predicate("p3", 0);
+	Predicate d = Predicate("d", 0);
+	Predicate detour1Pred = Predicate("detour1", 0);
+	Predicate detour2Pred = Predicate("detour2", 0);
+};
+
+TEST_F(AStarAgentTest, AnytimeRestarts) {
+	// Achieving g1 right away looks best to a greedy search, preparing then finishing both goals is shorter
+	vector<Action> actions = {
+		Action(preparePred(), {}, {}, { prepared() }, {}),
+		Action(finishPred(), { prepared() }, {}, { g1(), g2() }, {}),
+		Action(s1Pred(), {}, {}, { g1() }, {}),
+		Action(s2Pred(), { g1() }, {}, { q() }, {}),
+		Action(s3Pred(), { q() }, {}, { r() }, {}),
+		Action(s4Pred(), { r() }, {}, { g2() }, {})
+	};
+	shared_ptr<Domain> domain = make_shared<Domain>(vector<shared_ptr<TermType>>(),
+		set<Predicate>{ g1, g2, prepared, q, r, preparePred, finishPred, s1Pred, s2Pred, s3Pred, s4Pred }, set<Term>(), actions);
+
+	Goal goal;
+	goal.trueFacts = { g1(), g2() };
+
+	vector<float> costs;
+	AStarAgent agent(false);
+	agent.setAnytime(true, 5.0f);
+	agent.setImprovementCallback([&](vector<Literal> const& plan, float cost) {
+		EXPECT_EQ(plan.size(), (size_t)cost);
+		costs.push_back(cost);
+	});
+	agent.init(domain, {}, goal, make_shared<vector<Trace>>());
+
+	State state;
+	vector<Literal> executed;
+	for (size_t step = 0; step < 10 && !goal.reached(state); step++) {
+		Literal action = agent.getNextAction(state);
+		if (action == Literal()) break;
+
+		executed.push_back(action);
+		state = domain->tryAction(state, {}, action).obj;
+	}
+
+	EXPECT_TRUE(goal.reached(state));
+	EXPECT_EQ(executed.size(), 2);
+	EXPECT_GE(costs.size(), 2);
+	for (size_t ci = 1; ci < costs.size(); ci++)
+		EXPECT_LT(costs[ci], costs[ci - 1]);
+	EXPECT_EQ(costs.back(), 2.0f);
+}
+
+TEST_F(AStarAgentTest, PlanRepair) {
+	Goal goal;
+	goal.trueFacts = { g1() };
+
+	// The revised third step now gives q: the first two steps still apply and are kept, only the rest is planned again
+	shared_ptr<RecordingDomain> domain = chainDomain();
+	AStarAgent agent(false);
+	agent.init(domain, {}, goal, make_shared<vector<Trace>>());
+
+	State state;
+	Literal first = agent.getNextAction(state);
+	EXPECT_TRUE(first == s1Pred());
+	state = domain->tryAction(state, {}, first).obj;
+
+	domain->replaceAction(2, Action(s3Pred(), { p1() }, {}, { q() }, {}));
+	agent.updateDomain(domain);
+
+	// Planning from scratch would only take the third step and finish
+	vector<Literal> executed = runAgent(agent, domain, goal, state);
+	EXPECT_TRUE(goal.reached(state));
+	EXPECT_TRUE(allEq(executed, { s2Pred(), s3Pred(), finishPred() }));
+
+	// The revised second step no longer applies and the plan is repaired from the current state, which was expanded
+	// by the first search: only the successors of the revised predicate are computed again
+	domain = chainDomain();
+	agent.init(domain, {}, goal, make_shared<vector<Trace>>());
+
+	state = State();
+	first = agent.getNextAction(state);
+	EXPECT_TRUE(first == s1Pred());
+	state = domain->tryAction(state, {}, first).obj;
+
+	domain->replaceAction(1, Action(s2Pred(), { p1(), q() }, {}, { p2() }, {}));
+	agent.updateDomain(domain);
+
+	domain->tried.clear();
+	Literal next = agent.getNextAction(state);
+	EXPECT_TRUE(next == detour1Pred());
+
+	size_t recomputed = 0;
+	foreach(tried, domain->tried) {
+		if (!(tried->first == state)) continue;
+		EXPECT_TRUE(tried->second == s2Pred);
+		recomputed++;
+	}
+	EXPECT_GT(recomputed, 0);
+
+	state = domain->tryAction(state, {}, next).obj;
+	executed = runAgent(agent, domain, goal, state);
+	EXPECT_TRUE(goal.reached(state));
+	EXPECT_TRUE(allEq(executed, { detour2Pred(), s3Pred(), s4Pred() }));
+}
@@ -0,0 +1,53 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#include "Logic/Domain.h"
+
+using namespace std;
+
+// Blocks world with three blocks on a table, shared by the planner tests
+class BlocksWorldTest : public ::testing::Test {
+protected:
+	shared_ptr<Domain> blocksWorld() {
+		Action move = Action(movePred(x, y, z), { on(x, z), clear(x), clear(y), block(x), block(y) }, {},
+			{ on(x, y), clear(z) }, { -on(x, z), -clear(y) });
+		Action moveToTable = Action(moveTablePred(x, z), { on(x, z), clear(x), block(x), block(z) }, {},
+			{ on(x, t), clear(z) }, { -on(x, z) });
+		return make_shared<Domain>(vector<shared_ptr<TermType>>(), set<Predicate>{ on, clear, block, movePred, moveTablePred },
+			set<Term>(), vector<Action>{ move, moveToTable });
+	}
+
+	// Sussman anomaly: c is on a, the goal is a on b on c
+	State sussmanState() {
+		return State({ on(c, a), on(a, t), on(b, t), clear(c), clear(b), block(a), block(b), block(c) });
+	}
+
+	Goal sussmanGoal() {
+		Goal goal;
+		goal.trueFacts = { on(a, b), on(b, c) };
+		return goal;
+	}
+
+	Predicate on = Predicate("on", 2);
+	Predicate clear = Predicate("clear", 1);
+	Predicate block = Predicate("block", 1);
+	Predicate movePred = Predicate("move", 3);
+	Predicate moveTablePred = Predicate("move_table", 2);
+
+	Variable x = Variable("X");
+	Variable y = Variable("Y");
+	Variable z = Variable("Z");
+
+	Instance a = Instance("a");
+	Instance b = Instance("b");
+	Instance c = Instance("c");
+	Instance t = Instance("t");
+
+	vector<Term> instances { a, b, c, t };
+};
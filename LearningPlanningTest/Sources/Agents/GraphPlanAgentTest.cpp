@@ -0,0 +1,102 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "pch.h"
+
+#include "Agents/BlocksWorldTest.h"
+#include "Agents/GraphPlanAgent.h"
+
+using namespace std;
+
+class GraphPlanAgentTest : public BlocksWorldTest {
+protected:
+	vector<Literal> runAgent(shared_ptr<Domain> domain, vector<Term> instances, State state, Goal goal, /*r*/ State& finalState) {
+		GraphPlanAgent agent = GraphPlanAgent(false);
+		agent.init(domain, instances, goal, make_shared<vector<Trace>>());
+
+		vector<Literal> executed;
+		finalState = state;
+		for (size_t step = 0; step < 20; step++) {
+			Literal action = agent.getNextAction(finalState);
+			if (action == Literal()) break;
+
+			Opt<State> next = domain->tryAction(finalState, instances, action);
+			EXPECT_TRUE(next.there);
+			if (!next.there) break;
+
+			executed.push_back(action);
+			finalState = next.obj;
+		}
+		return executed;
+	}
+};
+
+TEST_F(GraphPlanAgentTest, BlocksWorld) {
+	Goal goal = sussmanGoal();
+
+	State finalState;
+	vector<Literal> executed = runAgent(blocksWorld(), instances, sussmanState(), goal, finalState);
+	EXPECT_TRUE(goal.reached(finalState));
+	EXPECT_EQ(executed.size(), 3);
+}
+
+TEST_F(GraphPlanAgentTest, NegativeConditions) {
+	Predicate lit = Predicate("lit", 1);
+	Predicate toggle = Predicate("toggle", 1);
+	Predicate light = Predicate("light", 1);
+
+	// Lighting requires the lamp to be off, and the goal requires b to be off
+	Action turnOn = Action(light(x), {}, { lit(x) }, { lit(x) }, {});
+	Action turnOff = Action(toggle(x), { lit(x) }, {}, {}, { -lit(x) });
+	shared_ptr<Domain> domain = make_shared<Domain>(vector<shared_ptr<TermType>>(), set<Predicate>{ lit, toggle, light },
+		set<Term>(), vector<Action>{ turnOn, turnOff });
+
+	vector<Term> lamps { a, b };
+	State state({ lit(b) });
+	Goal goal;
+	goal.trueFacts = { lit(a) };
+	goal.falseFacts = { lit(b) };
+
+	State finalState;
+	vector<Literal> executed = runAgent(domain, lamps, state, goal, finalState);
+	EXPECT_TRUE(goal.reached(finalState));
+	EXPECT_EQ(executed.size(), 2);
+
+	// Unreachable goals are detected once the graph levels off
+	Goal impossible;
+	impossible.trueFacts = { lit(c) };
+	executed = runAgent(domain, lamps, state, impossible, finalState);
+	EXPECT_EQ(executed.size(), 0);
+}
+
+TEST_F(GraphPlanAgentTest, FreePreconditionVariables) {
+	Predicate key = Predicate("key", 1);
+	Predicate opened = Predicate("opened", 1);
+	Predicate used = Predicate("used", 1);
+	Predicate open = Predicate("open", 1);
+	Predicate drop = Predicate("drop", 1);
+
+	// The key used to open is not an action parameter, the executor picks it among the keys held
+	Action openDoor = Action(open(x), { key(y) }, {}, { opened(x), used(y) }, { -key(y) });
+	Action dropKey = Action(drop(y), { key(y) }, {}, {}, { -key(y) });
+	shared_ptr<Domain> domain = make_shared<Domain>(vector<shared_ptr<TermType>>(), set<Predicate>{ key, opened, used, open, drop },
+		set<Term>(), vector<Action>{ openDoor, dropKey });
+
+	vector<Term> doorsAndKeys { a, b, c };
+	vector<Term> keys { a, b };
+
+	foreach(wanted, keys) {
+		Term other = *wanted == a ? b : a;
+		State state({ key(a), key(b) });
+		Goal goal;
+		goal.trueFacts = { opened(c), used(*wanted) };
+		goal.falseFacts = { key(other) };
+
+		State finalState;
+		vector<Literal> executed = runAgent(domain, doorsAndKeys, state, goal, finalState);
+		EXPECT_TRUE(goal.reached(finalState));
+		EXPECT_EQ(executed.size(), 2);
+	}
+}
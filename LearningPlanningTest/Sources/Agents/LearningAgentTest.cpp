@@ -10,6 +10,10 @@
 #include "Logic/Domain.h"
 #include "Agents/LearningAgent/LearningAgent.h"
 #include "Agents/LearningAgent/ActionRule.h"
+#include "Agents/LearningAgent/BayesianExplorer.h"
+#include "Agents/LearningAgent/CdProbability.h"
+#include "Agents/LearningAgent/SubstitutionSampler.h"
+#include "Agents/LearningAgent/MatchNetwork.h"
 #include "Logic/JSON_Parsing.h"
 
 using namespace std;
@@ -144,6 +148,14 @@ TEST_F(LearningAgentTest, ActionRuleConstruction) {
 	EXPECT_TRUE(in(rule->parameters, a));
 	EXPECT_TRUE(in(rule->parameters, b));
 	EXPECT_TRUE(in(rule->parameters, f2));
+
+	// Facts whose terms are not linked to the action or the effects are filtered out
+	initState.addFact(on(c, d));
+	newState.addFact(on(c, d));
+	shared_ptr<ActionRule> filtered = make_shared<ActionRule>(Trace(initState, instAct, true, newState), 0.01f, true);
+	EXPECT_FALSE(in(filtered->preconditions, on(c, d)));
+	EXPECT_TRUE(in(filtered->preconditions, on(b, f1)));
+	EXPECT_TRUE(filtered->wellFormed());
 }
 
 TEST_F(LearningAgentTest, LitGenTests) {
@@ -1548,6 +1560,393 @@ TEST_F(LearningAgentTest, VariablesTests) {
 	EXPECT_TRUE(rule3->specificity() == 5);
 }
 
+TEST_F(LearningAgentTest, RuleStoreIndexing) {
+	set<shared_ptr<ActionRule>> parents;
+	Predicate stackPred = Predicate("stack", 2);
+
+	shared_ptr<ActionRule> moveRule = make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y) }, movePred2(x, y),
+		set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false);
+	shared_ptr<ActionRule> moveOtherEffects = make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y) }, movePred2(x, y),
+		set<Literal>{ on(x, y) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false);
+	shared_ptr<ActionRule> stackRule = make_shared<ActionRule>(set<Literal>{ clear(x), clear(y) }, stackPred(x, y),
+		set<Literal>{ on(x, y) }, set<Literal>{ -clear(y) }, parents, false);
+
+	RuleStore store;
+	EXPECT_TRUE(store.insert(moveRule));
+	EXPECT_TRUE(store.insert(moveOtherEffects));
+	EXPECT_TRUE(store.insert(stackRule));
+	EXPECT_FALSE(store.insert(stackRule));
+	EXPECT_TRUE(store.size() == 3);
+
+	EXPECT_TRUE(store.byAction(movePred2) == (set<shared_ptr<ActionRule>>{ moveRule, moveOtherEffects }));
+	EXPECT_TRUE(store.byAction(Predicate("unstack", 2)).empty());
+
+	// Only the rule with the same effects shape can cover this example
+	shared_ptr<ActionRule> example = make_shared<ActionRule>(set<Literal>{ on(a, f1), clear(a), clear(b) }, movePred2(a, b),
+		set<Literal>{ on(a, b), clear(f1) }, set<Literal>{ -on(a, f1), -clear(b) }, parents, false);
+	EXPECT_TRUE(store.byEffects(*example) == set<shared_ptr<ActionRule>>{ moveRule });
+	EXPECT_TRUE(moveRule->covers(example));
+	EXPECT_FALSE(moveOtherEffects->covers(example));
+
+	// Postmatching ignores the signs of effects, and so do signatures
+	shared_ptr<ActionRule> unsignedExample = make_shared<ActionRule>(set<Literal>{ on(a, f1), clear(a), clear(b) }, movePred2(a, b),
+		set<Literal>{ on(a, b), clear(f1) }, set<Literal>{ on(a, f1), clear(b) }, parents, false);
+	EXPECT_TRUE(moveRule->covers(unsignedExample));
+	EXPECT_TRUE(store.byEffects(*unsignedExample) == set<shared_ptr<ActionRule>>{ moveRule });
+
+	EXPECT_TRUE(store.erase(moveRule));
+	EXPECT_FALSE(store.erase(moveRule));
+	EXPECT_TRUE(store.byEffects(*example).empty());
+	EXPECT_TRUE(store.byAction(movePred2) == set<shared_ptr<ActionRule>>{ moveOtherEffects });
+	EXPECT_TRUE(store.size() == 2);
+}
+
+TEST_F(LearningAgentTest, CounterExampleStoreFiltering) {
+	set<shared_ptr<ActionRule>> parents;
+	Predicate stackPred = Predicate("stack", 2);
+
+	shared_ptr<ActionRule> rule = make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y) }, movePred2(x, y),
+		set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false);
+
+	// Same action, nothing happened: prematched and contradicted
+	shared_ptr<ActionRule> failedMove = make_shared<ActionRule>(set<Literal>{ on(a, f1), clear(a), clear(b), block(a) }, movePred2(a, b),
+		set<Literal>(), set<Literal>(), parents, false);
+	// Only one clear fact, cannot be prematched
+	shared_ptr<ActionRule> oneClear = make_shared<ActionRule>(set<Literal>{ on(a, f1), clear(a), block(b) }, movePred2(a, b),
+		set<Literal>(), set<Literal>(), parents, false);
+	// Other action
+	shared_ptr<ActionRule> stack = make_shared<ActionRule>(set<Literal>{ on(a, f1), clear(a), clear(b) }, stackPred(a, b),
+		set<Literal>(), set<Literal>(), parents, false);
+	// Same effects as the rule, consistent with it
+	shared_ptr<ActionRule> success = make_shared<ActionRule>(set<Literal>{ on(c, f2), clear(c), clear(d) }, movePred2(c, d),
+		set<Literal>{ on(c, d), clear(f2) }, set<Literal>{ -on(c, f2), -clear(d) }, parents, false);
+
+	CounterExampleStore store;
+	EXPECT_TRUE(store.insert(oneClear));
+	EXPECT_TRUE(store.insert(stack));
+	EXPECT_TRUE(store.insert(success));
+	EXPECT_FALSE(store.insert(success));
+
+	EXPECT_TRUE(allEqNoOrder(store.candidates(rule), { success }));
+	EXPECT_FALSE(rule->prematches(oneClear));
+	EXPECT_TRUE(store.findContradicted(rule) == nullptr);
+	EXPECT_TRUE(store.findPrematched(rule) == success);
+
+	EXPECT_TRUE(store.insert(failedMove));
+	EXPECT_TRUE(store.size() == 4);
+	EXPECT_TRUE(allEqNoOrder(store.candidates(rule), { success, failedMove }));
+	EXPECT_TRUE(rule->contradicts(failedMove));
+	EXPECT_TRUE(store.findContradicted(rule) == failedMove);
+
+	// A predicate no counter-example has rules everything out
+	shared_ptr<ActionRule> blockRule = make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y), block2(x) }, movePred2(x, y),
+		set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false);
+	EXPECT_TRUE(store.candidates(blockRule).empty());
+
+	store.clear();
+	EXPECT_TRUE(store.size() == 0);
+	EXPECT_TRUE(store.findPrematched(rule) == nullptr);
+}
+
+TEST_F(LearningAgentTest, SeededGeneralizationTrials) {
+	set<shared_ptr<ActionRule>> parents;
+	shared_ptr<ActionRule> rule = make_shared<ActionRule>(set<Literal>{ on(a, f1), clear(a), clear(b), block(a), block(b) }, movePred2(a, b),
+		set<Literal>{ on(a, b), clear(f1) }, set<Literal>{ -on(a, f1), -clear(b) }, parents, false);
+	shared_ptr<ActionRule> example = make_shared<ActionRule>(set<Literal>{ on(c, f2), clear(c), clear(d), block(c), block(d), block(e) }, movePred2(c, d),
+		set<Literal>{ on(c, d), clear(f2) }, set<Literal>{ -on(c, f2), -clear(d) }, parents, false);
+
+	// Trials sharing a seed find the same generalization, whichever thread runs them
+	size_t streams = 4;
+	vector<string> results = vector<string>(streams * 4);
+	vector<function<void()>> tasks;
+	foreachindex(ti, results)
+		tasks.push_back([&, ti]() {
+			seed_seq seeds = { 7u, (unsigned int)(ti % streams) };
+			mt19937 g = mt19937(seeds);
+			Substitution subr, subx;
+			set<Term> genVars;
+			if (rule->postGeneralizes(example, subr, subx, genVars, g))
+				results[ti] = join(rule->anyGeneralization(example, subr, subx, genVars, g));
+		});
+
+	WorkStealingPool pool(4);
+	EXPECT_TRUE(pool.size() == 4);
+	pool.run(tasks);
+
+	foreachindex(ti, results) {
+		EXPECT_FALSE(results[ti].empty());
+		EXPECT_EQ(results[ti], results[ti % streams]);
+	}
+}
+
+TEST_F(LearningAgentTest, WorkStealingPoolBatches) {
+	// Back-to-back batches, workers still running the end of one may take tasks of the next
+	WorkStealingPool pool(4);
+	atomic<size_t> done(0);
+	for (size_t batch = 0; batch < 5000; batch++) {
+		vector<function<void()>> tasks;
+		for (size_t ti = 0; ti < 1 + batch % 7; ti++)
+			tasks.push_back([&]() { done++; });
+		size_t before = done;
+		pool.run(tasks);
+		ASSERT_EQ(done - before, tasks.size());
+	}
+}
+
+TEST_F(LearningAgentTest, SeededRolloutThreads) {
+	set<shared_ptr<ActionRule>> parents;
+	RuleStore rules;
+	rules.insert(make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y) }, movePred3(x, y, z),
+		set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false));
+	rules.insert(make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y), block(y) }, movePred3(x, y, z),
+		set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false));
+
+	// Without a time limit, the explorer's plan only depends on the seed, whatever the number of rollout threads
+	ConfigReader* fileConfig = config;
+	vector<vector<Literal>> plans;
+	for (int threads : { 1, 4 }) {
+		string json = "{ \"bayesian_explorer\": { \"gamma\": 0.99, \"start_pu\": 0.001, \"estimated_rules_per_action\": 2, "
+			"\"random_plans\": 8, \"random_experiments\": 10, \"random_action_trials\": 20, \"plan_depth\": 3, "
+			"\"rollout_threads\": " + to_string(threads) + " } }";
+		config = ConfigReader::fromObject(cJSON_Parse(json.c_str()));
+
+		globalRandomDevice.seed(11);
+		BayesianExplorer explorer = BayesianExplorer(false);
+		explorer.init(domain, toVec(problem->instances), problem->goal, trace);
+		explorer.setActionLiterals(domain->getActionLiterals());
+		explorer.setRules(rules);
+		explorer.informRevision(true);
+
+		vector<Literal> plan = { explorer.getNextAction(problem->initialState) };
+		for (int i = 1; i < 3; i++)
+			plan.push_back(explorer.getNextAction(problem->initialState));
+		plans.push_back(plan);
+	}
+	config = fileConfig;
+
+	EXPECT_FALSE(plans[0][0] == Literal());
+	EXPECT_EQ(join(plans[0]), join(plans[1]));
+}
+
+TEST_F(LearningAgentTest, RevisionCacheVersions) {
+	set<shared_ptr<ActionRule>> parents;
+	shared_ptr<ActionRule> rule = make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y) }, movePred2(x, y),
+		set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false);
+
+	State state = State({ on(a, f1), clear(a), clear(b) });
+	State otherState = State({ on(a, f1), clear(a) });
+	EXPECT_EQ(RevisionCache::stateHash(state), RevisionCache::stateHash(State({ clear(b), clear(a), on(a, f1) })));
+
+	RevisionCache cache;
+	size_t hash = RevisionCache::stateHash(state);
+	EXPECT_TRUE(cache.find(*rule, hash, state, movePred2(a, b)) == nullptr);
+
+	shared_ptr<RevisionCache::Entry> entry = make_shared<RevisionCache::Entry>();
+	entry->state = state;
+	entry->probability = 0.5f;
+	cache.insert(*rule, hash, movePred2(a, b), entry);
+
+	// Copies keep the version, and share entries with the original
+	ActionRule copy = *rule;
+	EXPECT_TRUE(cache.find(copy, hash, state, movePred2(a, b)) == entry);
+	EXPECT_TRUE(cache.find(*rule, hash, state, movePred2(b, a)) == nullptr);
+	EXPECT_TRUE(cache.find(*rule, hash, otherState, movePred2(a, b)) == nullptr);
+	EXPECT_TRUE(cache.hits() == 1);
+	EXPECT_TRUE(cache.misses() == 3);
+
+	// Changed necessities invalidate the rule's entries
+	map<Literal, float> precondNecs = rule->necessityVector().precondMap();
+	precondNecs[clear(y)] = 0.9f;
+	rule->setNecessities(precondNecs, rule->necessityVector().constMap());
+	EXPECT_TRUE(cache.find(*rule, hash, state, movePred2(a, b)) == nullptr);
+
+	RuleStore rules;
+	rules.insert(rule);
+	EXPECT_TRUE(cache.size() == 1);
+	cache.forgetOutdated(rules);
+	EXPECT_TRUE(cache.size() == 0);
+}
+
+TEST_F(LearningAgentTest, RevisionCacheGenerations) {
+	set<shared_ptr<ActionRule>> parents;
+	shared_ptr<ActionRule> rule = make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y) }, movePred2(x, y),
+		set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false);
+
+	State state = State({ on(a, f1), clear(a), clear(b) });
+	size_t hash = RevisionCache::stateHash(state);
+	vector<Literal> actions = { movePred2(a, b), movePred2(a, c), movePred2(a, d), movePred2(b, a) };
+	shared_ptr<RevisionCache::Entry> entry = make_shared<RevisionCache::Entry>();
+	entry->state = state;
+
+	// A full generation becomes the previous one, whose entries are kept while they are hit
+	RevisionCache cache = RevisionCache(2);
+	cache.insert(*rule, hash, actions[0], entry);
+	cache.insert(*rule, hash, actions[1], entry);
+	cache.insert(*rule, hash, actions[2], entry);
+	EXPECT_TRUE(cache.size() == 3);
+	EXPECT_TRUE(cache.find(*rule, hash, state, actions[0]) == entry);
+
+	// Inserting into the full current generation drops the entry that was not hit
+	cache.insert(*rule, hash, actions[3], entry);
+	EXPECT_TRUE(cache.size() == 3);
+	EXPECT_TRUE(cache.find(*rule, hash, state, actions[1]) == nullptr);
+	EXPECT_TRUE(cache.find(*rule, hash, state, actions[0]) == entry);
+	EXPECT_TRUE(cache.find(*rule, hash, state, actions[2]) == entry);
+	EXPECT_TRUE(cache.find(*rule, hash, state, actions[3]) == entry);
+}
+
+TEST_F(LearningAgentTest, StatePrematching) {
+	set<shared_ptr<ActionRule>> parents;
+	vector<shared_ptr<ActionRule>> rules = {
+		make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y) }, movePred2(x, y), set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, false),
+		make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), block(z) }, movePred2(x, y), set<Literal>{ clear(z) }, set<Literal>{ -on(x, z) }, parents, false),
+		make_shared<ActionRule>(set<Literal>{ on(x, f1), clear(y), block(a) }, movePred2(x, y), set<Literal>{}, set<Literal>{ -on(x, f1) }, parents, false),
+		make_shared<ActionRule>(set<Literal>{ clear(x) }, movePred2(x, x), set<Literal>{}, set<Literal>{}, parents, false)
+	};
+	vector<State> states = {
+		State({ on(a, f1), on(b, c), on(c, f2), clear(a), clear(b), block(a), block(b), block(c) }),
+		State({ on(a, b), on(b, c), on(c, f1), clear(a), block(b), block(c) }),
+		State({ on(a, f1), on(b, f1), clear(a), clear(b), clear(c), block(a) }),
+		State()
+	};
+	vector<Literal> actions = { movePred2(a, b), movePred2(b, a), movePred2(a, c), movePred2(b, b) };
+
+	// Matching directly against the state finds the substitutions of the example rule built from it
+	foreach(rule, rules)
+		foreach(state, states)
+			foreach(action, actions) {
+				shared_ptr<ActionRule> example = make_shared<ActionRule>(Trace(*state, *action, true, *state), 0.05f, false);
+				EXPECT_TRUE((*rule)->prematchingSubs(*state, *action) == (*rule)->prematchingSubs(example));
+			}
+
+	EXPECT_TRUE(rules[0]->prematchingSubs(states[0], movePred2(a, b)).size() == 1);
+	EXPECT_TRUE(rules[1]->prematchingSubs(states[0], movePred2(b, a)).size() == 1);
+	EXPECT_TRUE(rules[0]->prematchingSubs(states[1], movePred2(a, b)).size() == 0);
+}
+
+TEST_F(LearningAgentTest, CompiledMatching) {
+	set<shared_ptr<ActionRule>> parents;
+	shared_ptr<ActionRule> rule = make_shared<ActionRule>(set<Literal>{ on(x, z), clear(x), clear(y), block(a) }, movePred2(x, y),
+		set<Literal>{ on(x, y), clear(z) }, set<Literal>{ -on(x, z), -clear(y) }, parents, 0.05f, false);
+
+	shared_ptr<RuleMatchPrograms const> programs = rule->matchPrograms();
+	EXPECT_TRUE(programs->preconditions.slotCount() == 3);
+	EXPECT_TRUE(programs->preconditions.probeCount() == 4);
+	EXPECT_TRUE(rule->matchPrograms() == programs);
+
+	// Ground examples run through the program, others are left to the interpreter
+	set<Substitution> subs;
+	State state = State({ on(b, c), clear(b), clear(d), block(a) });
+	EXPECT_TRUE(programs->preconditions.unify(movePred2(b, d), state.facts, nullptr, Substitution(), true, subs));
+	EXPECT_TRUE(subs == set<Substitution>({ Substitution({ x, y, z }, { b, d, c }) }));
+
+	subs.clear();
+	Variable w = Variable("W");
+	shared_ptr<ActionRule> general = make_shared<ActionRule>(set<Literal>{ on(b, w), clear(b), clear(d), block(a) }, movePred2(b, d),
+		set<Literal>{}, set<Literal>{}, parents, 0.05f, false);
+	EXPECT_FALSE(programs->preconditions.unify(movePred2(b, d), general->preconditions, nullptr, Substitution(), true, subs));
+	EXPECT_TRUE(rule->prematchingSubs(general) == set<Substitution>({ Substitution({ x, y, z }, { b, d, w }) }));
+
+	// A new version of the rule is compiled again
+	rule->newVersion();
+	EXPECT_TRUE(rule->matchPrograms() != programs);
+}
+
+TEST_F(LearningAgentTest, LatticeCaches) {
+	auto makeRule = [&](set<shared_ptr<ActionRule>> parents) {
+		return make_shared<ActionRule>(set<Literal>{ clear(a) }, movePred2(a, b), set<Literal>{}, set<Literal>{}, parents, 0.05f, false);
+	};
+	shared_ptr<ActionRule> e1 = makeRule({});
+	shared_ptr<ActionRule> e2 = makeRule({});
+	shared_ptr<ActionRule> e3 = makeRule({});
+	shared_ptr<ActionRule> r0 = makeRule({ e3 });
+	shared_ptr<ActionRule> r1 = makeRule({ e1, e2 });
+	shared_ptr<ActionRule> r2 = makeRule({ r1, e2 });
+
+	EXPECT_TRUE(r2->generalityLevel() == 2);
+	EXPECT_TRUE(r2->countLeaves() == 3);
+	EXPECT_TRUE(r2->reaches(e2));
+	EXPECT_FALSE(r1->reaches(r2));
+
+	// Rules above the one getting a new parent are updated as well
+	r1->insertParent(r0);
+	EXPECT_TRUE(r1->generalityLevel() == 2);
+	EXPECT_TRUE(r2->generalityLevel() == 3);
+	EXPECT_TRUE(r2->countLeaves() == 4);
+
+	r2->removeParentRecursive(e2);
+	EXPECT_TRUE(r2->parents == set<shared_ptr<ActionRule>>({ r1 }));
+	EXPECT_TRUE(r1->parents == set<shared_ptr<ActionRule>>({ e1, r0 }));
+	EXPECT_TRUE(r2->countLeaves() == 2);
+	EXPECT_FALSE(r2->reaches(e2));
+}
+
+TEST_F(LearningAgentTest, MatchNetworkDeltas) {
+	Variable w = Variable("W");
+	vector<set<Literal>> conditions = {
+		{ on(x, y), clear(x) },
+		{ on(z, w), clear(z) },
+		{ on(x, y), on(y, z), clear(x) },
+		{ on(x, a), block(x) },
+		{ on(x, x) }
+	};
+
+	MatchNetwork network;
+	vector<size_t> ids;
+	foreach(conds, conditions)
+		ids.push_back(network.addRule(*conds));
+
+	// The first two rules only differ by the names of their variables
+	EXPECT_TRUE(network.alphaCount() == 5);
+
+	vector<State> states = {
+		State({ on(a, b), clear(a), block(a) }),
+		State({ on(a, b), on(b, c), clear(a), block(b) }),
+		State({ on(b, a), on(c, c), clear(c), block(b) }),
+		State({ on(b, a), on(c, b), clear(c), block(b) }),
+		State({ clear(a), block(a) })
+	};
+	foreach(state, states) {
+		network.update(*state);
+		foreachindex(ri, conditions)
+			EXPECT_TRUE(network.active(ids[ri]) == (Substitution().oiSubsume(conditions[ri], state->facts).size() > 0));
+	}
+
+	// Removed rules release their memories, and ids are reused
+	network.removeRule(ids[3]);
+	EXPECT_TRUE(network.alphaCount() == 3);
+	EXPECT_TRUE(network.addRule({ clear(x) }) == ids[3]);
+	EXPECT_TRUE(network.active(ids[3]));
+}
+
+TEST_F(LearningAgentTest, SubstitutionSamplerWeights) {
+	mt19937 g = mt19937(42);
+
+	AliasTable table = AliasTable({ 0.1f, 0.2f, 0.0f, 0.7f });
+	vector<size_t> counts = vector<size_t>(4, 0);
+	for (size_t i = 0; i < 20000; i++)
+		counts[table.sample(g)]++;
+	EXPECT_TRUE(counts[2] == 0);
+	EXPECT_TRUE(abs((float)counts[0] / 20000.0f - 0.1f) < 0.015f);
+	EXPECT_TRUE(abs((float)counts[3] / 20000.0f - 0.7f) < 0.015f);
+
+	// Losses of 0, 0.5 and 0.5 give weights of 0.5, 0.25 and 0.25
+	State state = State({ clear(a), on(b, c) });
+	SubstitutionSampler sampler = SubstitutionSampler(state, { clear(x) }, { 0.5f }, {}, Substitution(), { x }, { a, b, c });
+	map<Term, size_t> chosen;
+	for (size_t i = 0; i < 20000; i++)
+		chosen[sampler.sample(Substitution(), g).apply(x)]++;
+	EXPECT_TRUE(abs((float)chosen[a] / 20000.0f - 0.5f) < 0.015f);
+	EXPECT_TRUE(abs((float)chosen[b] / 20000.0f - 0.25f) < 0.015f);
+
+	// Choices made for previous variables are no longer available
+	SubstitutionSampler pairSampler = SubstitutionSampler(state, { on(x, y) }, { 0.5f }, {}, Substitution(), { x, y }, { a, b, c });
+	for (size_t i = 0; i < 100; i++) {
+		Substitution sub = pairSampler.sample(Substitution(), g);
+		EXPECT_TRUE(sub.apply(x) != sub.apply(y));
+	}
+}
+
 TEST_F(LearningAgentTest, ProbabilitiesTests) {
 
 	// Containers
@@ -1575,13 +1974,13 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 		-on(x, z)
 	};
 	shared_ptr<ActionRule> rule = make_shared<ActionRule>(preconds, movePred2(x, y), add, del, nullParents, startPu, false);
-	EXPECT_TRUE(rule->precondsNecessities[on(x, z)] == 1.0f);
-	EXPECT_TRUE(rule->precondsNecessities[clear(y)] == expectedProb);
-	EXPECT_TRUE(rule->precondsNecessities[clear(z)] == expectedProb);
-	EXPECT_TRUE(rule->precondsNecessities[block(a)] == expectedProb);
-	EXPECT_TRUE(rule->precondsNecessities[block(c)] == expectedProb);
-	EXPECT_TRUE(rule->constsNecessities[a] == expectedProb);
-	EXPECT_TRUE(rule->constsNecessities[c] == expectedProb);
+	EXPECT_TRUE(rule->necessityVector().precondValue(on(x, z)) == 1.0f);
+	EXPECT_TRUE(rule->necessityVector().precondValue(clear(y)) == expectedProb);
+	EXPECT_TRUE(rule->necessityVector().precondValue(clear(z)) == expectedProb);
+	EXPECT_TRUE(rule->necessityVector().precondValue(block(a)) == expectedProb);
+	EXPECT_TRUE(rule->necessityVector().precondValue(block(c)) == expectedProb);
+	EXPECT_TRUE(rule->necessityVector().constValue(a) == expectedProb);
+	EXPECT_TRUE(rule->necessityVector().constValue(c) == expectedProb);
 
 	expectedProb = 1.0f - powf(startPu, 1.0f / 6.0f);
 	preconds = {
@@ -1601,13 +2000,13 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	nextState.addFacts(add);
 	nextState.removeFacts(del);
 	shared_ptr<ActionRule> rule2 = make_shared<ActionRule>(Trace(preconds, movePred2(a, b), true, nextState), startPu, false);
-	EXPECT_TRUE(rule2->precondsNecessities[on(a, c)] == 1.0f);
-	EXPECT_TRUE(rule2->precondsNecessities[clear(b)] == expectedProb);
-	EXPECT_TRUE(rule2->precondsNecessities[block(a)] == expectedProb);
-	EXPECT_TRUE(rule2->precondsNecessities[block(c)] == expectedProb);
-	EXPECT_TRUE(rule2->constsNecessities[a] == expectedProb);
-	EXPECT_TRUE(rule2->constsNecessities[b] == expectedProb);
-	EXPECT_TRUE(rule2->constsNecessities[c] == expectedProb);
+	EXPECT_TRUE(rule2->necessityVector().precondValue(on(a, c)) == 1.0f);
+	EXPECT_TRUE(rule2->necessityVector().precondValue(clear(b)) == expectedProb);
+	EXPECT_TRUE(rule2->necessityVector().precondValue(block(a)) == expectedProb);
+	EXPECT_TRUE(rule2->necessityVector().precondValue(block(c)) == expectedProb);
+	EXPECT_TRUE(rule2->necessityVector().constValue(a) == expectedProb);
+	EXPECT_TRUE(rule2->necessityVector().constValue(b) == expectedProb);
+	EXPECT_TRUE(rule2->necessityVector().constValue(c) == expectedProb);
 
 	// 2. Check fulfilment probabilities over simple cases
 	expectedProb = 1.0f - powf(startPu, 1.0f / 6.0f);
@@ -1621,16 +2020,16 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	/*EXPECT_TRUE(rule->cacheState == state);
 	EXPECT_TRUE(rule->cacheProbs.size() == 0);*/
 
-	map<Literal, float> updatedPrecondNecs = rule->precondsNecessities;
-	map<Term, float> updatedConstNecs = rule->constsNecessities;
+	map<Literal, float> updatedPrecondNecs = rule->necessityVector().precondMap();
+	map<Term, float> updatedConstNecs = rule->necessityVector().constMap();
 	vector<Substitution> notCovSubs = {
 		Substitution({ x, y }, { a, b }, false)
 	};
 	/*EXPECT_TRUE(rule->fulfilmentAndUpdatedNecsNotCov(updatedPrecondNecs, updatedConstNecs, state, notCovSubs) == 0.0f);
 	foreach(pair, updatedPrecondNecs)
-		EXPECT_TRUE(rule->precondsNecessities[pair->first] == pair->second);
+		EXPECT_TRUE(rule->necessityVector().precondValue(pair->first) == pair->second);
 	foreach(pair, updatedConstNecs)
-		EXPECT_TRUE(rule->constsNecessities[pair->first] == pair->second);*/
+		EXPECT_TRUE(rule->necessityVector().constValue(pair->first) == pair->second);*/
 
 	// 2.b. Case with only one sub prematching
 	state = State({
@@ -1647,16 +2046,16 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	EXPECT_TRUE(rule->cacheProbs.size() == 1);
 	EXPECT_TRUE(rule->cacheProbs.begin()->first == Substitution({ x, y, z }, { b, d, e }, false));*/
 
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { b, d, e }, false)
 	};
 	/*EXPECT_TRUE(rule->fulfilmentAndUpdatedNecsNotCov(updatedPrecondNecs, updatedConstNecs, state, notCovSubs) == 1.0f);
 	foreach(pair, updatedPrecondNecs)
-		EXPECT_TRUE(rule->precondsNecessities[pair->first] == pair->second);
+		EXPECT_TRUE(rule->necessityVector().precondValue(pair->first) == pair->second);
 	foreach(pair, updatedConstNecs)
-		EXPECT_TRUE(rule->constsNecessities[pair->first] == pair->second);*/
+		EXPECT_TRUE(rule->necessityVector().constValue(pair->first) == pair->second);*/
 
 	// 2.c. Case with absolute prematching (all subs) - so prematching is false
 	state = State({
@@ -1682,8 +2081,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	EXPECT_TRUE(in(rule->cacheProbs, Substitution({ x, y, z }, { b, d, f2 }, false)));
 	EXPECT_TRUE(in(rule->cacheProbs, Substitution({ x, y, z }, { b, d, f3 }, false)));*/
 
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { b, d, e }, false),
 		Substitution({ x, y, z }, { b, d, f1 }, false),
@@ -1691,9 +2090,9 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	};
 	/*EXPECT_TRUE(rule->fulfilmentAndUpdatedNecsNotCov(updatedPrecondNecs, updatedConstNecs, state, notCovSubs) == 1.0f);
 	foreach(pair, updatedPrecondNecs)
-		EXPECT_TRUE(rule->precondsNecessities[pair->first] == pair->second);
+		EXPECT_TRUE(rule->necessityVector().precondValue(pair->first) == pair->second);
 	foreach(pair, updatedConstNecs)
-		EXPECT_TRUE(rule->constsNecessities[pair->first] == pair->second);*/
+		EXPECT_TRUE(rule->necessityVector().constValue(pair->first) == pair->second);*/
 
 	// 2.d. Case with only one sub prematching except for one normal precondition
 	state = State({
@@ -1709,8 +2108,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	EXPECT_TRUE(rule->cacheProbs.size() == 1);
 	EXPECT_TRUE(rule->cacheProbs.begin()->first == Substitution({ x, y, z }, { b, d, e }, false));*/
 
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { b, d, e }, false)
 	};
@@ -1736,8 +2135,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	/*EXPECT_TRUE(rule->cacheState == state);
 	EXPECT_TRUE(rule->cacheProbs.size() == 0);*/
 
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { b, d, e }, false)
 	};
@@ -1766,8 +2165,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	EXPECT_TRUE(rule->cacheProbs.size() == 1);
 	EXPECT_TRUE(in(rule->cacheProbs, Substitution({ x, y, z }, { c, d, e }, false)));*/
 
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { c, d, e }, false)
 	};
@@ -1787,8 +2186,10 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 		clear(a)
 	};
 	rule->removedPreconditions = removedPreconds;
+	map<Literal, float> precondNecs = rule->necessityVector().precondMap();
 	foreach(rem, removedPreconds)
-		rule->precondsNecessities[*rem] = 0.05f;
+		precondNecs[*rem] = 0.05f;
+	rule->setNecessities(precondNecs, rule->necessityVector().constMap());
 
 	state = State({
 		on(b, e),
@@ -1806,8 +2207,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	EXPECT_TRUE(rule->cacheProbs.size() == 1);
 	EXPECT_TRUE(rule->cacheProbs.begin()->first == Substitution({ x, y, z }, { b, d, e }, false));*/
 
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { b, d, e }, false)
 	};
@@ -1826,7 +2227,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 
 	// 2.h. Case of prematching with under-PRECISION level probabilities (optional)
 	foreach(rem, removedPreconds)
-		rule->precondsNecessities[*rem] = 0.99999f;
+		precondNecs[*rem] = 0.99999f;
+	rule->setNecessities(precondNecs, rule->necessityVector().constMap());
 
 	state = State({
 		on(b, e),
@@ -1842,8 +2244,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	/*EXPECT_TRUE(rule->cacheState == state);
 	EXPECT_TRUE(rule->cacheProbs.size() == 0);*/
 
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { b, d, e }, false)
 	};
@@ -1898,8 +2300,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	EXPECT_TRUE(rule->cacheProbs[Substitution({ x, y, z }, { b, d, e }, false)] == pSub1);
 	EXPECT_TRUE(rule->cacheProbs[Substitution({ x, y, z }, { b, d, f1 }, false)] == pSub2);*/
 
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { b, d, f1 }, false),
 		Substitution({ x, y, z }, { b, d, e }, false)
@@ -1915,8 +2317,8 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 	EXPECT_TRUE(updatedConstNecs[c] == expectedProb);*/
 
 	// This second algorithm should not depend on the order of application of the substitutions
-	updatedPrecondNecs = rule->precondsNecessities;
-	updatedConstNecs = rule->constsNecessities;
+	updatedPrecondNecs = rule->necessityVector().precondMap();
+	updatedConstNecs = rule->necessityVector().constMap();
 	notCovSubs = {
 		Substitution({ x, y, z }, { b, d, e }, false),
 		Substitution({ x, y, z }, { b, d, f1 }, false)
@@ -1935,25 +2337,33 @@ TEST_F(LearningAgentTest, ProbabilitiesTests) {
 TEST_F(LearningAgentTest, CdProbTests) {
 	shared_ptr<ActionRule> rule = make_shared<ActionRule>(set<Literal>{}, movePred2(x, y), set<Literal>{}, set<Literal>{}, set<shared_ptr<ActionRule>>{}, 0.05f, false);
 
-	map<Literal, float> precondNecs;
-	map<Term, float> constNecs;
-	vector<pair<vector<Literal>, vector<Term>>> cds;
+	vector<Unverified> cds;
+	auto masks = [&]() {
+		vector<NecessityMask> result;
+		NecessityMask mask;
+		foreach(disj, cds) {
+			EXPECT_TRUE(rule->necessityVector().toMask(*disj, mask));
+			result.push_back(mask);
+		}
+		return result;
+	};
 
-	EXPECT_TRUE(rule->cdProb(precondNecs, constNecs, cds) == 1.0f);
+	EXPECT_TRUE(rule->cdProb(masks()) == 1.0f);
 
-	precondNecs = {
+	map<Literal, float> precondNecs = {
 		{ block(a), 0.2f },
 		{ block(b), 0.4f },
 		{ block(c), 0.6f },
 		{ block(d), 0.8f }
 	};
 
-	constNecs = {
+	map<Term, float> constNecs = {
 		{ a, 0.1f },
 		{ b, 0.3f },
 		{ c, 0.5f },
 		{ d, 0.7f }
 	};
+	rule->setNecessities(precondNecs, constNecs);
 
 	cds = {
 		{{ block(a) }, { a }},
@@ -1962,19 +2372,19 @@ TEST_F(LearningAgentTest, CdProbTests) {
 	};
 
 	float expectedProb = (0.2f + 0.1f - 0.2f * 0.1f) * (0.4f + 0.3f - 0.4f * 0.3f) * (0.6f + 0.5f - 0.6f * 0.5f);
-	EXPECT_TRUE(rule->cdProb(precondNecs, constNecs, cds) == expectedProb);
+	EXPECT_TRUE(rule->cdProb(masks()) == expectedProb);
 
 	cds = {
 		{{ block(a), block(d) }, { a, d }},
 		{{ block(b), block(d) }, { b, d }},
 		{{ block(c), block(d) }, { c, d }}
 	};
-	EXPECT_TRUE(abs(rule->cdProb(precondNecs, constNecs, cds) - 0.947795f) < 0.0001f);
+	EXPECT_TRUE(abs(rule->cdProb(masks()) - 0.947795f) < 0.0001f);
 
 	cds = {
 		{{ block(a), block(d) }, { a, d }}
 	};
-	EXPECT_TRUE(abs(rule->cdProb(precondNecs, constNecs, cds) - 0.956800f) < 0.0001f);
+	EXPECT_TRUE(abs(rule->cdProb(masks()) - 0.956800f) < 0.0001f);
 
 	cds = {
 		{{ block(a), block(b) }, { a, b }},
@@ -1982,7 +2392,98 @@ TEST_F(LearningAgentTest, CdProbTests) {
 		{{ block(c), block(d) }, { c, d }},
 		{{ block(d), block(a) }, { d, a }}
 	};
-	EXPECT_TRUE(abs(rule->cdProb(precondNecs, constNecs, cds) - 0.647075f) < 0.0001f);
+	EXPECT_TRUE(abs(rule->cdProb(masks()) - 0.647075f) < 0.0001f);
+}
+
+TEST_F(LearningAgentTest, NecessityVectorMasks) {
+	shared_ptr<ActionRule> rule = make_shared<ActionRule>(set<Literal>{}, movePred2(x, y), set<Literal>{}, set<Literal>{}, set<shared_ptr<ActionRule>>{}, 0.05f, false);
+	rule->setNecessities({ { block(a), 0.2f }, { block(b), 0.4f }, { block(c), 0.6f } }, { { a, 0.1f }, { b, 0.3f } });
+
+	// Preconditions come first, constants after, each in map order
+	NecessityVector const& necs = rule->necessityVector();
+	EXPECT_TRUE(necs.size() == 5);
+	EXPECT_TRUE(necs.values == vector<float>({ 0.2f, 0.4f, 0.6f, 0.1f, 0.3f }));
+
+	vector<Unverified> cds = { {{ block(a), block(b) }, { a }}, {{ block(c) }, { b }} };
+	vector<NecessityMask> masks;
+	NecessityMask mask;
+	foreach(disj, cds) {
+		EXPECT_TRUE(necs.toMask(*disj, mask));
+		masks.push_back(mask);
+	}
+	EXPECT_TRUE(NecessityVector::indices(masks[0]) == vector<size_t>({ 0, 1, 3 }));
+	EXPECT_FALSE(necs.toMask({ { block(d) }, {} }, mask));
+
+	// Same disjunctions written out: (a or b or a) and (c or b)
+	float expectedProb = (1.0f - (1.0f - 0.2f) * (1.0f - 0.4f) * (1.0f - 0.1f)) * (1.0f - (1.0f - 0.6f) * (1.0f - 0.3f));
+	EXPECT_TRUE(abs(rule->cdProb(masks) - expectedProb) < 0.0001f);
+
+	// Reading the vector leaves the rule as it is, new values give the rule a new version
+	unsigned __int64 version = rule->getVersion();
+	EXPECT_TRUE(&rule->necessityVector() == &necs);
+	EXPECT_TRUE(rule->getVersion() == version);
+
+	rule->setNecessityValues({ 0.2f, 0.4f, 0.6f, 0.1f, 0.9f });
+	EXPECT_TRUE(necs.values[4] == 0.9f);
+	EXPECT_TRUE(rule->necessityVector().constValue(b) == 0.9f);
+	EXPECT_TRUE((rule->necessityVector().constMap() == map<Term, float>({ { a, 0.1f }, { b, 0.9f } })));
+	EXPECT_TRUE(rule->getVersion() != version);
+
+	// Setting necessities lays the vector out again
+	version = rule->getVersion();
+	rule->setNecessities({ { block(a), 0.2f }, { block(d), 0.7f } }, {});
+	EXPECT_TRUE(necs.preconds == vector<Literal>({ block(a), block(d) }));
+	EXPECT_TRUE(necs.values == vector<float>({ 0.2f, 0.7f }));
+	EXPECT_TRUE(rule->necessityVector().preconds.size() == 2 && rule->necessityVector().consts.empty());
+	EXPECT_TRUE(rule->getVersion() != version);
+}
+
+TEST_F(LearningAgentTest, CdProbabilityModes) {
+	vector<float> probabilities = { 0.2f, 0.4f, 0.6f, 0.8f, 0.1f, 0.3f, 0.5f, 0.7f };
+
+	// Certain and impossible variables, duplicated and implied disjunctions
+	EXPECT_TRUE(CdProbability().solve(probabilities, { {} }) == 0.0f);
+	EXPECT_TRUE(CdProbability().solve({ 0.0f, 1.0f }, { { 0 } }) == 0.0f);
+	EXPECT_TRUE(CdProbability().solve({ 0.0f, 1.0f }, { { 0, 1 } }) == 1.0f);
+	EXPECT_TRUE(abs(CdProbability().solve(probabilities, { { 0, 4 }, { 4, 0 }, { 0, 4, 5 } }) - 0.28f) < 0.0001f);
+
+	// Independent groups multiply
+	float first = CdProbability().solve(probabilities, { { 0, 1 }, { 1, 2 } });
+	float second = CdProbability().solve(probabilities, { { 4, 5 }, { 5, 6 } });
+	EXPECT_TRUE(abs(CdProbability().solve(probabilities, { { 0, 1 }, { 1, 2 }, { 4, 5 }, { 5, 6 } }) - first * second) < 0.0001f);
+
+	// Overlapping disjunctions over many variables: the bounded mode stays under the exact value, within its tolerance
+	vector<float> manyProbabilities;
+	vector<vector<size_t>> disjunctions;
+	for (size_t v = 0; v < 30; v++) {
+		manyProbabilities.push_back(0.05f + 0.01f * (float)(v % 7));
+		disjunctions.push_back({ v, (v + 1) % 30, (v + 11) % 30, (v + 17) % 30 });
+	}
+
+	double dropped = 0.0;
+	float exact = CdProbability().solve(manyProbabilities, disjunctions, dropped);
+	EXPECT_TRUE(dropped == 0.0);
+
+	float bounded = CdProbability(0.001).solve(manyProbabilities, disjunctions, dropped);
+	EXPECT_TRUE(dropped <= 0.001);
+	EXPECT_TRUE(bounded <= exact + 0.00001f);
+	EXPECT_TRUE(bounded >= exact - (float)dropped - 0.00001f);
+
+	// Independent groups share the tolerance, each of these would drop most of it on its own
+	vector<float> groupedProbabilities;
+	vector<vector<size_t>> groupedDisjunctions;
+	for (size_t group = 0; group < 2; group++)
+		foreach(disj, disjunctions) {
+			groupedProbabilities.push_back(0.3f + 0.03f * (float)(groupedProbabilities.size() % 7));
+			groupedDisjunctions.push_back({ (*disj)[0] + 30 * group, (*disj)[1] + 30 * group, (*disj)[2] + 30 * group, (*disj)[3] + 30 * group });
+		}
+
+	exact = CdProbability().solve(groupedProbabilities, groupedDisjunctions);
+	bounded = CdProbability(0.01).solve(groupedProbabilities, groupedDisjunctions, dropped);
+	EXPECT_TRUE(dropped > 0.0);
+	EXPECT_TRUE(dropped <= 0.01);
+	EXPECT_TRUE(bounded <= exact + 0.00001f);
+	EXPECT_TRUE(bounded >= exact - 0.01f - 0.00001f);
 }
 
 TEST_F(LearningAgentTest, GeneralizationAndTreeTests) {
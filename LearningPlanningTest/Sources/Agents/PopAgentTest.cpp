@@ -0,0 +1,207 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "pch.h"
+
+#include "Agents/BlocksWorldTest.h"
+#include "Agents/PartialOrderPlanner/PopAgentMultivariate.h"
+
+using namespace std;
+
+class PopAgentTest : public BlocksWorldTest {
+protected:
+	// Both goals need s, which only holds in the start state
+	vector<Action> independentActions() {
+		return {
+			Action(reach1Pred(), { s() }, {}, { g1() }, {}),
+			Action(reach2Pred(), { s() }, {}, { g2() }, {})
+		};
+	}
+
+	Predicate s = Predicate("s", 0);
+	Predicate g1 = Predicate("g1", 0);
+	Predicate g2 = Predicate("g2", 0);
+	Predicate reach1Pred = Predicate("reach1", 0);
+	Predicate reach2Pred = Predicate("reach2", 0);
+};
+
+TEST_F(PopAgentTest, IndependentGoals) {
+	vector<Action> actions = independentActions();
+	shared_ptr<Domain> domain = make_shared<Domain>(vector<shared_ptr<TermType>>(),
+		set<Predicate>{ s, g1, g2, reach1Pred, reach2Pred }, set<Term>(), actions);
+
+	Goal goal;
+	goal.trueFacts = { g1(), g2() };
+
+	PopAgentMultivariate agent = PopAgentMultivariate(false);
+	agent.init(domain, {}, goal, make_shared<vector<Trace>>());
+
+	State state = State({ s() });
+	vector<Literal> executed;
+	for (size_t step = 0; step < 5 && !goal.reached(state); step++) {
+		Literal action = agent.getNextAction(state);
+		if (action == Literal()) break;
+
+		Opt<State> next = domain->tryAction(state, {}, action);
+		EXPECT_TRUE(next.there);
+		if (!next.there) break;
+
+		executed.push_back(action);
+		state = next.obj;
+	}
+
+	EXPECT_TRUE(goal.reached(state));
+	EXPECT_TRUE(allEqNoOrder(executed, { reach1Pred(), reach2Pred() }));
+}
+
+TEST_F(PopAgentTest, StartAndFinishLeftOut) {
+	vector<Action> actions = independentActions();
+	shared_ptr<Domain> domain = make_shared<Domain>(vector<shared_ptr<TermType>>(),
+		set<Predicate>{ s, g1, g2, reach1Pred, reach2Pred }, set<Term>(), actions);
+
+	Goal goal;
+	goal.trueFacts = { g1() };
+
+	PopAgentMultivariate agent = PopAgentMultivariate(false);
+	agent.init(domain, {}, goal, make_shared<vector<Trace>>());
+
+	// The plan is the single step reaching the goal, without the steps standing for the start state and the goal
+	State state = State({ s() });
+	EXPECT_TRUE(agent.getNextAction(state) == reach1Pred());
+	EXPECT_TRUE(agent.getNextAction(State({ s(), g1() })) == Literal());
+}
+
+TEST_F(PopAgentTest, DuplicatePlans) {
+	vector<GroundedAction> available;
+	vector<Action> actions = independentActions();
+	foreach(act, actions)
+		available.push_back(GroundedAction(*act));
+
+	Goal goal;
+	goal.trueFacts = { g1(), g2() };
+	PartialPlan root = PartialPlan(State({ s() }), goal, Predicate("POP_Start", 0)(), Predicate("POP_Finish", 0)());
+
+	// A step is added for g1 first, as both goals have one achiever
+	vector<shared_ptr<PartialPlan>> children;
+	root.computeNextChoices(available, children);
+	ASSERT_EQ(children.size(), 1);
+
+	// Then the precondition of that step is bound to the start, or a step is added for g2
+	vector<shared_ptr<PartialPlan>> grandChildren;
+	children[0]->computeNextChoices(available, grandChildren);
+	ASSERT_EQ(grandChildren.size(), 2);
+	EXPECT_NE(grandChildren[0]->canonicalKey(), grandChildren[1]->canonicalKey());
+
+	// Doing the other refinement next gives the same partial plan both ways
+	vector<shared_ptr<PartialPlan>> boundFirst, addedFirst;
+	grandChildren[0]->computeNextChoices(available, boundFirst);
+	grandChildren[1]->computeNextChoices(available, addedFirst);
+	ASSERT_EQ(boundFirst.size(), 1);
+	ASSERT_EQ(addedFirst.size(), 1);
+	EXPECT_TRUE(boundFirst[0] != addedFirst[0]);
+	EXPECT_EQ(boundFirst[0]->canonicalKey(), addedFirst[0]->canonicalKey());
+
+	// Refinements copy the components they modify, their parent is left untouched
+	EXPECT_EQ(root.actions->size(), 2);
+	EXPECT_EQ(children[0]->actions->size(), 3);
+}
+
+TEST_F(PopAgentTest, BlocksWorld) {
+	shared_ptr<Domain> domain = blocksWorld();
+	// a is already on the table: its goal can be linked to the start before or after b is moved, which leads to the same
+	// partial plan twice
+	Goal goal;
+	goal.trueFacts = { on(b, c), on(a, t) };
+
+	PopAgentMultivariate agent = PopAgentMultivariate(false);
+	agent.init(domain, instances, goal, make_shared<vector<Trace>>());
+
+	State state = sussmanState();
+	vector<Literal> executed;
+	for (size_t step = 0; step < 10 && !goal.reached(state); step++) {
+		Literal action = agent.getNextAction(state);
+		if (action == Literal()) break;
+
+		Opt<State> next = domain->tryAction(state, instances, action);
+		EXPECT_TRUE(next.there);
+		if (!next.there) break;
+
+		executed.push_back(action);
+		state = next.obj;
+	}
+
+	EXPECT_TRUE(goal.reached(state));
+	EXPECT_TRUE(allEq(executed, { movePred(b, c, t) }));
+	EXPECT_GT(agent.prunedPlans(), 0);
+}
+
+TEST(OrderingGraphTest, Closure) {
+	// The chain is inserted out of order, the closure links both halves once they are joined
+	OrderingGraph graph;
+	graph.addConstraint(2, 3);
+	graph.addConstraint(0, 1);
+	EXPECT_FALSE(graph.precedes(0, 3));
+
+	graph.addConstraint(1, 2);
+	EXPECT_TRUE(graph.precedes(0, 3));
+	EXPECT_TRUE(graph.precedes(1, 3));
+	EXPECT_FALSE(graph.precedes(3, 0));
+	EXPECT_FALSE(graph.precedes(2, 2));
+	EXPECT_TRUE(allEq(graph.successors(0), { 1, 2, 3 }));
+	EXPECT_TRUE(allEq(graph.successors(2), { 3 }));
+	EXPECT_TRUE(graph.successors(3).empty());
+	EXPECT_EQ(graph.size(), 4);
+
+	// A new predecessor of the chain start precedes every step of it
+	graph.addConstraint(4, 0);
+	EXPECT_TRUE(allEq(graph.successors(4), { 0, 1, 2, 3 }));
+	EXPECT_FALSE(graph.isCyclic());
+}
+
+TEST(OrderingGraphTest, Cycles) {
+	OrderingGraph graph;
+	EXPECT_TRUE(graph.tryAddConstraint(0, 1));
+	EXPECT_TRUE(graph.tryAddConstraint(1, 2));
+
+	// Constraints closing a cycle are rejected and leave the graph as it was
+	EXPECT_TRUE(graph.wouldCreateCycle(2, 0));
+	EXPECT_TRUE(graph.wouldCreateCycle(1, 1));
+	EXPECT_FALSE(graph.wouldCreateCycle(0, 2));
+	EXPECT_FALSE(graph.tryAddConstraint(2, 0));
+	EXPECT_FALSE(graph.tryAddConstraint(1, 1));
+	EXPECT_FALSE(graph.precedes(2, 0));
+	EXPECT_FALSE(graph.isCyclic());
+
+	// Redundant constraints are accepted
+	EXPECT_TRUE(graph.tryAddConstraint(0, 2));
+
+	// Forcing one marks the graph cyclic, nothing can be added afterwards
+	graph.addConstraint(2, 0);
+	EXPECT_TRUE(graph.isCyclic());
+	EXPECT_FALSE(graph.tryAddConstraint(3, 4));
+}
+
+TEST(OrderingGraphTest, LargeGraphs) {
+	// Rows span several words past 64 steps
+	OrderingGraph graph;
+	for (size_t step = 0; step < 99; step++)
+		EXPECT_TRUE(graph.tryAddConstraint(step, step + 1));
+
+	EXPECT_EQ(graph.size(), 100);
+	EXPECT_TRUE(graph.precedes(0, 99));
+	EXPECT_TRUE(graph.precedes(63, 64));
+	EXPECT_TRUE(graph.precedes(10, 70));
+	EXPECT_FALSE(graph.precedes(70, 10));
+	EXPECT_EQ(graph.successors(10).size(), 89);
+	EXPECT_FALSE(graph.tryAddConstraint(99, 0));
+
+	// Growing the rows keeps the closure: a step far past the end follows the whole chain
+	EXPECT_TRUE(graph.tryAddConstraint(99, 200));
+	EXPECT_EQ(graph.size(), 201);
+	EXPECT_TRUE(graph.precedes(0, 200));
+	EXPECT_TRUE(graph.precedes(64, 200));
+	EXPECT_FALSE(graph.precedes(150, 200));
+	EXPECT_TRUE(graph.wouldCreateCycle(200, 5));
+}
@@ -0,0 +1,217 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "pch.h"
+
+#include <chrono>
+#include <thread>
+
+#include "Agents/BlocksWorldTest.h"
+#include "Agents/PortfolioAgent.h"
+#include "Agents/AStarAgent.h"
+#include "Agents/GraphPlanAgent.h"
+
+using namespace std;
+
+// Plays a fixed plan once its delay is over, and gives up as soon as it is cancelled while waiting. A negative delay
+// waits until it is cancelled.
+class ScriptedAgent : public Agent {
+public:
+	ScriptedAgent(vector<Literal> inScript, int inDelayMs) : Agent(false), script(inScript), delayMs(inDelayMs) {}
+
+	void init(shared_ptr<Domain> inDomain, vector<Term> inInstances, Goal inGoal, shared_ptr<vector<Trace>> inTrace) override {
+		Agent::init(inDomain, inInstances, inGoal, inTrace);
+		initDomain = inDomain;
+	}
+
+	void updateProblem(vector<Term> inInstances, Goal inGoal, vector<Literal> inHeadstart) override {
+		Agent::updateProblem(inInstances, inGoal, inHeadstart);
+		step = 0;
+	}
+
+	Literal getNextAction(State state) override {
+		if (step == 0) {
+			planningCalls++;
+			chrono::steady_clock::time_point until = chrono::steady_clock::now() + chrono::milliseconds(delayMs);
+			while (delayMs < 0 || chrono::steady_clock::now() < until) {
+				if (cancelled()) {
+					cancellations++;
+					return Literal();
+				}
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+		}
+
+		if (step >= script.size()) return Literal();
+		return script[step++];
+	}
+
+	shared_ptr<Domain> initDomain;
+	size_t planningCalls = 0;
+	size_t cancellations = 0;
+
+private:
+	vector<Literal> script;
+	int delayMs;
+	size_t step = 0;
+};
+
+class PortfolioAgentTest : public BlocksWorldTest {
+protected:
+	void SetUp() override {
+		PortfolioAgent::resetWins();
+	}
+
+	vector<Literal> runAgent(Agent& agent, shared_ptr<Domain> domain, /*r*/ State& state) {
+		vector<Literal> executed;
+		Goal goal = sussmanGoal();
+		for (size_t step = 0; step < 10 && !goal.reached(state); step++) {
+			Literal action = agent.getNextAction(state);
+			if (action == Literal()) break;
+
+			Opt<State> next = domain->tryAction(state, instances, action);
+			EXPECT_TRUE(next.there);
+			if (!next.there) break;
+
+			executed.push_back(action);
+			state = next.obj;
+		}
+		return executed;
+	}
+
+	vector<Literal> shortPlan() {
+		return { moveTablePred(c, a), movePred(b, c, t), movePred(a, b, t) };
+	}
+
+	// Puts c on b and back to the table before following the short plan
+	vector<Literal> longPlan() {
+		return { moveTablePred(c, a), movePred(c, b, t), moveTablePred(c, b), movePred(b, c, t), movePred(a, b, t) };
+	}
+};
+
+TEST_F(PortfolioAgentTest, BlocksWorld) {
+	shared_ptr<Domain> domain = blocksWorld();
+	Goal goal = sussmanGoal();
+
+	PortfolioAgent agent = PortfolioAgent(false);
+	agent.addPlanner("AStarAgent", make_shared<AStarAgent>(false));
+	agent.addPlanner("GraphPlanAgent", make_shared<GraphPlanAgent>(false));
+	agent.init(domain, instances, goal, make_shared<vector<Trace>>());
+
+	// Sussman anomaly, solved twice: each race is won by one of the planners, which then plans alone
+	for (size_t run = 0; run < 2; run++) {
+		agent.updateProblem(instances, goal, {});
+
+		State state = sussmanState();
+		runAgent(agent, domain, state);
+		EXPECT_TRUE(goal.reached(state));
+		EXPECT_TRUE(agent.getNextAction(state) == Literal());
+	}
+
+	map<string, size_t> wins = PortfolioAgent::getWins(domain);
+	EXPECT_EQ(wins["AStarAgent"] + wins["GraphPlanAgent"], 2);
+}
+
+TEST_F(PortfolioAgentTest, RaceFavoursWinner) {
+	shared_ptr<Domain> domain = blocksWorld();
+	Goal goal = sussmanGoal();
+
+	shared_ptr<ScriptedAgent> slow = make_shared<ScriptedAgent>(shortPlan(), -1);
+	shared_ptr<ScriptedAgent> fast = make_shared<ScriptedAgent>(longPlan(), 0);
+
+	PortfolioAgent agent = PortfolioAgent(false);
+	agent.addPlanner("Slow", slow);
+	agent.addPlanner("Fast", fast);
+	agent.init(domain, instances, goal, make_shared<vector<Trace>>());
+
+	// Planners try actions on their own copy of the domain
+	EXPECT_TRUE(slow->initDomain != domain);
+	EXPECT_TRUE(fast->initDomain != domain);
+	EXPECT_TRUE(slow->initDomain != fast->initDomain);
+
+	// Without wins, both planners start: the fast one wins and the slow one, which never plans, is cancelled
+	State state = sussmanState();
+	vector<Literal> executed = runAgent(agent, domain, state);
+	EXPECT_TRUE(allEq(executed, longPlan()));
+	EXPECT_EQ(fast->planningCalls, 1);
+	EXPECT_EQ(slow->planningCalls, 1);
+	EXPECT_EQ(slow->cancellations, 1);
+	EXPECT_EQ(PortfolioAgent::getWins(domain)["Fast"], 1);
+
+	// The winner gets a head start. The slow planner is only launched if the head start is over before the winner
+	// plans, and is then cancelled again.
+	agent.updateProblem(instances, goal, {});
+	state = sussmanState();
+	executed = runAgent(agent, domain, state);
+	EXPECT_TRUE(allEq(executed, longPlan()));
+	EXPECT_EQ(fast->planningCalls, 2);
+	EXPECT_LE(slow->planningCalls, 2);
+	EXPECT_EQ(slow->cancellations, slow->planningCalls);
+
+	map<string, size_t> wins = PortfolioAgent::getWins(domain);
+	EXPECT_EQ(wins["Fast"], 2);
+	EXPECT_EQ(wins["Slow"], 0);
+}
+
+TEST_F(PortfolioAgentTest, WinsPerDomain) {
+	shared_ptr<Domain> domain = blocksWorld();
+	domain->name = "blocksworld";
+	Goal goal = sussmanGoal();
+
+	PortfolioAgent agent = PortfolioAgent(false);
+	agent.addPlanner("Fast", make_shared<ScriptedAgent>(shortPlan(), 0));
+	agent.init(domain, instances, goal, make_shared<vector<Trace>>());
+
+	State state = sussmanState();
+	runAgent(agent, domain, state);
+	EXPECT_EQ(PortfolioAgent::getWins(domain)["Fast"], 1);
+
+	// Copies share the wins of their domain
+	EXPECT_EQ(PortfolioAgent::getWins(domain->copy())["Fast"], 1);
+
+	// A domain learned from it has the same actions, but its own wins
+	shared_ptr<Domain> learned = domain->copy();
+	learned->name = domain->name + ":learned";
+	EXPECT_TRUE(PortfolioAgent::getWins(learned).empty());
+
+	// So does a domain with the same actions over other predicates
+	shared_ptr<Domain> other = domain->copy();
+	other->predicates.insert(Predicate("other", 1));
+	EXPECT_TRUE(PortfolioAgent::getWins(other).empty());
+}
+
+TEST_F(PortfolioAgentTest, ShortestPlan) {
+	shared_ptr<Domain> domain = blocksWorld();
+	Goal goal = sussmanGoal();
+
+	shared_ptr<ScriptedAgent> fastLong = make_shared<ScriptedAgent>(longPlan(), 0);
+	shared_ptr<ScriptedAgent> slowShort = make_shared<ScriptedAgent>(shortPlan(), 100);
+	shared_ptr<ScriptedAgent> fastShort = make_shared<ScriptedAgent>(shortPlan(), 0);
+
+	PortfolioAgent agent = PortfolioAgent(false);
+	agent.setSelection(SHORTEST_PLAN);
+	agent.addPlanner("FastLong", fastLong);
+	agent.addPlanner("SlowShort", slowShort);
+	agent.addPlanner("FastShort", fastShort);
+	agent.init(domain, instances, goal, make_shared<vector<Trace>>());
+
+	// Every planner finishes, the shortest plan wins and ties go to the planner added first, whatever the timing
+	for (size_t run = 0; run < 2; run++) {
+		agent.updateProblem(instances, goal, {});
+
+		State state = sussmanState();
+		vector<Literal> executed = runAgent(agent, domain, state);
+		EXPECT_TRUE(goal.reached(state));
+		EXPECT_TRUE(allEq(executed, shortPlan()));
+	}
+
+	EXPECT_EQ(fastLong->planningCalls, 2);
+	EXPECT_EQ(slowShort->cancellations, 0);
+
+	map<string, size_t> wins = PortfolioAgent::getWins(domain);
+	EXPECT_EQ(wins["SlowShort"], 2);
+	EXPECT_EQ(wins["FastShort"], 0);
+	EXPECT_EQ(wins["FastLong"], 0);
+}
@@ -0,0 +1,121 @@
+/**
+ * @author Thomas Lamson
+ * Contact: thomas.lamson@cea.fr
+ */
+
+#include "pch.h"
+
+#include "Agents/BlocksWorldTest.h"
+#include "Agents/Strips/StripsAgent.h"
+
+using namespace std;
+
+// Gives access to the recursion, to run it under forbids set up by hand
+class InspectedStripsAgent : public StripsAgent {
+public:
+	InspectedStripsAgent() : StripsAgent(false) {}
+
+	void startSearch() {
+		forbiddenStates = vector<unordered_map<FactSet, size_t, FactSetHasher>>(allGroundedActions.size());
+		forbiddenLog.clear();
+		oldestForbiddenHit = SIZE_MAX;
+		failedGoals.clear();
+	}
+
+	// Solves the goals one level down, as if the caller had already tried the given actions from the same state
+	bool solveUnder(State state, vector<Condition> goals, vector<Literal> callerForbids) {
+		FactSet facts = task->encode(state);
+		size_t logMark = forbiddenLog.size();
+		foreachindex(ai, allGroundedActions)
+			if (in(callerForbids, allGroundedActions[ai].actionLiteral)) {
+				forbiddenStates[ai][facts] = forbiddenLog.size();
+				forbiddenLog.push_back(make_pair(ai, facts));
+			}
+
+		vector<GroundedAction> subPlan;
+		bool success = findPlanRecursive(state, goals, subPlan, 1);
+
+		while (forbiddenLog.size() > logMark) {
+			forbiddenStates[forbiddenLog.back().first].erase(forbiddenLog.back().second);
+			forbiddenLog.pop_back();
+		}
+		return success;
+	}
+
+	size_t forbiddenEntries() const {
+		size_t entries = forbiddenLog.size();
+		foreach(states, forbiddenStates)
+			entries += states->size();
+		return entries;
+	}
+
+	size_t failedGoalLists() const {
+		size_t lists = 0;
+		foreach(failed, failedGoals)
+			lists += failed->second.size();
+		return lists;
+	}
+};
+
+class StripsAgentTest : public BlocksWorldTest {
+protected:
+	Predicate g = Predicate("g", 0);
+	Predicate h = Predicate("h", 0);
+	Predicate reachPred = Predicate("reach", 0);
+};
+
+TEST_F(StripsAgentTest, BlocksWorld) {
+	shared_ptr<Domain> domain = blocksWorld();
+	Goal goal;
+	goal.trueFacts = { on(b, c) };
+
+	InspectedStripsAgent agent;
+	agent.init(domain, instances, goal, make_shared<vector<Trace>>());
+
+	State state = sussmanState();
+	vector<Literal> executed;
+	for (size_t step = 0; step < 10 && !goal.reached(state); step++) {
+		Literal action = agent.getNextAction(state);
+		if (action == Literal()) break;
+
+		Opt<State> next = domain->tryAction(state, instances, action);
+		EXPECT_TRUE(next.there);
+		if (!next.there) break;
+
+		executed.push_back(action);
+		state = next.obj;
+	}
+
+	EXPECT_TRUE(goal.reached(state));
+	EXPECT_TRUE(allEq(executed, { movePred(b, c, t) }));
+
+	// Every action forbidden along the way was allowed again when the recursion returned
+	EXPECT_EQ(agent.forbiddenEntries(), 0);
+}
+
+TEST_F(StripsAgentTest, FailuresUnderForbids) {
+	shared_ptr<Domain> domain = make_shared<Domain>(vector<shared_ptr<TermType>>(), set<Predicate>{ g, h, reachPred },
+		set<Term>(), vector<Action>{ Action(reachPred(), {}, {}, { g() }, {}) });
+	Goal goal;
+	goal.trueFacts = { g() };
+
+	InspectedStripsAgent agent;
+	agent.init(domain, {}, goal, make_shared<vector<Trace>>());
+	agent.startSearch();
+
+	// The only achiever of g is forbidden by the caller: the goal fails, but the failure is not memoized
+	State state;
+	vector<Condition> goals = { Condition(g(), true) };
+	EXPECT_FALSE(agent.solveUnder(state, goals, { reachPred() }));
+	EXPECT_EQ(agent.failedGoalLists(), 0);
+	EXPECT_EQ(agent.forbiddenEntries(), 0);
+
+	// From the same state at the same depth, with the achiever allowed, the goal succeeds
+	EXPECT_TRUE(agent.solveUnder(state, goals, {}));
+
+	// A goal without achiever fails whatever the caller forbids, the failure is memoized
+	EXPECT_FALSE(agent.solveUnder(state, { Condition(h(), true) }, {}));
+	EXPECT_EQ(agent.failedGoalLists(), 1);
+	EXPECT_FALSE(agent.solveUnder(state, { Condition(h(), true) }, { reachPred() }));
+	EXPECT_EQ(agent.failedGoalLists(), 1);
+}
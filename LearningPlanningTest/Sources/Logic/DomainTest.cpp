@@ -6,6 +6,10 @@
 #include "pch.h"
 
 #include "Logic/Domain.h"
+#include "Logic/PlanOptimizer.h"
+#include "Logic/Landmarks.h"
+#include "Logic/RegressionSearch.h"
+#include "Agents/AStarAgent.h"
 
 using namespace std;
 
@@ -175,6 +179,21 @@ TEST_F(DomainTest, SubstitutionOps) {
 		Literal(pred1, {b})
 	};
 	EXPECT_TRUE(allEqNoOrder(toVec(Substitution().oiSubsume(source, dest)), {})); // Does not subsume in any way (injectively, y=b so w=/=b)
+	EXPECT_FALSE(Substitution().oiSubsumes(source, dest));
+
+	source = {
+		Literal(pred2, {x, y}),
+		Literal(pred1, {x})
+	};
+	EXPECT_TRUE(Substitution().oiSubsumes(source, dest));
+	EXPECT_TRUE(Substitution().oiSubsume(source, dest).size() == 2);
+	EXPECT_TRUE(Substitution().oiSubsume(source, dest, 1).size() == 1);
+
+	// A repeated variable maps to one term
+	dest.insert(Literal(pred2, {e, e}));
+	EXPECT_TRUE(allEqNoOrder(toVec(Substitution().oiSubsume(set<Literal>{ Literal(pred2, {x, x}), Literal(pred1, {x}) }, dest)),
+		{ Substitution({ x }, { e }) }
+	));
 }
 
 TEST_F(DomainTest, TypesOps) {
@@ -414,5 +433,209 @@ TEST_F(DomainTest, DomainOps) {
 	EXPECT_TRUE(legalAct.obj == State(state1.facts + set<Literal>{pred0(), pred2(c, a)} - set<Literal>{pred2(a, c)}));
 	EXPECT_TRUE(illegalAct.obj == state2);
 	EXPECT_TRUE(onlyAddAct.obj == State(state1.facts + set<Literal>{pred0(), pred2(c, a)}));
+
+	// Patching actions only marks their predicates as changed
+	Action other = Action(pred0(), {}, {}, { pred1(a) }, {});
+	unsigned __int64 before = domain->getVersion();
+	size_t otherId = domain->addAction(other);
+	EXPECT_TRUE(allEq(domain->getActions(), { act, other }));
+	EXPECT_TRUE(allEqNoOrder(toVec(domain->changedActionPredicates(before)), { pred0 }));
+
+	before = domain->getVersion();
+	domain->replaceAction(otherId, act);
+	EXPECT_TRUE(allEq(domain->getActions(), { act, act }));
+	EXPECT_TRUE(allEqNoOrder(toVec(domain->changedActionPredicates(before)), { pred0, act.actionLiteral.pred }));
+
+	before = domain->getVersion();
+	domain->removeAction(otherId);
+	EXPECT_TRUE(allEq(domain->getActions(), { act }));
+	EXPECT_TRUE(allEqNoOrder(toVec(domain->changedActionPredicates(before)), { act.actionLiteral.pred }));
+	EXPECT_TRUE(domain->changedActionPredicates(domain->getVersion()).empty());
+
+	// Removing an action that is not the last one keeps the order of the others, the first matching action applies
+	Predicate pingPred = Predicate("ping", 0);
+	Action pingA = Action(pingPred(), {}, {}, { pred1(a) }, {});
+	Action pingB = Action(pingPred(), {}, {}, { pred1(b) }, {});
+	size_t actId = 0;  // Ids are given in order by the constructor
+	size_t pingAId = domain->addAction(pingA);
+	domain->addAction(pingB);
+
+	before = domain->getVersion();
+	domain->removeAction(actId);
+	EXPECT_TRUE(allEq(domain->getActions(), { pingA, pingB }));
+	EXPECT_TRUE(allEqNoOrder(toVec(domain->changedActionPredicates(before)), { act.actionLiteral.pred }));
+
+	Opt<State> pinged = domain->tryAction(State(), instances, pingPred(), false);
+	EXPECT_TRUE(pinged.there);
+	EXPECT_TRUE(pinged.obj == State({ pred1(a) }));
+
+	// Copies get a version of their own, and keep the ids of the actions
+	shared_ptr<Domain> copy = domain->copy();
+	EXPECT_FALSE(copy->getVersion() == domain->getVersion());
+	EXPECT_FALSE(copy->getId() == domain->getId());
+	unsigned __int64 copyId = copy->getId();
+	copy->removeAction(pingAId);
+	EXPECT_EQ(copy->getId(), copyId);
+	EXPECT_TRUE(allEq(copy->getActions(), { pingB }));
+	EXPECT_TRUE(allEq(domain->getActions(), { pingA, pingB }));
+}
+
+
+TEST_F(DomainTest, PlanOptimization) {
+	Predicate movePred = Predicate("move", 2);
+	Predicate pingPred = Predicate("ping", 0);
+
+	Action move = Action(movePred(x, y), { pred1(x) }, { pred1(y) }, { pred1(y) }, { -pred1(x) });
+	Action ping = Action(pingPred(), {}, {}, { pred0() }, {});
+	shared_ptr<Domain> domain = make_shared<Domain>(vector<shared_ptr<TermType>>(), set<Predicate>{ pred0, pred1, movePred, pingPred }, set<Term>(), vector<Action>{ move, ping });
+
+	vector<Term> instances { a, b, c, d };
+	State state({ pred1(a) });
+	Goal goal;
+	goal.trueFacts = { pred1(c) };
+
+	// Compiled operators behave like the domain
+	shared_ptr<GroundedTask> task = make_shared<GroundedTask>(domain, instances);
+	FactSet facts = task->encode(state);
+	EXPECT_TRUE(task->tryAction(movePred(a, b), facts));
+	EXPECT_FALSE(task->tryAction(movePred(a, c), facts));
+	EXPECT_TRUE(task->decode(facts) == domain->tryAction(state, instances, movePred(a, b)).obj);
+	EXPECT_TRUE(facts == task->encode(task->decode(facts)));
+
+	// Loop removal
+	PlanOptimizer optimizer = PlanOptimizer(task);
+	vector<Literal> loopingPlan = { movePred(a, b), movePred(b, a), movePred(a, b), movePred(b, d), movePred(d, c) };
+	vector<Literal> expected = { movePred(a, b), movePred(b, d), movePred(d, c) };
+	EXPECT_TRUE(allEq(optimizer.removeLoops(state, loopingPlan), expected));
+
+	// Steps supporting nothing are removed, the result stays valid
+	vector<Literal> uselessPlan = { pingPred(), movePred(a, d), movePred(d, b), pingPred(), movePred(b, c) };
+	EXPECT_TRUE(optimizer.validate(state, uselessPlan, goal));
+	vector<Literal> optimized = optimizer.optimize(state, uselessPlan, goal);
+	EXPECT_TRUE(allEq(optimized, { movePred(a, d), movePred(d, b), movePred(b, c) }));
+	EXPECT_TRUE(optimizer.validate(state, optimized, goal));
+
+	// Invalid plans are left untouched
+	vector<Literal> invalidPlan = { movePred(b, c) };
+	EXPECT_FALSE(optimizer.validate(state, invalidPlan, goal));
+	EXPECT_TRUE(allEq(optimizer.optimize(state, invalidPlan, goal), invalidPlan));
+
+	// A ping needed by the goal is kept once, the second one leaves the state unchanged
+	Goal pingGoal;
+	pingGoal.trueFacts = { pred1(c), pred0() };
+	EXPECT_TRUE(allEq(optimizer.optimize(state, uselessPlan, pingGoal), { pingPred(), movePred(a, d), movePred(d, b), movePred(b, c) }));
 }
 
+TEST_F(DomainTest, Landmarks) {
+	Predicate at = Predicate("at", 1);
+	Predicate link = Predicate("link", 2);
+	Predicate goPred = Predicate("go", 2);
+
+	Action go = Action(goPred(x, y), { at(x), link(x, y) }, {}, { at(y) }, { -at(x) });
+	shared_ptr<Domain> domain = make_shared<Domain>(vector<shared_ptr<TermType>>(), set<Predicate>{ at, link, goPred },
+		set<Term>(), vector<Action>{ go });
+
+	// A single path a -> b -> c -> d, with a shortcut a -> c, and a link e -> d from a place that cannot be reached
+	vector<Term> instances { a, b, c, d, e };
+	State state({ at(a), link(a, b), link(b, c), link(c, d), link(a, c), link(e, d) });
+	Goal goal;
+	goal.trueFacts = { at(d) };
+
+	// Moves from e are never applicable from the start, so at(c) is necessary to reach at(d)
+	shared_ptr<LandmarkGraph const> graph = LandmarkGraph::get(domain, instances, goal, state);
+	set<Literal> found;
+	for (size_t li = 0; li < graph->size(); li++)
+		found.insert(graph->getLandmark(li));
+	EXPECT_TRUE(in(found, at(d)));
+	EXPECT_TRUE(in(found, at(c)));
+	EXPECT_TRUE(in(found, link(c, d)));
+	EXPECT_FALSE(in(found, at(b)));
+
+	EXPECT_TRUE(graph->relaxedReachable(state));
+	Goal unreachable;
+	unreachable.trueFacts = { at(e) };
+	EXPECT_FALSE(LandmarkGraph::get(domain, instances, unreachable, state)->relaxedReachable(state));
+
+	// Counting: link(c, d) holds from the start, at(c) and at(d) are still to achieve
+	FactSet accepted = graph->initialAccepted(state);
+	EXPECT_EQ(graph->count(accepted, state), 2);
+	State atC = domain->tryAction(state, instances, goPred(a, c)).obj;
+	accepted = graph->progress(accepted, atC);
+	EXPECT_EQ(graph->count(accepted, atC), 1);
+
+	// Graphs are shared until the domain changes
+	EXPECT_TRUE(LandmarkGraph::get(domain, instances, goal, state) == graph);
+	domain->addAction(Action(goPred(x, y), { at(y), link(x, y) }, {}, { at(x) }, { -at(y) }));
+	EXPECT_FALSE(LandmarkGraph::get(domain, instances, goal, state) == graph);
+
+	AStarAgent agent(false);
+	agent.setLandmarkHeuristic(true);
+	agent.init(domain, instances, goal, make_shared<vector<Trace>>());
+	State current = state;
+	for (size_t step = 0; step < 5 && !goal.reached(current); step++) {
+		Literal action = agent.getNextAction(current);
+		if (action == Literal()) break;
+		current = domain->tryAction(current, instances, action).obj;
+	}
+	EXPECT_TRUE(goal.reached(current));
+
+	// Only the new action is ground for the next version, jumping makes at(c) optional
+	Predicate jumpPred = Predicate("jump", 2);
+	domain->addPredicate(jumpPred);
+	domain->addAction(Action(jumpPred(x, y), { at(x) }, {}, { at(y) }, { -at(x) }));
+	graph = LandmarkGraph::get(domain, instances, goal, state);
+	found.clear();
+	for (size_t li = 0; li < graph->size(); li++)
+		found.insert(graph->getLandmark(li));
+	EXPECT_TRUE(in(found, at(d)));
+	EXPECT_FALSE(in(found, at(c)));
+}
+
+TEST_F(DomainTest, RegressionSearch) {
+	Predicate on = Predicate("on", 1);
+	Predicate flipPred = Predicate("flip", 1);
+	Predicate at = Predicate("at", 1);
+	Predicate link = Predicate("link", 2);
+	Predicate goPred = Predicate("go", 2);
+
+	// Switches: every one of them can be turned on, only two matter for the goal
+	Action flip = Action(flipPred(x), {}, { on(x) }, { on(x) }, {});
+	shared_ptr<Domain> switches = make_shared<Domain>(vector<shared_ptr<TermType>>(), set<Predicate>{ on, flipPred },
+		set<Term>(), vector<Action>{ flip });
+
+	vector<Term> instances { a, b, c, d, e };
+	State state;
+	Goal goal;
+	goal.trueFacts = { on(c), on(e) };
+
+	vector<Literal> plan;
+	RegressionSearch backward = RegressionSearch(make_shared<GroundedTask>(switches, instances), goal);
+	EXPECT_TRUE(backward.search(state, false, -1, nullptr, plan));
+	EXPECT_EQ(plan.size(), 2);
+	EXPECT_LE(backward.expansions(), 3);
+
+	State reached = state;
+	for (size_t si = plan.size(); si > 0; si--)
+		reached = switches->tryAction(reached, instances, plan[si - 1]).obj;
+	EXPECT_TRUE(goal.reached(reached));
+
+	// Both frontiers meet on a path, the plan is replayed through the domain
+	Action go = Action(goPred(x, y), { at(x), link(x, y) }, {}, { at(y) }, { -at(x) });
+	shared_ptr<Domain> paths = make_shared<Domain>(vector<shared_ptr<TermType>>(), set<Predicate>{ at, link, goPred },
+		set<Term>(), vector<Action>{ go });
+
+	state = State({ at(a), link(a, b), link(b, c), link(c, d), link(d, e) });
+	goal.trueFacts = { at(e) };
+
+	RegressionSearch bidirectional = RegressionSearch(make_shared<GroundedTask>(paths, instances), goal);
+	EXPECT_TRUE(bidirectional.search(state, true, -1, nullptr, plan));
+	EXPECT_EQ(plan.size(), 4);
+
+	reached = state;
+	for (size_t si = plan.size(); si > 0; si--)
+		reached = paths->tryAction(reached, instances, plan[si - 1]).obj;
+	EXPECT_TRUE(goal.reached(reached));
+
+	// Within the depth limit, there is no plan
+	EXPECT_FALSE(bidirectional.search(state, true, 3, nullptr, plan));
+}